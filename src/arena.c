@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "base.h"
+
+/* Reserves `reserve` bytes of address space, none of it committed yet. */
+arena
+new_arena(u64 reserve)
+{
+    arena a = {0};
+    void *data;
+
+    reserve = (reserve + ARENA_COMMIT_SIZE - 1) & ~(u64)(ARENA_COMMIT_SIZE - 1);
+    data = mmap(NULL, (size_t)reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("[error] unable to reserve memory for new arena");
+        exit(1);
+    }
+
+    a.data = (u8 *)data;
+    a.reserved = reserve;
+    MEM_TAG_ARENA(&a, MEM_ARENAS);
+    return a;
+}
+
+void
+arena_release(arena *a)
+{
+    if (a->data != NULL)
+    {
+        munmap(a->data, (size_t)a->reserved);
+        MEM_COUNT(a->tag, a->committed, 0);
+    }
+
+    memset(a, 0, sizeof(*a));
+}
+
+/* Commits the pages up to `end`, which the caller has checked is within the reservation. */
+static void
+arena_commit(arena *a, u64 end)
+{
+    u64 committed = (end + ARENA_COMMIT_SIZE - 1) & ~(u64)(ARENA_COMMIT_SIZE - 1);
+
+    if (mprotect(a->data + a->committed, (size_t)(committed - a->committed), PROT_READ | PROT_WRITE) != 0)
+    {
+        perror("[error] unable to commit arena memory");
+        exit(1);
+    }
+
+    MEM_COUNT(a->tag, a->committed, committed);
+    a->committed = committed;
+}
+
+/* `len` bytes aligned to `align`, a power of two; they are not zeroed. */
+void *
+arena_push_aligned(arena *a, u64 len, u64 align)
+{
+    u64 start = (a->cur_pos + align - 1) & ~(align - 1);
+
+    if (start > a->reserved || len > a->reserved - start)
+    {
+        fprintf(stderr, "[error] arena of %llu bytes exhausted\n", (unsigned long long)a->reserved);
+        exit(1);
+    }
+
+    if (start + len > a->committed)
+    {
+        arena_commit(a, start + len);
+    }
+
+    a->cur_pos = start + len;
+    return a->data + start;
+}
+
+void *
+arena_push(arena *a, u64 len)
+{
+    return arena_push_aligned(a, len, 1);
+}
+
+void
+arena_push_array(arena *a, u8 *data, u64 len)
+{
+    memcpy(arena_push(a, len), data, (size_t)len);
+}
+
+/* Drops everything, the committed pages are kept for reuse. */
+void
+arena_reset(arena *a)
+{
+    a->cur_pos = 0;
+}
+
+arena_checkpoint
+arena_save(arena *a)
+{
+    arena_checkpoint checkpoint;
+
+    checkpoint.pos = a->cur_pos;
+    return checkpoint;
+}
+
+void
+arena_restore(arena *a, arena_checkpoint checkpoint)
+{
+    if (checkpoint.pos <= a->cur_pos)
+    {
+        a->cur_pos = checkpoint.pos;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "base.h"
+#include "mem.h"
+
+/* pages are committed this many bytes at a time as the arena grows into its reservation */
+#define ARENA_COMMIT_SIZE KB(64)
+
+/*
+ * A bump allocator over one reserved range of address space. Pages are
+ * committed as pushes reach them, so the arena grows without moving:
+ * pointers into it stay valid until it is reset or released, and nothing
+ * is ever copied. `cur_pos` is the bytes in use, `data[0, cur_pos)`.
+ */
+typedef struct
+{
+    u8 *data;
+    u64 cur_pos;
+    u64 committed;
+    u64 reserved;
+#ifdef MEM_TRACKING
+    /* the counter its committed pages are added to */
+    mem_tag tag;
+#endif
+} arena;
+
+/* A position to return to, dropping everything pushed since. */
+typedef struct
+{
+    u64 pos;
+} arena_checkpoint;
+
+arena new_arena(u64 reserve);
+void arena_release(arena *a);
+void *arena_push(arena *a, u64 len);
+void *arena_push_aligned(arena *a, u64 len, u64 align);
+void arena_push_array(arena *a, u8 *data, u64 len);
+void arena_reset(arena *a);
+arena_checkpoint arena_save(arena *a);
+void arena_restore(arena *a, arena_checkpoint checkpoint);
+
+#endif
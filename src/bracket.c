@@ -0,0 +1,743 @@
+#include "bracket.h"
+#include "base.h"
+
+/* the prefix and suffix bounds of an empty tree never win a min or max */
+#define BRACKET_NO_PREFIX (1 << 30)
+#define BRACKET_NO_SUFFIX (-(1 << 30))
+
+static const char *bracket_c_extensions[] = {
+    ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", ".m", ".java", ".js", ".ts",
+    ".cs", ".go",
+};
+
+static s32
+bracket_delta(u8 c, u64 k)
+{
+    static const u8 opens[] = "([{";
+    static const u8 closes[] = ")]}";
+
+    return c == opens[k] ? 1 : c == closes[k] ? -1 : 0;
+}
+
+/* The kind index of a bracket byte, BRACKET_KINDS for anything else. */
+static u64
+bracket_kind(u8 c)
+{
+    switch (c) {
+    case '(':
+    case ')':
+        return 0;
+    case '[':
+    case ']':
+        return 1;
+    case '{':
+    case '}':
+        return 2;
+    default:
+        return BRACKET_KINDS;
+    }
+}
+
+static u32
+bracket_random(bracket_index *bi)
+{
+    bi->seed ^= bi->seed << 13;
+    bi->seed ^= bi->seed >> 17;
+    bi->seed ^= bi->seed << 5;
+    return bi->seed;
+}
+
+static void
+bracket_update(bracket_index *bi, u32 t)
+{
+    bracket_node *n = &bi->nodes[t];
+    bracket_node *l = &bi->nodes[n->left];
+    bracket_node *r = &bi->nodes[n->right];
+    u64 k;
+
+    for (k = 0; k < BRACKET_KINDS; k++)
+    {
+        s32 d = bracket_delta(n->kind, k);
+        s32 through = l->sum[k] + d;
+        s32 back = r->sum[k] + d;
+
+        n->sum[k] = through + r->sum[k];
+
+        n->min_prefix[k] = l->min_prefix[k] < through ? l->min_prefix[k] : through;
+        if (r->min_prefix[k] != BRACKET_NO_PREFIX && through + r->min_prefix[k] < n->min_prefix[k])
+        {
+            n->min_prefix[k] = through + r->min_prefix[k];
+        }
+
+        n->max_suffix[k] = r->max_suffix[k] > back ? r->max_suffix[k] : back;
+        if (l->max_suffix[k] != BRACKET_NO_SUFFIX && back + l->max_suffix[k] > n->max_suffix[k])
+        {
+            n->max_suffix[k] = back + l->max_suffix[k];
+        }
+    }
+}
+
+/* Hands the pending shift of `t` to its children. */
+static void
+bracket_push(bracket_index *bi, u32 t)
+{
+    bracket_node *n = &bi->nodes[t];
+
+    if (n->shift == 0)
+    {
+        return;
+    }
+
+    if (n->left)
+    {
+        bi->nodes[n->left].offset += (u64)n->shift;
+        bi->nodes[n->left].shift += n->shift;
+    }
+    if (n->right)
+    {
+        bi->nodes[n->right].offset += (u64)n->shift;
+        bi->nodes[n->right].shift += n->shift;
+    }
+    n->shift = 0;
+}
+
+static u32
+bracket_node_new(bracket_index *bi, u64 offset, u8 kind)
+{
+    bracket_node *n;
+    u32 t;
+
+    if (bi->free_list)
+    {
+        t = bi->free_list;
+        bi->free_list = bi->nodes[t].left;
+    }
+    else
+    {
+        if (bi->node_count == bi->node_capacity)
+        {
+            bi->node_capacity = bi->node_capacity ? bi->node_capacity * 2 : 1024;
+            bi->nodes = (bracket_node *)realloc(bi->nodes, sizeof(bracket_node) * bi->node_capacity);
+            if (bi->nodes == NULL)
+            {
+                fprintf(stderr, "[error] bracket_node_new unable to realloc\n");
+                exit(1);
+            }
+        }
+        t = (u32)bi->node_count++;
+    }
+
+    n = &bi->nodes[t];
+    memset(n, 0, sizeof(*n));
+    n->offset = offset;
+    n->kind = kind;
+    n->priority = bracket_random(bi);
+    bracket_update(bi, t);
+    return t;
+}
+
+/* Splits `t` into the tokens before `x` and those at or after it. */
+static void
+bracket_split(bracket_index *bi, u32 t, u64 x, u32 *before, u32 *after)
+{
+    if (t == 0)
+    {
+        *before = 0;
+        *after = 0;
+        return;
+    }
+
+    bracket_push(bi, t);
+    if (bi->nodes[t].offset < x)
+    {
+        bracket_split(bi, bi->nodes[t].right, x, &bi->nodes[t].right, after);
+        *before = t;
+    }
+    else
+    {
+        bracket_split(bi, bi->nodes[t].left, x, before, &bi->nodes[t].left);
+        *after = t;
+    }
+    bracket_update(bi, t);
+}
+
+static u32
+bracket_merge(bracket_index *bi, u32 a, u32 b)
+{
+    u32 child;
+
+    if (a == 0 || b == 0)
+    {
+        return a ? a : b;
+    }
+
+    if (bi->nodes[a].priority > bi->nodes[b].priority)
+    {
+        bracket_push(bi, a);
+        child = bracket_merge(bi, bi->nodes[a].right, b);
+        bi->nodes[a].right = child;
+        bracket_update(bi, a);
+        return a;
+    }
+
+    bracket_push(bi, b);
+    child = bracket_merge(bi, a, bi->nodes[b].left);
+    bi->nodes[b].left = child;
+    bracket_update(bi, b);
+    return b;
+}
+
+/* Frees the nodes of `t`, noting the last block comment token among them. */
+static void
+bracket_release(bracket_index *bi, u32 t, u8 *last_comment)
+{
+    u32 right;
+
+    if (t == 0)
+    {
+        return;
+    }
+
+    bracket_release(bi, bi->nodes[t].left, last_comment);
+    if (bi->nodes[t].kind == BRACKET_COMMENT_OPEN || bi->nodes[t].kind == BRACKET_COMMENT_CLOSE)
+    {
+        *last_comment = bi->nodes[t].kind;
+    }
+
+    right = bi->nodes[t].right;
+    bi->nodes[t].left = bi->free_list;
+    bi->free_list = t;
+    bracket_release(bi, right, last_comment);
+}
+
+static void
+bracket_update_all(bracket_index *bi, u32 t)
+{
+    if (t == 0)
+    {
+        return;
+    }
+
+    bracket_update_all(bi, bi->nodes[t].left);
+    bracket_update_all(bi, bi->nodes[t].right);
+    bracket_update(bi, t);
+}
+
+/* A treap of sorted tokens in O(n), keeping the heap order with a stack of the right spine. */
+static u32
+bracket_build(bracket_index *bi, bracket_token *tokens, u64 count)
+{
+    u32 *stack;
+    u64 depth = 0;
+    u32 root;
+    u64 i;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (count > bi->spine_capacity)
+    {
+        bi->spine_capacity = count;
+        bi->spine = (u32 *)realloc(bi->spine, sizeof(u32) * (size_t)count);
+        if (bi->spine == NULL)
+        {
+            fprintf(stderr, "[error] bracket_build unable to realloc\n");
+            exit(1);
+        }
+    }
+    stack = bi->spine;
+
+    for (i = 0; i < count; i++)
+    {
+        u32 t = bracket_node_new(bi, tokens[i].offset, tokens[i].kind);
+        u32 last = 0;
+
+        while (depth > 0 && bi->nodes[stack[depth - 1]].priority < bi->nodes[t].priority)
+        {
+            last = stack[--depth];
+        }
+
+        bi->nodes[t].left = last;
+        if (depth > 0)
+        {
+            bi->nodes[stack[depth - 1]].right = t;
+        }
+        stack[depth++] = t;
+    }
+
+    root = stack[0];
+    bracket_update_all(bi, root);
+    return root;
+}
+
+/* Whether the offsets from `x` on start inside a block comment, going by the tokens before it. */
+static u8
+bracket_in_comment_at(bracket_index *bi, u64 x)
+{
+    u32 t = bi->root;
+    u8 kind = 0;
+
+    while (t)
+    {
+        bracket_push(bi, t);
+        if (bi->nodes[t].offset < x)
+        {
+            kind = bi->nodes[t].kind;
+            t = bi->nodes[t].right;
+        }
+        else
+        {
+            t = bi->nodes[t].left;
+        }
+    }
+
+    return kind == BRACKET_COMMENT_OPEN;
+}
+
+static void
+bracket_tokens_push(bracket_tokens *out, u64 offset, u8 kind)
+{
+    if (out->count == out->capacity)
+    {
+        out->capacity = out->capacity ? out->capacity * 2 : 256;
+        out->items = (bracket_token *)realloc(out->items, sizeof(bracket_token) * out->capacity);
+        if (out->items == NULL)
+        {
+            fprintf(stderr, "[error] bracket_tokens_push unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    out->items[out->count].offset = offset;
+    out->items[out->count].kind = kind;
+    out->count++;
+}
+
+/*
+ * Lexes from the line start `from`. Past `until` it stops at the first
+ * line start where the comment state agrees with the tokens still in the
+ * tree, and returns it: from there on the old tokens are still right.
+ * Strings, character literals and line comments end at the newline.
+ */
+static u64
+bracket_lex(bracket_index *bi, u64 from, u8 in_comment, u64 until, bracket_tokens *out)
+{
+    buffer *b = bi->b;
+    u64 len = b->total_len;
+    buffer_reader r;
+    u64 i = from;
+
+    buffer_reader_init(&r, b);
+
+    while (i < len)
+    {
+        u8 c = buffer_reader_byte(&r, i);
+
+        if (c == '\n')
+        {
+            /* only a newline past the change was a line start before it too */
+            if (i >= until && bracket_in_comment_at(bi, i + 1) == in_comment)
+            {
+                return i + 1;
+            }
+            i++;
+            continue;
+        }
+
+        if (in_comment)
+        {
+            if (c == '*' && i + 1 < len && buffer_reader_byte(&r, i + 1) == '/')
+            {
+                bracket_tokens_push(out, i + 1, BRACKET_COMMENT_CLOSE);
+                in_comment = 0;
+                i++;
+            }
+            i++;
+            continue;
+        }
+
+        if (bi->lex && c == '/' && i + 1 < len && buffer_reader_byte(&r, i + 1) == '/')
+        {
+            while (i < len && buffer_reader_byte(&r, i) != '\n')
+            {
+                i++;
+            }
+            continue;
+        }
+
+        if (bi->lex && c == '/' && i + 1 < len && buffer_reader_byte(&r, i + 1) == '*')
+        {
+            bracket_tokens_push(out, i, BRACKET_COMMENT_OPEN);
+            in_comment = 1;
+            i += 2;
+            continue;
+        }
+
+        if (bi->lex && (c == '"' || c == '\''))
+        {
+            i++;
+            while (i < len)
+            {
+                u8 s = buffer_reader_byte(&r, i);
+
+                if (s == c || s == '\n')
+                {
+                    break;
+                }
+                i += s == '\\' ? 2 : 1;
+            }
+            i += i < len && buffer_reader_byte(&r, i) == c;
+            continue;
+        }
+
+        if (bracket_kind(c) < BRACKET_KINDS)
+        {
+            bracket_tokens_push(out, i, c);
+        }
+        i++;
+    }
+
+    return len;
+}
+
+static void
+bracket_ensure(bracket_index *bi)
+{
+    bracket_tokens tokens = {0};
+
+    if (bi->built)
+    {
+        return;
+    }
+
+    bracket_lex(bi, 0, 0, bi->b->total_len + 1, &tokens);
+    bi->root = bracket_build(bi, tokens.items, tokens.count);
+    bi->built = 1;
+    free(tokens.items);
+}
+
+/*
+ * Drops the tokens in changed text and shifts those after it, right to
+ * left so the pre-edit offsets stay valid, then re-lexes each touched
+ * line onwards. A removed comment token leaves a marker behind so the
+ * state after the change still reads as it was before it.
+ */
+static void
+bracket_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    bracket_index *bi = (bracket_index *)ctx;
+    bracket_tokens *tokens = &bi->relexed;
+    u64 done = 0;
+    s64 delta = 0;
+    u64 i;
+
+    if (!bi->built)
+    {
+        return;
+    }
+
+    for (i = count; i > 0; i--)
+    {
+        buffer_change *c = &changes[i - 1];
+        u8 last_comment = 0;
+        u32 before;
+        u32 middle;
+        u32 after;
+        u32 marker = 0;
+
+        bracket_split(bi, bi->root, c->offset, &before, &after);
+        bracket_split(bi, after, c->offset + c->old_len, &middle, &after);
+        bracket_release(bi, middle, &last_comment);
+
+        if (after)
+        {
+            bi->nodes[after].offset += (u64)((s64)c->new_len - (s64)c->old_len);
+            bi->nodes[after].shift += (s64)c->new_len - (s64)c->old_len;
+        }
+        if (last_comment)
+        {
+            marker = bracket_node_new(bi, c->offset, last_comment);
+        }
+
+        bi->root = bracket_merge(bi, before, bracket_merge(bi, marker, after));
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        u64 start = (u64)((s64)changes[i].offset + delta);
+        u64 end = start + changes[i].new_len;
+        u64 line;
+        u64 col;
+        u64 from;
+        u64 to;
+        u32 before;
+        u32 middle;
+        u32 after;
+        u8 last_comment = 0;
+
+        delta += (s64)changes[i].new_len - (s64)changes[i].old_len;
+
+        /* an earlier change already re-lexed this far */
+        if (end < done)
+        {
+            continue;
+        }
+
+        buffer_offset_to_line_col(b, start, &line, &col);
+        from = buffer_line_start(b, line);
+        if (from < done)
+        {
+            from = done;
+        }
+
+        tokens->count = 0;
+        to = bracket_lex(bi, from, bracket_in_comment_at(bi, from), end, tokens);
+
+        bracket_split(bi, bi->root, from, &before, &after);
+        bracket_split(bi, after, to, &middle, &after);
+        bracket_release(bi, middle, &last_comment);
+        bi->root = bracket_merge(bi, before,
+                                 bracket_merge(bi, bracket_build(bi, tokens->items, tokens->count),
+                                               after));
+        done = to;
+    }
+}
+
+void
+bracket_index_init(bracket_index *bi, buffer *b)
+{
+    u64 i;
+
+    memset(bi, 0, sizeof(*bi));
+    bi->b = b;
+    bi->seed = 0x9e3779b9u;
+
+    for (i = 0; i < sizeof(bracket_c_extensions) / sizeof(bracket_c_extensions[0]); i++)
+    {
+        u64 n = strlen(bracket_c_extensions[i]);
+
+        if (b->file_path.len > n &&
+            memcmp(b->file_path.s + b->file_path.len - n, bracket_c_extensions[i], (size_t)n) == 0)
+        {
+            bi->lex = 1;
+        }
+    }
+
+    /* node 0 stands for the empty tree */
+    bracket_node_new(bi, 0, 0);
+    for (i = 0; i < BRACKET_KINDS; i++)
+    {
+        bi->nodes[0].min_prefix[i] = BRACKET_NO_PREFIX;
+        bi->nodes[0].max_suffix[i] = BRACKET_NO_SUFFIX;
+    }
+
+    buffer_add_listener(b, bracket_on_change, bi);
+}
+
+void
+bracket_index_free(bracket_index *bi)
+{
+    buffer_remove_listener(bi->b, bracket_on_change, bi);
+    free(bi->nodes);
+    free(bi->relexed.items);
+    free(bi->spine);
+    memset(bi, 0, sizeof(*bi));
+}
+
+/* First node of `t` where the running sum of kind `k`, starting at `acc`, drops to -1. */
+static u32
+bracket_find_close(bracket_index *bi, u32 t, u64 k, s32 acc)
+{
+    if (t == 0 || acc + bi->nodes[t].min_prefix[k] > -1)
+    {
+        return 0;
+    }
+
+    while (t)
+    {
+        u32 left = bi->nodes[t].left;
+
+        bracket_push(bi, t);
+        if (left && acc + bi->nodes[left].min_prefix[k] <= -1)
+        {
+            t = left;
+            continue;
+        }
+
+        acc += bi->nodes[left].sum[k] + bracket_delta(bi->nodes[t].kind, k);
+        if (acc <= -1)
+        {
+            return t;
+        }
+        t = bi->nodes[t].right;
+    }
+
+    return 0;
+}
+
+/* Last node of `t` where the sum of kind `k` from it to the end, plus `acc`, reaches +1. */
+static u32
+bracket_find_open(bracket_index *bi, u32 t, u64 k, s32 acc)
+{
+    if (t == 0 || acc + bi->nodes[t].max_suffix[k] < 1)
+    {
+        return 0;
+    }
+
+    while (t)
+    {
+        u32 right = bi->nodes[t].right;
+
+        bracket_push(bi, t);
+        if (right && acc + bi->nodes[right].max_suffix[k] >= 1)
+        {
+            t = right;
+            continue;
+        }
+
+        acc += bi->nodes[right].sum[k] + bracket_delta(bi->nodes[t].kind, k);
+        if (acc >= 1)
+        {
+            return t;
+        }
+        t = bi->nodes[t].left;
+    }
+
+    return 0;
+}
+
+/* The innermost open bracket of kind `k` before `x` that is not closed before `x`. */
+static int
+bracket_unclosed_before(bracket_index *bi, u64 x, u64 k, u64 *out)
+{
+    u32 before;
+    u32 after;
+    u32 t;
+
+    bracket_split(bi, bi->root, x, &before, &after);
+    t = bracket_find_open(bi, before, k, 0);
+    if (t)
+    {
+        *out = bi->nodes[t].offset;
+    }
+    bi->root = bracket_merge(bi, before, after);
+
+    return t != 0;
+}
+
+/* The partner of the bracket at `offset`, which must be one outside strings and comments. */
+int
+bracket_index_match(bracket_index *bi, u64 offset, u64 *out)
+{
+    u32 before;
+    u32 at;
+    u32 after;
+    u32 t = 0;
+    u8 c;
+
+    bracket_ensure(bi);
+
+    bracket_split(bi, bi->root, offset, &before, &after);
+    bracket_split(bi, after, offset + 1, &at, &after);
+
+    c = bi->nodes[at].kind;
+    if (at && bracket_kind(c) < BRACKET_KINDS)
+    {
+        u64 k = bracket_kind(c);
+
+        t = bracket_delta(c, k) > 0 ? bracket_find_close(bi, after, k, 0) :
+                                      bracket_find_open(bi, before, k, 0);
+        if (t)
+        {
+            *out = bi->nodes[t].offset;
+        }
+    }
+
+    bi->root = bracket_merge(bi, before, bracket_merge(bi, at, after));
+    return t != 0;
+}
+
+/* First bracket outside strings and comments in [from, to). */
+int
+bracket_index_next(bracket_index *bi, u64 from, u64 to, u64 *out)
+{
+    bracket_ensure(bi);
+
+    while (from < to)
+    {
+        u32 t = bi->root;
+        u32 best = 0;
+
+        while (t)
+        {
+            bracket_push(bi, t);
+            if (bi->nodes[t].offset >= from)
+            {
+                best = t;
+                t = bi->nodes[t].left;
+            }
+            else
+            {
+                t = bi->nodes[t].right;
+            }
+        }
+
+        if (best == 0 || bi->nodes[best].offset >= to)
+        {
+            return 0;
+        }
+
+        if (bracket_kind(bi->nodes[best].kind) < BRACKET_KINDS)
+        {
+            *out = bi->nodes[best].offset;
+            return 1;
+        }
+
+        from = bi->nodes[best].offset + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The `count`th pair of `open` brackets around `offset`, counting a pair
+ * whose bracket is at `offset` as the first, for i( and a{.
+ */
+int
+bracket_index_enclosing(bracket_index *bi, u64 offset, u8 open, u64 count, u64 *start, u64 *end)
+{
+    u64 k = bracket_kind(open);
+    u64 partner;
+    u8 c = 0;
+
+    bracket_ensure(bi);
+
+    if (offset < bi->b->total_len && bracket_index_match(bi, offset, &partner))
+    {
+        c = buffer_byte_at(bi->b, offset);
+    }
+
+    if (bracket_kind(c) == k)
+    {
+        *start = bracket_delta(c, k) > 0 ? offset : partner;
+        *end = bracket_delta(c, k) > 0 ? partner : offset;
+    }
+    else if (!bracket_unclosed_before(bi, offset, k, start) ||
+             !bracket_index_match(bi, *start, end))
+    {
+        return 0;
+    }
+
+    while (count > 1)
+    {
+        if (!bracket_unclosed_before(bi, *start, k, start) || !bracket_index_match(bi, *start, end))
+        {
+            return 0;
+        }
+        count--;
+    }
+
+    return 1;
+}
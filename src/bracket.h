@@ -0,0 +1,81 @@
+#ifndef BRACKET_H
+#define BRACKET_H
+
+#include "base.h"
+#include "buffer.h"
+
+/* token kinds besides the bracket bytes themselves */
+#define BRACKET_COMMENT_OPEN  1
+#define BRACKET_COMMENT_CLOSE 2
+
+/* (), [] and {} */
+#define BRACKET_KINDS 3
+
+/*
+ * One token in a treap ordered by offset. `shift` is an offset change not
+ * yet passed on to the children, so an edit moves every later token in
+ * O(log n). Each node sums the +1/-1 of the brackets below it per kind,
+ * with the lowest prefix and highest suffix of those sums, which is what
+ * finding the partner of a bracket descends on.
+ */
+typedef struct
+{
+    u64 offset;
+    s64 shift;
+    u32 left;
+    u32 right;
+    u32 priority;
+    u8 kind;
+    s32 sum[BRACKET_KINDS];
+    s32 min_prefix[BRACKET_KINDS];
+    s32 max_suffix[BRACKET_KINDS];
+} bracket_node;
+
+typedef struct
+{
+    u64 offset;
+    u8 kind;
+} bracket_token;
+
+typedef struct
+{
+    bracket_token *items;
+    u64 count;
+    u64 capacity;
+} bracket_tokens;
+
+/*
+ * The brackets of a buffer outside strings and comments, built on first
+ * use and kept up to date by re-lexing the lines an edit touches. Block
+ * comments are kept as tokens too so the lexer can restart at any line.
+ */
+typedef struct
+{
+    buffer *b;
+    u8 built;
+    /* skip strings and comments, for C-like files */
+    u8 lex;
+
+    /* node 0 is the empty tree */
+    bracket_node *nodes;
+    u64 node_count;
+    u64 node_capacity;
+    u32 free_list;
+    u32 root;
+    u32 seed;
+
+    /* the tokens of the lines an edit re-lexes and the stack bracket_build
+     * keeps, both kept for the next edit */
+    bracket_tokens relexed;
+    u32 *spine;
+    u64 spine_capacity;
+} bracket_index;
+
+void bracket_index_init(bracket_index *bi, buffer *b);
+void bracket_index_free(bracket_index *bi);
+int bracket_index_match(bracket_index *bi, u64 offset, u64 *out);
+int bracket_index_next(bracket_index *bi, u64 from, u64 to, u64 *out);
+int bracket_index_enclosing(bracket_index *bi, u64 offset, u8 open, u64 count, u64 *start,
+                            u64 *end);
+
+#endif
@@ -1,5 +1,6 @@
 #include "buffer.h"
 #include "base.h"
+#include "mem.h"
 
 static void
 line_index_reserve(line_index *lines, u64 needed_capacity)
@@ -12,7 +13,8 @@ line_index_reserve(line_index *lines, u64 needed_capacity)
         new_capacity *= 2;
     }
 
-    new_items = (line_info *)realloc(lines->items, sizeof(line_info) * new_capacity);
+    new_items = (line_info *)MEM_REALLOC(MEM_LINES, lines->items, sizeof(line_info) * lines->capacity,
+                                         sizeof(line_info) * new_capacity);
     if (new_items == NULL)
     {
         fprintf(stderr, "[error] line_index_reserve unable to realloc\n");
@@ -23,18 +25,72 @@ line_index_reserve(line_index *lines, u64 needed_capacity)
     lines->capacity = new_capacity;
 }
 
+static u8 *
+buffer_piece_data(buffer *b, piece p)
+{
+    if (p.source == BUFFER_SRC_ORIG)
+    {
+        return b->orig.s + p.start;
+    }
+
+    return b->add.s + p.start;
+}
+
 static void
-buffer_rebuild_line_index(buffer *b)
+buffer_reindex_pieces(buffer *b)
 {
     u64 i;
+    u64 doc_pos = 0;
+
+    if (b->pieces.count > b->piece_starts_capacity)
+    {
+        u64 new_capacity = b->piece_starts_capacity ? b->piece_starts_capacity : 8;
+        u64 *new_starts;
+
+        while (new_capacity < b->pieces.count)
+        {
+            new_capacity *= 2;
+        }
+
+        new_starts = (u64 *)MEM_REALLOC(MEM_PIECES, b->piece_starts, sizeof(u64) * b->piece_starts_capacity,
+                                        sizeof(u64) * new_capacity);
+        if (new_starts == NULL)
+        {
+            fprintf(stderr, "[error] buffer_reindex_pieces unable to realloc\n");
+            exit(1);
+        }
+
+        b->piece_starts = new_starts;
+        b->piece_starts_capacity = new_capacity;
+    }
+
+    for (i = 0; i < b->pieces.count; i++)
+    {
+        b->piece_starts[i] = doc_pos;
+        doc_pos += b->pieces.items[i].len;
+    }
+}
+
+static void
+buffer_rebuild_line_index(buffer *b)
+{
+    u64 offset;
     u64 line_count = 1;
 
-    for (i = 0; i < b->total_len; i++)
+    for (offset = 0; offset < b->total_len;)
     {
-        if (buffer_byte_at(b, i) == '\n')
+        u8 *data;
+        u64 n = buffer_span_at(b, offset, &data);
+        u8 *end = data + n;
+        u8 *nl = data;
+
+        while ((nl = (u8 *)memchr(nl, '\n', (size_t)(end - nl))) != NULL)
         {
             line_count++;
+            nl++;
         }
+
+        offset += n;
     }
 
     if (line_count > b->lines.capacity)
@@ -45,20 +101,28 @@ buffer_rebuild_line_index(buffer *b)
     b->lines.count = 0;
     b->lines.items[b->lines.count++] = (line_info){.start = 0};
 
-    for (i = 0; i < b->total_len; i++)
+    for (offset = 0; offset < b->total_len;)
     {
-        if (buffer_byte_at(b, i) == '\n')
+        u8 *data;
+        u64 n = buffer_span_at(b, offset, &data);
+        u8 *end = data + n;
+        u8 *nl = data;
+
+        while ((nl = (u8 *)memchr(nl, '\n', (size_t)(end - nl))) != NULL)
         {
-            b->lines.items[b->lines.count++] = (line_info){.start = i + 1};
+            nl++;
+            b->lines.items[b->lines.count++] = (line_info){.start = offset + (u64)(nl - data)};
         }
+
+        offset += n;
     }
 }
 
 static piece_loc
 find_piece_at_offset(buffer *b, u64 offset)
 {
-    u64 doc_pos = 0;
-    u64 i;
+    u64 lo = 0;
+    u64 hi;
 
     if (offset > b->total_len)
     {
@@ -66,23 +130,38 @@ find_piece_at_offset(buffer *b, u64 offset)
         exit(1);
     }
 
-    for (i = 0; i < b->pieces.count; i++)
+    if (b->pieces.count == 0)
     {
-        piece p = b->pieces.items[i];
+        fprintf(stderr, "[error] find_piece_at_offset could not locate piece\n");
+        exit(1);
+    }
+
+    /* last piece starting at or before offset */
+    hi = b->pieces.count;
+    while (hi - lo > 1)
+    {
+        u64 mid = lo + (hi - lo) / 2;
 
-        if (offset < doc_pos + p.len)
+        if (b->piece_starts[mid] <= offset)
         {
-            return (piece_loc){
-                .piece_index = i,
-                .piece_offset = offset - doc_pos,
-                .doc_start = doc_pos,
-            };
+            lo = mid;
         }
+        else
+        {
+            hi = mid;
+        }
+    }
 
-        doc_pos += p.len;
+    if (offset < b->piece_starts[lo] + b->pieces.items[lo].len)
+    {
+        return (piece_loc){
+            .piece_index = lo,
+            .piece_offset = offset - b->piece_starts[lo],
+            .doc_start = b->piece_starts[lo],
+        };
     }
 
-    if (offset == b->total_len && b->pieces.count > 0)
+    if (offset == b->total_len)
     {
         piece last = b->pieces.items[b->pieces.count - 1];
         return (piece_loc){
@@ -99,27 +178,106 @@ find_piece_at_offset(buffer *b, u64 offset)
 u8
 buffer_byte_at(buffer *b, u64 offset)
 {
-    string r;
-
     piece_loc loc = find_piece_at_offset(b, offset);
     piece p = b->pieces.items[loc.piece_index];
 
-    if (p.source == BUFFER_SRC_ORIG)
+    return buffer_piece_data(b, p)[loc.piece_offset];
+}
+
+/* Contiguous bytes starting at offset, up to the end of their piece. */
+u64
+buffer_span_at(buffer *b, u64 offset, u8 **data)
+{
+    piece_loc loc;
+    piece p;
+
+    if (offset >= b->total_len)
     {
-        r = b->orig;
+        *data = NULL;
+        return 0;
     }
-    else
+
+    loc = find_piece_at_offset(b, offset);
+    p = b->pieces.items[loc.piece_index];
+
+    *data = buffer_piece_data(b, p) + loc.piece_offset;
+    return p.len - loc.piece_offset;
+}
+
+/* Contiguous bytes ending at offset, back to the start of their piece. */
+u64
+buffer_span_before(buffer *b, u64 offset, u8 **data)
+{
+    piece_loc loc;
+    piece p;
+
+    if (offset == 0 || offset > b->total_len)
     {
-        r = b->add;
+        *data = NULL;
+        return 0;
     }
 
-    return r.s[p.start + loc.piece_offset];
+    loc = find_piece_at_offset(b, offset - 1);
+    p = b->pieces.items[loc.piece_index];
+
+    *data = buffer_piece_data(b, p);
+    return loc.piece_offset + 1;
 }
 
 void
-buffer_slice(buffer *b, u64 start, u64 len, string *out)
+buffer_reader_init(buffer_reader *r, buffer *b)
+{
+    r->b = b;
+    r->data = NULL;
+    r->start = 0;
+    r->len = 0;
+}
+
+u8
+buffer_reader_byte(buffer_reader *r, u64 offset)
+{
+    piece_loc loc;
+    piece p;
+
+    if (offset >= r->start && offset - r->start < r->len)
+    {
+        return r->data[offset - r->start];
+    }
+
+    loc = find_piece_at_offset(r->b, offset);
+    p = r->b->pieces.items[loc.piece_index];
+
+    r->data = buffer_piece_data(r->b, p);
+    r->start = loc.doc_start;
+    r->len = p.len;
+
+    return r->data[offset - r->start];
+}
+
+/* Copies [start, start + len) into `out`, one memcpy per piece. */
+void
+buffer_read(buffer *b, u64 start, u64 len, u8 *out)
 {
     u64 i;
+
+    for (i = 0; i < len;)
+    {
+        u8 *span;
+        u64 n = buffer_span_at(b, start + i, &span);
+
+        if (n > len - i)
+        {
+            n = len - i;
+        }
+
+        memcpy(out + i, span, (size_t)n);
+        i += n;
+    }
+}
+
+void
+buffer_slice(buffer *b, u64 start, u64 len, string *out)
+{
     u8 *data;
 
     if (start + len > b->total_len)
@@ -135,19 +293,34 @@ buffer_slice(buffer *b, u64 start, u64 len, string *out)
         exit(1);
     }
 
-    for (i = 0; i < len; i++)
-    {
-        data[i] = buffer_byte_at(b, start + i);
-    }
+    buffer_read(b, start, len, data);
 
     out->s = data;
     out->len = len;
 }
 
+/* Like buffer_slice, the copy lives in `a` and goes when the arena is reset. */
+string
+buffer_slice_arena(buffer *b, arena *a, u64 start, u64 len)
+{
+    string out;
+
+    if (start > b->total_len || len > b->total_len - start)
+    {
+        fprintf(stderr, "[error] buffer_slice_arena out of bounds\n");
+        exit(1);
+    }
+
+    out.s = (u8 *)arena_push(a, len);
+    out.len = len;
+    buffer_read(b, start, len, out.s);
+    return out;
+}
+
 
 
 static void
-piece_array_reserve(piece_array *a, u64 needed_capacity)
+piece_array_reserve(piece_array *a, u64 needed_capacity, mem_tag tag)
 {
     u64 new_capacity = a->capacity ? a->capacity : 8;
 
@@ -156,7 +329,7 @@ piece_array_reserve(piece_array *a, u64 needed_capacity)
         new_capacity *= 2;
     }
 
-    piece *new_items = (piece *)realloc(a->items, (sizeof(piece) * new_capacity));
+    piece *new_items = (piece *)MEM_REALLOC(tag, a->items, sizeof(piece) * a->capacity, sizeof(piece) * new_capacity);
     if (new_items == NULL)
     {
         fprintf(stderr, "[error] piece_array_reserve unable to realloc\n");
@@ -168,20 +341,13 @@ piece_array_reserve(piece_array *a, u64 needed_capacity)
 }
 
 static void
-buffer_add_append(buffer *b, string text, u64 *start_out)
+buffer_add_reserve(buffer *b, u64 extra)
 {
     u8 *new_data;
     u64 needed_capacity;
     u64 new_capacity;
 
-    *start_out = b->add.len;
-
-    if (text.len == 0)
-    {
-        return;
-    }
-
-    needed_capacity = b->add.len + text.len;
+    needed_capacity = b->add.len + extra;
     if (needed_capacity > b->add_capacity)
     {
         new_capacity = b->add_capacity ? b->add_capacity : 8;
@@ -190,7 +356,7 @@ buffer_add_append(buffer *b, string text, u64 *start_out)
             new_capacity *= 2;
         }
 
-        new_data = (u8 *)realloc(b->add.s, sizeof(u8) * new_capacity);
+        new_data = (u8 *)MEM_REALLOC(MEM_ADD, b->add.s, b->add_capacity, sizeof(u8) * new_capacity);
         if (new_data == NULL)
         {
             fprintf(stderr, "[error] buffer_add_append unable to realloc\n");
@@ -200,13 +366,27 @@ buffer_add_append(buffer *b, string text, u64 *start_out)
         b->add.s = new_data;
         b->add_capacity = new_capacity;
     }
+}
+
+static void
+buffer_add_append(buffer *b, string text, u64 *start_out)
+{
+    *start_out = b->add.len;
+
+    if (text.len == 0)
+    {
+        return;
+    }
+
+    buffer_add_reserve(b, text.len);
 
     memcpy(b->add.s + *start_out, text.s, text.len);
     b->add.len += text.len;
 }
 
 static void
-piece_array_replace(piece_array *a, u64 index, u64 remove_count, piece *new_pieces, u64 new_count)
+piece_array_replace(piece_array *a, u64 index, u64 remove_count, piece *new_pieces, u64 new_count,
+                    mem_tag tag)
 {
     u64 i;
     u64 tail_start;
@@ -228,7 +408,7 @@ piece_array_replace(piece_array *a, u64 index, u64 remove_count, piece *new_piec
     new_total = a->count - remove_count + new_count;
     if (new_total > a->capacity)
     {
-        piece_array_reserve(a, new_total);
+        piece_array_reserve(a, new_total, tag);
     }
 
     tail_start = index + remove_count;
@@ -259,38 +439,7 @@ piece_array_replace(piece_array *a, u64 index, u64 remove_count, piece *new_piec
 
 
 static void
-piece_array_remove(piece_array *a, u64 index, u64 count)
-{
-    u64 i;
-
-    if (index > a->count)
-    {
-        fprintf(stderr, "[error] piece_array_remove index out of bounds\n");
-        exit(1);
-    }
-
-    if (count == 0)
-    {
-        return;
-    }
-
-    if (index + count > a->count)
-    {
-        fprintf(stderr, "[error] piece_array_remove range out of bounds\n");
-        exit(1);
-    }
-
-    for (i = index; i + count < a->count; i++)
-    {
-        a->items[i] = a->items[i + count];
-    }
-
-    a->count -= count;
-}
-
-
-static void
-piece_array_insert(piece_array* a, u64 idx, piece p)
+piece_array_insert(piece_array* a, u64 idx, piece p, mem_tag tag)
 {
     if (idx > a->count)
     {
@@ -300,7 +449,7 @@ piece_array_insert(piece_array* a, u64 idx, piece p)
 
     if (a->count == a->capacity)
     {
-        piece_array_reserve(a, a->count + 1);
+        piece_array_reserve(a, a->count + 1, tag);
     }
 
     u64 i = 0;
@@ -351,6 +500,9 @@ buffer_init(buffer *b, string data, string path)
     b->lines.items = NULL;
     b->lines.count = 0;
     b->lines.capacity = 0;
+    b->piece_starts = NULL;
+    b->piece_starts_capacity = 0;
+    b->listener_count = 0;
     b->total_len = data.len;
 
     if (buffer_copy_path_cstr(path, &c_path) == 0 && c_path != NULL)
@@ -364,7 +516,7 @@ buffer_init(buffer *b, string data, string path)
     }
 
     u64 piece_capacity = 64;
-    piece* pieces = (piece*)malloc(sizeof(piece) * piece_capacity);
+    piece* pieces = (piece*)MEM_MALLOC(MEM_PIECES, sizeof(piece) * piece_capacity);
     if (pieces == NULL)
     {
         fprintf(stderr, "[error] unable to malloc pieces\n");
@@ -377,167 +529,733 @@ buffer_init(buffer *b, string data, string path)
     piece_array_insert(
             &b->pieces,
             0,
-            (piece){.source = BUFFER_SRC_ORIG, .start = 0, .len = data.len}
+            (piece){.source = BUFFER_SRC_ORIG, .start = 0, .len = data.len},
+            MEM_PIECES
             );
 
+    buffer_reindex_pieces(b);
     buffer_rebuild_line_index(b);
 }
 
+/*
+ * A read-only buffer over `data` for searching text that is not open, e.g.
+ * a mapped file. No line index is built, so the line functions do not apply.
+ */
 void
-buffer_insert(buffer *b, u64 offset, string text)
+buffer_init_text(buffer *b, string data)
 {
-    piece_loc loc;
-    piece old_piece;
-    piece add_piece;
-    u64 add_start;
+    memset(b, 0, sizeof(*b));
+    b->orig = data;
+    b->total_len = data.len;
 
-    if (offset > b->total_len)
+    piece_array_reserve(&b->pieces, 1, MEM_PIECES);
+    b->pieces.items[0] = (piece){.source = BUFFER_SRC_ORIG, .start = 0, .len = data.len};
+    b->pieces.count = data.len > 0 ? 1 : 0;
+
+    buffer_reindex_pieces(b);
+}
+
+void
+buffer_free(buffer *b)
+{
+    MEM_FREE(MEM_PIECES, b->pieces.items, sizeof(piece) * b->pieces.capacity);
+    MEM_FREE(MEM_ADD, b->add.s, b->add_capacity);
+    MEM_FREE(MEM_PIECES, b->piece_starts, sizeof(u64) * b->piece_starts_capacity);
+    MEM_FREE(MEM_LINES, b->lines.items, sizeof(line_info) * b->lines.capacity);
+
+    b->pieces.items = NULL;
+    b->pieces.count = 0;
+    b->pieces.capacity = 0;
+    b->add.s = NULL;
+    b->add_capacity = 0;
+    b->piece_starts = NULL;
+    b->piece_starts_capacity = 0;
+    b->lines.items = NULL;
+    b->lines.count = 0;
+    b->lines.capacity = 0;
+}
+
+/*
+ * Patches the line index for an edit that replaced [start, start + len)
+ * with `items`: line starts inside the removed range are dropped, the
+ * newlines of the inserted pieces are added and the tail is shifted once.
+ */
+static void
+buffer_update_line_index(buffer *b, u64 start, u64 len, piece *items, u64 count)
+{
+    line_info *lines;
+    u64 lo = 0;
+    u64 hi;
+    u64 first_removed;
+    u64 first_kept;
+    u64 new_lines = 0;
+    u64 new_count;
+    u64 insert_len = 0;
+    u64 pos;
+    u64 i;
+
+    for (i = 0; i < count; i++)
     {
-        fprintf(stderr, "[error] buffer_insert out of bounds\n");
-        exit(1);
+        u8 *data = buffer_piece_data(b, items[i]);
+        u8 *end = data + items[i].len;
+        u8 *nl = data;
+
+        while ((nl = (u8 *)memchr(nl, '\n', (size_t)(end - nl))) != NULL)
+        {
+            new_lines++;
+            nl++;
+        }
+
+        insert_len += items[i].len;
     }
 
-    if (text.len == 0)
+    /* first line starting after `start` */
+    hi = b->lines.count;
+    while (lo < hi)
     {
-        return;
-    }
+        u64 mid = lo + (hi - lo) / 2;
 
-    buffer_add_append(b, text, &add_start);
-    add_piece = (piece){.source = BUFFER_SRC_ADD, .start = add_start, .len = text.len};
+        if (b->lines.items[mid].start <= start)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    first_removed = lo;
 
-    if (b->pieces.count == 0)
+    /* first line starting after the removed range */
+    hi = b->lines.count;
+    while (lo < hi)
     {
-        piece_array_insert(&b->pieces, 0, add_piece);
-        b->total_len += text.len;
-        return;
-    }
+        u64 mid = lo + (hi - lo) / 2;
 
-    loc = find_piece_at_offset(b, offset);
-    old_piece = b->pieces.items[loc.piece_index];
+        if (b->lines.items[mid].start <= start + len)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    first_kept = lo;
 
-    if (loc.piece_offset == 0)
+    new_count = b->lines.count - (first_kept - first_removed) + new_lines;
+    if (new_count > b->lines.capacity)
     {
-        piece_array_insert(&b->pieces, loc.piece_index, add_piece);
+        line_index_reserve(&b->lines, new_count);
     }
-    else if (loc.piece_offset == old_piece.len)
+
+    lines = b->lines.items;
+    memmove(lines + first_removed + new_lines,
+            lines + first_kept,
+            sizeof(line_info) * (b->lines.count - first_kept));
+
+    for (i = first_removed + new_lines; i < new_count; i++)
     {
-        piece_array_insert(&b->pieces, loc.piece_index + 1, add_piece);
+        lines[i].start = lines[i].start + insert_len - len;
     }
-    else
+
+    pos = start;
+    new_lines = first_removed;
+    for (i = 0; i < count; i++)
     {
-        piece replacement[3];
+        u8 *data = buffer_piece_data(b, items[i]);
+        u8 *end = data + items[i].len;
+        u8 *nl = data;
 
-        replacement[0] = (piece){
-            .source = old_piece.source,
-            .start = old_piece.start,
-            .len = loc.piece_offset,
-        };
+        while ((nl = (u8 *)memchr(nl, '\n', (size_t)(end - nl))) != NULL)
+        {
+            nl++;
+            lines[new_lines++].start = pos + (u64)(nl - data);
+        }
+
+        pos += items[i].len;
+    }
 
-        replacement[1] = add_piece;
+    b->lines.count = new_count;
+}
 
-        replacement[2] = (piece){
-            .source = old_piece.source,
-            .start = old_piece.start + loc.piece_offset,
-            .len = old_piece.len - loc.piece_offset,
-        };
+static void
+buffer_notify_before(buffer *b, buffer_change *changes, u64 count)
+{
+    u64 i;
 
-        piece_array_replace(&b->pieces, loc.piece_index, 1, replacement, 3);
+    for (i = 0; i < b->listener_count; i++)
+    {
+        if (b->listeners[i].before != NULL)
+        {
+            b->listeners[i].before(b, changes, count, b->listeners[i].ctx);
+        }
     }
+}
 
-    b->total_len += text.len;
-    buffer_rebuild_line_index(b);
+static void
+buffer_notify(buffer *b, buffer_change *changes, u64 count)
+{
+    u64 i;
+
+    for (i = 0; i < b->listener_count; i++)
+    {
+        b->listeners[i].fn(b, changes, count, b->listeners[i].ctx);
+    }
 }
 
-void
-buffer_delete(buffer *b, u64 start, u64 len)
+/*
+ * Replaces [start, start + len) with `items` in one pass over the piece
+ * array. Every edit goes through here so the piece starts and the line
+ * index are rebuilt once per edit.
+ */
+static void
+buffer_splice_pieces(buffer *b, u64 start, u64 len, piece *items, u64 count)
 {
+    piece_loc loc;
+    piece first;
+    piece last;
+    piece keep[2];
+    u64 keep_count = 0;
+    u64 first_index;
+    u64 last_index;
+    u64 insert_len = 0;
     u64 i;
-    u64 end;
-    u64 doc_pos;
-    u64 new_count;
-    u64 new_capacity;
-    piece *new_items;
 
-    if (len == 0)
+    for (i = 0; i < count; i++)
     {
-        return;
+        insert_len += items[i].len;
     }
 
-    if (start > b->total_len || len > b->total_len - start)
+    if (len == 0 && insert_len == 0)
     {
-        fprintf(stderr, "[error] buffer_delete out of bounds\n");
-        exit(1);
+        return;
     }
 
-    end = start + len;
-    new_capacity = b->pieces.count ? b->pieces.count + 1 : 1;
-    new_items = (piece *)malloc(sizeof(piece) * new_capacity);
-    if (new_items == NULL)
+    buffer_update_line_index(b, start, len, items, count);
+
+    if (b->pieces.count == 0)
     {
-        fprintf(stderr, "[error] buffer_delete unable to alloc temp pieces\n");
-        exit(1);
+        piece_array_replace(&b->pieces, 0, 0, items, count, MEM_PIECES);
+        b->total_len += insert_len;
+        buffer_reindex_pieces(b);
+        return;
     }
 
-    doc_pos = 0;
-    new_count = 0;
-    for (i = 0; i < b->pieces.count; i++)
+    loc = find_piece_at_offset(b, start);
+    first_index = loc.piece_index;
+    first = b->pieces.items[first_index];
+
+    /* typing appends to the add buffer right after the piece it extends, so it grows that piece */
+    if (len == 0 && count == 1 && items[0].source == BUFFER_SRC_ADD &&
+        (loc.piece_offset == first.len || (loc.piece_offset == 0 && first_index > 0)))
     {
-        piece p = b->pieces.items[i];
-        u64 piece_start = doc_pos;
-        u64 piece_end = doc_pos + p.len;
+        piece *prev = &b->pieces.items[loc.piece_offset == first.len ? first_index : first_index - 1];
 
-        if (piece_end <= start || piece_start >= end)
+        if (prev->source == BUFFER_SRC_ADD && prev->start + prev->len == items[0].start)
         {
-            new_items[new_count++] = p;
+            prev->len += items[0].len;
+            b->total_len += insert_len;
+            buffer_reindex_pieces(b);
+            return;
         }
-        else
-        {
-            u64 left_keep = 0;
-            u64 right_keep = 0;
+    }
 
-            if (start > piece_start)
-            {
-                left_keep = start - piece_start;
-            }
+    if (len == 0)
+    {
+        if (loc.piece_offset == 0)
+        {
+            piece_array_replace(&b->pieces, first_index, 0, items, count, MEM_PIECES);
+        }
+        else if (loc.piece_offset == first.len)
+        {
+            piece_array_replace(&b->pieces, first_index + 1, 0, items, count, MEM_PIECES);
+        }
+        else
+        {
+            keep[0] = (piece){
+                .source = first.source,
+                .start = first.start,
+                .len = loc.piece_offset,
+            };
+
+            keep[1] = (piece){
+                .source = first.source,
+                .start = first.start + loc.piece_offset,
+                .len = first.len - loc.piece_offset,
+            };
+
+            piece_array_replace(&b->pieces, first_index, 1, keep, 2, MEM_PIECES);
+            piece_array_replace(&b->pieces, first_index + 1, 0, items, count, MEM_PIECES);
+        }
+
+        b->total_len += insert_len;
+        buffer_reindex_pieces(b);
+        return;
+    }
+
+    loc = find_piece_at_offset(b, start + len - 1);
+    last_index = loc.piece_index;
+    last = b->pieces.items[last_index];
+
+    if (start > b->piece_starts[first_index])
+    {
+        keep[keep_count++] = (piece){
+            .source = first.source,
+            .start = first.start,
+            .len = start - b->piece_starts[first_index],
+        };
+    }
+
+    if (loc.piece_offset + 1 < last.len)
+    {
+        keep[keep_count++] = (piece){
+            .source = last.source,
+            .start = last.start + loc.piece_offset + 1,
+            .len = last.len - loc.piece_offset - 1,
+        };
+    }
+
+    piece_array_replace(&b->pieces, first_index, last_index - first_index + 1, keep, keep_count, MEM_PIECES);
+
+    if (count > 0)
+    {
+        u64 at = first_index;
+
+        if (start > b->piece_starts[first_index])
+        {
+            at++;
+        }
+
+        piece_array_replace(&b->pieces, at, 0, items, count, MEM_PIECES);
+    }
+
+    b->total_len = b->total_len - len + insert_len;
+    buffer_reindex_pieces(b);
+}
+
+static void
+buffer_splice(buffer *b, u64 start, u64 len, piece *items, u64 count)
+{
+    buffer_change change = {.offset = start, .old_len = len, .new_len = 0};
+    u64 i;
+
+    for (i = 0; i < count; i++)
+    {
+        change.new_len += items[i].len;
+    }
+
+    if (b->listener_count > 0 && (change.old_len > 0 || change.new_len > 0))
+    {
+        buffer_notify_before(b, &change, 1);
+    }
+
+    buffer_splice_pieces(b, start, len, items, count);
+
+    if (b->listener_count > 0 && (change.old_len > 0 || change.new_len > 0))
+    {
+        buffer_notify(b, &change, 1);
+    }
+}
+
+void
+buffer_insert(buffer *b, u64 offset, string text)
+{
+    piece add_piece;
+    u64 add_start;
+
+    if (offset > b->total_len)
+    {
+        fprintf(stderr, "[error] buffer_insert out of bounds\n");
+        exit(1);
+    }
+
+    if (text.len == 0)
+    {
+        return;
+    }
+
+    buffer_add_append(b, text, &add_start);
+    add_piece = (piece){.source = BUFFER_SRC_ADD, .start = add_start, .len = text.len};
+
+    buffer_splice(b, offset, 0, &add_piece, 1);
+}
 
-            if (piece_end > end)
+void
+buffer_insert_pieces(buffer *b, u64 offset, piece *items, u64 count)
+{
+    if (offset > b->total_len)
+    {
+        fprintf(stderr, "[error] buffer_insert_pieces out of bounds\n");
+        exit(1);
+    }
+
+    buffer_splice(b, offset, 0, items, count);
+}
+
+void
+buffer_collect_pieces(buffer *b, u64 start, u64 len, piece_array *out, mem_tag tag)
+{
+    piece_loc loc;
+    u64 skip;
+    u64 i;
+
+    if (start > b->total_len || len > b->total_len - start)
+    {
+        fprintf(stderr, "[error] buffer_collect_pieces out of bounds\n");
+        exit(1);
+    }
+
+    if (len == 0 || b->pieces.count == 0)
+    {
+        return;
+    }
+
+    loc = find_piece_at_offset(b, start);
+    skip = loc.piece_offset;
+
+    for (i = loc.piece_index; i < b->pieces.count && len > 0; i++)
+    {
+        piece p = b->pieces.items[i];
+        u64 take = p.len - skip;
+
+        if (take > len)
+        {
+            take = len;
+        }
+
+        if (take > 0)
+        {
+            if (out->count == out->capacity)
             {
-                right_keep = piece_end - end;
+                piece_array_reserve(out, out->count + 1, tag);
             }
 
-            if (left_keep > 0)
+            out->items[out->count++] = (piece){
+                .source = p.source,
+                .start = p.start + skip,
+                .len = take,
+            };
+        }
+
+        len -= take;
+        skip = 0;
+    }
+}
+
+void
+buffer_delete(buffer *b, u64 start, u64 len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    if (start > b->total_len || len > b->total_len - start)
+    {
+        fprintf(stderr, "[error] buffer_delete out of bounds\n");
+        exit(1);
+    }
+
+    buffer_splice(b, start, len, NULL, 0);
+}
+
+void
+buffer_replace(buffer *b, u64 start, u64 len, string text)
+{
+    piece add_piece;
+    u64 add_start;
+
+    if (start > b->total_len || len > b->total_len - start)
+    {
+        fprintf(stderr, "[error] buffer_replace out of bounds\n");
+        exit(1);
+    }
+
+    if (text.len == 0)
+    {
+        buffer_splice(b, start, len, NULL, 0);
+        return;
+    }
+
+    buffer_add_append(b, text, &add_start);
+    add_piece = (piece){.source = BUFFER_SRC_ADD, .start = add_start, .len = text.len};
+
+    buffer_splice(b, start, len, &add_piece, 1);
+}
+
+/*
+ * Copies [from, to) of the current document into `out` as piece references.
+ * `*index` is the piece to resume from, callers walk the document forward.
+ */
+static void
+buffer_emit_pieces(buffer *b, u64 *index, u64 from, u64 to, piece *out, u64 *out_count)
+{
+    while (from < to)
+    {
+        piece p;
+        u64 skip;
+        u64 take;
+
+        while (b->piece_starts[*index] + b->pieces.items[*index].len <= from)
+        {
+            (*index)++;
+        }
+
+        p = b->pieces.items[*index];
+        skip = from - b->piece_starts[*index];
+        take = p.len - skip;
+        if (take > to - from)
+        {
+            take = to - from;
+        }
+
+        out[(*out_count)++] = (piece){
+            .source = p.source,
+            .start = p.start + skip,
+            .len = take,
+        };
+
+        from += take;
+    }
+}
+
+/*
+ * Applies a sorted, non-overlapping list of edits given in pre-edit
+ * offsets. All inserted text is appended to the add buffer together, the
+ * pieces between the first and last edit are rebuilt in one walk and the
+ * line index is merged in one pass, however many edits there are.
+ */
+void
+buffer_apply_edits(buffer *b, buffer_edit *edits, u64 count)
+{
+    piece_loc loc;
+    piece *stretch;
+    line_info *lines;
+    buffer_change *changes = NULL;
+    u64 stretch_count = 0;
+    u64 stretch_capacity;
+    u64 first_piece;
+    u64 last_piece;
+    u64 piece_index;
+    u64 stretch_end;
+    u64 cursor;
+    u64 insert_total = 0;
+    u64 delete_total = 0;
+    u64 add_start;
+    u64 new_lines = 0;
+    u64 line;
+    u64 out_line;
+    u64 line_count;
+    s64 delta;
+    u64 i;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        u64 j;
+
+        if (edits[i].offset > b->total_len ||
+            edits[i].delete_len > b->total_len - edits[i].offset ||
+            (i > 0 && edits[i].offset < edits[i - 1].offset + edits[i - 1].delete_len))
+        {
+            fprintf(stderr, "[error] buffer_apply_edits edits out of bounds or unsorted\n");
+            exit(1);
+        }
+
+        for (j = 0; j < edits[i].text.len; j++)
+        {
+            if (edits[i].text.s[j] == '\n')
             {
-                new_items[new_count++] = (piece){
-                    .source = p.source,
-                    .start = p.start,
-                    .len = left_keep,
-                };
+                new_lines++;
             }
+        }
 
-            if (right_keep > 0)
+        insert_total += edits[i].text.len;
+        delete_total += edits[i].delete_len;
+    }
+
+    if (insert_total == 0 && delete_total == 0)
+    {
+        return;
+    }
+
+    if (b->listener_count > 0)
+    {
+        changes = (buffer_change *)MEM_MALLOC(MEM_SCRATCH, sizeof(buffer_change) * count);
+        if (changes == NULL)
+        {
+            fprintf(stderr, "[error] buffer_apply_edits unable to alloc changes\n");
+            exit(1);
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            changes[i].offset = edits[i].offset;
+            changes[i].old_len = edits[i].delete_len;
+            changes[i].new_len = edits[i].text.len;
+        }
+
+        buffer_notify_before(b, changes, count);
+    }
+
+    buffer_add_reserve(b, insert_total);
+    add_start = b->add.len;
+    for (i = 0; i < count; i++)
+    {
+        if (edits[i].text.len)
+        {
+            memcpy(b->add.s + b->add.len, edits[i].text.s, (size_t)edits[i].text.len);
+            b->add.len += edits[i].text.len;
+        }
+    }
+
+    /* line index: keep, shift or drop each old start, adding new ones in order */
+    line_count = b->lines.count + new_lines;
+    lines = (line_info *)MEM_MALLOC(MEM_LINES, sizeof(line_info) * line_count);
+    if (lines == NULL)
+    {
+        fprintf(stderr, "[error] buffer_apply_edits unable to alloc line index\n");
+        exit(1);
+    }
+
+    line = 0;
+    out_line = 0;
+    delta = 0;
+    for (i = 0; i < count; i++)
+    {
+        u64 j;
+        u64 new_offset;
+
+        while (line < b->lines.count && b->lines.items[line].start <= edits[i].offset)
+        {
+            lines[out_line++].start = (u64)((s64)b->lines.items[line].start + delta);
+            line++;
+        }
+
+        while (line < b->lines.count &&
+               b->lines.items[line].start <= edits[i].offset + edits[i].delete_len)
+        {
+            line++;
+        }
+
+        new_offset = (u64)((s64)edits[i].offset + delta);
+        for (j = 0; j < edits[i].text.len; j++)
+        {
+            if (edits[i].text.s[j] == '\n')
             {
-                new_items[new_count++] = (piece){
-                    .source = p.source,
-                    .start = p.start + (p.len - right_keep),
-                    .len = right_keep,
-                };
+                lines[out_line++].start = new_offset + j + 1;
             }
         }
 
-        doc_pos = piece_end;
+        delta += (s64)edits[i].text.len - (s64)edits[i].delete_len;
     }
 
-    if (new_count > b->pieces.capacity)
+    while (line < b->lines.count)
     {
-        piece_array_reserve(&b->pieces, new_count);
+        lines[out_line++].start = (u64)((s64)b->lines.items[line].start + delta);
+        line++;
     }
 
-    memcpy(b->pieces.items, new_items, sizeof(piece) * new_count);
-    b->pieces.count = new_count;
-    b->total_len -= len;
-    free(new_items);
+    MEM_FREE(MEM_LINES, b->lines.items, sizeof(line_info) * b->lines.capacity);
+    b->lines.items = lines;
+    b->lines.count = out_line;
+    b->lines.capacity = line_count;
 
-    buffer_rebuild_line_index(b);
+    /* pieces: only the stretch from the first to the last edit is rebuilt */
+    if (b->pieces.count == 0)
+    {
+        piece_array_insert(&b->pieces, 0, (piece){.source = BUFFER_SRC_ORIG, .start = 0, .len = 0}, MEM_PIECES);
+        buffer_reindex_pieces(b);
+    }
+
+    loc = find_piece_at_offset(b, edits[0].offset);
+    first_piece = loc.piece_index;
+    loc = find_piece_at_offset(b, edits[count - 1].offset + edits[count - 1].delete_len);
+    last_piece = loc.piece_index;
+    stretch_end = b->piece_starts[last_piece] + b->pieces.items[last_piece].len;
+
+    stretch_capacity = last_piece - first_piece + 1 + 3 * count;
+    stretch = (piece *)MEM_MALLOC(MEM_PIECES, sizeof(piece) * stretch_capacity);
+    if (stretch == NULL)
+    {
+        fprintf(stderr, "[error] buffer_apply_edits unable to alloc pieces\n");
+        exit(1);
+    }
+
+    piece_index = first_piece;
+    cursor = b->piece_starts[first_piece];
+    for (i = 0; i < count; i++)
+    {
+        buffer_emit_pieces(b, &piece_index, cursor, edits[i].offset, stretch, &stretch_count);
+
+        if (edits[i].text.len > 0)
+        {
+            stretch[stretch_count++] = (piece){
+                .source = BUFFER_SRC_ADD,
+                .start = add_start,
+                .len = edits[i].text.len,
+            };
+            add_start += edits[i].text.len;
+        }
+
+        cursor = edits[i].offset + edits[i].delete_len;
+    }
+    buffer_emit_pieces(b, &piece_index, cursor, stretch_end, stretch, &stretch_count);
+
+    piece_array_replace(&b->pieces, first_piece, last_piece - first_piece + 1, stretch, stretch_count,
+                        MEM_PIECES);
+    MEM_FREE(MEM_PIECES, stretch, sizeof(piece) * stretch_capacity);
+
+    b->total_len = b->total_len + insert_total - delete_total;
+    buffer_reindex_pieces(b);
+
+    if (changes != NULL)
+    {
+        buffer_notify(b, changes, count);
+        MEM_FREE(MEM_SCRATCH, changes, sizeof(buffer_change) * count);
+    }
+}
+
+void
+buffer_add_listener(buffer *b, buffer_listener_fn fn, void *ctx)
+{
+    buffer_add_edit_listener(b, NULL, fn, ctx);
+}
+
+/* `before` sees each edit ahead of `fn`, for indexes that need the text it removes. */
+void
+buffer_add_edit_listener(buffer *b, buffer_listener_fn before, buffer_listener_fn fn, void *ctx)
+{
+    if (b->listener_count >= BUFFER_MAX_LISTENERS)
+    {
+        fprintf(stderr, "[error] buffer_add_listener too many listeners\n");
+        exit(1);
+    }
+
+    b->listeners[b->listener_count].fn = fn;
+    b->listeners[b->listener_count].before = before;
+    b->listeners[b->listener_count].ctx = ctx;
+    b->listener_count++;
+}
+
+void
+buffer_remove_listener(buffer *b, buffer_listener_fn fn, void *ctx)
+{
+    u64 i;
+
+    for (i = 0; i < b->listener_count; i++)
+    {
+        if (b->listeners[i].fn == fn && b->listeners[i].ctx == ctx)
+        {
+            b->listeners[i] = b->listeners[--b->listener_count];
+            return;
+        }
+    }
 }
 
 u64
@@ -579,10 +1297,25 @@ buffer_line_len(buffer *b, u64 line)
     return end - start;
 }
 
+/* The empty line after a final newline is where the file ends, not a line. */
+u64
+buffer_last_line(buffer *b)
+{
+    u64 last = b->lines.count - 1;
+
+    if (last > 0 && b->lines.items[last].start == b->total_len)
+    {
+        last--;
+    }
+
+    return last;
+}
+
 u64
 buffer_offset_to_line_col(buffer *b, u64 offset, u64 *line, u64 *col)
 {
-    u64 i;
+    u64 lo;
+    u64 hi;
     u64 clamped_offset = offset;
 
     if (clamped_offset > b->total_len)
@@ -593,15 +1326,24 @@ buffer_offset_to_line_col(buffer *b, u64 offset, u64 *line, u64 *col)
     *line = 0;
     *col = 0;
 
-    for (i = 0; i + 1 < b->lines.count; i++)
+    /* last line starting at or before the offset */
+    lo = 0;
+    hi = b->lines.count;
+    while (hi - lo > 1)
     {
-        if (b->lines.items[i + 1].start > clamped_offset)
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (b->lines.items[mid].start <= clamped_offset)
         {
-            break;
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
         }
-        *line = i + 1;
     }
 
+    *line = lo;
     *col = clamped_offset - b->lines.items[*line].start;
     return clamped_offset;
 }
@@ -634,54 +1376,23 @@ buffer_line_col_to_offset(buffer *b, u64 line, u64 col)
 
 string buffer_to_string(buffer *b)
 {
-    u64 len = 0;
-    u64 i;
-    u64 idx = 0;
-    string r = {0};
-    u8 *s;
+    string r;
 
     if (b == NULL)
     {
         return (string){0};
     }
 
-    for (i = 0; i < b->pieces.count; i++)
-    {
-        len += b->pieces.items[i].len;
-    }
-
-    s = (u8 *)malloc(len == 0 ? 1 : (size_t)len);
-
-    ASSERT(s != NULL);
-
-    for (i = 0; i < b->pieces.count; i++)
-    {
-
-        piece p = b->pieces.items[i];
-
-        ASSERT(
-                p.source == BUFFER_SRC_ORIG ||
-                p.source == BUFFER_SRC_ADD
-                );
-
-        u8* src;
-
-        if (p.source == BUFFER_SRC_ORIG)
-        {
-            src = b->orig.s;
-        }
-        else if (p.source == BUFFER_SRC_ADD)
-        {
-            src = b->add.s;
-        }
-
-        memcpy(s + idx, src + p.start, (size_t)p.len);
-
-        idx += p.len;
-    }
-
-    r.s = s;
-    r.len = idx;
+    r.s = (u8 *)malloc(b->total_len == 0 ? 1 : (size_t)b->total_len);
+    ASSERT(r.s != NULL);
+    r.len = b->total_len;
+    buffer_read(b, 0, r.len, r.s);
 
     return r;
 }
+
+string
+buffer_to_string_arena(buffer *b, arena *a)
+{
+    return buffer_slice_arena(b, a, 0, b->total_len);
+}
@@ -2,6 +2,8 @@
 #define BUFFER_H
 
 #include "base.h"
+#include "arena.h"
+#include "mem.h"
 
 typedef enum {
     BUFFER_SRC_ORIG,
@@ -41,7 +43,31 @@ typedef struct
     u64 capacity;
 } line_index;
 
+#define BUFFER_MAX_LISTENERS 8
+
+/*
+ * An applied edit as listeners see it. A batch is reported as one sorted
+ * list with every `offset` in pre-edit coordinates.
+ */
+typedef struct
+{
+    u64 offset;
+    u64 old_len;
+    u64 new_len;
+} buffer_change;
+
+struct buffer;
+typedef void (*buffer_listener_fn)(struct buffer *b, buffer_change *changes, u64 count, void *ctx);
+
 typedef struct
+{
+    buffer_listener_fn fn;
+    /* optional, given the same changes while the old text can still be read */
+    buffer_listener_fn before;
+    void *ctx;
+} buffer_listener;
+
+typedef struct buffer
 {
     string file_path;
     struct stat file_stat;
@@ -52,20 +78,62 @@ typedef struct
     u64 add_capacity;
     piece_array pieces;
 
+    /* document offset of each piece, kept in step with `pieces` */
+    u64 *piece_starts;
+    u64 piece_starts_capacity;
+
     line_index lines;
     u64 total_len;
+
+    /* called after every edit, for indexes kept alongside the text */
+    buffer_listener listeners[BUFFER_MAX_LISTENERS];
+    u64 listener_count;
 } buffer;
 
+/* One replacement in a batch, `offset` is in pre-edit coordinates. */
+typedef struct
+{
+    u64 offset;
+    u64 delete_len;
+    string text;
+} buffer_edit;
+
+/* Caches the piece last read from so sequential scans stay O(1) per byte. */
+typedef struct
+{
+    buffer *b;
+    u8 *data;
+    u64 start;
+    u64 len;
+} buffer_reader;
+
 void buffer_init(buffer *b, string data, string path);
+void buffer_init_text(buffer *b, string data);
+void buffer_free(buffer *b);
 void buffer_insert(buffer *b, u64 offset, string text);
 void buffer_delete(buffer *b, u64 start, u64 len);
+void buffer_replace(buffer *b, u64 start, u64 len, string text);
+void buffer_apply_edits(buffer *b, buffer_edit *edits, u64 count);
+void buffer_add_listener(buffer *b, buffer_listener_fn fn, void *ctx);
+void buffer_add_edit_listener(buffer *b, buffer_listener_fn before, buffer_listener_fn fn, void *ctx);
+void buffer_remove_listener(buffer *b, buffer_listener_fn fn, void *ctx);
+void buffer_insert_pieces(buffer *b, u64 offset, piece *items, u64 count);
+void buffer_collect_pieces(buffer *b, u64 start, u64 len, piece_array *out, mem_tag tag);
 u8 buffer_byte_at(buffer *b, u64 offset);
+u64 buffer_span_at(buffer *b, u64 offset, u8 **data);
+u64 buffer_span_before(buffer *b, u64 offset, u8 **data);
+void buffer_reader_init(buffer_reader *r, buffer *b);
+u8 buffer_reader_byte(buffer_reader *r, u64 offset);
+void buffer_read(buffer *b, u64 start, u64 len, u8 *out);
 void buffer_slice(buffer *b, u64 start, u64 len, string *out);
+string buffer_slice_arena(buffer *b, arena *a, u64 start, u64 len);
 u64 buffer_line_start(buffer *b, u64 line);
 u64 buffer_line_len(buffer *b, u64 line);
+u64 buffer_last_line(buffer *b);
 u64 buffer_offset_to_line_col(buffer *b, u64 offset, u64 *line, u64 *col);
 u64 buffer_line_col_to_offset(buffer *b, u64 line, u64 col);
 string buffer_to_string(buffer *b);
+string buffer_to_string_arena(buffer *b, arena *a);
 
 
 
@@ -2,6 +2,7 @@
 #include "cmd.h"
 #include "editor.h"
 #include "file.h"
+#include <ctype.h>
 #include <limits.h>
 
 static void
@@ -36,114 +37,693 @@ set_write_status_message(write_file_result result)
     editor_set_cmd_status_message((u8*)message);
 }
 
-void cmd_process(arena *cmd)
+/* Lists every register that holds text. Only the stored lengths are read. */
+static void
+cmd_list_registers(void)
 {
-    if (cmd == NULL || cmd->data == NULL)
+    static const char names[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char message[256];
+    int used = 0;
+    u64 i;
+
+    register_slot *unnamed = registers_get(&E.regs, REGISTER_UNNAMED);
+    if (unnamed != NULL && unnamed->in_use)
     {
-        return;
+        used += snprintf(message + used, sizeof(message) - (size_t)used,
+                         "\"\" %lluB%s  ",
+                         (unsigned long long)unnamed->len,
+                         unnamed->kind == REGISTER_LINEWISE ? " line" : "");
     }
 
-    if (cmd->cur_pos == 0)
+    for (i = 0; names[i] != '\0' && used < (int)sizeof(message); i++)
     {
-        return;
+        register_slot *slot = registers_get(&E.regs, (u8)names[i]);
+
+        if (slot == NULL || !slot->in_use)
+        {
+            continue;
+        }
+
+        used += snprintf(message + used, sizeof(message) - (size_t)used,
+                         "\"%c %lluB%s  ",
+                         names[i],
+                         (unsigned long long)slot->len,
+                         slot->kind == REGISTER_LINEWISE ? " line" : "");
+        if (used >= (int)sizeof(message))
+        {
+            break;
+        }
     }
 
-    /* enter with only colon */
-    if (cmd->cur_pos == 1 && cmd->data[0] == ':')
+    if (used == 0)
     {
-        cmd->cur_pos = 0;
-        E.mode = EDITOR_NORMAL_MODE;
+        editor_set_cmd_status_message((u8*)"No registers in use");
         return;
     }
 
-    /* Skip the leading ':' and parse the command before clearing it. */
-    u64 i = 1;
+    editor_set_cmd_status_message((u8*)message);
+}
+
+/* what a command takes, parsed before its handler runs */
+#define CMD_RANGE    (1 << 0)
+/* without a range it covers every line instead of the cursor line */
+#define CMD_WHOLE    (1 << 1)
+#define CMD_BANG     (1 << 2)
+#define CMD_REGISTER (1 << 3)
+/* a count N makes the range the N lines from its last one */
+#define CMD_COUNT    (1 << 4)
+/* a destination address, for :m and :t */
+#define CMD_DEST     (1 << 5)
+/* the rest of the line goes to the handler as `args` */
+#define CMD_ARGS     (1 << 6)
+
+/* Lines are 0-based here, `dest` counts from 1 with 0 above the first line. */
+typedef struct
+{
+    u64 first_line;
+    u64 last_line;
+    u8 bang;
+    u8 register_name;
+    /* how many times a one-character name was written, the levels of :>> */
+    u64 repeat;
+    u64 dest;
+    string args;
+} cmd_args;
+
+typedef struct
+{
+    const char *name;
+    /* shortest abbreviation accepted */
+    u64 min_len;
+    u32 flags;
+    void (*fn)(cmd_args *a);
+} cmd_entry;
+
+static u64
+cmd_parse_number(arena *cmd, u64 *i)
+{
+    u64 n = 0;
 
-    while (i < cmd->cur_pos && (cmd->data[i] == ' ' || cmd->data[i] == '\t'))
+    while (*i < cmd->cur_pos && cmd->data[*i] >= '0' && cmd->data[*i] <= '9')
     {
-        i++;
+        /* past any line count, clamped later */
+        if (n < (u64)1 << 48)
+        {
+            n = n * 10 + (u64)(cmd->data[*i] - '0');
+        }
+        (*i)++;
     }
 
-    if (i < cmd->cur_pos && cmd->data[i] == 'q')
+    return n;
+}
+
+static void
+cmd_skip_blanks(arena *cmd, u64 *i)
+{
+    while (*i < cmd->cur_pos && (cmd->data[*i] == ' ' || cmd->data[*i] == '\t'))
     {
-        i++;
+        (*i)++;
+    }
+}
 
-        while (i < cmd->cur_pos && (cmd->data[i] == ' ' || cmd->data[i] == '\t'))
+/*
+ * One address as a line counted from 1, 0 above the first: a number, `.`,
+ * `$`, `'<` or `'>`, /pattern/ or ?pattern? searched from `cursor`, then
+ * any +N and -N, which alone count from `cursor`. Returns 0 if there is
+ * none, -1 with the status message set if it does not resolve.
+ */
+static int
+cmd_parse_address(arena *cmd, u64 *i, u64 cursor, u64 *out)
+{
+    buffer *b = editor_active_buffer();
+    char message[sizeof(E.status_message)];
+    u64 n = cursor;
+    int found = 0;
+    u8 c = *i < cmd->cur_pos ? cmd->data[*i] : 0;
+
+    if (c == '.' || c == '$')
+    {
+        (*i)++;
+        n = c == '$' ? buffer_last_line(b) + 1 : cursor;
+        found = 1;
+    }
+    else if (c >= '0' && c <= '9')
+    {
+        n = cmd_parse_number(cmd, i);
+        found = 1;
+    }
+    else if (c == '\'')
+    {
+        u8 mark = *i + 1 < cmd->cur_pos ? cmd->data[*i + 1] : 0;
+
+        if (mark != '<' && mark != '>')
         {
-            i++;
+            editor_set_cmd_status_message((u8*)"Unknown mark");
+            return -1;
+        }
+        if (!E.visual_marked)
+        {
+            editor_set_cmd_status_message((u8*)"Mark not set");
+            return -1;
         }
 
-        if (i == cmd->cur_pos)
+        *i += 2;
+        n = (mark == '<' ? E.visual_first_line : E.visual_last_line) + 1;
+        found = 1;
+    }
+    else if (c == '/' || c == '?')
+    {
+        u64 start = ++(*i);
+        u64 line;
+        string pattern;
+
+        while (*i < cmd->cur_pos && cmd->data[*i] != c)
         {
-            cmd->cur_pos = 0;
-            E.mode = EDITOR_NORMAL_MODE;
-            E.running = FALSE;
-            return;
+            *i += cmd->data[*i] == '\\' && *i + 1 < cmd->cur_pos ? 2 : 1;
         }
+        pattern = (string){.s = cmd->data + start, .len = *i - start};
+        *i += *i < cmd->cur_pos;
 
-        editor_set_cmd_status_message((u8*)"Trailing characters on quit");
+        if (!editor_search_line(pattern, cursor > 0 ? cursor - 1 : 0, c == '?', &line))
+        {
+            snprintf(message, sizeof(message), "Pattern not found: %.*s", (int)pattern.len,
+                     (char *)pattern.s);
+            editor_set_cmd_status_message((u8*)message);
+            return -1;
+        }
+
+        n = line + 1;
+        found = 1;
     }
-    else if (i < cmd->cur_pos && cmd->data[i] == 'w')
+
+    while (*i < cmd->cur_pos && (cmd->data[*i] == '+' || cmd->data[*i] == '-'))
     {
-        int force = 0;
-        int quit_after_save = FALSE;
-        write_file_result result;
+        u8 sign = cmd->data[(*i)++];
+        u64 k = 1;
 
-        i++;
+        if (*i < cmd->cur_pos && cmd->data[*i] >= '0' && cmd->data[*i] <= '9')
+        {
+            k = cmd_parse_number(cmd, i);
+        }
 
-        if (i < cmd->cur_pos && cmd->data[i] == '!')
+        if (sign == '-' && k > n)
         {
-            force = 1;
-            i++;
+            editor_set_cmd_status_message((u8*)"Invalid range");
+            return -1;
         }
-        else if (i < cmd->cur_pos && cmd->data[i] == 'q')
+
+        n = sign == '+' ? n + k : n - k;
+        found = 1;
+    }
+
+    *out = n;
+    return found;
+}
+
+/*
+ * `%`, or addresses separated by `,`, or by `;` which searches the next
+ * one from the address before it. A missing one is the cursor line and
+ * of more than two the last two count. Returns how many were given, or
+ * -1 with the status message set.
+ */
+static int
+cmd_parse_range(arena *cmd, u64 *i, u64 *first, u64 *last)
+{
+    u64 cursor = E.views[E.active_view].cursor.y + 1;
+    int given;
+    int r;
+
+    if (*i < cmd->cur_pos && cmd->data[*i] == '%')
+    {
+        (*i)++;
+        *first = 1;
+        *last = buffer_last_line(editor_active_buffer()) + 1;
+        return 2;
+    }
+
+    given = cmd_parse_address(cmd, i, cursor, first);
+    if (given < 0)
+    {
+        return -1;
+    }
+    *last = *first;
+
+    while (*i < cmd->cur_pos && (cmd->data[*i] == ',' || cmd->data[*i] == ';'))
+    {
+        if (cmd->data[(*i)++] == ';')
         {
-            quit_after_save = TRUE;
-            i++;
+            cursor = *last;
         }
 
-        while (i < cmd->cur_pos && (cmd->data[i] == ' ' || cmd->data[i] == '\t'))
+        *first = *last;
+        r = cmd_parse_address(cmd, i, cursor, last);
+        if (r < 0)
         {
-            i++;
+            return -1;
         }
 
-        if (i != cmd->cur_pos)
+        given = 2;
+    }
+
+    return given;
+}
+
+static void
+cmd_delete(cmd_args *a)
+{
+    editor_delete_lines(a->first_line, a->last_line, a->register_name);
+}
+
+static void
+cmd_yank(cmd_args *a)
+{
+    editor_yank_lines(a->first_line, a->last_line, a->register_name);
+}
+
+static void
+cmd_move(cmd_args *a)
+{
+    editor_copy_lines(a->first_line, a->last_line, a->dest, 1);
+}
+
+static void
+cmd_copy(cmd_args *a)
+{
+    editor_copy_lines(a->first_line, a->last_line, a->dest, 0);
+}
+
+static void
+cmd_shift_right(cmd_args *a)
+{
+    editor_shift_lines(a->first_line, a->last_line, a->repeat, 0);
+}
+
+static void
+cmd_shift_left(cmd_args *a)
+{
+    editor_shift_lines(a->first_line, a->last_line, a->repeat, 1);
+}
+
+static void
+cmd_normal(cmd_args *a)
+{
+    if (a->args.len == 0)
+    {
+        editor_set_cmd_status_message((u8*)"Argument required");
+        return;
+    }
+
+    editor_normal(a->first_line, a->last_line, a->args);
+}
+
+static void
+cmd_substitute(cmd_args *a)
+{
+    editor_substitute(a->first_line, a->last_line, a->args);
+}
+
+static void
+cmd_global(cmd_args *a)
+{
+    editor_global(a->first_line, a->last_line, a->args, a->bang);
+}
+
+static void
+cmd_vglobal(cmd_args *a)
+{
+    editor_global(a->first_line, a->last_line, a->args, 1);
+}
+
+static void
+cmd_registers(cmd_args *a)
+{
+    cmd_list_registers();
+}
+
+static void
+cmd_grep(cmd_args *a)
+{
+    if (a->args.len == 0)
+    {
+        editor_set_cmd_status_message((u8*)"No pattern");
+        return;
+    }
+
+    editor_start_grep(a->args);
+}
+
+static void
+cmd_cnext(cmd_args *a)
+{
+    editor_quickfix_step(1);
+}
+
+static void
+cmd_cprevious(cmd_args *a)
+{
+    editor_quickfix_step(0);
+}
+
+static void
+cmd_tag(cmd_args *a)
+{
+    if (a->args.len == 0)
+    {
+        editor_set_cmd_status_message((u8*)"No tag name");
+        return;
+    }
+
+    editor_goto_symbol(a->args);
+}
+
+static void
+cmd_index(cmd_args *a)
+{
+    editor_build_trigram_index();
+}
+
+static void
+cmd_lsp(cmd_args *a)
+{
+    char command[KB(1)];
+
+    if (a->args.len == 0)
+    {
+        editor_lsp_status();
+    }
+    else if (a->args.len == 4 && memcmp(a->args.s, "stop", 4) == 0)
+    {
+        editor_stop_lsp();
+    }
+    else if (a->args.len >= sizeof(command))
+    {
+        editor_set_cmd_status_message((u8*)"Language server command too long");
+    }
+    else
+    {
+        memcpy(command, a->args.s, (size_t)a->args.len);
+        command[a->args.len] = '\0';
+        editor_start_lsp(command);
+    }
+}
+
+static void
+cmd_mem(cmd_args *a)
+{
+    char path[KB(1)];
+
+    if (a->args.len == 0)
+    {
+        editor_mem(NULL);
+    }
+    else if (a->args.len >= sizeof(path))
+    {
+        editor_set_cmd_status_message((u8*)"File name too long");
+    }
+    else
+    {
+        memcpy(path, a->args.s, (size_t)a->args.len);
+        path[a->args.len] = '\0';
+        editor_mem(path);
+    }
+}
+
+static void
+cmd_nohlsearch(cmd_args *a)
+{
+    /* the index is kept, the next search or n shows it again */
+    E.hlsearch = 0;
+}
+
+static void
+cmd_quit(cmd_args *a)
+{
+    E.running = FALSE;
+}
+
+static void
+cmd_write_file(int force, int quit_after_save)
+{
+    write_file_result result = write_file(editor_active_buffer(), force, &E.scratch);
+
+    if (result.status == WRITE_FILE_OK)
+    {
+        set_write_status_message(result);
+        editor_file_written(result.path);
+        if (quit_after_save)
         {
-            editor_set_cmd_status_message((u8*)"Trailing characters on write");
-            return;
+            E.running = FALSE;
+        }
+    }
+    else if (result.status == WRITE_FILE_NO_PATH)
+    {
+        editor_set_cmd_status_message((u8*)"No file name");
+    }
+    else if (result.status == WRITE_FILE_NEEDS_CONFIRMATION)
+    {
+        editor_set_cmd_status_message((u8*)"File changed on disk. Use :w! to overwrite");
+    }
+    else
+    {
+        editor_set_cmd_status_message((u8*)"Unable to write file");
+    }
+}
+
+static void
+cmd_write(cmd_args *a)
+{
+    cmd_write_file(a->bang, 0);
+}
+
+static void
+cmd_write_quit(cmd_args *a)
+{
+    cmd_write_file(a->bang, 1);
+}
+
+/* The first entry a name abbreviates wins, so shorter abbreviations go to earlier ones. */
+static const cmd_entry cmd_table[] = {
+    {"delete",     1, CMD_RANGE | CMD_REGISTER | CMD_COUNT, cmd_delete},
+    {"yank",       1, CMD_RANGE | CMD_REGISTER | CMD_COUNT, cmd_yank},
+    {"move",       1, CMD_RANGE | CMD_DEST, cmd_move},
+    {"t",          1, CMD_RANGE | CMD_DEST, cmd_copy},
+    {"copy",       2, CMD_RANGE | CMD_DEST, cmd_copy},
+    {">",          1, CMD_RANGE | CMD_COUNT, cmd_shift_right},
+    {"<",          1, CMD_RANGE | CMD_COUNT, cmd_shift_left},
+    {"normal",     4, CMD_RANGE | CMD_BANG | CMD_ARGS, cmd_normal},
+    {"substitute", 1, CMD_RANGE | CMD_ARGS, cmd_substitute},
+    {"global",     1, CMD_RANGE | CMD_WHOLE | CMD_BANG | CMD_ARGS, cmd_global},
+    {"vglobal",    1, CMD_RANGE | CMD_WHOLE | CMD_ARGS, cmd_vglobal},
+    {"registers",  3, 0, cmd_registers},
+    {"grep",       2, CMD_ARGS, cmd_grep},
+    {"cnext",      2, 0, cmd_cnext},
+    {"cprevious",  2, 0, cmd_cprevious},
+    {"tag",        2, CMD_ARGS, cmd_tag},
+    {"index",      3, 0, cmd_index},
+    {"lsp",        3, CMD_ARGS, cmd_lsp},
+    {"mem",        3, CMD_ARGS, cmd_mem},
+    {"nohlsearch", 3, 0, cmd_nohlsearch},
+    {"quit",       1, CMD_BANG, cmd_quit},
+    {"write",      1, CMD_BANG, cmd_write},
+    {"wq",         2, CMD_BANG, cmd_write_quit},
+};
+
+/*
+ * The name at `*i`: a run of letters, or of one of the other characters
+ * a command can be named with, which sets `repeat` to its length.
+ */
+static const cmd_entry *
+cmd_find(arena *cmd, u64 *i, u64 *repeat)
+{
+    u64 start = *i;
+    u64 len;
+    u64 k;
+
+    if (*i < cmd->cur_pos && isalpha(cmd->data[*i]))
+    {
+        while (*i < cmd->cur_pos && isalpha(cmd->data[*i]))
+        {
+            (*i)++;
         }
+    }
+    else
+    {
+        while (*i < cmd->cur_pos && cmd->data[*i] == cmd->data[start])
+        {
+            (*i)++;
+        }
+    }
 
-        result = write_file(editor_active_buffer(), force);
+    len = *i - start;
+    *repeat = len;
+    for (k = 0; len > 0 && k < sizeof(cmd_table) / sizeof(cmd_table[0]); k++)
+    {
+        const cmd_entry *e = &cmd_table[k];
 
-        if (result.status == WRITE_FILE_OK)
+        if (!isalpha(cmd->data[start]))
         {
-            set_write_status_message(result);
-            if (quit_after_save)
+            if (e->name[0] == cmd->data[start] && e->name[1] == '\0')
             {
-                cmd->cur_pos = 0;
-                E.mode = EDITOR_NORMAL_MODE;
-                E.running = FALSE;
-                return;
+                return e;
             }
+            continue;
         }
-        else if (result.status == WRITE_FILE_NO_PATH)
+
+        if (len >= e->min_len && len <= strlen(e->name) &&
+            memcmp(e->name, cmd->data + start, (size_t)len) == 0)
         {
-            editor_set_cmd_status_message((u8*)"No file name");
+            return e;
         }
-        else if (result.status == WRITE_FILE_NEEDS_CONFIRMATION)
+    }
+
+    return NULL;
+}
+
+/*
+ * An ex command line: a range, a name looked up in cmd_table, then what
+ * the entry's flags say it takes, in the order bang, register, count or
+ * destination, arguments. Addresses are resolved through the line index
+ * once, so a range command runs as one edit whatever its size.
+ */
+static void
+cmd_run(arena *cmd)
+{
+    buffer *b = editor_active_buffer();
+    u64 lines = buffer_last_line(b) + 1;
+    const cmd_entry *e;
+    cmd_args a = {0};
+    u64 first;
+    u64 last;
+    u64 t;
+    u64 i = 1;
+    int range;
+
+    cmd_skip_blanks(cmd, &i);
+    range = cmd_parse_range(cmd, &i, &first, &last);
+    if (range < 0)
+    {
+        return;
+    }
+    cmd_skip_blanks(cmd, &i);
+
+    if (i == cmd->cur_pos)
+    {
+        if (range > 0)
+        {
+            editor_goto_line(last > 0 ? (last <= lines ? last - 1 : lines - 1) : 0);
+        }
+        return;
+    }
+
+    e = cmd_find(cmd, &i, &a.repeat);
+    if (e == NULL)
+    {
+        editor_set_cmd_status_message((u8*)"Unknown command");
+        return;
+    }
+
+    if (range > 0 && !(e->flags & CMD_RANGE))
+    {
+        editor_set_cmd_status_message((u8*)"No range allowed");
+        return;
+    }
+
+    if (first > last)
+    {
+        t = first;
+        first = last;
+        last = t;
+    }
+
+    if (range == 0 && (e->flags & CMD_WHOLE))
+    {
+        first = 1;
+        last = lines;
+    }
+
+    a.first_line = first > 0 ? (first <= lines ? first - 1 : lines - 1) : 0;
+    a.last_line = last > 0 ? (last <= lines ? last - 1 : lines - 1) : 0;
+
+    if ((e->flags & CMD_BANG) && i < cmd->cur_pos && cmd->data[i] == '!')
+    {
+        a.bang = 1;
+        i++;
+    }
+    cmd_skip_blanks(cmd, &i);
+
+    if ((e->flags & CMD_REGISTER) && i < cmd->cur_pos && !isdigit(cmd->data[i]) &&
+        registers_valid_name(cmd->data[i]) &&
+        (i + 1 == cmd->cur_pos || cmd->data[i + 1] == ' ' || cmd->data[i + 1] == '\t'))
+    {
+        a.register_name = cmd->data[i++];
+        cmd_skip_blanks(cmd, &i);
+    }
+
+    if ((e->flags & CMD_COUNT) && i < cmd->cur_pos && isdigit(cmd->data[i]))
+    {
+        u64 count = cmd_parse_number(cmd, &i);
+
+        if (count == 0)
         {
-            editor_set_cmd_status_message((u8*)"File changed on disk. Use :w! to overwrite");
+            editor_set_cmd_status_message((u8*)"Positive count required");
+            return;
+        }
+
+        a.first_line = a.last_line;
+        a.last_line = count - 1 < lines - a.first_line ? a.first_line + count - 1 : lines - 1;
+        cmd_skip_blanks(cmd, &i);
+    }
+
+    if (e->flags & CMD_DEST)
+    {
+        int dest = cmd_parse_address(cmd, &i, E.views[E.active_view].cursor.y + 1, &a.dest);
+
+        if (dest == 0)
+        {
+            editor_set_cmd_status_message((u8*)"Invalid address");
         }
-        else
+        if (dest <= 0)
         {
-            editor_set_cmd_status_message((u8*)"Unable to write file");
+            return;
         }
+        cmd_skip_blanks(cmd, &i);
     }
-    else
+
+    if (e->flags & CMD_ARGS)
     {
-        editor_set_cmd_status_message((u8*)"Unknown command");
+        a.args = (string){.s = cmd->data + i, .len = cmd->cur_pos - i};
+    }
+    else if (i != cmd->cur_pos)
+    {
+        editor_set_cmd_status_message((u8*)"Trailing characters");
+        return;
+    }
+
+    e->fn(&a);
+}
+
+void cmd_process(arena *cmd)
+{
+    if (cmd == NULL || cmd->data == NULL)
+    {
+        return;
+    }
+
+    if (cmd->cur_pos == 0)
+    {
+        return;
     }
 
+    /* enter with only colon */
+    if (cmd->cur_pos == 1 && cmd->data[0] == ':')
+    {
+        cmd->cur_pos = 0;
+        E.mode = EDITOR_NORMAL_MODE;
+        return;
+    }
+
+    cmd_run(cmd);
+
     cmd->cur_pos = 0;
     E.mode = EDITOR_NORMAL_MODE;
 }
@@ -2,6 +2,7 @@
 #define COMMAND_H
 
 #include "base.h"
+#include "arena.h"
 
 void cmd_process(arena *cmd);
 #endif
@@ -6,6 +6,13 @@
 #include "term.h"
 #include "funcs.h"
 #include "view.h"
+#include "search.h"
+#include "subst.h"
+#include "global.h"
+#include "mem.h"
+
+#include <ctype.h>
+#include <poll.h>
 
 static u64
 editor_cursor_offset(view *v, buffer *b)
@@ -30,25 +37,81 @@ editor_clamp_cursor_x(view *v, buffer *b)
     }
 }
 
+/* Leaves E.register_name set for the operator about to run. */
 static void
-editor_clear_pending_op(void)
+editor_clear_pending_op_keep_register(void)
 {
     E.mode = EDITOR_NORMAL_MODE;
     E.pending_op = 0;
-    E.pending_op_stage = 0;
+    E.pending_keys_len = 0;
 }
 
 static void
-editor_free_register_one(void)
+editor_clear_pending_op(void)
+{
+    E.mode = EDITOR_NORMAL_MODE;
+    E.pending_op = 0;
+    E.pending_keys_len = 0;
+    E.pending_replace = 0;
+    E.register_name = 0;
+    E.count = 0;
+    E.op_count = 0;
+}
+
+/* Whether :grep found more or finished since it was last drawn. */
+static int
+editor_grep_changed(void)
 {
-    if (E.register_one == NULL)
+    u64 count = grep_hit_count(&E.grep);
+    u8 running = (u8)grep_running(&E.grep);
+    int changed = count != E.grep_drawn || running != E.grep_drawn_running;
+
+    if (E.grep.started && !running)
     {
-        return;
+        grep_wait(&E.grep);
+    }
+
+    E.grep_drawn = count;
+    E.grep_drawn_running = running;
+    return changed;
+}
+
+/* Whether the finder has new paths to rank since it was last drawn. */
+static int
+editor_finder_changed(void)
+{
+    return E.mode == EDITOR_FINDER_MODE && fuzzy_update(&E.finder, &E.paths);
+}
+
+/* Moves the language server traffic along and shows what it sent back. */
+static int
+editor_lsp_changed(void)
+{
+    char message[sizeof(E.status_message)];
+    u64 len;
+
+    if (!lsp_pump(&E.lsp))
+    {
+        return 0;
+    }
+
+    if (E.lsp.hover_ready)
+    {
+        E.lsp.hover_ready = 0;
+        for (len = 0; len < E.lsp.hover_len && E.lsp.hover[len] != '\n'; len++)
+        {
+        }
+
+        snprintf(message, sizeof(message), "%.*s", (int)len, (char *)E.lsp.hover);
+        editor_set_cmd_status_message((u8 *)(len > 0 ? message : "No hover information"));
+    }
+    else if (E.lsp.message[0] != '\0')
+    {
+        editor_set_cmd_status_message((u8 *)E.lsp.message);
+        E.lsp.message[0] = '\0';
     }
 
-    free(E.register_one->s);
-    free(E.register_one);
-    E.register_one = NULL;
+    return 1;
 }
 
 u64
@@ -56,7 +119,41 @@ editor_read_key(int fd)
 {
     int nread;
     char c, seq[3];
-    while ((nread = read(fd,&c,1)) == 0);
+    struct pollfd pending = {.fd = fd, .events = POLLIN};
+
+    for (;;)
+    {
+        int worked = editor_grep_changed() | editor_finder_changed() | editor_lsp_changed();
+
+        /* background scans run in slices until a key is waiting */
+        while (poll(&pending, 1, 0) == 0 && editor_background_work())
+        {
+            worked = 1;
+        }
+
+        if (worked)
+        {
+            editor_draw();
+        }
+
+        /* with a server running, its pipes wake the loop as well as a key does */
+        if (E.lsp.running)
+        {
+            struct pollfd fds[3];
+
+            fds[0] = pending;
+            if (poll(fds, (nfds_t)(1 + lsp_poll_fds(&E.lsp, fds + 1)), 100) <= 0 ||
+                !(fds[0].revents & POLLIN))
+            {
+                continue;
+            }
+        }
+
+        if ((nread = read(fd,&c,1)) != 0)
+        {
+            break;
+        }
+    }
     if (nread == -1) exit(1);
 
     while(1) {
@@ -144,188 +241,128 @@ editor_is_blank_char(u8 c)
     return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
-static int
-editor_is_keyword_char(u8 c)
-{
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           (c >= '0' && c <= '9') ||
-           c == '_';
-}
-
 typedef enum {
     EDITOR_WORD_BLANK = 0,
     EDITOR_WORD_KEYWORD,
     EDITOR_WORD_OTHER,
 } editor_word_class;
 
+/* the enum follows the SEARCH_CLASS_ values, so the table answers directly */
 static editor_word_class
 editor_classify_char(u8 c)
 {
-    if (editor_is_blank_char(c))
-    {
-        return EDITOR_WORD_BLANK;
-    }
-
-    if (editor_is_keyword_char(c))
-    {
-        return EDITOR_WORD_KEYWORD;
-    }
-
-    return EDITOR_WORD_OTHER;
+    return (editor_word_class)search_word_class[c];
 }
 
 static u64
-editor_skip_word_forward(buffer *b, u64 offset)
+editor_skip_word_forward(buffer *b, u64 offset, u64 count)
 {
     u64 limit = b->total_len;
     editor_word_class class;
+    buffer_reader r;
 
-    if (offset >= limit)
-    {
-        return limit;
-    }
+    buffer_reader_init(&r, b);
 
-    if (editor_classify_char(buffer_byte_at(b, offset)) != EDITOR_WORD_BLANK)
+    while (count > 0 && offset < limit)
     {
-        class = editor_classify_char(buffer_byte_at(b, offset));
-        while (offset < limit && editor_classify_char(buffer_byte_at(b, offset)) == class)
+        class = editor_classify_char(buffer_reader_byte(&r, offset));
+        if (class != EDITOR_WORD_BLANK)
+        {
+            while (offset < limit &&
+                   editor_classify_char(buffer_reader_byte(&r, offset)) == class)
+            {
+                offset++;
+            }
+        }
+
+        while (offset < limit && editor_is_blank_char(buffer_reader_byte(&r, offset)))
         {
             offset++;
         }
-    }
 
-    while (offset < limit && editor_is_blank_char(buffer_byte_at(b, offset)))
-    {
-        offset++;
+        count--;
     }
 
     return offset;
 }
 
 static u64
-editor_skip_word_backward(buffer *b, u64 offset)
+editor_skip_word_backward(buffer *b, u64 offset, u64 count)
 {
     editor_word_class class;
+    buffer_reader r;
 
-    if (b->total_len == 0 || offset == 0)
+    if (b->total_len == 0)
     {
         return 0;
     }
 
-    if (offset >= b->total_len)
+    if (offset > b->total_len)
     {
-        offset = b->total_len - 1;
+        offset = b->total_len;
     }
 
-    if (editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
+    buffer_reader_init(&r, b);
+
+    while (count > 0 && offset > 0)
     {
-        while (offset > 0 && editor_is_blank_char(buffer_byte_at(b, offset)))
+        offset--;
+
+        while (offset > 0 && editor_is_blank_char(buffer_reader_byte(&r, offset)))
         {
             offset--;
         }
 
-        if (editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
+        class = editor_classify_char(buffer_reader_byte(&r, offset));
+        if (class == EDITOR_WORD_BLANK)
         {
             return 0;
         }
-    }
 
-    class = editor_classify_char(buffer_byte_at(b, offset));
-
-    if (offset > 0 && editor_classify_char(buffer_byte_at(b, offset - 1)) == class)
-    {
-        while (offset > 0 && editor_classify_char(buffer_byte_at(b, offset - 1)) == class)
+        while (offset > 0 &&
+               editor_classify_char(buffer_reader_byte(&r, offset - 1)) == class)
         {
             offset--;
         }
-        return offset;
-    }
-
-    if (offset == 0)
-    {
-        return 0;
-    }
-
-    offset--;
-
-    while (offset > 0 && editor_is_blank_char(buffer_byte_at(b, offset)))
-    {
-        offset--;
-    }
-
-    if (editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
-    {
-        return 0;
-    }
 
-    class = editor_classify_char(buffer_byte_at(b, offset));
-
-    while (offset > 0 && editor_classify_char(buffer_byte_at(b, offset - 1)) == class)
-    {
-        offset--;
+        count--;
     }
 
     return offset;
 }
 
 static u64
-editor_skip_word_end(buffer *b, u64 offset)
+editor_skip_word_end(buffer *b, u64 offset, u64 count)
 {
     u64 limit = b->total_len;
     editor_word_class class;
+    buffer_reader r;
 
     if (limit == 0)
     {
         return 0;
     }
 
-    if (offset >= limit)
-    {
-        offset = limit - 1;
-    }
+    buffer_reader_init(&r, b);
 
-    if (editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
+    while (count > 0 && offset + 1 < limit)
     {
-        while (offset < limit && editor_is_blank_char(buffer_byte_at(b, offset)))
-        {
-            offset++;
-        }
+        offset++;
 
-        if (offset >= limit)
+        while (offset + 1 < limit && editor_is_blank_char(buffer_reader_byte(&r, offset)))
         {
-            return limit;
+            offset++;
         }
-    }
-
-    class = editor_classify_char(buffer_byte_at(b, offset));
-
-    while (offset + 1 < limit &&
-           editor_classify_char(buffer_byte_at(b, offset + 1)) == class)
-    {
-        offset++;
-    }
 
-    if (offset + 1 < limit)
-    {
-        u64 next = offset + 1;
+        class = editor_classify_char(buffer_reader_byte(&r, offset));
 
-        while (next < limit && editor_is_blank_char(buffer_byte_at(b, next)))
+        while (offset + 1 < limit &&
+               editor_classify_char(buffer_reader_byte(&r, offset + 1)) == class)
         {
-            next++;
+            offset++;
         }
 
-        if (next < limit)
-        {
-            while (next + 1 < limit &&
-                   editor_classify_char(buffer_byte_at(b, next + 1)) ==
-                   editor_classify_char(buffer_byte_at(b, next)))
-            {
-                next++;
-            }
-
-            return next;
-        }
+        count--;
     }
 
     return offset;
@@ -334,6 +371,9 @@ editor_skip_word_end(buffer *b, u64 offset)
 typedef struct {
     u64 start;
     u64 end;
+    u8 linewise;
+    /* the motion found no target, an operator leaves the text alone */
+    u8 failed;
 } editor_range;
 
 static editor_range
@@ -341,6 +381,7 @@ editor_inner_word_range(buffer *b, u64 offset)
 {
     editor_range range = {0};
     editor_word_class class;
+    buffer_reader r;
 
     if (b->total_len == 0)
     {
@@ -352,10 +393,12 @@ editor_inner_word_range(buffer *b, u64 offset)
         offset = b->total_len - 1;
     }
 
-    if (editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
+    buffer_reader_init(&r, b);
+
+    if (editor_classify_char(buffer_reader_byte(&r, offset)) == EDITOR_WORD_BLANK)
     {
         while (offset < b->total_len &&
-               editor_classify_char(buffer_byte_at(b, offset)) == EDITOR_WORD_BLANK)
+               editor_classify_char(buffer_reader_byte(&r, offset)) == EDITOR_WORD_BLANK)
         {
             offset++;
         }
@@ -366,18 +409,18 @@ editor_inner_word_range(buffer *b, u64 offset)
         }
     }
 
-    class = editor_classify_char(buffer_byte_at(b, offset));
+    class = editor_classify_char(buffer_reader_byte(&r, offset));
     range.start = offset;
     range.end = offset + 1;
 
     while (range.start > 0 &&
-           editor_classify_char(buffer_byte_at(b, range.start - 1)) == class)
+           editor_classify_char(buffer_reader_byte(&r, range.start - 1)) == class)
     {
         range.start--;
     }
 
     while (range.end < b->total_len &&
-           editor_classify_char(buffer_byte_at(b, range.end)) == class)
+           editor_classify_char(buffer_reader_byte(&r, range.end)) == class)
     {
         range.end++;
     }
@@ -385,127 +428,3223 @@ editor_inner_word_range(buffer *b, u64 offset)
     return range;
 }
 
-void
-editor_move_cursor(u64 key)
+static void
+editor_put(view *v, buffer *b, int before, u64 count)
 {
-    view *v = &E.views[E.active_view];
-    buffer *b = &E.buffers[v->buffer_id];
+    u8 name = E.register_name;
+    register_slot *slot = registers_get(&E.regs, name);
+    string nl = {.s = (u8*)"\n", .len = 1};
+    u64 insert_off;
+    u64 len;
+    u64 i;
 
-    switch (key) {
-        case KEY_J:
-            if (v->cursor.y + 1 < b->lines.count)
-            {
-                v->cursor.y++;
-                editor_clamp_cursor_x(v, b);
-            }
-            view_scroll_to_cursor(v);
-            break;
-        case KEY_K:
-            if (v->cursor.y > 0)
-            {
-                v->cursor.y--;
-                editor_clamp_cursor_x(v, b);
-            }
-            view_scroll_to_cursor(v);
-            break;
-        case KEY_L:
+    E.register_name = 0;
+
+    if (slot == NULL || !slot->in_use || slot->len == 0)
+    {
+        return;
+    }
+
+    if (slot->kind == REGISTER_LINEWISE)
+    {
+        u64 line = v->cursor.y;
+
+        if (before)
+        {
+            insert_off = buffer_line_start(b, line);
+        }
+        else if (line + 1 < b->lines.count)
+        {
+            insert_off = buffer_line_start(b, line + 1);
+        }
+        else
+        {
+            insert_off = b->total_len;
+            buffer_insert(b, insert_off, nl);
+            insert_off++;
+        }
+
+        /* every copy goes in at the same offset, ahead of the last one */
+        for (i = 0; i < count; i++)
+        {
+            len = registers_put(&E.regs, name, b, insert_off);
+
+            /* a line yanked from the end of the file has no newline of its own */
+            if (insert_off + len < b->total_len &&
+                buffer_byte_at(b, insert_off + len - 1) != '\n')
             {
-                u64 line_len = buffer_line_len(b, v->cursor.y);
-                if (v->cursor.x < line_len - 1)
-                {
-                    v->cursor.x++;
-                }
-                break;
+                buffer_insert(b, insert_off + len, nl);
             }
-        case KEY_H:
-            if (v->cursor.x > 0) v->cursor.x--;
-            break;
+        }
+
+        view_set_cursor_from_offset(v, b, insert_off);
+        view_scroll_to_cursor(v);
+        return;
+    }
+
+    if (slot->kind == REGISTER_BLOCKWISE)
+    {
+        string text;
+        u64 col = v->cursor.x;
+
+        if (!before && buffer_line_len(b, v->cursor.y) > 0)
+        {
+            col++;
+        }
+
+        registers_materialize(&E.regs, slot, &text);
+        for (i = 0; i < count; i++)
+        {
+            put_block(b, v->cursor.y, col, text);
+        }
+        free(text.s);
+
+        v->cursor.x = col;
+        editor_clamp_cursor_x(v, b);
+        view_scroll_to_cursor(v);
+        return;
+    }
+
+    insert_off = editor_cursor_offset(v, b);
+    if (!before && buffer_line_len(b, v->cursor.y) > 0)
+    {
+        insert_off++;
     }
+
+    len = 0;
+    for (i = 0; i < count; i++)
+    {
+        len += registers_put(&E.regs, name, b, insert_off);
+    }
+
+    view_set_cursor_from_offset(v, b, insert_off + len - 1);
+    view_scroll_to_cursor(v);
 }
 
-void
-editor_process_keypress(int c)
+/* Counts past this are clamped, nothing in a buffer needs more. */
+#define EDITOR_MAX_COUNT 999999999ULL
+
+static u64
+editor_take_count(void)
 {
-    view *v = &E.views[E.active_view];
-    buffer *b = &E.buffers[v->buffer_id];
+    u64 count = E.count ? E.count : 1;
 
-    if (E.mode == EDITOR_NORMAL_MODE)
+    if (E.op_count)
     {
-        switch(c) {
-        case 'A':
-            {
-                u64 offset = insert_at_end_of_line(b, v->cursor.y);
-                view_set_cursor_from_offset(v, b, offset);
-                break;
-            }
-        case 'a':
-            {
-                view_set_cursor_from_offset(v, b, v->cursor.x + 1);
-                E.mode = EDITOR_INSERT_MODE;
-                break;
-            }
-        case 'b':
-            {
-                u64 offset = editor_cursor_offset(v, b);
-                offset = editor_skip_word_backward(b, offset);
-                view_set_cursor_from_offset(v, b, offset);
-                view_scroll_to_cursor(v);
-                break;
-            }
-        case 'J':
-            {
-                u64 line = v->cursor.y;
-                u64 prev_cursor = editor_cursor_offset(v, b);
+        count *= E.op_count;
+    }
 
-                join_lines(b, line);
+    E.count = 0;
+    E.op_count = 0;
+    return count;
+}
 
-                view_set_cursor_from_offset(v, b, prev_cursor);
-                view_scroll_to_cursor(v);
-                break;
-            }
-        case 'j':
-        case 'k':
-        case 'h':
-        case 'l':
-            {
-                editor_move_cursor(c);
-                break;
-            }
-        case 'u':
-            {
-                /* undo */
-                break;
-            }
-        case 'V':
-            {
-                /*visual line select*/
-                break;
-            }
-        case ':':
-            {
-                E.mode = EDITOR_COMMAND_MODE;
-                u8 *colon = (u8*)":";
-                arena_push_array(&E.cmd, colon, 1);
-                break;
-            }
-        case 'w':
-            {
-                u64 offset = editor_cursor_offset(v, b);
-                offset = editor_skip_word_forward(b, offset);
-                view_set_cursor_from_offset(v, b, offset);
-                view_scroll_to_cursor(v);
-                break;
-            }
-        case 'e':
-            {
-                u64 offset = editor_cursor_offset(v, b);
+static int
+editor_accumulate_count(int c)
+{
+    if ((c >= '1' && c <= '9') || (c == '0' && E.count > 0))
+    {
+        E.count = E.count * 10 + (u64)(c - '0');
+        if (E.count > EDITOR_MAX_COUNT)
+        {
+            E.count = EDITOR_MAX_COUNT;
+        }
+        return 1;
+    }
 
-                offset = editor_skip_word_end(b, offset);
-                view_set_cursor_from_offset(v, b, offset);
-                view_scroll_to_cursor(v);
-                break;
-            }
-        case 'i':
+    return 0;
+}
+
+/* Start of the line `count - 1` lines below `line`, or the end of the buffer. */
+static u64
+editor_lines_end(buffer *b, u64 line, u64 count)
+{
+    if (count >= b->lines.count - line)
+    {
+        return b->total_len;
+    }
+
+    return buffer_line_start(b, line + count);
+}
+
+typedef enum {
+    EDITOR_MOTION_EXCLUSIVE,
+    EDITOR_MOTION_INCLUSIVE,
+    EDITOR_MOTION_LINEWISE,
+    EDITOR_MOTION_OBJECT,
+} editor_motion_kind;
+
+/*
+ * Motions return {start = offset, end = target}; text objects return the
+ * range they cover. `count` is 0 when none was typed.
+ */
+typedef editor_range (*editor_motion_fn)(buffer *b, u64 offset, u64 count);
+
+typedef struct {
+    const char *keys;
+    editor_motion_kind kind;
+    editor_motion_fn fn;
+} editor_motion;
+
+typedef void (*editor_operator_fn)(view *v, buffer *b, editor_range range);
+
+typedef struct {
+    const char *keys;
+    editor_operator_fn fn;
+    u8 linewise;
+} editor_operator;
+
+typedef enum {
+    EDITOR_KEYS_NONE,
+    EDITOR_KEYS_PREFIX,
+    EDITOR_KEYS_EXACT,
+} editor_keys_match;
+
+static editor_range
+editor_motion_left(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    editor_range r = {.start = offset, .end = offset};
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    count = count ? count : 1;
+    r.end = offset - (count > col ? col : count);
+    return r;
+}
+
+static editor_range
+editor_motion_right(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    u64 room;
+    editor_range r = {.start = offset, .end = offset};
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    room = buffer_line_len(b, line) - col;
+    count = count ? count : 1;
+    r.end = offset + (count > room ? room : count);
+    return r;
+}
+
+static editor_range
+editor_motion_down(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    editor_range r = {.start = offset, .end = offset};
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    count = count ? count : 1;
+    if (count > b->lines.count - 1 - line)
+    {
+        count = b->lines.count - 1 - line;
+    }
+
+    r.end = buffer_line_col_to_offset(b, line + count, col);
+    return r;
+}
+
+static editor_range
+editor_motion_up(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    editor_range r = {.start = offset, .end = offset};
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    count = count ? count : 1;
+    if (count > line)
+    {
+        count = line;
+    }
+
+    r.end = buffer_line_col_to_offset(b, line - count, col);
+    return r;
+}
+
+static editor_range
+editor_motion_word_forward(buffer *b, u64 offset, u64 count)
+{
+    editor_range r = {.start = offset};
+
+    r.end = editor_skip_word_forward(b, offset, count ? count : 1);
+    return r;
+}
+
+static editor_range
+editor_motion_word_backward(buffer *b, u64 offset, u64 count)
+{
+    editor_range r = {.start = offset};
+
+    r.end = editor_skip_word_backward(b, offset, count ? count : 1);
+    return r;
+}
+
+static editor_range
+editor_motion_word_end(buffer *b, u64 offset, u64 count)
+{
+    editor_range r = {.start = offset};
+
+    r.end = editor_skip_word_end(b, offset, count ? count : 1);
+    return r;
+}
+
+static editor_range
+editor_motion_line_start(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    editor_range r = {.start = offset};
+
+    /* 0 is never a count, it only gets here as a motion */
+    (void)count;
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    r.end = buffer_line_start(b, line);
+    return r;
+}
+
+static editor_range
+editor_motion_first_nonblank(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    editor_range r = {.start = offset};
+
+    /* as in vi, 3^ is ^ */
+    (void)count;
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    r.end = editor_line_first_nonblank_offset(b, line);
+    return r;
+}
+
+static editor_range
+editor_motion_line_end(buffer *b, u64 offset, u64 count)
+{
+    u64 line;
+    u64 col;
+    u64 len;
+    editor_range r = {.start = offset};
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    count = count ? count : 1;
+    if (count - 1 > b->lines.count - 1 - line)
+    {
+        count = b->lines.count - line;
+    }
+
+    line += count - 1;
+    len = buffer_line_len(b, line);
+    r.end = buffer_line_start(b, line) + (len ? len - 1 : 0);
+    return r;
+}
+
+static editor_range
+editor_motion_goto_line(buffer *b, u64 offset, u64 count)
+{
+    u64 line = count ? count - 1 : b->lines.count - 1;
+    editor_range r = {.start = offset};
+
+    if (line >= b->lines.count)
+    {
+        line = b->lines.count - 1;
+    }
+
+    r.end = editor_line_first_nonblank_offset(b, line);
+    return r;
+}
+
+static editor_range
+editor_motion_goto_first_line(buffer *b, u64 offset, u64 count)
+{
+    return editor_motion_goto_line(b, offset, count ? count : 1);
+}
+
+/* 3iw, 3aw: the next words are taken from where the last one ended. */
+static editor_range
+editor_object_inner_word(buffer *b, u64 offset, u64 count)
+{
+    editor_range r = editor_inner_word_range(b, offset);
+    u64 i;
+
+    for (i = 1; i < count; i++)
+    {
+        editor_range next = editor_inner_word_range(b, r.end);
+
+        if (next.end <= r.end)
+        {
+            break;
+        }
+        r.end = next.end;
+    }
+
+    return r;
+}
+
+/* The word plus its trailing blanks, or its leading blanks at end of line. */
+static editor_range
+editor_a_word_range(buffer *b, u64 offset)
+{
+    editor_range r = editor_inner_word_range(b, offset);
+    buffer_reader reader;
+    u64 end = r.end;
+
+    buffer_reader_init(&reader, b);
+
+    while (end < b->total_len)
+    {
+        u8 c = buffer_reader_byte(&reader, end);
+
+        if (c != ' ' && c != '\t')
+        {
+            break;
+        }
+        end++;
+    }
+
+    if (end > r.end)
+    {
+        r.end = end;
+        return r;
+    }
+
+    while (r.start > 0)
+    {
+        u8 c = buffer_reader_byte(&reader, r.start - 1);
+
+        if (c != ' ' && c != '\t')
+        {
+            break;
+        }
+        r.start--;
+    }
+
+    return r;
+}
+
+static editor_range
+editor_object_a_word(buffer *b, u64 offset, u64 count)
+{
+    editor_range r = editor_a_word_range(b, offset);
+    u64 i;
+
+    for (i = 1; i < count; i++)
+    {
+        editor_range next = editor_a_word_range(b, r.end);
+
+        if (next.end <= r.end)
+        {
+            break;
+        }
+        r.end = next.end;
+    }
+
+    return r;
+}
+
+static bracket_index *
+editor_brackets(buffer *b)
+{
+    return &E.brackets[b - E.buffers];
+}
+
+/* %, from the bracket under or after the cursor on its line to its partner. */
+static editor_range
+editor_motion_match_pair(buffer *b, u64 offset, u64 count)
+{
+    bracket_index *bi = editor_brackets(b);
+    editor_range r = {.start = offset, .end = offset, .failed = 1};
+    u64 line;
+    u64 col;
+    u64 at;
+
+    /* {count}%, a percentage of the file in vi, is not taken here */
+    (void)count;
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    if (bracket_index_next(bi, offset, buffer_line_start(b, line) + buffer_line_len(b, line), &at) &&
+        bracket_index_match(bi, at, &r.end))
+    {
+        r.failed = 0;
+    }
+
+    return r;
+}
+
+/* The `count`th pair of `open` around the cursor, with the brackets when `around`. */
+static editor_range
+editor_object_pair(buffer *b, u64 offset, u64 count, u8 open, int around)
+{
+    editor_range r = {.start = offset, .end = offset, .failed = 1};
+    u64 start;
+    u64 end;
+
+    if (bracket_index_enclosing(editor_brackets(b), offset, open, count ? count : 1, &start, &end))
+    {
+        r.start = around ? start : start + 1;
+        r.end = around ? end + 1 : end;
+        r.failed = 0;
+    }
+
+    return r;
+}
+
+static editor_range
+editor_object_inner_paren(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '(', 0);
+}
+
+static editor_range
+editor_object_a_paren(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '(', 1);
+}
+
+static editor_range
+editor_object_inner_bracket(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '[', 0);
+}
+
+static editor_range
+editor_object_a_bracket(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '[', 1);
+}
+
+static editor_range
+editor_object_inner_brace(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '{', 0);
+}
+
+static editor_range
+editor_object_a_brace(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_pair(b, offset, count, '{', 1);
+}
+
+static line_class_index *
+editor_line_classes(buffer *b)
+{
+    return &E.line_classes[b - E.buffers];
+}
+
+/*
+ * }, to the empty line ending the `count`th paragraph from the cursor, or
+ * the end of the buffer. Runs of empty lines count as one.
+ */
+static editor_range
+editor_motion_paragraph_forward(buffer *b, u64 offset, u64 count)
+{
+    line_class_index *lc = editor_line_classes(b);
+    u64 lines = line_class_count(lc);
+    editor_range r = {.start = offset, .end = b->total_len};
+    u64 line;
+    u64 col;
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    for (count = count ? count : 1; count > 0 && line < lines; count--)
+    {
+        line = line_class_next(lc, 0, line_class_next(lc, 0, line, 0), 1);
+    }
+
+    if (line < lines)
+    {
+        r.end = buffer_line_start(b, line);
+    }
+    return r;
+}
+
+/* {, the same backward, to the start of the buffer when there is no empty line. */
+static editor_range
+editor_motion_paragraph_backward(buffer *b, u64 offset, u64 count)
+{
+    line_class_index *lc = editor_line_classes(b);
+    u64 lines = line_class_count(lc);
+    editor_range r = {.start = offset};
+    u64 line;
+    u64 col;
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    for (count = count ? count : 1; count > 0 && line < lines; count--)
+    {
+        u64 text = line_class_prev(lc, 0, line, 0);
+
+        line = text < lines && text > 0 ? line_class_prev(lc, 0, text - 1, 1) : lines;
+    }
+
+    if (line < lines)
+    {
+        r.end = buffer_line_start(b, line);
+    }
+    return r;
+}
+
+/* Last line of the run of blank or non-blank lines holding `line`. */
+static u64
+editor_paragraph_run_end(line_class_index *lc, u64 line)
+{
+    return line_class_next(lc, 1, line, !line_class_is_blank(lc, line)) - 1;
+}
+
+static u64
+editor_paragraph_run_start(line_class_index *lc, u64 line)
+{
+    u64 prev = line_class_prev(lc, 1, line, !line_class_is_blank(lc, line));
+
+    return prev < line_class_count(lc) ? prev + 1 : 0;
+}
+
+/*
+ * ip is the run of blank or non-blank lines under the cursor, each count
+ * adding the next run. ap takes a paragraph with the blank lines after it,
+ * or before it when it ends the buffer.
+ */
+static editor_range
+editor_object_paragraph(buffer *b, u64 offset, u64 count, int around)
+{
+    line_class_index *lc = editor_line_classes(b);
+    u64 lines = buffer_last_line(b) + 1;
+    editor_range r = {.start = offset, .end = offset, .linewise = 1};
+    u64 first;
+    u64 last;
+    u64 col;
+    u64 runs;
+
+    buffer_offset_to_line_col(b, offset, &first, &col);
+    if (first >= lines)
+    {
+        r.failed = 1;
+        return r;
+    }
+
+    last = editor_paragraph_run_end(lc, first);
+    first = editor_paragraph_run_start(lc, first);
+    runs = (count ? count : 1) * (around ? 2 : 1) - 1;
+
+    for (; runs > 0 && last + 1 < lines; runs--)
+    {
+        last = editor_paragraph_run_end(lc, last + 1);
+    }
+
+    if (last >= lines)
+    {
+        last = lines - 1;
+    }
+
+    if (around && runs > 0 && !line_class_is_blank(lc, last) && first > 0)
+    {
+        first = editor_paragraph_run_start(lc, first - 1);
+    }
+
+    r.start = buffer_line_start(b, first);
+    r.end = editor_lines_end(b, first, last - first + 1);
+    return r;
+}
+
+static editor_range
+editor_object_inner_paragraph(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_paragraph(b, offset, count, 0);
+}
+
+static editor_range
+editor_object_a_paragraph(buffer *b, u64 offset, u64 count)
+{
+    return editor_object_paragraph(b, offset, count, 1);
+}
+
+static const editor_motion editor_motions[] = {
+    {"h",  EDITOR_MOTION_EXCLUSIVE, editor_motion_left},
+    {"l",  EDITOR_MOTION_EXCLUSIVE, editor_motion_right},
+    {"j",  EDITOR_MOTION_LINEWISE,  editor_motion_down},
+    {"k",  EDITOR_MOTION_LINEWISE,  editor_motion_up},
+    {"w",  EDITOR_MOTION_EXCLUSIVE, editor_motion_word_forward},
+    {"b",  EDITOR_MOTION_EXCLUSIVE, editor_motion_word_backward},
+    {"e",  EDITOR_MOTION_INCLUSIVE, editor_motion_word_end},
+    {"0",  EDITOR_MOTION_EXCLUSIVE, editor_motion_line_start},
+    {"^",  EDITOR_MOTION_EXCLUSIVE, editor_motion_first_nonblank},
+    {"$",  EDITOR_MOTION_INCLUSIVE, editor_motion_line_end},
+    {"G",  EDITOR_MOTION_LINEWISE,  editor_motion_goto_line},
+    {"gg", EDITOR_MOTION_LINEWISE,  editor_motion_goto_first_line},
+    {"iw", EDITOR_MOTION_OBJECT,    editor_object_inner_word},
+    {"aw", EDITOR_MOTION_OBJECT,    editor_object_a_word},
+    {"%",  EDITOR_MOTION_INCLUSIVE, editor_motion_match_pair},
+    {"i(", EDITOR_MOTION_OBJECT,    editor_object_inner_paren},
+    {"i)", EDITOR_MOTION_OBJECT,    editor_object_inner_paren},
+    {"ib", EDITOR_MOTION_OBJECT,    editor_object_inner_paren},
+    {"a(", EDITOR_MOTION_OBJECT,    editor_object_a_paren},
+    {"a)", EDITOR_MOTION_OBJECT,    editor_object_a_paren},
+    {"ab", EDITOR_MOTION_OBJECT,    editor_object_a_paren},
+    {"i[", EDITOR_MOTION_OBJECT,    editor_object_inner_bracket},
+    {"i]", EDITOR_MOTION_OBJECT,    editor_object_inner_bracket},
+    {"a[", EDITOR_MOTION_OBJECT,    editor_object_a_bracket},
+    {"a]", EDITOR_MOTION_OBJECT,    editor_object_a_bracket},
+    {"i{", EDITOR_MOTION_OBJECT,    editor_object_inner_brace},
+    {"i}", EDITOR_MOTION_OBJECT,    editor_object_inner_brace},
+    {"iB", EDITOR_MOTION_OBJECT,    editor_object_inner_brace},
+    {"a{", EDITOR_MOTION_OBJECT,    editor_object_a_brace},
+    {"a}", EDITOR_MOTION_OBJECT,    editor_object_a_brace},
+    {"aB", EDITOR_MOTION_OBJECT,    editor_object_a_brace},
+    {"}",  EDITOR_MOTION_EXCLUSIVE, editor_motion_paragraph_forward},
+    {"{",  EDITOR_MOTION_EXCLUSIVE, editor_motion_paragraph_backward},
+    {"ip", EDITOR_MOTION_OBJECT,    editor_object_inner_paragraph},
+    {"ap", EDITOR_MOTION_OBJECT,    editor_object_a_paragraph},
+};
+
+static editor_keys_match
+editor_match_keys(const char *table_keys, u8 *keys, u64 len)
+{
+    u64 i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (table_keys[i] == '\0' || (u8)table_keys[i] != keys[i])
+        {
+            return EDITOR_KEYS_NONE;
+        }
+    }
+
+    return table_keys[len] == '\0' ? EDITOR_KEYS_EXACT : EDITOR_KEYS_PREFIX;
+}
+
+static editor_keys_match
+editor_find_motion(u8 *keys, u64 len, int allow_objects, const editor_motion **out)
+{
+    editor_keys_match best = EDITOR_KEYS_NONE;
+    u64 i;
+
+    for (i = 0; i < sizeof(editor_motions) / sizeof(editor_motions[0]); i++)
+    {
+        editor_keys_match m;
+
+        if (!allow_objects && editor_motions[i].kind == EDITOR_MOTION_OBJECT)
+        {
+            continue;
+        }
+
+        m = editor_match_keys(editor_motions[i].keys, keys, len);
+        if (m == EDITOR_KEYS_EXACT)
+        {
+            *out = &editor_motions[i];
+            return m;
+        }
+
+        if (m == EDITOR_KEYS_PREFIX)
+        {
+            best = m;
+        }
+    }
+
+    return best;
+}
+
+/* Start of the last line touched by a linewise range that ends at `end`. */
+static editor_range
+editor_expand_to_lines(buffer *b, u64 start, u64 end)
+{
+    u64 first_line;
+    u64 last_line;
+    u64 col;
+    editor_range r;
+
+    buffer_offset_to_line_col(b, start, &first_line, &col);
+    buffer_offset_to_line_col(b, end, &last_line, &col);
+
+    r.start = buffer_line_start(b, first_line);
+    r.end = editor_lines_end(b, first_line, last_line - first_line + 1);
+    r.linewise = 1;
+    r.failed = 0;
+    return r;
+}
+
+static editor_range
+editor_motion_range(const editor_motion *m, buffer *b, u64 offset, u64 count)
+{
+    editor_range r = m->fn(b, offset, count);
+    editor_range out;
+
+    if (m->kind == EDITOR_MOTION_OBJECT || r.failed)
+    {
+        return r;
+    }
+
+    out.start = r.start < r.end ? r.start : r.end;
+    out.end = r.start < r.end ? r.end : r.start;
+    out.linewise = 0;
+    out.failed = 0;
+
+    if (m->kind == EDITOR_MOTION_INCLUSIVE && out.end < b->total_len)
+    {
+        out.end++;
+    }
+
+    if (m->kind == EDITOR_MOTION_LINEWISE)
+    {
+        out = editor_expand_to_lines(b, out.start, out.end);
+    }
+
+    return out;
+}
+
+/*
+ * `w` under an operator stops at the end of the line instead of eating the
+ * newline and indent, and `cw` on a word behaves like `ce`.
+ */
+static editor_range
+editor_operator_word_range(buffer *b, u64 offset, u64 count, int change)
+{
+    editor_range r = {.start = offset};
+    u64 end_line;
+    u64 end_col;
+    u64 line;
+    u64 col;
+
+    if (change && offset < b->total_len && !editor_is_blank_char(buffer_byte_at(b, offset)))
+    {
+        editor_range word = editor_inner_word_range(b, offset);
+
+        r.end = word.end;
+        if (count > 1)
+        {
+            r.end = editor_skip_word_end(b, word.end - 1, count - 1) + 1;
+        }
+
+        if (r.end > b->total_len)
+        {
+            r.end = b->total_len;
+        }
+        return r;
+    }
+
+    r.end = editor_skip_word_forward(b, offset, count ? count : 1);
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    buffer_offset_to_line_col(b, r.end, &end_line, &end_col);
+    if (end_line > line && r.end <= editor_line_first_nonblank_offset(b, end_line))
+    {
+        r.end = buffer_line_start(b, end_line - 1) + buffer_line_len(b, end_line - 1);
+    }
+
+    return r;
+}
+
+static void
+editor_cursor_to_range_start(view *v, buffer *b, editor_range range)
+{
+    if (range.linewise)
+    {
+        u64 line;
+        u64 col;
+
+        buffer_offset_to_line_col(b, range.start, &line, &col);
+        view_set_cursor_from_offset(v, b, editor_line_first_nonblank_offset(b, line));
+    }
+    else
+    {
+        view_set_cursor_from_offset(v, b, range.start);
+    }
+
+    editor_clamp_cursor_x(v, b);
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_op_delete(view *v, buffer *b, editor_range range)
+{
+    u64 delete_start = range.start;
+
+    if (range.end == range.start)
+    {
+        return;
+    }
+
+    /* removing the last lines also takes the newline before them */
+    if (range.linewise && range.end == b->total_len && range.start > 0 &&
+        buffer_byte_at(b, range.end - 1) != '\n')
+    {
+        delete_start = range.start - 1;
+    }
+
+    registers_delete(&E.regs, E.register_name, b, range.start, range.end - range.start,
+                     range.linewise ? REGISTER_LINEWISE : REGISTER_CHARWISE);
+    buffer_delete(b, delete_start, range.end - delete_start);
+
+    if (range.linewise && delete_start < range.start)
+    {
+        range.start = delete_start;
+    }
+
+    editor_cursor_to_range_start(v, b, range);
+}
+
+static void
+editor_op_yank(view *v, buffer *b, editor_range range)
+{
+    if (range.end == range.start)
+    {
+        return;
+    }
+
+    registers_yank(&E.regs, E.register_name, b, range.start, range.end - range.start,
+                   range.linewise ? REGISTER_LINEWISE : REGISTER_CHARWISE);
+
+    if (range.linewise)
+    {
+        u64 line;
+        u64 col;
+
+        buffer_offset_to_line_col(b, range.start, &line, &col);
+        if (line < v->cursor.y)
+        {
+            v->cursor.y = line;
+            editor_clamp_cursor_x(v, b);
+            view_scroll_to_cursor(v);
+        }
+        return;
+    }
+
+    view_set_cursor_from_offset(v, b, range.start);
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_op_change(view *v, buffer *b, editor_range range)
+{
+    u64 end = range.end;
+
+    registers_delete(&E.regs, E.register_name, b, range.start, range.end - range.start,
+                     range.linewise ? REGISTER_LINEWISE : REGISTER_CHARWISE);
+
+    /* a linewise change keeps one empty line to type into */
+    if (range.linewise && end > range.start && buffer_byte_at(b, end - 1) == '\n')
+    {
+        end--;
+    }
+
+    buffer_delete(b, range.start, end - range.start);
+
+    view_set_cursor_from_offset(v, b, range.start);
+    view_scroll_to_cursor(v);
+    E.mode = EDITOR_INSERT_MODE;
+}
+
+static void
+editor_op_indent(view *v, buffer *b, editor_range range)
+{
+    u64 first;
+    u64 last;
+    u64 col;
+
+    buffer_offset_to_line_col(b, range.start, &first, &col);
+    buffer_offset_to_line_col(b, range.end > range.start ? range.end - 1 : range.start, &last, &col);
+
+    indent_lines(b, first, last, 1);
+    view_set_cursor_from_offset(v, b, editor_line_first_nonblank_offset(b, first));
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_op_dedent(view *v, buffer *b, editor_range range)
+{
+    u64 first;
+    u64 last;
+    u64 col;
+
+    buffer_offset_to_line_col(b, range.start, &first, &col);
+    buffer_offset_to_line_col(b, range.end > range.start ? range.end - 1 : range.start, &last, &col);
+
+    dedent_lines(b, first, last, 1);
+    view_set_cursor_from_offset(v, b, editor_line_first_nonblank_offset(b, first));
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_op_case(view *v, buffer *b, editor_range range, case_mode mode)
+{
+    change_case_range(b, range.start, range.end - range.start, mode);
+    editor_cursor_to_range_start(v, b, range);
+}
+
+static void
+editor_op_lower(view *v, buffer *b, editor_range range)
+{
+    editor_op_case(v, b, range, CASE_LOWER);
+}
+
+static void
+editor_op_upper(view *v, buffer *b, editor_range range)
+{
+    editor_op_case(v, b, range, CASE_UPPER);
+}
+
+static void
+editor_op_toggle_case(view *v, buffer *b, editor_range range)
+{
+    editor_op_case(v, b, range, CASE_TOGGLE);
+}
+
+static const editor_operator editor_operators[] = {
+    {"d",  editor_op_delete,      0},
+    {"c",  editor_op_change,      0},
+    {"y",  editor_op_yank,        0},
+    {">",  editor_op_indent,      1},
+    {"<",  editor_op_dedent,      1},
+    {"gu", editor_op_lower,       0},
+    {"gU", editor_op_upper,       0},
+    {"g~", editor_op_toggle_case, 0},
+};
+
+static editor_keys_match
+editor_find_operator(u8 *keys, u64 len, u64 *out)
+{
+    editor_keys_match best = EDITOR_KEYS_NONE;
+    u64 i;
+
+    for (i = 0; i < sizeof(editor_operators) / sizeof(editor_operators[0]); i++)
+    {
+        editor_keys_match m = editor_match_keys(editor_operators[i].keys, keys, len);
+
+        if (m == EDITOR_KEYS_EXACT)
+        {
+            *out = i;
+            return m;
+        }
+
+        if (m == EDITOR_KEYS_PREFIX)
+        {
+            best = m;
+        }
+    }
+
+    return best;
+}
+
+static void
+editor_apply_operator(view *v, buffer *b, const editor_operator *op, editor_range range)
+{
+    if (op->linewise && !range.linewise)
+    {
+        range = editor_expand_to_lines(b, range.start, range.end > range.start ? range.end - 1 : range.start);
+    }
+
+    op->fn(v, b, range);
+}
+
+/* `{count}r{char}` replaces that many characters with one add piece. */
+static void
+editor_pending_replace(view *v, buffer *b, int c, u64 count)
+{
+    u64 line_len = buffer_line_len(b, v->cursor.y);
+    u64 start = editor_cursor_offset(v, b);
+
+    if (c < 32 || c > 126 || v->cursor.x + count > line_len)
+    {
+        return;
+    }
+
+    replace_chars_range(b, start, count, (u8)c);
+    view_set_cursor_from_offset(v, b, start + count - 1);
+}
+
+static u64
+editor_take_raw_count(void)
+{
+    u64 count = E.count;
+
+    if (E.op_count)
+    {
+        count = (count ? count : 1) * E.op_count;
+    }
+
+    E.count = 0;
+    E.op_count = 0;
+    return count;
+}
+
+static void
+editor_motion_move_cursor(view *v, buffer *b, const editor_motion *m)
+{
+    editor_range r = m->fn(b, editor_cursor_offset(v, b), editor_take_raw_count());
+
+    view_set_cursor_from_offset(v, b, r.end);
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_process_pending_key(view *v, buffer *b, int c)
+{
+    const editor_operator *op;
+    const editor_motion *motion = NULL;
+    editor_keys_match motion_match;
+    editor_range range;
+    u64 count;
+
+    if (E.pending_keys_len >= sizeof(E.pending_keys))
+    {
+        editor_clear_pending_op();
+        return;
+    }
+
+    E.pending_keys[E.pending_keys_len++] = (u8)c;
+
+    if (E.pending_op == 0)
+    {
+        u64 index = 0;
+        editor_keys_match op_match = editor_find_operator(E.pending_keys, E.pending_keys_len, &index);
+
+        if (op_match == EDITOR_KEYS_EXACT)
+        {
+            E.pending_op = index + 1;
+            E.pending_keys_len = 0;
+            return;
+        }
+
+        /* gd is neither, it may leave the buffer */
+        if (E.pending_keys_len == 2 && E.pending_keys[0] == 'g' && E.pending_keys[1] == 'd')
+        {
+            editor_range word = editor_inner_word_range(b, editor_cursor_offset(v, b));
+            u8 name[EDITOR_MAX_SEARCH];
+            u64 len = word.end - word.start < sizeof(name) ? word.end - word.start : sizeof(name);
+
+            editor_clear_pending_op();
+            buffer_read(b, word.start, len, name);
+            if (len == 0 || search_word_class[name[0]] != SEARCH_CLASS_KEYWORD)
+            {
+                editor_set_cmd_status_message((u8 *)"No identifier under cursor");
+                return;
+            }
+
+            editor_goto_symbol((string){.s = name, .len = len});
+            return;
+        }
+
+        motion_match = editor_find_motion(E.pending_keys, E.pending_keys_len, 0, &motion);
+        if (motion_match == EDITOR_KEYS_EXACT)
+        {
+            editor_motion_move_cursor(v, b, motion);
+            editor_clear_pending_op();
+            return;
+        }
+
+        if (op_match == EDITOR_KEYS_NONE && motion_match == EDITOR_KEYS_NONE)
+        {
+            editor_clear_pending_op();
+        }
+        return;
+    }
+
+    op = &editor_operators[E.pending_op - 1];
+
+    /* dd, >>, gugu and guu work on whole lines */
+    if (editor_match_keys(op->keys, E.pending_keys, E.pending_keys_len) == EDITOR_KEYS_EXACT ||
+        (E.pending_keys_len == 1 && op->keys[1] != '\0' && (u8)op->keys[1] == E.pending_keys[0]))
+    {
+        u64 line = v->cursor.y;
+
+        count = editor_take_count();
+        range.start = buffer_line_start(b, line);
+        range.end = editor_lines_end(b, line, count);
+        range.linewise = 1;
+
+        editor_clear_pending_op_keep_register();
+        editor_apply_operator(v, b, op, range);
+        E.register_name = 0;
+        return;
+    }
+
+    motion_match = editor_find_motion(E.pending_keys, E.pending_keys_len, 1, &motion);
+    if (motion_match == EDITOR_KEYS_PREFIX ||
+        editor_match_keys(op->keys, E.pending_keys, E.pending_keys_len) == EDITOR_KEYS_PREFIX)
+    {
+        return;
+    }
+
+    if (motion_match == EDITOR_KEYS_NONE)
+    {
+        editor_clear_pending_op();
+        return;
+    }
+
+    count = editor_take_raw_count();
+    if (motion->fn == editor_motion_word_forward)
+    {
+        range = editor_operator_word_range(b, editor_cursor_offset(v, b), count,
+                                           op->fn == editor_op_change);
+    }
+    else
+    {
+        range = editor_motion_range(motion, b, editor_cursor_offset(v, b), count);
+    }
+
+    if (range.failed)
+    {
+        editor_clear_pending_op();
+        return;
+    }
+
+    editor_clear_pending_op_keep_register();
+    editor_apply_operator(v, b, op, range);
+    E.register_name = 0;
+}
+
+static void
+editor_enter_visual(view *v, buffer *b, u8 kind)
+{
+    E.mode = EDITOR_VISUAL_MODE;
+    E.visual_kind = kind;
+    E.visual_replace = 0;
+    E.visual_anchor = editor_cursor_offset(v, b);
+    E.pending_keys_len = 0;
+}
+
+static void
+editor_exit_visual(void)
+{
+    E.mode = EDITOR_NORMAL_MODE;
+    E.visual_replace = 0;
+    E.pending_keys_len = 0;
+    E.count = 0;
+    E.register_name = 0;
+}
+
+/* The selection as a half-open range, expanded to whole lines for V. */
+static editor_range
+editor_visual_range(view *v, buffer *b)
+{
+    u64 cursor = editor_cursor_offset(v, b);
+    u64 first = E.visual_anchor < cursor ? E.visual_anchor : cursor;
+    u64 last = E.visual_anchor < cursor ? cursor : E.visual_anchor;
+    editor_range r;
+
+    if (last > b->total_len)
+    {
+        last = b->total_len;
+    }
+
+    /* linewise operators on a block act on all of its lines */
+    if (E.visual_kind == EDITOR_VISUAL_LINE || E.visual_kind == EDITOR_VISUAL_BLOCK)
+    {
+        return editor_expand_to_lines(b, first, last);
+    }
+
+    r.start = first;
+    r.end = last < b->total_len ? last + 1 : last;
+    r.linewise = 0;
+    r.failed = 0;
+    return r;
+}
+
+static block_range
+editor_visual_block(view *v, buffer *b)
+{
+    u64 line;
+    u64 col;
+    block_range r;
+
+    buffer_offset_to_line_col(b, E.visual_anchor < b->total_len ? E.visual_anchor : b->total_len,
+                              &line, &col);
+
+    r.first_line = line < v->cursor.y ? line : v->cursor.y;
+    r.last_line = line < v->cursor.y ? v->cursor.y : line;
+    r.left = col < v->cursor.x ? col : v->cursor.x;
+    r.right = col < v->cursor.x ? v->cursor.x : col;
+    return r;
+}
+
+static void
+editor_block_to_top_left(view *v, buffer *b, block_range r)
+{
+    v->cursor.y = r.first_line;
+    v->cursor.x = r.left;
+    editor_clamp_cursor_x(v, b);
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_begin_block_insert(view *v, buffer *b, block_range r, u64 col, int pad)
+{
+    u64 line_len;
+
+    if (pad && buffer_line_len(b, r.first_line) < col)
+    {
+        insert_block(b, r.first_line, r.first_line, col, (string){0}, 1);
+    }
+
+    line_len = buffer_line_len(b, r.first_line);
+    if (col > line_len)
+    {
+        col = line_len;
+    }
+
+    E.block_insert = 1;
+    E.block_insert_pad = (u8)pad;
+    E.block_insert_first = r.first_line;
+    E.block_insert_last = r.last_line;
+    E.block_insert_col = col;
+    E.block_insert_start = buffer_line_start(b, r.first_line) + col;
+
+    view_set_cursor_from_offset(v, b, E.block_insert_start);
+    view_scroll_to_cursor(v);
+    E.mode = EDITOR_INSERT_MODE;
+}
+
+/* Repeats what was typed on the first line of the block on the rest of it. */
+static void
+editor_finish_block_insert(view *v, buffer *b)
+{
+    u64 end = editor_cursor_offset(v, b);
+    u64 line_end;
+    string text;
+    u64 i;
+
+    E.block_insert = 0;
+
+    line_end = buffer_line_start(b, E.block_insert_first) + buffer_line_len(b, E.block_insert_first);
+    if (E.block_insert_last == E.block_insert_first ||
+        end <= E.block_insert_start || end > line_end)
+    {
+        return;
+    }
+
+    text = buffer_slice_arena(b, &E.scratch, E.block_insert_start, end - E.block_insert_start);
+    for (i = 0; i < text.len && text.s[i] != '\n'; i++)
+    {
+    }
+
+    if (i == text.len)
+    {
+        insert_block(b, E.block_insert_first + 1, E.block_insert_last,
+                     E.block_insert_col, text, E.block_insert_pad);
+    }
+
+    view_set_cursor_from_offset(v, b, E.block_insert_start);
+    view_scroll_to_cursor(v);
+}
+
+#define EDITOR_MAX_COMPLETIONS 256
+#define EDITOR_COMPLETION_ROWS 8
+
+/*
+ * Ctrl-N and Ctrl-P in insert mode. The first press gathers the keywords
+ * of every open buffer that extend the one before the cursor, from indexes
+ * already counted in the background, the next ones cycle through them and
+ * back to what was typed.
+ */
+static void
+editor_complete_word(view *v, buffer *b, int forward)
+{
+    char message[64];
+    string shown;
+    u64 i;
+
+    if (!E.completing)
+    {
+        u64 offset = editor_cursor_offset(v, b);
+        u64 start = offset;
+        buffer_reader r;
+        string prefix;
+
+        buffer_reader_init(&r, b);
+        while (start > 0 && offset - start < WORD_INDEX_MAX_LEN &&
+               search_word_class[buffer_reader_byte(&r, start - 1)] == SEARCH_CLASS_KEYWORD)
+        {
+            start--;
+        }
+
+        E.completion_prefix_len = offset - start;
+        buffer_read(b, start, E.completion_prefix_len, E.completion_prefix);
+        prefix = (string){.s = E.completion_prefix, .len = E.completion_prefix_len};
+
+        E.completion_indexing = 0;
+        word_list_clear(&E.completions);
+        for (i = 0; i < E.buffer_count; i++)
+        {
+            word_index_matches(&E.words[i], prefix, &E.completions, EDITOR_MAX_COMPLETIONS);
+            E.completion_indexing |= (u8)!word_index_complete(&E.words[i]);
+        }
+        word_list_finish(&E.completions, EDITOR_MAX_COMPLETIONS);
+
+        if (E.completions.count == 0)
+        {
+            editor_set_cmd_status_message((u8 *)(E.completion_indexing ?
+                                                  "No completions yet, still indexing" :
+                                                  "No completions"));
+            return;
+        }
+
+        E.completing = 1;
+        E.completion_start = start;
+        E.completion_len = E.completion_prefix_len;
+        E.completion_selected = E.completions.count;
+    }
+
+    /* the typed prefix sits between the last candidate and the first */
+    E.completion_selected = forward ?
+        (E.completion_selected + 1) % (E.completions.count + 1) :
+        (E.completion_selected + E.completions.count) % (E.completions.count + 1);
+
+    if (E.completion_selected == E.completions.count)
+    {
+        shown = (string){.s = E.completion_prefix, .len = E.completion_prefix_len};
+        snprintf(message, sizeof(message), "Back at original");
+    }
+    else
+    {
+        shown = word_list_get(&E.completions, E.completion_selected);
+        snprintf(message, sizeof(message), "match %llu of %llu%s",
+                 (unsigned long long)(E.completion_selected + 1),
+                 (unsigned long long)E.completions.count,
+                 E.completion_indexing ? " (indexing)" : "");
+    }
+
+    buffer_replace(b, E.completion_start, E.completion_len, shown);
+    E.completion_len = shown.len;
+    view_set_cursor_from_offset(v, b, E.completion_start + shown.len);
+    view_scroll_to_cursor(v);
+    editor_set_cmd_status_message((u8 *)message);
+}
+
+/* Operators with a blockwise meaning, the rest fall back to whole lines. */
+static int
+editor_process_block_op(view *v, buffer *b, int c)
+{
+    block_range r = editor_visual_block(v, b);
+    u8 name = E.register_name;
+    string text;
+
+    switch (c) {
+    case 'd':
+    case 'x':
+    case 'c':
+    case 's':
+        block_text(b, r, &text);
+        registers_delete_text(&E.regs, name, text, REGISTER_BLOCKWISE);
+        free(text.s);
+        editor_exit_visual();
+        delete_block(b, r);
+        if (c == 'c' || c == 's')
+        {
+            editor_begin_block_insert(v, b, r, r.left, 0);
+        }
+        else
+        {
+            editor_block_to_top_left(v, b, r);
+        }
+        return 1;
+    case 'y':
+        block_text(b, r, &text);
+        registers_set_text(&E.regs, name, text, REGISTER_BLOCKWISE);
+        free(text.s);
+        editor_exit_visual();
+        editor_block_to_top_left(v, b, r);
+        return 1;
+    case 'I':
+    case 'A':
+        editor_exit_visual();
+        editor_begin_block_insert(v, b, r, c == 'I' ? r.left : r.right + 1, c == 'A');
+        return 1;
+    case 'u':
+    case 'U':
+    case '~':
+        editor_exit_visual();
+        change_case_block(b, r, c == 'u' ? CASE_LOWER : (c == 'U' ? CASE_UPPER : CASE_TOGGLE));
+        editor_block_to_top_left(v, b, r);
+        return 1;
+    }
+
+    return 0;
+}
+
+static const struct {
+    u8 key;
+    const char *op;
+} editor_visual_operators[] = {
+    {'d', "d"},
+    {'x', "d"},
+    {'c', "c"},
+    {'s', "c"},
+    {'y', "y"},
+    {'>', ">"},
+    {'<', "<"},
+    {'u', "gu"},
+    {'U', "gU"},
+    {'~', "g~"},
+};
+
+static void
+editor_process_visual_key(view *v, buffer *b, int c)
+{
+    const editor_motion *motion = NULL;
+    editor_keys_match match;
+    u64 i;
+    block_range lines = editor_visual_block(v, b);
+
+    E.visual_first_line = lines.first_line;
+    E.visual_last_line = lines.last_line;
+    E.visual_marked = 1;
+
+    if (E.visual_replace)
+    {
+        editor_range range = editor_visual_range(v, b);
+
+        if (c >= 32 && c <= 126 && E.visual_kind == EDITOR_VISUAL_BLOCK)
+        {
+            block_range r = editor_visual_block(v, b);
+
+            replace_chars_block(b, r, (u8)c);
+            editor_block_to_top_left(v, b, r);
+        }
+        else if (c >= 32 && c <= 126)
+        {
+            replace_chars_range(b, range.start, range.end - range.start, (u8)c);
+            editor_cursor_to_range_start(v, b, range);
+        }
+
+        editor_exit_visual();
+        return;
+    }
+
+    if (E.pending_keys_len == 0)
+    {
+        if (editor_accumulate_count(c))
+        {
+            return;
+        }
+
+        switch (c) {
+        case ESC:
+            editor_exit_visual();
+            return;
+        case ':':
+            editor_exit_visual();
+            E.mode = EDITOR_COMMAND_MODE;
+            arena_push_array(&E.cmd, (u8 *)":'<,'>", 6);
+            return;
+        case 'v':
+        case 'V':
+        case CTRL_V:
+            {
+                u8 kind = (c == 'v') ? EDITOR_VISUAL_CHAR :
+                          (c == 'V') ? EDITOR_VISUAL_LINE : EDITOR_VISUAL_BLOCK;
+
+                if (E.visual_kind == kind)
+                {
+                    editor_exit_visual();
+                }
+                else
+                {
+                    E.visual_kind = kind;
+                }
+                return;
+            }
+        case 'o':
+            {
+                u64 cursor = editor_cursor_offset(v, b);
+
+                view_set_cursor_from_offset(v, b, E.visual_anchor);
+                view_scroll_to_cursor(v);
+                E.visual_anchor = cursor;
+                return;
+            }
+        case '"':
+            E.register_select = TRUE;
+            return;
+        case 'r':
+            E.visual_replace = TRUE;
+            return;
+        case 'j':
+        case 'k':
+        case 'h':
+        case 'l':
+            editor_move_cursor(c, editor_take_count());
+            return;
+        }
+
+        if (E.visual_kind == EDITOR_VISUAL_BLOCK && editor_process_block_op(v, b, c))
+        {
+            E.register_name = 0;
+            return;
+        }
+
+        for (i = 0; i < sizeof(editor_visual_operators) / sizeof(editor_visual_operators[0]); i++)
+        {
+            u64 index;
+
+            if (editor_visual_operators[i].key != c)
+            {
+                continue;
+            }
+
+            if (editor_find_operator((u8 *)editor_visual_operators[i].op,
+                                     strlen(editor_visual_operators[i].op),
+                                     &index) == EDITOR_KEYS_EXACT)
+            {
+                editor_range range = editor_visual_range(v, b);
+                u8 name = E.register_name;
+
+                editor_exit_visual();
+                E.register_name = name;
+                editor_apply_operator(v, b, &editor_operators[index], range);
+                E.register_name = 0;
+            }
+            return;
+        }
+    }
+
+    E.pending_keys[E.pending_keys_len++] = (u8)c;
+    match = editor_find_motion(E.pending_keys, E.pending_keys_len, 1, &motion);
+
+    if (match == EDITOR_KEYS_PREFIX && E.pending_keys_len < sizeof(E.pending_keys))
+    {
+        return;
+    }
+
+    E.pending_keys_len = 0;
+    if (match != EDITOR_KEYS_EXACT)
+    {
+        E.count = 0;
+        return;
+    }
+
+    if (motion->kind == EDITOR_MOTION_OBJECT)
+    {
+        editor_range r = motion->fn(b, editor_cursor_offset(v, b), editor_take_raw_count());
+
+        if (r.end > r.start)
+        {
+            if (r.linewise)
+            {
+                E.visual_kind = EDITOR_VISUAL_LINE;
+            }
+            E.visual_anchor = r.start;
+            view_set_cursor_from_offset(v, b, r.end - 1);
+            view_scroll_to_cursor(v);
+        }
+        return;
+    }
+
+    editor_motion_move_cursor(v, b, motion);
+}
+
+/*
+ * One step of a wrapping search: forward finds the first match at or after
+ * `from`, backward the last one starting before it. Patterns without regex
+ * syntax go straight to the literal scanner and `re` is NULL for them,
+ * `word` keeps only the matches that are whole keywords.
+ */
+static int
+editor_search_step(buffer *b, string pattern, regex *re, u8 word, u64 from, u8 backward,
+                   u64 *out, u64 *out_len)
+{
+    *out_len = pattern.len;
+
+    if (word && backward)
+    {
+        return search_backward_word(b, pattern, from, out) ||
+               search_backward_word(b, pattern, b->total_len, out);
+    }
+
+    if (word)
+    {
+        return search_forward_word(b, pattern, from, out) ||
+               search_forward_word(b, pattern, 0, out);
+    }
+
+    if (re != NULL && backward)
+    {
+        return regex_search_backward(re, b, from, out, out_len) ||
+               regex_search_backward(re, b, b->total_len + 1, out, out_len);
+    }
+
+    if (re != NULL)
+    {
+        return regex_search_forward(re, b, from, out, out_len) ||
+               regex_search_forward(re, b, 0, out, out_len);
+    }
+
+    if (backward)
+    {
+        return search_backward(b, pattern, from, out) ||
+               search_backward(b, pattern, b->total_len, out);
+    }
+
+    return search_forward(b, pattern, from, out) ||
+           search_forward(b, pattern, 0, out);
+}
+
+static void
+editor_search_not_found(string pattern)
+{
+    char message[EDITOR_MAX_SEARCH + 32];
+
+    snprintf(message, sizeof(message), "Pattern not found: %.*s",
+             (int)pattern.len, (char *)pattern.s);
+    editor_set_cmd_status_message((u8 *)message);
+}
+
+static void
+editor_begin_search(view *v, buffer *b, u8 backward)
+{
+    E.mode = EDITOR_SEARCH_MODE;
+    E.search_len = 0;
+    E.search_backward = backward;
+    E.search_origin = editor_cursor_offset(v, b);
+    editor_set_cmd_status_message(NULL);
+}
+
+static void
+editor_search_show(view *v, buffer *b)
+{
+    u64 offset = E.search_origin;
+
+    if (E.search_len > 0 && E.search_found[E.search_len - 1])
+    {
+        offset = E.search_hits[E.search_len - 1];
+    }
+
+    view_set_cursor_from_offset(v, b, offset);
+    view_scroll_to_cursor(v);
+}
+
+static void
+editor_search_drop_regex(void)
+{
+    if (E.search_re_valid)
+    {
+        regex_free(&E.search_re);
+        E.search_re_valid = 0;
+    }
+}
+
+/*
+ * A match of a longer literal is also a match of the shorter one, so the
+ * new match can be no earlier (in search order) than the previous one and
+ * there is none at all if the previous pattern had none. Regex patterns do
+ * not extend that way and are searched again from the origin.
+ */
+static void
+editor_search_refine(buffer *b)
+{
+    string pattern = {.s = E.search_pattern, .len = E.search_len};
+    u64 k = E.search_len - 1;
+    regex *re = NULL;
+    u64 from;
+
+    editor_search_drop_regex();
+
+    if (!regex_is_literal(pattern))
+    {
+        if (!regex_compile(&E.search_re, pattern))
+        {
+            E.search_found[k] = 0;
+            return;
+        }
+
+        E.search_re_valid = 1;
+        re = &E.search_re;
+    }
+    else if (k > 0 && !E.search_found[k - 1])
+    {
+        E.search_found[k] = 0;
+        return;
+    }
+
+    if (re == NULL && k > 0)
+    {
+        from = E.search_hits[k - 1] + (E.search_backward ? 1 : 0);
+    }
+    else
+    {
+        from = E.search_origin + (E.search_backward ? 0 : 1);
+    }
+
+    E.search_found[k] = (u8)editor_search_step(b, pattern, re, 0, from, E.search_backward,
+                                               &E.search_hits[k], &E.search_lens[k]);
+}
+
+/* Highlights every match of the last pattern, indexing it if it is new. */
+static void
+editor_search_highlight(view *v)
+{
+    string pattern = {.s = E.last_search, .len = E.last_search_len};
+
+    E.hlsearch = (u8)match_index_set_pattern(&E.search_index[v->buffer_id], pattern,
+                                             E.last_search_word);
+}
+
+/* Makes the pattern just typed the one n and N repeat. */
+static void
+editor_search_accept(void)
+{
+    memcpy(E.last_search, E.search_pattern, (size_t)E.search_len);
+    E.last_search_len = E.search_len;
+    E.last_search_backward = E.search_backward;
+    E.last_search_word = 0;
+
+    if (E.last_re_valid)
+    {
+        regex_free(&E.last_re);
+    }
+
+    E.last_re = E.search_re;
+    E.last_re_valid = E.search_re_valid;
+    E.search_re_valid = 0;
+}
+
+static void
+editor_process_search_key(view *v, buffer *b, int c)
+{
+    switch (c) {
+    case ESC:
+        E.mode = EDITOR_NORMAL_MODE;
+        editor_search_drop_regex();
+        view_set_cursor_from_offset(v, b, E.search_origin);
+        view_scroll_to_cursor(v);
+        return;
+    case BACKSPACE:
+    case DEL_KEY:
+        if (E.search_len == 0)
+        {
+            E.mode = EDITOR_NORMAL_MODE;
+            return;
+        }
+
+        E.search_len--;
+        editor_search_show(v, b);
+        return;
+    case ENTER:
+        {
+            string pattern = {.s = E.search_pattern, .len = E.search_len};
+            u64 hit;
+            u64 hit_len;
+
+            E.mode = EDITOR_NORMAL_MODE;
+
+            /* an empty pattern repeats the last one */
+            if (E.search_len == 0)
+            {
+                pattern = (string){.s = E.last_search, .len = E.last_search_len};
+                E.last_search_backward = E.search_backward;
+                editor_search_highlight(v);
+                if (pattern.len > 0 &&
+                    editor_search_step(b, pattern, E.last_re_valid ? &E.last_re : NULL,
+                                       E.last_search_word,
+                                       E.search_origin + (E.search_backward ? 0 : 1),
+                                       E.search_backward, &hit, &hit_len))
+                {
+                    view_set_cursor_from_offset(v, b, hit);
+                    view_scroll_to_cursor(v);
+                }
+                else if (pattern.len > 0)
+                {
+                    editor_search_not_found(pattern);
+                }
+                return;
+            }
+
+            /* backspacing may have left the regex of a longer pattern */
+            editor_search_drop_regex();
+            if (!regex_is_literal(pattern))
+            {
+                char message[EDITOR_MAX_SEARCH + 96];
+
+                if (!regex_compile(&E.search_re, pattern))
+                {
+                    snprintf(message, sizeof(message), "Invalid pattern: %s", E.search_re.error);
+                    editor_set_cmd_status_message((u8 *)message);
+                    return;
+                }
+
+                E.search_re_valid = 1;
+            }
+
+            editor_search_accept();
+            editor_search_highlight(v);
+
+            if (!E.search_found[E.search_len - 1])
+            {
+                editor_search_not_found(pattern);
+            }
+            return;
+        }
+    default:
+        if (c >= 32 && c <= 126 && E.search_len < EDITOR_MAX_SEARCH)
+        {
+            E.search_pattern[E.search_len++] = (u8)c;
+            editor_search_refine(b);
+            editor_search_show(v, b);
+        }
+        return;
+    }
+}
+
+/* n and N, `reverse` flips the direction of the last search. */
+static void
+editor_search_next(view *v, buffer *b, u8 reverse, u64 count)
+{
+    string pattern = {.s = E.last_search, .len = E.last_search_len};
+    regex *re = E.last_re_valid ? &E.last_re : NULL;
+    u8 backward = (u8)(E.last_search_backward ^ reverse);
+    match_index *mi = &E.search_index[v->buffer_id];
+    u64 offset = editor_cursor_offset(v, b);
+    u64 len;
+    u64 i;
+
+    if (pattern.len == 0)
+    {
+        editor_set_cmd_status_message((u8 *)"No previous search pattern");
+        return;
+    }
+
+    editor_search_highlight(v);
+
+    for (i = 0; i < count; i++)
+    {
+        /* once the index is complete a jump is a binary search */
+        if (match_index_complete(mi) && mi->count > 0)
+        {
+            u64 k = match_index_lower_bound(mi, backward ? offset : offset + 1);
+
+            if (backward)
+            {
+                k = (k == 0 ? mi->count : k) - 1;
+            }
+            else if (k == mi->count)
+            {
+                k = 0;
+            }
+
+            offset = mi->items[k].start;
+        }
+        else if (!editor_search_step(b, pattern, re, E.last_search_word,
+                                     backward ? offset : offset + 1, backward, &offset, &len))
+        {
+            editor_search_not_found(pattern);
+            return;
+        }
+    }
+
+    view_set_cursor_from_offset(v, b, offset);
+    view_scroll_to_cursor(v);
+}
+
+/*
+ * * and #, the word under or after the cursor becomes the last pattern. A
+ * keyword only matches as a whole word, any other run of characters is
+ * escaped and searched as it is.
+ */
+static void
+editor_search_word(view *v, buffer *b, u8 backward, u64 count)
+{
+    editor_range word = editor_inner_word_range(b, editor_cursor_offset(v, b));
+    u8 text[EDITOR_MAX_SEARCH];
+    u64 len = word.end - word.start;
+    u64 i;
+
+    if (len == 0)
+    {
+        editor_set_cmd_status_message((u8 *)"No string under cursor");
+        return;
+    }
+
+    if (len > sizeof(text))
+    {
+        len = sizeof(text);
+    }
+    buffer_read(b, word.start, len, text);
+
+    E.last_search_word = (u8)(search_word_class[text[0]] == SEARCH_CLASS_KEYWORD);
+    E.last_search_len = 0;
+    for (i = 0; i < len && E.last_search_len + 2 <= EDITOR_MAX_SEARCH; i++)
+    {
+        if (!E.last_search_word && text[i] != '\0' &&
+            strchr("\\.[]()*+?|^$", text[i]) != NULL)
+        {
+            E.last_search[E.last_search_len++] = '\\';
+        }
+        E.last_search[E.last_search_len++] = text[i];
+    }
+    E.last_search_backward = backward;
+
+    if (E.last_re_valid)
+    {
+        regex_free(&E.last_re);
+    }
+    E.last_re_valid = (u8)!regex_is_literal((string){.s = E.last_search, .len = E.last_search_len});
+    if (E.last_re_valid)
+    {
+        regex_compile(&E.last_re, (string){.s = E.last_search, .len = E.last_search_len});
+    }
+
+    /* from the start of the word, so # skips the word itself */
+    view_set_cursor_from_offset(v, b, word.start);
+    editor_search_next(v, b, 0, count);
+}
+
+static void
+editor_lsp_open(buffer *b)
+{
+    const syntax_language *lang = syntax_language_for(b->file_path);
+
+    lsp_open(&E.lsp, b, lang != NULL ? lang->name : "plaintext");
+}
+
+/* Buffer holding the file at `path`, read into a new one the first time. */
+static int
+editor_open_file(const char *path, u64 *id)
+{
+    struct stat st;
+    string file;
+    string file_path;
+    u64 i;
+
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < E.buffer_count; i++)
+    {
+        buffer *b = &E.buffers[i];
+
+        if (b->has_file_stat && b->file_stat.st_dev == st.st_dev && b->file_stat.st_ino == st.st_ino)
+        {
+            *id = i;
+            return 1;
+        }
+    }
+
+    if (E.buffer_count == EDITOR_MAX_BUFFERS || readfile(path, &file, MAX_FILE_SIZE) != 0)
+    {
+        return 0;
+    }
+
+    file_path.len = strlen(path);
+    file_path.s = (u8 *)malloc((size_t)file_path.len);
+    if (file_path.s == NULL)
+    {
+        perror("[error] unable to allocate memory for a file path");
+        exit(1);
+    }
+    memcpy(file_path.s, path, (size_t)file_path.len);
+
+    buffer_init(&E.buffers[E.buffer_count], file, file_path);
+    match_index_init(&E.search_index[E.buffer_count], &E.buffers[E.buffer_count]);
+    bracket_index_init(&E.brackets[E.buffer_count], &E.buffers[E.buffer_count]);
+    line_class_init(&E.line_classes[E.buffer_count], &E.buffers[E.buffer_count]);
+    syntax_index_init(&E.syntax[E.buffer_count], &E.buffers[E.buffer_count]);
+    word_index_init(&E.words[E.buffer_count], &E.buffers[E.buffer_count]);
+    editor_lsp_open(&E.buffers[E.buffer_count]);
+    *id = E.buffer_count++;
+    return 1;
+}
+
+static void
+editor_show_buffer(view *v, u64 id)
+{
+    if (v->buffer_id != id)
+    {
+        v->buffer_id = id;
+        v->cursor.x = 0;
+        v->cursor.y = 0;
+        v->rowoff = 0;
+        v->coloff = 0;
+    }
+}
+
+/* Opens the `index`th (from 1) :grep hit in the active view. */
+static void
+editor_quickfix_goto(u64 index)
+{
+    view *v = &E.views[E.active_view];
+    grep_hit hit = grep_hit_at(&E.grep, index - 1);
+    char message[sizeof(E.status_message)];
+    buffer *b;
+    u64 line;
+    u64 col;
+    u64 id;
+
+    if (!editor_open_file(hit.path, &id))
+    {
+        snprintf(message, sizeof(message), "Unable to open %s", hit.path);
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    editor_show_buffer(v, id);
+
+    b = &E.buffers[id];
+    line = hit.line - 1 < b->lines.count ? hit.line - 1 : b->lines.count - 1;
+    col = hit.col - 1 < buffer_line_len(b, line) ? hit.col - 1 : buffer_line_len(b, line);
+    view_set_cursor_from_offset(v, b, buffer_line_start(b, line) + col);
+    view_scroll_to_cursor(v);
+
+    E.quickfix_index = index;
+    snprintf(message, sizeof(message), "(%llu of %llu) %s:%llu: %s",
+             (unsigned long long)index, (unsigned long long)grep_hit_count(&E.grep),
+             hit.path, (unsigned long long)hit.line, hit.text);
+    editor_set_cmd_status_message((u8 *)message);
+}
+
+/* :cn and :cp. */
+void
+editor_quickfix_step(int forward)
+{
+    u64 count = grep_hit_count(&E.grep);
+
+    if (count == 0)
+    {
+        editor_set_cmd_status_message((u8 *)(grep_running(&E.grep) ? "No matches yet" : "No matches"));
+        return;
+    }
+
+    if (forward ? E.quickfix_index >= count : E.quickfix_index <= 1)
+    {
+        editor_set_cmd_status_message((u8 *)"No more items");
+        return;
+    }
+
+    editor_quickfix_goto(forward ? E.quickfix_index + 1 : E.quickfix_index - 1);
+}
+
+/*
+ * :grep, the hits stream in while the walk runs on the worker threads.
+ * Once the path index is built and watched it already knows every file,
+ * so the search starts from it instead of walking the tree again, and a
+ * trigram index narrows the pattern down to the files that can hold it, a
+ * regex by the longest literal every match of it contains.
+ */
+void
+editor_start_grep(string pattern)
+{
+    char error[128];
+    char **paths;
+    regex re;
+    u64 count;
+    int ok;
+
+    grep_free(&E.grep);
+    E.quickfix_index = 0;
+
+    if (!E.trigrams_tried)
+    {
+        E.trigrams_tried = 1;
+
+        /* the index needs the watched path index, this search still walks */
+        if (trigram_index_open(&E.trigrams, TRIGRAM_INDEX_FILE) && !E.paths.started)
+        {
+            path_index_build(&E.paths, (string){.s = (u8 *)".", .len = 1});
+        }
+    }
+
+    if (E.paths.watching && !path_index_building(&E.paths))
+    {
+        paths = path_index_snapshot(&E.paths, &count);
+
+        if (E.trigrams.loaded && !E.trigrams.building)
+        {
+            /* a rebuilt path index may have missed changes, so check every mtime again */
+            if (E.trigrams_generation != E.paths.generation)
+            {
+                E.trigrams.refreshed = 0;
+                E.trigrams_generation = E.paths.generation;
+            }
+
+            path_index_listen(&E.paths, trigram_index_on_path, &E.trigrams);
+            trigram_index_refresh(&E.trigrams, paths, count);
+
+            if (regex_is_literal(pattern))
+            {
+                paths = trigram_index_filter(&E.trigrams, pattern, paths, &count);
+            }
+            else if (regex_compile(&re, pattern))
+            {
+                paths = trigram_index_filter(&E.trigrams,
+                                             (string){.s = re.required, .len = re.required_len},
+                                             paths, &count);
+                regex_free(&re);
+            }
+        }
+
+        ok = grep_start_files(&E.grep, paths, count, pattern, error, sizeof(error));
+    }
+    else
+    {
+        ok = grep_start(&E.grep, (string){.s = (u8 *)".", .len = 1}, pattern, error, sizeof(error));
+    }
+
+    if (!ok)
+    {
+        editor_set_cmd_status_message((u8 *)error);
+    }
+}
+
+/* :index, reads every file on all cores once the path index is built, see editor_index_work. */
+void
+editor_build_trigram_index(void)
+{
+    if (!E.trigrams.building)
+    {
+        if (!E.paths.started)
+        {
+            path_index_build(&E.paths, (string){.s = (u8 *)".", .len = 1});
+        }
+
+        if (!E.trigrams.started)
+        {
+            trigram_index_open(&E.trigrams, TRIGRAM_INDEX_FILE);
+        }
+        E.trigrams_tried = 1;
+        E.trigrams_pending = 1;
+    }
+
+    editor_set_cmd_status_message((u8 *)"Indexing...");
+}
+
+/*
+ * Starts the index builds waiting for the path index once it is built, and
+ * writes them once their walks are over. 0 while there is only waiting.
+ */
+static int
+editor_index_work(void)
+{
+    char message[128];
+    char **paths;
+    u64 count;
+    u64 i;
+
+    if (E.trigrams_pending && !path_index_building(&E.paths))
+    {
+        E.trigrams_pending = 0;
+        E.trigrams_generation = E.paths.generation;
+
+        paths = path_index_snapshot(&E.paths, &count);
+        path_index_listen(&E.paths, trigram_index_on_path, &E.trigrams);
+        trigram_index_start(&E.trigrams, TRIGRAM_INDEX_FILE, paths, count);
+        return 1;
+    }
+
+    if (E.trigrams.building && !trigram_index_building(&E.trigrams))
+    {
+        count = E.trigrams.built_count;
+        if (trigram_index_finish(&E.trigrams))
+        {
+            snprintf(message, sizeof(message), "Indexed %llu files", (unsigned long long)count);
+        }
+        else
+        {
+            snprintf(message, sizeof(message), "Unable to write %s", TRIGRAM_INDEX_FILE);
+        }
+        editor_set_cmd_status_message((u8 *)message);
+        return 1;
+    }
+
+    if (E.symbols_pending && !path_index_building(&E.paths))
+    {
+        E.symbols_pending = 0;
+
+        paths = path_index_snapshot(&E.paths, &count);
+        symbol_index_start(&E.symbols, paths, count);
+        for (i = 0; i < count; i++)
+        {
+            free(paths[i]);
+        }
+        free(paths);
+        return 1;
+    }
+
+    if (E.symbols.scanning && !symbol_index_scanning(&E.symbols))
+    {
+        /* gd said it was indexing only when there was no index yet */
+        if (E.symbols.loaded)
+        {
+            symbol_index_finish(&E.symbols);
+            return 1;
+        }
+
+        if (symbol_index_finish(&E.symbols))
+        {
+            snprintf(message, sizeof(message), "Indexed %llu files",
+                     (unsigned long long)E.symbols.header->file_count);
+        }
+        else
+        {
+            snprintf(message, sizeof(message), "Unable to write %s", SYMBOL_INDEX_FILE);
+        }
+        editor_set_cmd_status_message((u8 *)message);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The symbol index, mapped from its file when there is one. It is brought
+ * in line with the path index, or built from it when there is none, by
+ * editor_index_work once the path index is built.
+ */
+static int
+editor_symbols_ready(void)
+{
+    if (!E.symbols_tried)
+    {
+        E.symbols_tried = 1;
+        E.symbols_pending = 1;
+
+        if (!E.paths.started)
+        {
+            path_index_build(&E.paths, (string){.s = (u8 *)".", .len = 1});
+        }
+        symbol_index_open(&E.symbols, SYMBOL_INDEX_FILE);
+    }
+
+    return E.symbols.loaded;
+}
+
+/* Whether a buffer's path names the same file as a path relative to the working directory. */
+static int
+editor_path_is(string file_path, const char *path)
+{
+    u64 len = strlen(path);
+
+    if (file_path.len == len)
+    {
+        return memcmp(file_path.s, path, (size_t)len) == 0;
+    }
+
+    return file_path.len > len && file_path.s[file_path.len - len - 1] == '/' &&
+           memcmp(file_path.s + file_path.len - len, path, (size_t)len) == 0;
+}
+
+/* :tag and gd, a definition in the file being edited is taken before the others. */
+void
+editor_goto_symbol(string name)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+    char message[sizeof(E.status_message)];
+    symbol_match matches[64];
+    u8 text[EDITOR_MAX_SEARCH];
+    u64 count;
+    u64 pick = 0;
+    u64 line;
+    u64 len;
+    u64 col = 0;
+    u64 id;
+    u64 i;
+
+    if (!editor_symbols_ready())
+    {
+        if (E.symbols_pending || E.symbols.scanning)
+        {
+            editor_set_cmd_status_message((u8 *)"Indexing...");
+            return;
+        }
+
+        snprintf(message, sizeof(message), "Unable to write %s", SYMBOL_INDEX_FILE);
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    count = symbol_index_find(&E.symbols, name, matches, sizeof(matches) / sizeof(matches[0]));
+    if (count == 0)
+    {
+        snprintf(message, sizeof(message), "Tag not found: %.*s", (int)name.len, (char *)name.s);
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (editor_path_is(b->file_path, matches[i].path))
+        {
+            pick = i;
+            break;
+        }
+    }
+
+    if (!editor_open_file(matches[pick].path, &id))
+    {
+        snprintf(message, sizeof(message), "Unable to open %s", matches[pick].path);
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    editor_show_buffer(v, id);
+    b = &E.buffers[id];
+    line = matches[pick].line - 1 < b->lines.count ? matches[pick].line - 1 : b->lines.count - 1;
+
+    /* on the name itself when the line still holds it */
+    len = buffer_line_len(b, line) < sizeof(text) ? buffer_line_len(b, line) : sizeof(text);
+    buffer_read(b, buffer_line_start(b, line), len, text);
+    for (i = 0; i + name.len <= len; i++)
+    {
+        if (memcmp(text + i, name.s, (size_t)name.len) == 0 &&
+            (i == 0 || search_word_class[text[i - 1]] != SEARCH_CLASS_KEYWORD))
+        {
+            col = i;
+            break;
+        }
+    }
+
+    view_set_cursor_from_offset(v, b, buffer_line_start(b, line) + col);
+    view_scroll_to_cursor(v);
+
+    snprintf(message, sizeof(message), "(%llu of %llu) %s:%llu", (unsigned long long)pick + 1,
+             (unsigned long long)count, matches[pick].path, (unsigned long long)matches[pick].line);
+    editor_set_cmd_status_message((u8 *)message);
+}
+
+/* Starts `command` as the language server of every buffer open now or later. */
+void
+editor_start_lsp(const char *command)
+{
+    u64 i;
+
+    lsp_stop(&E.lsp);
+    if (!lsp_start(&E.lsp, command, "."))
+    {
+        editor_set_cmd_status_message((u8 *)"Unable to start language server");
+        return;
+    }
+
+    for (i = 0; i < E.buffer_count; i++)
+    {
+        editor_lsp_open(&E.buffers[i]);
+    }
+
+    editor_set_cmd_status_message((u8 *)"lsp: starting");
+}
+
+void
+editor_stop_lsp(void)
+{
+    lsp_stop(&E.lsp);
+    editor_set_cmd_status_message((u8 *)"lsp: stopped");
+}
+
+void
+editor_lsp_status(void)
+{
+    char message[sizeof(E.status_message)];
+    lsp_document *doc = lsp_document_for(&E.lsp, editor_active_buffer());
+
+    if (!E.lsp.running)
+    {
+        editor_set_cmd_status_message((u8 *)"No language server");
+        return;
+    }
+
+    if (doc != NULL && doc->diagnostic_count > 0)
+    {
+        snprintf(message, sizeof(message), "%llu: %s", (unsigned long long)doc->diagnostic_line + 1,
+                 doc->diagnostic);
+    }
+    else
+    {
+        snprintf(message, sizeof(message), "lsp: %s, %llu documents%s",
+                 E.lsp.initialized ? "running" : "starting", (unsigned long long)E.lsp.document_count,
+                 E.lsp.incremental ? "" : ", not synced");
+    }
+
+    editor_set_cmd_status_message((u8 *)message);
+}
+
+/* The memory counters on the status bar, or with `path` written there one tag per line. */
+void
+editor_mem(const char *path)
+{
+#ifdef MEM_TRACKING
+    char message[sizeof(E.status_message)];
+    FILE *f;
+    int failed;
+
+    if (path == NULL)
+    {
+        mem_summary(message, sizeof(message));
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    f = fopen(path, "w");
+    failed = f == NULL || mem_dump(f) != 0;
+    if (f != NULL && fclose(f) != 0)
+    {
+        failed = 1;
+    }
+
+    if (failed)
+    {
+        snprintf(message, sizeof(message), "Unable to write %s", path);
+    }
+    else
+    {
+        snprintf(message, sizeof(message), "mem: written to %s", path);
+    }
+    editor_set_cmd_status_message((u8 *)message);
+#else
+    (void)path;
+    editor_set_cmd_status_message((u8 *)"Not built with memory tracking (bin/build mem)");
+#endif
+}
+
+static u64
+editor_lsp_diagnostics(buffer *b)
+{
+    lsp_document *doc = lsp_document_for(&E.lsp, b);
+
+    return doc != NULL ? doc->diagnostic_count : 0;
+}
+
+/* After :w, so the trigram and symbol indexes do not wait for the watcher to see the rename. */
+void
+editor_file_written(string path)
+{
+    char cwd[KB(4)];
+    char relative[KB(4)];
+    u64 cwd_len;
+
+    lsp_saved(&E.lsp, editor_active_buffer());
+
+    if ((!E.trigrams.loaded && !E.symbols.loaded) || path.len == 0 || path.len >= sizeof(relative))
+    {
+        return;
+    }
+
+    /* the index holds paths as the walk of "." produced them */
+    if (path.s[0] == '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+    {
+        cwd_len = strlen(cwd);
+        if (path.len > cwd_len + 1 && memcmp(path.s, cwd, (size_t)cwd_len) == 0 && path.s[cwd_len] == '/')
+        {
+            path.s += cwd_len + 1;
+            path.len -= cwd_len + 1;
+        }
+    }
+    else if (path.len > 2 && path.s[0] == '.' && path.s[1] == '/')
+    {
+        path.s += 2;
+        path.len -= 2;
+    }
+
+    memcpy(relative, path.s, (size_t)path.len);
+    relative[path.len] = '\0';
+
+    if (E.trigrams.loaded)
+    {
+        trigram_index_update(&E.trigrams, relative);
+    }
+    if (E.symbols.loaded || E.symbols.scanning)
+    {
+        symbol_index_update(&E.symbols, relative);
+    }
+}
+
+/*
+ * :s over lines [first_line, last_line]. There is no undo, so the single
+ * batched edit is what makes a substitution all or nothing.
+ */
+void
+editor_substitute(u64 first_line, u64 last_line, string args)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+    char message[sizeof(E.status_message)];
+    string pattern;
+    string replacement;
+    subst_result result;
+    u64 flags;
+
+    if (!subst_parse(args, &pattern, &replacement, &flags, message, sizeof(message)))
+    {
+        editor_set_cmd_status_message((u8 *)message);
+        return;
+    }
+
+    if (pattern.len == 0 && E.last_search_len == 0)
+    {
+        editor_set_cmd_status_message((u8 *)"No previous search pattern");
+    }
+    else if (subst_apply(b, first_line, last_line,
+                         pattern.len ? pattern : (string){.s = E.last_search, .len = E.last_search_len},
+                         replacement, flags, &result, message, sizeof(message)))
+    {
+        if (result.count == 0)
+        {
+            snprintf(message, sizeof(message), "Pattern not found: %.*s",
+                     (int)(pattern.len ? pattern.len : E.last_search_len),
+                     pattern.len ? (char *)pattern.s : (char *)E.last_search);
+        }
+        else if (flags & SUBST_COUNT)
+        {
+            snprintf(message, sizeof(message), "%llu match%s on %llu line%s",
+                     (unsigned long long)result.count, result.count == 1 ? "" : "es",
+                     (unsigned long long)result.lines, result.lines == 1 ? "" : "s");
+        }
+        else
+        {
+            view_set_cursor_from_offset(v, b, result.last_line_start);
+            view_scroll_to_cursor(v);
+            snprintf(message, sizeof(message), "%llu substitution%s on %llu line%s",
+                     (unsigned long long)result.count, result.count == 1 ? "" : "s",
+                     (unsigned long long)result.lines, result.lines == 1 ? "" : "s");
+        }
+        editor_set_cmd_status_message((u8 *)message);
+    }
+    else
+    {
+        editor_set_cmd_status_message((u8 *)message);
+    }
+
+    free(pattern.s);
+    free(replacement.s);
+}
+
+/*
+ * :g/pattern/cmd over lines [first_line, last_line], :v and :g! when
+ * `invert`. The matching lines are found first, then the command runs on
+ * all of them as one batched edit, so `:g/x/d` costs one rebuild of the
+ * pieces and line index however many lines go. The commands are d, s and
+ * none, which counts the lines.
+ */
+void
+editor_global(u64 first_line, u64 last_line, string args, u8 invert)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+    char message[sizeof(E.status_message)];
+    global_lines gl;
+    string pattern;
+    string rest;
+    u64 i = 1;
+    u8 delim;
+
+    if (args.len == 0 || isalnum(args.s[0]) || args.s[0] == ' ' || args.s[0] == '\\' ||
+        args.s[0] == '"' || args.s[0] == '|')
+    {
+        editor_set_cmd_status_message((u8 *)"Regular expression missing from :global");
+        return;
+    }
+
+    delim = args.s[0];
+    pattern = subst_field(args, &i, delim);
+    i += i < args.len;
+    while (i < args.len && (args.s[i] == ' ' || args.s[i] == '\t'))
+    {
+        i++;
+    }
+    rest = (string){.s = args.s + i, .len = args.len - i};
+    while (rest.len > 0 && (rest.s[rest.len - 1] == ' ' || rest.s[rest.len - 1] == '\t'))
+    {
+        rest.len--;
+    }
+
+    if (pattern.len == 0 && E.last_search_len == 0)
+    {
+        editor_set_cmd_status_message((u8 *)"No previous search pattern");
+        free(pattern.s);
+        return;
+    }
+    if (pattern.len == 0)
+    {
+        free(pattern.s);
+        pattern.s = (u8 *)malloc((size_t)E.last_search_len + 1);
+        if (pattern.s == NULL)
+        {
+            fprintf(stderr, "[error] editor_global unable to malloc\n");
+            exit(1);
+        }
+        memcpy(pattern.s, E.last_search, (size_t)E.last_search_len);
+        pattern.len = E.last_search_len;
+    }
+
+    if (!(rest.len == 0 || (rest.len == 1 && rest.s[0] == 'd') ||
+          (rest.len == 6 && memcmp(rest.s, "delete", 6) == 0) ||
+          (rest.s[0] == 's' && (rest.len == 1 || !isalpha(rest.s[1])))))
+    {
+        snprintf(message, sizeof(message), "Not supported under :global: %.*s", (int)rest.len,
+                 (char *)rest.s);
+        editor_set_cmd_status_message((u8 *)message);
+        free(pattern.s);
+        return;
+    }
+
+    if (!global_match(b, first_line, last_line, pattern, invert, &gl, message, sizeof(message)))
+    {
+        editor_set_cmd_status_message((u8 *)message);
+        free(pattern.s);
+        return;
+    }
+
+    if (gl.selected == 0)
+    {
+        snprintf(message, sizeof(message), "%s: %.*s",
+                 invert ? "Pattern found in every line" : "Pattern not found", (int)pattern.len,
+                 (char *)pattern.s);
+    }
+    else if (rest.len == 0)
+    {
+        snprintf(message, sizeof(message), "%llu matching line%s",
+                 (unsigned long long)gl.selected, gl.selected == 1 ? "" : "s");
+    }
+    else if (rest.s[0] == 'd')
+    {
+        u64 line = global_delete(b, &gl);
+
+        if (line >= b->lines.count)
+        {
+            line = b->lines.count - 1;
+        }
+        view_set_cursor_from_offset(v, b, buffer_line_start(b, line));
+        view_scroll_to_cursor(v);
+        snprintf(message, sizeof(message), "%llu line%s deleted",
+                 (unsigned long long)gl.selected, gl.selected == 1 ? "" : "s");
+    }
+    else
+    {
+        string sub_pattern;
+        string replacement;
+        subst_result result;
+        subst_batch sb;
+        u64 flags;
+        u64 run_first;
+        u64 run_last;
+        u64 line = first_line;
+
+        rest.s++;
+        rest.len--;
+        if (subst_parse(rest, &sub_pattern, &replacement, &flags, message, sizeof(message)))
+        {
+            /* an empty :s pattern is the :g one, as in vi */
+            if (subst_begin(&sb, b, sub_pattern.len ? sub_pattern : pattern, replacement, flags,
+                            message, sizeof(message)))
+            {
+                while (global_next_run(&gl, &line, &run_first, &run_last))
+                {
+                    subst_collect(&sb, run_first, run_last);
+                }
+                subst_finish(&sb, &result);
+
+                if (result.count == 0)
+                {
+                    snprintf(message, sizeof(message), "Pattern not found: %.*s",
+                             (int)(sub_pattern.len ? sub_pattern.len : pattern.len),
+                             sub_pattern.len ? (char *)sub_pattern.s : (char *)pattern.s);
+                }
+                else
+                {
+                    if (!(flags & SUBST_COUNT))
+                    {
+                        view_set_cursor_from_offset(v, b, result.last_line_start);
+                        view_scroll_to_cursor(v);
+                    }
+                    snprintf(message, sizeof(message), "%llu %s%s on %llu line%s",
+                             (unsigned long long)result.count,
+                             flags & SUBST_COUNT ? "match" : "substitution",
+                             result.count == 1 ? "" : flags & SUBST_COUNT ? "es" : "s",
+                             (unsigned long long)result.lines, result.lines == 1 ? "" : "s");
+                }
+            }
+            free(sub_pattern.s);
+            free(replacement.s);
+        }
+    }
+
+    editor_set_cmd_status_message((u8 *)message);
+    global_lines_free(&gl);
+    free(pattern.s);
+}
+
+/*
+ * The line of a /pattern/ or ?pattern? address: the first match below line
+ * `from`, or the last one above it, wrapping around the buffer. An empty
+ * pattern is the last search.
+ */
+int
+editor_search_line(string pattern, u64 from, u8 backward, u64 *line)
+{
+    buffer *b = editor_active_buffer();
+    regex re;
+    regex *compiled = NULL;
+    u64 start;
+    u64 offset;
+    u64 len;
+    u64 col;
+    int found;
+
+    if (pattern.len == 0)
+    {
+        pattern = (string){.s = E.last_search, .len = E.last_search_len};
+    }
+    if (pattern.len == 0)
+    {
+        return 0;
+    }
+
+    if (!regex_is_literal(pattern))
+    {
+        if (!regex_compile(&re, pattern))
+        {
+            return 0;
+        }
+        compiled = &re;
+    }
+
+    if (backward)
+    {
+        start = buffer_line_start(b, from);
+    }
+    else
+    {
+        start = from + 1 < b->lines.count ? buffer_line_start(b, from + 1) : b->total_len;
+    }
+
+    found = editor_search_step(b, pattern, compiled, 0, start, backward, &offset, &len);
+    if (compiled != NULL)
+    {
+        regex_free(compiled);
+    }
+
+    if (found)
+    {
+        buffer_offset_to_line_col(b, offset, line, &col);
+    }
+    return found;
+}
+
+static void
+editor_cursor_to_line(view *v, buffer *b, u64 line)
+{
+    view_set_cursor_from_offset(v, b, editor_line_first_nonblank_offset(b, line));
+    view_scroll_to_cursor(v);
+}
+
+/* :N, a range alone moves the cursor to its last line. */
+void
+editor_goto_line(u64 line)
+{
+    editor_cursor_to_line(&E.views[E.active_view], editor_active_buffer(), line);
+}
+
+/* :d, lines [first_line, last_line] go to register `name` and out of the buffer in one delete. */
+void
+editor_delete_lines(u64 first_line, u64 last_line, u8 name)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+    u64 start;
+    u64 end;
+    u64 line;
+    u64 col;
+
+    lines_span(b, first_line, last_line, &start, &end);
+    if (end > start)
+    {
+        registers_delete(&E.regs, name, b, start, end - start, REGISTER_LINEWISE);
+    }
+
+    buffer_offset_to_line_col(b, delete_lines(b, first_line, last_line), &line, &col);
+    editor_cursor_to_line(v, b, line);
+}
+
+void
+editor_yank_lines(u64 first_line, u64 last_line, u8 name)
+{
+    buffer *b = editor_active_buffer();
+    u64 start;
+    u64 end;
+
+    lines_span(b, first_line, last_line, &start, &end);
+    if (end > start)
+    {
+        registers_yank(&E.regs, name, b, start, end - start, REGISTER_LINEWISE);
+    }
+}
+
+/* :> and :<, `levels` is how many of the character were given. */
+void
+editor_shift_lines(u64 first_line, u64 last_line, u64 levels, u8 left)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+
+    if (left)
+    {
+        dedent_lines(b, first_line, last_line, levels);
+    }
+    else
+    {
+        indent_lines(b, first_line, last_line, levels);
+    }
+
+    editor_cursor_to_line(v, b, last_line);
+}
+
+/* :t and :m, `dest` counts lines from 1 and 0 is above the first one. */
+void
+editor_copy_lines(u64 first_line, u64 last_line, u64 dest, u8 move)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = editor_active_buffer();
+    u64 offset;
+    u64 line;
+    u64 col;
+
+    if (!move)
+    {
+        offset = copy_lines(b, first_line, last_line, dest);
+    }
+    else if (!move_lines(b, first_line, last_line, dest, &offset))
+    {
+        editor_set_cmd_status_message((u8 *)"Cannot move a range of lines into itself");
+        return;
+    }
+
+    buffer_offset_to_line_col(b, offset, &line, &col);
+    editor_cursor_to_line(v, b, line + last_line - first_line);
+}
+
+/*
+ * :normal, `keys` run as if typed with the cursor at the start of each of
+ * lines [first_line, last_line] in turn, ending with ESC if they leave a
+ * mode open. Lines the keys add or remove move the ones still to come, and
+ * nothing is drawn until all of them are done.
+ */
+void
+editor_normal(u64 first_line, u64 last_line, string keys)
+{
+    view *v = &E.views[E.active_view];
+    arena_checkpoint checkpoint = arena_save(&E.scratch);
+    u64 remaining = last_line - first_line + 1;
+    u64 line = first_line;
+    u8 *typed;
+    u64 i;
+
+    /* keys that open the command line write over E.cmd, where `keys` is */
+    typed = (u8 *)arena_push(&E.scratch, keys.len);
+    memcpy(typed, keys.s, (size_t)keys.len);
+    E.cmd.cur_pos = 0;
+    E.mode = EDITOR_NORMAL_MODE;
+
+    while (remaining > 0 && E.running)
+    {
+        buffer *b = editor_active_buffer();
+        u64 before = b->lines.count;
+
+        if (line >= b->lines.count)
+        {
+            break;
+        }
+
+        view_set_cursor_from_offset(v, b, buffer_line_start(b, line));
+        for (i = 0; i < keys.len; i++)
+        {
+            editor_process_keypress(typed[i]);
+        }
+        for (i = 0; i < 4 && E.mode != EDITOR_NORMAL_MODE; i++)
+        {
+            editor_process_keypress(ESC);
+        }
+
+        line = (u64)((s64)line + 1 + (s64)b->lines.count - (s64)before);
+        remaining--;
+    }
+
+    view_scroll_to_cursor(v);
+    arena_restore(&E.scratch, checkpoint);
+}
+
+/* Ctrl-P, the path index is built on first use and kept afterwards. */
+static void
+editor_open_finder(void)
+{
+    if (!E.paths.started)
+    {
+        path_index_build(&E.paths, (string){.s = (u8 *)".", .len = 1});
+    }
+
+    fuzzy_set_query(&E.finder, &E.paths, (string){.s = E.finder.query, .len = 0});
+    E.finder_selected = 0;
+    E.mode = EDITOR_FINDER_MODE;
+}
+
+/*
+ * Copies out the path of the `index`th best result, the pool may move. It
+ * is empty if the watcher removed the path or rebuilt the index since.
+ */
+static void
+editor_finder_path(u64 index, char *out, u64 out_len)
+{
+    pthread_mutex_lock(&E.paths.lock);
+    if (E.finder.generation == E.paths.generation)
+    {
+        snprintf(out, (size_t)out_len, "%s", E.paths.pool + E.paths.offsets[E.finder.results[index].path]);
+    }
+    else
+    {
+        out[0] = '\0';
+    }
+    pthread_mutex_unlock(&E.paths.lock);
+}
+
+static void
+editor_process_finder_key(view *v, int c)
+{
+    u8 query[FUZZY_MAX_QUERY];
+    u64 len = E.finder.query_len;
+
+    memcpy(query, E.finder.query, (size_t)len);
+
+    switch (c) {
+    case ESC:
+        E.mode = EDITOR_NORMAL_MODE;
+        return;
+    /* the best result is drawn at the bottom, next to the prompt */
+    case CTRL_P:
+    case ARROW_UP:
+        if (E.finder_selected + 1 < E.finder.result_count)
+        {
+            E.finder_selected++;
+        }
+        return;
+    case CTRL_N:
+    case ARROW_DOWN:
+        if (E.finder_selected > 0)
+        {
+            E.finder_selected--;
+        }
+        return;
+    case ENTER:
+        {
+            char path[KB(4)];
+            char message[sizeof(E.status_message)];
+            u64 id;
+
+            E.mode = EDITOR_NORMAL_MODE;
+            if (E.finder.result_count == 0)
+            {
+                return;
+            }
+
+            editor_finder_path(E.finder_selected, path, sizeof(path));
+            if (!editor_open_file(path, &id))
+            {
+                snprintf(message, sizeof(message), "Unable to open %s", path);
+                editor_set_cmd_status_message((u8 *)message);
+                return;
+            }
+
+            editor_show_buffer(v, id);
+            return;
+        }
+    case BACKSPACE:
+        if (len == 0)
+        {
+            return;
+        }
+        len--;
+        break;
+    default:
+        if (c < 32 || c > 126 || len == FUZZY_MAX_QUERY)
+        {
+            return;
+        }
+        query[len++] = (u8)c;
+        break;
+    }
+
+    fuzzy_set_query(&E.finder, &E.paths, (string){.s = query, .len = len});
+    E.finder_selected = 0;
+}
+
+/* Runs one slice of the pending match or word scans or one step of an index build, 0 when there is none. */
+int
+editor_background_work(void)
+{
+    u64 i;
+
+    for (i = 0; i < EDITOR_MAX_BUFFERS; i++)
+    {
+        match_index *mi = &E.search_index[i];
+
+        if (mi->active && !match_index_complete(mi))
+        {
+            match_index_scan(mi, MATCH_INDEX_SCAN_CHUNK);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < E.buffer_count; i++)
+    {
+        if (word_index_scan(&E.words[i], WORD_INDEX_SCAN_CHUNK))
+        {
+            return 1;
+        }
+    }
+
+    return editor_index_work();
+}
+
+void
+editor_move_cursor(u64 key, u64 count)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = &E.buffers[v->buffer_id];
+
+    switch (key) {
+        case KEY_J:
+            if (count > b->lines.count - 1 - v->cursor.y)
+            {
+                count = b->lines.count - 1 - v->cursor.y;
+            }
+            v->cursor.y += count;
+            editor_clamp_cursor_x(v, b);
+            view_scroll_to_cursor(v);
+            break;
+        case KEY_K:
+            if (count > v->cursor.y)
+            {
+                count = v->cursor.y;
+            }
+            v->cursor.y -= count;
+            editor_clamp_cursor_x(v, b);
+            view_scroll_to_cursor(v);
+            break;
+        case KEY_L:
+            {
+                u64 line_len = buffer_line_len(b, v->cursor.y);
+
+                if (line_len > 0 && v->cursor.x + count > line_len - 1)
+                {
+                    v->cursor.x = line_len - 1;
+                }
+                else if (line_len > 0)
+                {
+                    v->cursor.x += count;
+                }
+                break;
+            }
+        case KEY_H:
+            if (count > v->cursor.x)
+            {
+                count = v->cursor.x;
+            }
+            v->cursor.x -= count;
+            break;
+    }
+}
+
+void
+editor_process_keypress(int c)
+{
+    view *v = &E.views[E.active_view];
+    buffer *b = &E.buffers[v->buffer_id];
+
+    if (E.mode == EDITOR_NORMAL_MODE)
+    {
+        if (E.register_select)
+        {
+            E.register_select = FALSE;
+            E.register_name = registers_valid_name((u8)c) ? (u8)c : 0;
+            return;
+        }
+
+        if (editor_accumulate_count(c))
+        {
+            return;
+        }
+
+        switch(c) {
+        case 'A':
+            {
+                u64 offset = insert_at_end_of_line(b, v->cursor.y);
+                view_set_cursor_from_offset(v, b, offset);
+                break;
+            }
+        case 'a':
+            {
+                view_set_cursor_from_offset(v, b, v->cursor.x + 1);
+                E.mode = EDITOR_INSERT_MODE;
+                break;
+            }
+        case 'J':
+            {
+                u64 line = v->cursor.y;
+                u64 prev_cursor = editor_cursor_offset(v, b);
+
+                join_lines(b, line);
+
+                view_set_cursor_from_offset(v, b, prev_cursor);
+                view_scroll_to_cursor(v);
+                break;
+            }
+        case 'j':
+        case 'k':
+        case 'h':
+        case 'l':
+            {
+                editor_move_cursor(c, editor_take_count());
+                break;
+            }
+        case 'u':
+            {
+                /* undo */
+                break;
+            }
+        case 'v':
+            {
+                editor_enter_visual(v, b, EDITOR_VISUAL_CHAR);
+                break;
+            }
+        case 'V':
+            {
+                editor_enter_visual(v, b, EDITOR_VISUAL_LINE);
+                break;
+            }
+        case CTRL_V:
+            {
+                editor_enter_visual(v, b, EDITOR_VISUAL_BLOCK);
+                break;
+            }
+        case '/':
+        case '?':
+            {
+                editor_begin_search(v, b, c == '?');
+                break;
+            }
+        case 'n':
+        case 'N':
+            {
+                editor_search_next(v, b, c == 'N', editor_take_count());
+                break;
+            }
+        case '*':
+        case '#':
+            {
+                editor_search_word(v, b, c == '#', editor_take_count());
+                break;
+            }
+        case 'K':
+            {
+                editor_take_count();
+                if (!lsp_hover(&E.lsp, b, editor_cursor_offset(v, b)))
+                {
+                    editor_set_cmd_status_message((u8 *)(E.lsp.running ? "Language server not ready" :
+                                                                         "No language server"));
+                }
+                break;
+            }
+        case ':':
+            {
+                E.mode = EDITOR_COMMAND_MODE;
+                u8 *colon = (u8*)":";
+                arena_push_array(&E.cmd, colon, 1);
+                break;
+            }
+        case 'i':
             {
                 E.mode = EDITOR_INSERT_MODE;
                 break;
@@ -535,62 +3674,25 @@ editor_process_keypress(int c)
                 view_scroll_to_cursor(v);
                 break;
             }
-        case PASTE:
+        case 'r':
             {
-                u64 line;
-                u64 insert_off;
-
-                if (E.paste_newline)
-                {
-                    line = v->cursor.y;
-                    insert_off = buffer_line_start(b, line) +
-                        buffer_line_len(b, line);
-                    buffer_insert(b, insert_off, *E.register_one);
-                    view_set_cursor_from_offset(v, b, insert_off);
-                    view_scroll_to_cursor(v);
-                    break;
-                }
-
-                line = v->cursor.y;
-                insert_off = editor_cursor_offset(v, b);
-                buffer_insert(b, insert_off, *E.register_one);
-                view_set_cursor_from_offset(v, b, insert_off);
-                view_scroll_to_cursor(v);
-                break;
+                E.mode = EDITOR_PENDING_OP_MODE;
+                E.pending_replace = TRUE;
+                return;
             }
-        case PASTE_BEFORE:
+        case PASTE:
             {
-                if (E.paste_newline)
-                {
-                    u64 insert_off = buffer_line_start(b, v->cursor.y);
-                    string nl = {.s = (u8*)"\n", .len = 1};
-                    buffer_insert(b, insert_off, *E.register_one);
-                    buffer_insert(b, insert_off + E.register_one->len, nl);
-                    view_set_cursor_from_offset(v, b, insert_off);
-                    view_scroll_to_cursor(v);
-                    break;
-                }
-
-                u64 insert_off = editor_cursor_offset(v, b);
-                buffer_insert(b, insert_off, *E.register_one);
-                view_set_cursor_from_offset(v, b, insert_off);
-                view_scroll_to_cursor(v);
+                editor_put(v, b, 0, editor_take_count());
                 break;
             }
-        case 'g':
-        case REPLACE:
-        case CLEAR:
-        case DELETE:
-        case YANK:
+        case PASTE_BEFORE:
             {
-                E.mode = EDITOR_PENDING_OP_MODE;
-                E.pending_op = c;
+                editor_put(v, b, 1, editor_take_count());
                 break;
             }
-        case 'G':
+        case '"':
             {
-                view_set_cursor_from_offset(v, b, b->total_len - 1);
-                view_scroll_to_cursor(v);
+                E.register_select = TRUE;
                 break;
             }
         case CTRL_F:
@@ -643,12 +3745,45 @@ editor_process_keypress(int c)
                 editor_clamp_cursor_x(v, b);
                 break;
             }
+        case CTRL_P:
+            editor_open_finder();
+            break;
         case ESC:
+            if (grep_running(&E.grep))
+            {
+                grep_cancel(&E.grep);
+                editor_set_cmd_status_message((u8*)"grep cancelled");
+            }
             break;
         default:
-            break;
+            {
+                u8 key = (u8)c;
+                u64 index;
+                const editor_motion *motion = NULL;
+                editor_keys_match op_match = editor_find_operator(&key, 1, &index);
+                editor_keys_match motion_match = editor_find_motion(&key, 1, 0, &motion);
+
+                if (op_match != EDITOR_KEYS_NONE || motion_match == EDITOR_KEYS_PREFIX)
+                {
+                    E.mode = EDITOR_PENDING_OP_MODE;
+                    E.pending_op = 0;
+                    E.pending_keys_len = 0;
+                    E.op_count = E.count;
+                    E.count = 0;
+                    editor_process_pending_key(v, b, c);
+                    return;
+                }
+
+                if (motion_match == EDITOR_KEYS_EXACT)
+                {
+                    editor_motion_move_cursor(v, b, motion);
+                    return;
+                }
+                break;
+            }
         }
 
+        E.count = 0;
         return;
     }
 
@@ -656,9 +3791,23 @@ editor_process_keypress(int c)
     {
         u64 offset = editor_cursor_offset(v, b);
 
+        if (E.completing && c != CTRL_N && c != CTRL_P)
+        {
+            E.completing = 0;
+            editor_set_cmd_status_message(NULL);
+        }
+
         switch (c) {
+        case CTRL_N:
+        case CTRL_P:
+            editor_complete_word(v, b, c == CTRL_N);
+            break;
         case ESC:
             E.mode = EDITOR_NORMAL_MODE;
+            if (E.block_insert)
+            {
+                editor_finish_block_insert(v, b);
+            }
             break;
         case BACKSPACE:
         case DEL_KEY:
@@ -674,157 +3823,74 @@ editor_process_keypress(int c)
                 /* @cleanup: backspace is 4 */
                 buffer_insert(b, offset, TAB);
                 view_set_cursor_from_offset(v, b, offset + TAB.len);
-                view_scroll_to_cursor(v);
-                break;
-            }
-        case ENTER:
-            {
-                break;
-            }
-        default:
-            if (c >= 32 && c <= 126)
-            {
-                u8 ch = (u8)c;
-                string text = {.s = &ch, .len = 1};
-                buffer_insert(b, offset, text);
-                view_set_cursor_from_offset(v, b, offset + 1);
-                view_scroll_to_cursor(v);
-            }
-            break;
-        }
-        return;
-    }
-
-    if (E.mode == EDITOR_PENDING_OP_MODE)
-    {
-        if (c == ESC)
-        {
-            editor_clear_pending_op();
-            return;
-        }
-
-        if (E.pending_op == YANK)
-        {
-            if (E.pending_op_stage == 0)
-            {
-                if (c == INNER)
-                {
-                    E.pending_op_stage = 1;
-                    return;
-                }
-                else if (c == 'w')
-                {
-
-                }
-                else if (c == YANK)
-                {
-                    editor_free_register_one();
-                    string *s = malloc(sizeof(string));
-                    u64 line = v->cursor.y;
-                    u64 start = buffer_line_start(b, line);
-                    u64 line_len = buffer_line_len(b, line);
-                    buffer_slice(b, start, line_len, s);
-
-                    E.register_one = s;
-                    E.paste_newline = TRUE;
-                    editor_clear_pending_op();
-                    return;
-                }
-            }
-
-            if (E.pending_op_stage == 1)
-            {
-                if (c == WORD)
-                {
-                    editor_range range = editor_inner_word_range(
-                            b,
-                            editor_cursor_offset(v, b)
-                            );
-
-                    if (range.end > range.start)
-                    {
-                        editor_free_register_one();
-                        string *s = (string*)malloc(sizeof(string));
-                        buffer_slice(b, range.start, range.end - range.start, s);
-                        E.register_one = s;
-                        E.paste_newline = FALSE;
-                        view_set_cursor_from_offset(v, b, range.start);
-                        editor_clamp_cursor_x(v, b);
-                        view_scroll_to_cursor(v);
-                    }
-
-                    editor_clear_pending_op();
-                    return;
-                }
-            }
-        }
-
-        if (E.pending_op == DELETE)
-        {
-            if (E.pending_op_stage == 0)
-            {
-                if (c == INNER)
-                {
-                    E.pending_op_stage = 1;
-                    return;
-                }
-                else if (c == WORD)
-                {
-                    editor_range range = editor_inner_word_range(b, editor_cursor_offset(v, b));
-
-                    if (range.end > range.start)
-                    {
-                        buffer_delete(b, range.start, range.end - range.start);
-                        view_set_cursor_from_offset(v, b, range.start);
-                        editor_clamp_cursor_x(v, b);
-                        view_scroll_to_cursor(v);
-                    }
-
-                    editor_clear_pending_op();
-                    return;
-                }
-
-                editor_clear_pending_op();
-                return;
+                view_scroll_to_cursor(v);
+                break;
             }
-
-            if (E.pending_op_stage == 1)
+        case ENTER:
             {
-                if (c == WORD)
-                {
-                    editor_range range = editor_inner_word_range(b, editor_cursor_offset(v, b));
-
-                    if (range.end > range.start)
-                    {
-                        buffer_delete(b, range.start, range.end - range.start);
-                        view_set_cursor_from_offset(v, b, range.start);
-                        editor_clamp_cursor_x(v, b);
-                        view_scroll_to_cursor(v);
-                    }
-
-                    editor_clear_pending_op();
-                    return;
-                }
-
-                editor_clear_pending_op();
-                return;
+                break;
+            }
+        default:
+            if (c >= 32 && c <= 126)
+            {
+                u8 ch = (u8)c;
+                string text = {.s = &ch, .len = 1};
+                buffer_insert(b, offset, text);
+                view_set_cursor_from_offset(v, b, offset + 1);
+                view_scroll_to_cursor(v);
             }
+            break;
         }
+        return;
+    }
 
-        if (E.pending_op == YANK)
+    if (E.mode == EDITOR_PENDING_OP_MODE)
+    {
+        if (c == ESC)
         {
-
+            editor_clear_pending_op();
             return;
         }
 
+        /* `r` takes a character instead of a motion */
+        if (E.pending_replace)
+        {
+            editor_pending_replace(v, b, c, editor_take_count());
+            editor_clear_pending_op();
+            return;
+        }
 
+        if (E.pending_op != 0 && E.pending_keys_len == 0 && editor_accumulate_count(c))
+        {
+            return;
+        }
 
-        editor_clear_pending_op();
+        editor_process_pending_key(v, b, c);
         return;
     }
 
     if (E.mode == EDITOR_VISUAL_MODE)
     {
+        if (E.register_select)
+        {
+            E.register_select = FALSE;
+            E.register_name = registers_valid_name((u8)c) ? (u8)c : 0;
+            return;
+        }
+
+        editor_process_visual_key(v, b, c);
+        return;
+    }
+
+    if (E.mode == EDITOR_SEARCH_MODE)
+    {
+        editor_process_search_key(v, b, c);
+        return;
+    }
+
+    if (E.mode == EDITOR_FINDER_MODE)
+    {
+        editor_process_finder_key(v, c);
         return;
     }
 
@@ -886,12 +3952,185 @@ buffer* editor_active_buffer()
 void
 editor_at_exit()
 {
-    editor_free_register_one();
+    lsp_stop(&E.lsp);
+    registers_free(&E.regs);
     write(STDOUT_FILENO, SHOW_CURSOR, SHOW_CURSOR_LEN);
     term_exit_alt_screen();
     term_disable_raw_mode(STDIN_FILENO);
 }
 
+#define EDITOR_MAX_DRAW_COLS 1024
+
+typedef enum {
+    EDITOR_HL_NONE = 0,
+    EDITOR_HL_SELECTION,
+    EDITOR_HL_SEARCH,
+    /* plus a syntax_class, SYNTAX_NORMAL being no color */
+    EDITOR_HL_SYNTAX,
+} editor_highlight;
+
+static const char *editor_syntax_fg[SYNTAX_CLASS_COUNT] = {
+    "", KEYWORD_FG, TYPE_FG, STRING_FG, NUMBER_FG, COMMENT_FG, PREPROC_FG,
+};
+
+/* Writes one row of text, switching attributes only where they change. */
+static void
+editor_write_row(u8 *text, u8 *attrs, u64 len, u8 is_cursor_line)
+{
+    u8 out[EDITOR_MAX_DRAW_COLS * 8];
+    u64 used = 0;
+    u8 current = EDITOR_HL_NONE;
+    u64 i;
+
+    for (i = 0; i < len; i++)
+    {
+        /* room for the longest run of attributes and one byte */
+        if (used + 32 > sizeof(out))
+        {
+            write(STDOUT_FILENO, out, (size_t)used);
+            used = 0;
+        }
+
+        if (attrs[i] != current)
+        {
+            memcpy(out + used, RESET_ATTRS, RESET_ATTRS_LEN);
+            used += RESET_ATTRS_LEN;
+
+            if (is_cursor_line)
+            {
+                memcpy(out + used, CURSOR_LINE_BG, CURSOR_LINE_BG_LEN);
+                used += CURSOR_LINE_BG_LEN;
+            }
+
+            if (attrs[i] == EDITOR_HL_SELECTION)
+            {
+                memcpy(out + used, SELECTION_BG, SELECTION_BG_LEN);
+                used += SELECTION_BG_LEN;
+            }
+            else if (attrs[i] == EDITOR_HL_SEARCH)
+            {
+                memcpy(out + used, SEARCH_BG, SEARCH_BG_LEN);
+                used += SEARCH_BG_LEN;
+            }
+            else if (attrs[i] > EDITOR_HL_SYNTAX)
+            {
+                memcpy(out + used, editor_syntax_fg[attrs[i] - EDITOR_HL_SYNTAX], SYNTAX_FG_LEN);
+                used += SYNTAX_FG_LEN;
+            }
+
+            current = attrs[i];
+        }
+
+        out[used++] = text[i];
+    }
+
+    if (current != EDITOR_HL_NONE)
+    {
+        memcpy(out + used, RESET_ATTRS, RESET_ATTRS_LEN);
+        used += RESET_ATTRS_LEN;
+
+        if (is_cursor_line)
+        {
+            memcpy(out + used, CURSOR_LINE_BG, CURSOR_LINE_BG_LEN);
+            used += CURSOR_LINE_BG_LEN;
+        }
+    }
+
+    write(STDOUT_FILENO, out, (size_t)used);
+}
+
+static void
+editor_draw_finder_row(u64 index)
+{
+    char path[KB(4)];
+    u64 len;
+
+    editor_finder_path(index, path, sizeof(path));
+    len = strlen(path);
+    if (len + 2 > (u64)E.screencols)
+    {
+        len = (u64)E.screencols > 2 ? (u64)E.screencols - 2 : 0;
+    }
+
+    write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
+    if (index == E.finder_selected)
+    {
+        write(STDOUT_FILENO, SELECTION_BG, SELECTION_BG_LEN);
+    }
+    write(STDOUT_FILENO, index == E.finder_selected ? "> " : "  ", 2);
+    write(STDOUT_FILENO, path, (size_t)len);
+    write(STDOUT_FILENO, RESET_ATTRS, RESET_ATTRS_LEN);
+}
+
+/* The candidates around the selected one, under the word or above it near the bottom. */
+static void
+editor_draw_completions(view *v, buffer *b, u64 gutter_width)
+{
+    u64 rows = E.completions.count < EDITOR_COMPLETION_ROWS ? E.completions.count : EDITOR_COMPLETION_ROWS;
+    u64 cursor_row = v->cursor.y - v->rowoff;
+    u64 line;
+    u64 col;
+    u64 first = 0;
+    u64 top;
+    u64 width = 0;
+    u64 i;
+
+    buffer_offset_to_line_col(b, E.completion_start, &line, &col);
+    col = col > v->coloff ? col - v->coloff : 0;
+    col += gutter_width;
+    if (col >= (u64)E.screencols)
+    {
+        return;
+    }
+
+    if (E.completion_selected < E.completions.count && E.completion_selected >= rows)
+    {
+        first = E.completion_selected - rows + 1;
+    }
+
+    top = cursor_row + 1 + rows <= (u64)E.screenrows ? cursor_row + 1 :
+          (cursor_row >= rows ? cursor_row - rows : 0);
+
+    for (i = first; i < first + rows; i++)
+    {
+        u64 len = word_list_get(&E.completions, i).len;
+
+        if (len > width)
+        {
+            width = len;
+        }
+    }
+
+    width += 2;
+    if (width > (u64)E.screencols - col)
+    {
+        width = (u64)E.screencols - col;
+    }
+
+    for (i = first; i < first + rows; i++)
+    {
+        string word = word_list_get(&E.completions, i);
+        char seq[32];
+        u64 k;
+
+        snprintf(seq, sizeof(seq), SET_CURSOR_POS, (int)(top + i - first + 1), (int)(col + 1));
+        write(STDOUT_FILENO, seq, strlen(seq));
+        write(STDOUT_FILENO, POPUP_BG, POPUP_BG_LEN);
+        if (i == E.completion_selected)
+        {
+            write(STDOUT_FILENO, SELECTION_BG, SELECTION_BG_LEN);
+        }
+
+        write(STDOUT_FILENO, " ", 1);
+        write(STDOUT_FILENO, word.s, (size_t)(word.len + 1 < width ? word.len : width - 1));
+        for (k = word.len + 1; k < width; k++)
+        {
+            write(STDOUT_FILENO, " ", 1);
+        }
+        write(STDOUT_FILENO, RESET_ATTRS, RESET_ATTRS_LEN);
+    }
+}
+
 void
 editor_draw()
 {
@@ -899,6 +4138,18 @@ editor_draw()
     buffer *b = editor_active_buffer();
     int screen_row;
     u64 gutter_width = 2;
+    editor_range selection = {0};
+    block_range block = {0};
+    int has_selection = 0;
+    u64 search_hit = 0;
+    u64 search_len = 0;
+    match_index *mi = &E.search_index[v->buffer_id];
+    u64 finder_rows = 0;
+    u8 text[EDITOR_MAX_DRAW_COLS];
+    u8 attrs[EDITOR_MAX_DRAW_COLS];
+    u8 classes[EDITOR_MAX_DRAW_COLS];
+    syntax_index *si = &E.syntax[v->buffer_id];
+    syntax_state state;
 
     if (b->lines.count > 0)
     {
@@ -914,14 +4165,69 @@ editor_draw()
         gutter_width += 2;
     }
 
+    if (E.mode == EDITOR_VISUAL_MODE)
+    {
+        selection = editor_visual_range(v, b);
+        has_selection = 1;
+
+        if (E.visual_kind == EDITOR_VISUAL_BLOCK)
+        {
+            block = editor_visual_block(v, b);
+            has_selection = 2;
+        }
+    }
+
+    if (E.mode == EDITOR_SEARCH_MODE && E.search_len > 0 && E.search_found[E.search_len - 1])
+    {
+        search_hit = E.search_hits[E.search_len - 1];
+        search_len = E.search_lens[E.search_len - 1];
+    }
+
+    /* the visible lines are indexed now, the rest in the background */
+    if (E.hlsearch && b->lines.count > 0)
+    {
+        u64 last = v->rowoff + E.screenrows;
+
+        if (last > b->lines.count)
+        {
+            last = b->lines.count;
+        }
+
+        if (v->rowoff < last)
+        {
+            match_index_scan_range(mi, buffer_line_start(b, v->rowoff),
+                                   buffer_line_start(b, last - 1) + buffer_line_len(b, last - 1) + 1);
+        }
+    }
+
+    /* only the visible lines are lexed, from the state the first one starts in */
+    state = syntax_state_at(si, v->rowoff);
+
     write(STDOUT_FILENO, HIDE_CURSOR, HIDE_CURSOR_LEN);
     write(STDOUT_FILENO, CURSOR_HOME, CURSOR_HOME_LEN);
 
+    if (E.mode == EDITOR_FINDER_MODE)
+    {
+        finder_rows = E.finder.result_count < (u64)E.screenrows / 2 ?
+                      E.finder.result_count : (u64)E.screenrows / 2;
+    }
+
     for (screen_row = 0; screen_row < E.screenrows; screen_row++)
     {
         u64 line = v->rowoff + screen_row;
         u8 is_cursor_line = (line == v->cursor.y);
 
+        /* finder results cover the last rows, the best one at the bottom */
+        if ((u64)screen_row + finder_rows >= (u64)E.screenrows)
+        {
+            editor_draw_finder_row((u64)(E.screenrows - 1 - screen_row));
+            if (screen_row < E.screenrows - 1)
+            {
+                write(STDOUT_FILENO, "\r\n", 2);
+            }
+            continue;
+        }
+
         if (is_cursor_line)
         {
             write(STDOUT_FILENO, CURSOR_LINE_BG, CURSOR_LINE_BG_LEN);
@@ -961,6 +4267,11 @@ editor_draw()
                 text_cols = (u64)E.screencols - gutter_width;
             }
 
+            if (text_cols > EDITOR_MAX_DRAW_COLS)
+            {
+                text_cols = EDITOR_MAX_DRAW_COLS;
+            }
+
             if (draw_start < line_len && text_cols > 0)
             {
                 draw_len = line_len - draw_start;
@@ -969,13 +4280,94 @@ editor_draw()
                     draw_len = text_cols;
                 }
 
+                buffer_read(b, line_start + draw_start, draw_len, text);
+            }
+
+            memset(attrs, EDITOR_HL_NONE, (size_t)text_cols);
+
+            if (si->lang != NULL)
+            {
+                state = syntax_lex_line(si, line, state, classes, draw_start, draw_len);
                 for (i = 0; i < draw_len; i++)
                 {
-                    u8 c = buffer_byte_at(b, line_start + draw_start + i);
-                    write(STDOUT_FILENO, &c, 1);
+                    if (classes[i] != SYNTAX_NORMAL)
+                    {
+                        attrs[i] = (u8)(EDITOR_HL_SYNTAX + classes[i]);
+                    }
+                }
+            }
+
+            if (has_selection == 2)
+            {
+                if (line >= block.first_line && line <= block.last_line)
+                {
+                    for (i = 0; i < draw_len; i++)
+                    {
+                        if (draw_start + i >= block.left && draw_start + i <= block.right)
+                        {
+                            attrs[i] = EDITOR_HL_SELECTION;
+                        }
+                    }
+                }
+            }
+            else if (has_selection)
+            {
+                /* only this row's slice of the selection is looked at */
+                u64 row_start = line_start + draw_start;
+                u64 row_end = line_start + line_len + 1;
+                u64 from = selection.start > row_start ? selection.start : row_start;
+                u64 to = selection.end < row_end ? selection.end : row_end;
+
+                if (from < to && line_start + line_len >= row_start)
+                {
+                    if (draw_len == 0 && text_cols > 0)
+                    {
+                        text[0] = ' ';
+                        draw_len = 1;
+                    }
+
+                    for (i = from - row_start; i < to - row_start && i < draw_len; i++)
+                    {
+                        attrs[i] = EDITOR_HL_SELECTION;
+                    }
+                }
+            }
+
+            if (E.hlsearch && mi->active)
+            {
+                u64 row_start = line_start + draw_start;
+                u64 row_end = row_start + draw_len;
+                u64 k;
+
+                for (k = match_index_lower_bound(mi, line_start);
+                     k < mi->count && mi->items[k].start < row_end; k++)
+                {
+                    u64 from = mi->items[k].start > row_start ? mi->items[k].start : row_start;
+                    u64 to = mi->items[k].start + mi->items[k].len < row_end ?
+                             mi->items[k].start + mi->items[k].len : row_end;
+
+                    for (i = from; i < to; i++)
+                    {
+                        attrs[i - row_start] = EDITOR_HL_SEARCH;
+                    }
+                }
+            }
+
+            if (search_len > 0)
+            {
+                u64 row_start = line_start + draw_start;
+                u64 from = search_hit > row_start ? search_hit : row_start;
+                u64 to = search_hit + search_len < row_start + draw_len ?
+                         search_hit + search_len : row_start + draw_len;
+
+                for (i = from; i < to; i++)
+                {
+                    attrs[i - row_start] = EDITOR_HL_SEARCH;
                 }
             }
 
+            editor_write_row(text, attrs, draw_len, is_cursor_line);
+
             for (i = gutter_width + draw_len; i < (u64)E.screencols; i++)
             {
                 write(STDOUT_FILENO, " ", 1);
@@ -998,6 +4390,39 @@ editor_draw()
     write(STDOUT_FILENO, NEXT_LINE, NEXT_LINE_LEN);
     write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
     write(STDOUT_FILENO, b->file_path.s, b->file_path.len);
+    if (E.hlsearch && match_index_complete(mi) && E.mode == EDITOR_NORMAL_MODE)
+    {
+        u64 offset = editor_cursor_offset(v, b);
+        u64 k = match_index_lower_bound(mi, offset);
+
+        if (k < mi->count && mi->items[k].start == offset)
+        {
+            char position[64];
+            int position_len = snprintf(position, sizeof(position), "  match %llu of %llu",
+                                        (unsigned long long)(k + 1),
+                                        (unsigned long long)mi->count);
+
+            write(STDOUT_FILENO, position, (size_t)position_len);
+        }
+    }
+    if (editor_lsp_diagnostics(b) > 0)
+    {
+        char diagnostics[64];
+        int diagnostics_len = snprintf(diagnostics, sizeof(diagnostics), "  %llu diagnostics",
+                                       (unsigned long long)editor_lsp_diagnostics(b));
+
+        write(STDOUT_FILENO, diagnostics, (size_t)diagnostics_len);
+    }
+    if (E.grep.started)
+    {
+        char progress[96];
+        int progress_len = snprintf(progress, sizeof(progress), "  grep: %llu matches%s%s",
+                                    (unsigned long long)grep_hit_count(&E.grep),
+                                    E.grep.truncated ? " (truncated)" : "",
+                                    grep_running(&E.grep) ? ", searching (ESC to stop)" : "");
+
+        write(STDOUT_FILENO, progress, (size_t)progress_len);
+    }
     write(STDOUT_FILENO, "\x1b[0m", 4);
 
     /* command bar */
@@ -1009,15 +4434,59 @@ editor_draw()
         write(STDOUT_FILENO, SHOW_CURSOR, SHOW_CURSOR_LEN);
         return;
     }
+    else if (E.mode == EDITOR_FINDER_MODE)
+    {
+        char counts[64];
+        int counts_len = snprintf(counts, sizeof(counts), "  %llu/%llu%s",
+                                  (unsigned long long)E.finder.survivor_count,
+                                  (unsigned long long)E.finder.seen,
+                                  path_index_building(&E.paths) ? " (indexing)" : "");
+
+        write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
+        write(STDOUT_FILENO, counts, (size_t)counts_len);
+        write(STDOUT_FILENO, "\r> ", 3);
+        write(STDOUT_FILENO, E.finder.query, E.finder.query_len);
+        write(STDOUT_FILENO, SHOW_CURSOR, SHOW_CURSOR_LEN);
+        return;
+    }
+    else if (E.mode == EDITOR_SEARCH_MODE)
+    {
+        write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
+        write(STDOUT_FILENO, E.search_backward ? "?" : "/", 1);
+        write(STDOUT_FILENO, E.search_pattern, E.search_len);
+        write(STDOUT_FILENO, SHOW_CURSOR, SHOW_CURSOR_LEN);
+        return;
+    }
     else if (E.status_message[0] != '\0')
     {
         write(STDOUT_FILENO, E.status_message, strlen((char *)E.status_message));
     }
+    else if (E.mode == EDITOR_VISUAL_MODE)
+    {
+        write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
+        if (E.visual_kind == EDITOR_VISUAL_LINE)
+        {
+            write(STDOUT_FILENO, "-- VISUAL LINE --", 17);
+        }
+        else if (E.visual_kind == EDITOR_VISUAL_BLOCK)
+        {
+            write(STDOUT_FILENO, "-- VISUAL BLOCK --", 18);
+        }
+        else
+        {
+            write(STDOUT_FILENO, "-- VISUAL --", 12);
+        }
+    }
     else
     {
         write(STDOUT_FILENO, CLEAR_LINE, CLEAR_LINE_LEN);
     }
 
+    if (E.mode == EDITOR_INSERT_MODE && E.completing)
+    {
+        editor_draw_completions(v, b, gutter_width);
+    }
+
     {
         char seq[32];
         u64 cursor_screen_x = 0;
@@ -1051,11 +4520,12 @@ void editor_init(void)
     E.mode = EDITOR_NORMAL_MODE;
     E.running = 1;
     E.alt_screen = 0;
-    E.scratch = new_arena(MB(1));
-    E.cmd = new_arena(MB(1));
+    E.scratch = new_arena(EDITOR_SCRATCH_RESERVE);
+    MEM_TAG_ARENA(&E.scratch, MEM_SCRATCH);
+    E.cmd = new_arena(EDITOR_CMD_RESERVE);
     E.status_message[0] = '\0';
 
-    buffer* buffers = (buffer*)malloc(sizeof(buffer)*32);
+    buffer* buffers = (buffer*)malloc(sizeof(buffer)*EDITOR_MAX_BUFFERS);
     if (buffers == NULL)
     {
         perror("[error] unable to allocate memory for buffers");
@@ -1069,8 +4539,60 @@ void editor_init(void)
     readfile(p, &file, MAX_FILE_SIZE);
 
     buffer_init(&E.buffers[0], file, path);
+    E.buffer_count = 1;
+
+    match_index* search_index = (match_index*)malloc(sizeof(match_index)*EDITOR_MAX_BUFFERS);
+    if (search_index == NULL)
+    {
+        perror("[error] unable to allocate memory for search indexes");
+        exit(1);
+    }
+    memset(search_index, 0, sizeof(match_index)*EDITOR_MAX_BUFFERS);
+    E.search_index = search_index;
+    match_index_init(&E.search_index[0], &E.buffers[0]);
+    E.hlsearch = 0;
+
+    bracket_index* brackets = (bracket_index*)malloc(sizeof(bracket_index)*EDITOR_MAX_BUFFERS);
+    if (brackets == NULL)
+    {
+        perror("[error] unable to allocate memory for bracket indexes");
+        exit(1);
+    }
+    memset(brackets, 0, sizeof(bracket_index)*EDITOR_MAX_BUFFERS);
+    E.brackets = brackets;
+    bracket_index_init(&E.brackets[0], &E.buffers[0]);
+
+    line_class_index* line_classes = (line_class_index*)malloc(sizeof(line_class_index)*EDITOR_MAX_BUFFERS);
+    if (line_classes == NULL)
+    {
+        perror("[error] unable to allocate memory for line classes");
+        exit(1);
+    }
+    memset(line_classes, 0, sizeof(line_class_index)*EDITOR_MAX_BUFFERS);
+    E.line_classes = line_classes;
+    line_class_init(&E.line_classes[0], &E.buffers[0]);
+
+    syntax_index* syntax = (syntax_index*)malloc(sizeof(syntax_index)*EDITOR_MAX_BUFFERS);
+    if (syntax == NULL)
+    {
+        perror("[error] unable to allocate memory for syntax indexes");
+        exit(1);
+    }
+    memset(syntax, 0, sizeof(syntax_index)*EDITOR_MAX_BUFFERS);
+    E.syntax = syntax;
+    syntax_index_init(&E.syntax[0], &E.buffers[0]);
+
+    word_index* words = (word_index*)malloc(sizeof(word_index)*EDITOR_MAX_BUFFERS);
+    if (words == NULL)
+    {
+        perror("[error] unable to allocate memory for word indexes");
+        exit(1);
+    }
+    memset(words, 0, sizeof(word_index)*EDITOR_MAX_BUFFERS);
+    E.words = words;
+    word_index_init(&E.words[0], &E.buffers[0]);
 
-    view* views = (view*)malloc(sizeof(view)*32);
+    view* views = (view*)malloc(sizeof(view)*EDITOR_MAX_BUFFERS);
     if (views == NULL)
     {
         perror("[error] unable to allocate memory for buffers");
@@ -1084,7 +4606,13 @@ void editor_init(void)
     E.views[0].rowoff = 0;
     E.views[0].coloff = 0;
     E.pending_op = 0;
-    E.pending_op_stage = 0;
+    E.pending_keys_len = 0;
+    E.pending_replace = 0;
+    E.register_name = 0;
+    E.register_select = 0;
+    E.count = 0;
+    E.op_count = 0;
+    registers_init(&E.regs);
 
     /* @cleanup tmp */
     E.active_view = 0;
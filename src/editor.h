@@ -2,8 +2,22 @@
 #define EDITOR_H
 
 #include "base.h"
+#include "arena.h"
 #include "view.h"
 #include "buffer.h"
+#include "registers.h"
+#include "regex.h"
+#include "match_index.h"
+#include "bracket.h"
+#include "line_class.h"
+#include "syntax.h"
+#include "words.h"
+#include "grep.h"
+#include "path_index.h"
+#include "fuzzy.h"
+#include "trigram.h"
+#include "symbols.h"
+#include "lsp.h"
 
 #define YANK            'y'
 #define WORD            'w'
@@ -17,6 +31,9 @@
 #define TAB (string){.s = (u8*)"    ", .len = 4}
 
 #define MAX_FILE_SIZE GB(1)
+/* address space reserved for the per-frame scratch arena and the command line */
+#define EDITOR_SCRATCH_RESERVE GB((u64)4)
+#define EDITOR_CMD_RESERVE MB(64)
 
 #define EDITOR_NORMAL_MODE  1
 #define EDITOR_INSERT_MODE  2
@@ -24,6 +41,15 @@
 #define EDITOR_COMMAND_MODE 4
 #define EDITOR_PENDING_OP_MODE 5
 #define EDITOR_SEARCH_MODE 6
+#define EDITOR_FINDER_MODE 7
+
+#define EDITOR_MAX_SEARCH 256
+
+#define EDITOR_MAX_BUFFERS 32
+
+#define EDITOR_VISUAL_CHAR  0
+#define EDITOR_VISUAL_LINE  1
+#define EDITOR_VISUAL_BLOCK 2
 
 typedef struct {
     u64 mode;
@@ -32,16 +58,119 @@ typedef struct {
     u64 screencols;
     u64 rawmode;
     u64 alt_screen;
+    /* index + 1 into the operator table, 0 while the operator is being read */
     u64 pending_op;
-    u64 pending_op_stage;
+    u8 pending_keys[4];
+    u64 pending_keys_len;
+    /* `r` is waiting for its character */
+    u8 pending_replace;
+
+    /* offset where the selection started, the cursor is the other end */
+    u64 visual_anchor;
+    u8 visual_kind;
+    u8 visual_replace;
+    /* lines of the selection at its last key, for the '< and '> addresses */
+    u64 visual_first_line;
+    u64 visual_last_line;
+    u8 visual_marked;
+
+    /* text typed after a block I/A/c is repeated on the other lines on ESC */
+    u8 block_insert;
+    u8 block_insert_pad;
+    u64 block_insert_first;
+    u64 block_insert_last;
+    u64 block_insert_col;
+    u64 block_insert_start;
+
+    /* pattern being typed after / or ?, with the match found for each of
+     * its prefixes so a keystroke only refines the previous result */
+    u8 search_pattern[EDITOR_MAX_SEARCH];
+    u64 search_len;
+    u64 search_hits[EDITOR_MAX_SEARCH];
+    u64 search_lens[EDITOR_MAX_SEARCH];
+    u8 search_found[EDITOR_MAX_SEARCH];
+    regex search_re;
+    u8 search_re_valid;
+    u64 search_origin;
+    u8 search_backward;
+
+    /* last accepted pattern, for n and N */
+    u8 last_search[EDITOR_MAX_SEARCH];
+    u64 last_search_len;
+    u8 last_search_backward;
+    /* set by * and #, the pattern is a keyword matched as a whole word */
+    u8 last_search_word;
+    regex last_re;
+    u8 last_re_valid;
+
+    /* matches of the last pattern per buffer, drawn while hlsearch is set */
+    match_index *search_index;
+    u8 hlsearch;
+
+    /* bracket pairs per buffer, for % and the i( a{ objects */
+    bracket_index *brackets;
+
+    /* empty and blank line bitmaps per buffer, for { } and ip ap */
+    line_class_index *line_classes;
+
+    /* lexer states per buffer, for drawing the visible lines in color */
+    syntax_index *syntax;
+
+    /* keyword counts per buffer, for Ctrl-N and Ctrl-P in insert mode */
+    word_index *words;
+
+    /* the completion being cycled, [completion_start, + completion_len) holds
+     * the candidate shown, or the typed prefix when `completion_selected` is
+     * past the last candidate */
+    word_list completions;
+    u8 completing;
+    u8 completion_indexing;
+    u64 completion_start;
+    u64 completion_len;
+    u64 completion_selected;
+    u8 completion_prefix[WORD_INDEX_MAX_LEN];
+    u64 completion_prefix_len;
+
+    /* :grep results, :cn and :cp walk them while the search still runs */
+    grep_search grep;
+    u64 quickfix_index;
+    u64 grep_drawn;
+    u8 grep_drawn_running;
+
+    /* files under the working directory, walked the first time Ctrl-P is pressed */
+    path_index paths;
+    fuzzy_finder finder;
+    u64 finder_selected;
+
+    /* the optional trigram index of the working directory, built by :index */
+    trigram_index trigrams;
+    u64 trigrams_generation;
+    u8 trigrams_tried;
+    /* :index was asked for and waits for the path index */
+    u8 trigrams_pending;
+
+    /* declarations in the working directory for gd and :tag, built on first use */
+    symbol_index symbols;
+    u8 symbols_tried;
+    /* opened, its refresh or build waits for the path index */
+    u8 symbols_pending;
+
+    /* the language server started by :lsp, if any, for K and diagnostics */
+    lsp_client lsp;
+
+    /* count typed before a command, and before its operator if pending */
+    u64 count;
+    u64 op_count;
 
-    string *register_one;
-    u8 paste_newline;
+    registers regs;
+    u8 register_name;
+    u8 register_select;
 
     /* @cleanup tmp */
     u64 active_view;
 
     buffer* buffers;
+    u64 buffer_count;
     view* views;
 
     arena scratch;
@@ -55,9 +184,28 @@ typedef struct {
 extern editor E;
 
 u64 editor_read_key(int fd);
+int editor_background_work(void);
 void editor_process_keypress(int c);
-void editor_move_cursor(u64 c);
+void editor_move_cursor(u64 c, u64 count);
 void editor_set_cmd_status_message(u8 *msg);
+void editor_start_grep(string pattern);
+void editor_quickfix_step(int forward);
+void editor_build_trigram_index(void);
+void editor_start_lsp(const char *command);
+void editor_stop_lsp(void);
+void editor_lsp_status(void);
+void editor_mem(const char *path);
+void editor_file_written(string path);
+void editor_goto_symbol(string name);
+void editor_substitute(u64 first_line, u64 last_line, string args);
+void editor_global(u64 first_line, u64 last_line, string args, u8 invert);
+void editor_goto_line(u64 line);
+int editor_search_line(string pattern, u64 from, u8 backward, u64 *line);
+void editor_delete_lines(u64 first_line, u64 last_line, u8 name);
+void editor_yank_lines(u64 first_line, u64 last_line, u8 name);
+void editor_shift_lines(u64 first_line, u64 last_line, u64 levels, u8 left);
+void editor_copy_lines(u64 first_line, u64 last_line, u64 dest, u8 move);
+void editor_normal(u64 first_line, u64 last_line, string keys);
 buffer* editor_active_buffer();
 void editor_at_exit();
 void editor_draw();
@@ -2,30 +2,20 @@
 #define _POSIX_C_SOURCE 200809L
 #endif
 
+#include <sys/mman.h>
+
 #include "file.h"
 
-static int
-buffer_copy_path_cstr(string path, char **out)
+/* `path` and then `suffix` as a C string in `scratch`. */
+static char *
+file_copy_path_cstr(arena *scratch, string path, const char *suffix)
 {
-    char *c_path;
-
-    if (path.s == NULL || path.len == 0)
-    {
-        *out = NULL;
-        return 0;
-    }
-
-    c_path = (char *)malloc((size_t)path.len + 1);
-    if (c_path == NULL)
-    {
-        perror("[error] unable to allocate path copy");
-        return -1;
-    }
+    u64 suffix_len = strlen(suffix);
+    char *c_path = (char *)arena_push(scratch, path.len + suffix_len + 1);
 
     memcpy(c_path, path.s, (size_t)path.len);
-    c_path[path.len] = '\0';
-    *out = c_path;
-    return 0;
+    memcpy(c_path + path.len, suffix, (size_t)suffix_len + 1);
+    return c_path;
 }
 
 static int
@@ -84,16 +74,37 @@ buffer_paths_match_stat(buffer *b, struct stat *current)
     return 1;
 }
 
+/* The text is written a piece at a time rather than copied out first. */
+static int
+buffer_write_pieces(int fd, buffer *b)
+{
+    u64 offset;
+
+    for (offset = 0; offset < b->total_len;)
+    {
+        u8 *data;
+        u64 n = buffer_span_at(b, offset, &data);
+
+        if (buffer_write_all(fd, data, n) != 0)
+        {
+            return -1;
+        }
+        offset += n;
+    }
+
+    return 0;
+}
+
+/* The paths are built in `scratch`, which is restored before returning. */
 write_file_result
-write_file(buffer *b, int force)
+write_file(buffer *b, int force, arena *scratch)
 {
+    arena_checkpoint checkpoint = arena_save(scratch);
     char *path_c = NULL;
     char *tmp_c = NULL;
-    string contents;
     struct stat current;
     struct stat written;
     int fd = -1;
-    size_t tmp_len;
     write_file_result result = {0};
 
     result.status = WRITE_FILE_OK;
@@ -110,47 +121,22 @@ write_file(buffer *b, int force)
         return result;
     }
 
-    if (buffer_copy_path_cstr(b->file_path, &path_c) != 0)
-    {
-        result.status = WRITE_FILE_OPEN_FAILED;
-        return result;
-    }
+    path_c = file_copy_path_cstr(scratch, b->file_path, "");
 
     if (!force && b->has_file_stat)
     {
-        if (stat(path_c, &current) != 0)
+        if (stat(path_c, &current) != 0 || !buffer_paths_match_stat(b, &current))
         {
-            free(path_c);
-            result.status = WRITE_FILE_NEEDS_CONFIRMATION;
-            return result;
-        }
-
-        if (!buffer_paths_match_stat(b, &current))
-        {
-            free(path_c);
+            arena_restore(scratch, checkpoint);
             result.status = WRITE_FILE_NEEDS_CONFIRMATION;
             return result;
         }
     }
 
-    contents = buffer_to_string(b);
-    result.bytes_written = contents.len;
+    result.bytes_written = b->total_len;
     result.line_count = b->lines.count;
 
-    tmp_len = (size_t)b->file_path.len + 7;
-    tmp_c = (char *)malloc(tmp_len + 1);
-    if (tmp_c == NULL)
-    {
-        free(contents.s);
-        free(path_c);
-        result.status = WRITE_FILE_OPEN_FAILED;
-        return result;
-    }
-
-    memcpy(tmp_c, path_c, (size_t)b->file_path.len);
-    memcpy(tmp_c + (size_t)b->file_path.len, ".XXXXXX", 7);
-    tmp_c[tmp_len] = '\0';
-
+    tmp_c = file_copy_path_cstr(scratch, b->file_path, ".XXXXXX");
     fd = mkstemp(tmp_c);
     if (fd < 0)
     {
@@ -163,7 +149,7 @@ write_file(buffer *b, int force)
         (void)fchmod(fd, b->file_stat.st_mode & 0777);
     }
 
-    if (buffer_write_all(fd, contents.s, contents.len) != 0)
+    if (buffer_write_pieces(fd, b) != 0)
     {
         result.status = WRITE_FILE_WRITE_FAILED;
         goto cleanup;
@@ -207,13 +193,118 @@ cleanup:
         close(fd);
     }
 
-    if (tmp_c != NULL)
+    unlink(tmp_c);
+    arena_restore(scratch, checkpoint);
+    return result;
+}
+
+void
+file_image_push(file_image *img, const void *s, u64 len)
+{
+    if (img->len + len > img->capacity)
+    {
+        u64 new_capacity = img->capacity ? img->capacity : 16;
+
+        while (new_capacity < img->len + len)
+        {
+            new_capacity *= 2;
+        }
+
+        img->s = (u8 *)realloc(img->s, (size_t)new_capacity);
+        if (img->s == NULL)
+        {
+            fprintf(stderr, "[error] file_image_push unable to realloc\n");
+            exit(1);
+        }
+        img->capacity = new_capacity;
+    }
+
+    memcpy(img->s + img->len, s, (size_t)len);
+    img->len += len;
+}
+
+/* Pads with zeros to the next multiple of 8, where the mapped tables start. */
+void
+file_image_align(file_image *img)
+{
+    static const u8 zeros[8] = {0};
+
+    file_image_push(img, zeros, (8 - (img->len & 7)) & 7);
+}
+
+/*
+ * Writes `data` to a temporary next to `path` and renames it over `path`,
+ * so a crash leaves either the old file or the new one. 0 on failure.
+ */
+int
+file_write_atomic(const char *path, const u8 *data, u64 len)
+{
+    char *tmp = (char *)malloc(strlen(path) + 8);
+    int ok;
+    int fd;
+
+    if (tmp == NULL)
+    {
+        fprintf(stderr, "[error] file_write_atomic unable to malloc\n");
+        exit(1);
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    fd = mkstemp(tmp);
+    if (fd < 0)
+    {
+        free(tmp);
+        return 0;
+    }
+
+    (void)fchmod(fd, 0644);
+    ok = buffer_write_all(fd, (u8 *)data, len) == 0 && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+    {
+        unlink(tmp);
+    }
+
+    free(tmp);
+    return ok;
+}
+
+/*
+ * Maps the file at `path` read only when it holds at least `header_size`
+ * bytes and starts with the 8 of `magic`, NULL otherwise.
+ */
+u8 *
+file_map(const char *path, const char *magic, u64 header_size, u64 *len)
+{
+    struct stat st;
+    u8 *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < header_size)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = (u8 *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
     {
-        unlink(tmp_c);
-        free(tmp_c);
+        return NULL;
     }
 
-    free(contents.s);
-    free(path_c);
-    return result;
+    if (memcmp(map, magic, 8) != 0)
+    {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+
+    *len = (u64)st.st_size;
+    return map;
 }
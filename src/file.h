@@ -23,6 +23,18 @@ typedef struct
     struct stat written_stat;
 } write_file_result;
 
-write_file_result write_file(buffer *b, int force);
+/* Bytes gathered in memory, e.g. an index file before it is written whole. */
+typedef struct
+{
+    u8 *s;
+    u64 len;
+    u64 capacity;
+} file_image;
+
+write_file_result write_file(buffer *b, int force, arena *scratch);
+void file_image_push(file_image *img, const void *s, u64 len);
+void file_image_align(file_image *img);
+int file_write_atomic(const char *path, const u8 *data, u64 len);
+u8 *file_map(const char *path, const char *magic, u64 header_size, u64 *len);
 
 #endif
@@ -1,3 +1,5 @@
+#include <ctype.h>
+
 #include "funcs.h"
 #include "editor.h"
 
@@ -62,3 +64,710 @@ insert_below_current_line(buffer *b, u64 line)
 
     return(insert_off);
 }
+
+/*
+ * The range helpers below rewrite their text in one pass and hand it to
+ * buffer_replace, so a range of any size is a single add piece.
+ */
+void
+change_case_range(buffer *b, u64 start, u64 len, case_mode mode)
+{
+    string text;
+    u64 i;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    buffer_slice(b, start, len, &text);
+
+    for (i = 0; i < text.len; i++)
+    {
+        u8 c = text.s[i];
+        u8 lower = (c >= 'A' && c <= 'Z') ? (u8)(c + 32) : c;
+        u8 upper = (c >= 'a' && c <= 'z') ? (u8)(c - 32) : c;
+
+        if (mode == CASE_LOWER)
+        {
+            text.s[i] = lower;
+        }
+        else if (mode == CASE_UPPER)
+        {
+            text.s[i] = upper;
+        }
+        else
+        {
+            text.s[i] = (c == lower) ? upper : lower;
+        }
+    }
+
+    buffer_replace(b, start, len, text);
+    free(text.s);
+}
+
+void
+replace_chars_range(buffer *b, u64 start, u64 len, u8 c)
+{
+    string text;
+    u64 i;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    buffer_slice(b, start, len, &text);
+
+    for (i = 0; i < text.len; i++)
+    {
+        if (text.s[i] != '\n')
+        {
+            text.s[i] = c;
+        }
+    }
+
+    buffer_replace(b, start, len, text);
+    free(text.s);
+}
+
+void
+indent_lines(buffer *b, u64 first, u64 last, u64 levels)
+{
+    u64 start = buffer_line_start(b, first);
+    u64 end = buffer_line_start(b, last) + buffer_line_len(b, last);
+    u64 width = TAB.len * levels;
+    u64 line_count = last - first + 1;
+    string old_text;
+    string new_text;
+    u64 i;
+    u64 j;
+    u64 k;
+    int at_line_start = 1;
+
+    buffer_slice(b, start, end - start, &old_text);
+
+    new_text.s = (u8 *)malloc((size_t)(old_text.len + width * line_count + 1));
+    if (new_text.s == NULL)
+    {
+        perror("[error] unable to alloc indent text");
+        exit(1);
+    }
+
+    j = 0;
+    for (i = 0; i < old_text.len; i++)
+    {
+        /* empty lines stay empty */
+        if (at_line_start && old_text.s[i] != '\n')
+        {
+            for (k = 0; k < width; k++)
+            {
+                new_text.s[j++] = ' ';
+            }
+        }
+
+        new_text.s[j++] = old_text.s[i];
+        at_line_start = (old_text.s[i] == '\n');
+    }
+    new_text.len = j;
+
+    buffer_replace(b, start, old_text.len, new_text);
+    free(old_text.s);
+    free(new_text.s);
+}
+
+void
+dedent_lines(buffer *b, u64 first, u64 last, u64 levels)
+{
+    u64 start = buffer_line_start(b, first);
+    u64 end = buffer_line_start(b, last) + buffer_line_len(b, last);
+    u64 width = TAB.len * levels;
+    string old_text;
+    string new_text;
+    u64 i;
+    u64 j;
+
+    buffer_slice(b, start, end - start, &old_text);
+
+    new_text.s = (u8 *)malloc((size_t)old_text.len + 1);
+    if (new_text.s == NULL)
+    {
+        perror("[error] unable to alloc dedent text");
+        exit(1);
+    }
+
+    i = 0;
+    j = 0;
+    while (i < old_text.len)
+    {
+        u64 removed = 0;
+
+        while (i < old_text.len && removed < width)
+        {
+            if (old_text.s[i] == ' ')
+            {
+                removed++;
+            }
+            else if (old_text.s[i] == '\t')
+            {
+                removed += TAB.len;
+            }
+            else
+            {
+                break;
+            }
+            i++;
+        }
+
+        while (i < old_text.len && old_text.s[i] != '\n')
+        {
+            new_text.s[j++] = old_text.s[i++];
+        }
+
+        if (i < old_text.len)
+        {
+            new_text.s[j++] = old_text.s[i++];
+        }
+    }
+    new_text.len = j;
+
+    if (new_text.len != old_text.len)
+    {
+        buffer_replace(b, start, old_text.len, new_text);
+    }
+
+    free(old_text.s);
+    free(new_text.s);
+}
+
+/* Lines [first, last] as [*start, *end), with the newline after the last if it has one. */
+void
+lines_span(buffer *b, u64 first, u64 last, u64 *start, u64 *end)
+{
+    *start = buffer_line_start(b, first);
+    *end = last + 1 < b->lines.count ? buffer_line_start(b, last + 1) : b->total_len;
+}
+
+/*
+ * The last lines of the buffer leave with the newline before them. The
+ * empty line after a final newline goes as the whole line above it.
+ */
+static u64
+lines_delete_start(buffer *b, u64 start, u64 end)
+{
+    if (end == start && start == b->total_len && start > 0)
+    {
+        return buffer_line_start(b, buffer_last_line(b));
+    }
+
+    if (end == b->total_len && start > 0 && buffer_byte_at(b, end - 1) != '\n')
+    {
+        return start - 1;
+    }
+
+    return start;
+}
+
+/*
+ * A copy of [start, end) ending in one newline to go in at the line start
+ * `at`, or starting with it when `at` is the end of a last line without
+ * one. Returns 1 for the latter.
+ */
+static int
+lines_copy_text(buffer *b, u64 start, u64 end, u64 at, string *out)
+{
+    u64 body = end > start && buffer_byte_at(b, end - 1) == '\n' ? end - start - 1 : end - start;
+    int before = at == b->total_len && at > 0 && buffer_byte_at(b, at - 1) != '\n';
+
+    out->s = (u8 *)malloc((size_t)body + 1);
+    if (out->s == NULL)
+    {
+        perror("[error] unable to alloc line copy");
+        exit(1);
+    }
+
+    buffer_read(b, start, body, out->s + before);
+    out->s[before ? 0 : body] = '\n';
+    out->len = body + 1;
+    return before;
+}
+
+/* Deletes lines [first, last] with one buffer_delete, returns where the lines below now start. */
+u64
+delete_lines(buffer *b, u64 first, u64 last)
+{
+    u64 start;
+    u64 end;
+
+    lines_span(b, first, last, &start, &end);
+    start = lines_delete_start(b, start, end);
+
+    if (end > start)
+    {
+        buffer_delete(b, start, end - start);
+    }
+
+    return start;
+}
+
+/*
+ * Inserts a copy of lines [first, last] below line `dest` counted from 1,
+ * 0 puts it above the first line. Returns where the copy starts.
+ */
+u64
+copy_lines(buffer *b, u64 first, u64 last, u64 dest)
+{
+    u64 start;
+    u64 end;
+    u64 at;
+    string text;
+    int before;
+
+    lines_span(b, first, last, &start, &end);
+    at = dest < b->lines.count ? buffer_line_start(b, dest) : b->total_len;
+
+    before = lines_copy_text(b, start, end, at, &text);
+    buffer_insert(b, at, text);
+    free(text.s);
+
+    return at + (u64)before;
+}
+
+/*
+ * Moves lines [first, last] below line `dest` as copy_lines counts it,
+ * deleting and inserting with one buffer_apply_edits. Returns 0 if `dest`
+ * is inside the lines, otherwise sets `*moved` to where they start now.
+ */
+int
+move_lines(buffer *b, u64 first, u64 last, u64 dest, u64 *moved)
+{
+    buffer_edit edits[2];
+    u64 start;
+    u64 end;
+    u64 delete_start;
+    u64 at;
+    string text;
+    int before;
+
+    if (dest > first && dest <= last)
+    {
+        return 0;
+    }
+
+    lines_span(b, first, last, &start, &end);
+    delete_start = lines_delete_start(b, start, end);
+    if (end == start)
+    {
+        start = delete_start;
+    }
+
+    at = dest < b->lines.count ? buffer_line_start(b, dest) : b->total_len;
+    if (at == start || at == end)
+    {
+        *moved = start;
+        return 1;
+    }
+
+    before = lines_copy_text(b, start, end, at, &text);
+
+    if (at < start)
+    {
+        edits[0] = (buffer_edit){.offset = at, .delete_len = 0, .text = text};
+        edits[1] = (buffer_edit){.offset = delete_start, .delete_len = end - delete_start};
+        *moved = at;
+    }
+    else
+    {
+        edits[0] = (buffer_edit){.offset = delete_start, .delete_len = end - delete_start};
+        edits[1] = (buffer_edit){.offset = at, .delete_len = 0, .text = text};
+        *moved = at - (end - delete_start) + (u64)before;
+    }
+
+    buffer_apply_edits(b, edits, 2);
+    free(text.s);
+    return 1;
+}
+
+/*
+ * Block helpers work on the columns [left, right] of every line from
+ * first_line to last_line. Each one collects a row edit per line and
+ * applies them together with buffer_apply_edits.
+ */
+static u64
+block_row_span(buffer *b, block_range r, u64 line, u64 *start)
+{
+    u64 line_len = buffer_line_len(b, line);
+    u64 from = r.left < line_len ? r.left : line_len;
+    u64 to = r.right + 1 < line_len ? r.right + 1 : line_len;
+
+    *start = buffer_line_start(b, line) + from;
+    return to - from;
+}
+
+static buffer_edit *
+block_alloc_edits(u64 count)
+{
+    buffer_edit *edits = (buffer_edit *)malloc(sizeof(buffer_edit) * (count ? count : 1));
+
+    if (edits == NULL)
+    {
+        perror("[error] unable to alloc block edits");
+        exit(1);
+    }
+
+    return edits;
+}
+
+void
+block_text(buffer *b, block_range r, string *out)
+{
+    u64 total = 0;
+    u64 line;
+    u64 start;
+    u64 j = 0;
+
+    for (line = r.first_line; line <= r.last_line; line++)
+    {
+        total += block_row_span(b, r, line, &start) + 1;
+    }
+
+    out->s = (u8 *)malloc((size_t)total);
+    if (out->s == NULL)
+    {
+        perror("[error] unable to alloc block text");
+        exit(1);
+    }
+
+    for (line = r.first_line; line <= r.last_line; line++)
+    {
+        u64 len = block_row_span(b, r, line, &start);
+
+        buffer_read(b, start, len, out->s + j);
+        j += len;
+        if (line < r.last_line)
+        {
+            out->s[j++] = '\n';
+        }
+    }
+
+    out->len = j;
+}
+
+/* `text` is block_text output rewritten in place, row lengths unchanged. */
+static void
+block_rewrite(buffer *b, block_range r, string text)
+{
+    u64 count = r.last_line - r.first_line + 1;
+    buffer_edit *edits = block_alloc_edits(count);
+    u64 n = 0;
+    u64 j = 0;
+    u64 line;
+
+    for (line = r.first_line; line <= r.last_line; line++)
+    {
+        u64 start;
+        u64 len = block_row_span(b, r, line, &start);
+
+        if (len > 0)
+        {
+            edits[n].offset = start;
+            edits[n].delete_len = len;
+            edits[n].text.s = text.s + j;
+            edits[n].text.len = len;
+            n++;
+        }
+        j += len + 1;
+    }
+
+    buffer_apply_edits(b, edits, n);
+    free(edits);
+}
+
+void
+delete_block(buffer *b, block_range r)
+{
+    u64 count = r.last_line - r.first_line + 1;
+    buffer_edit *edits = block_alloc_edits(count);
+    u64 n = 0;
+    u64 line;
+
+    for (line = r.first_line; line <= r.last_line; line++)
+    {
+        u64 start;
+        u64 len = block_row_span(b, r, line, &start);
+
+        if (len > 0)
+        {
+            edits[n].offset = start;
+            edits[n].delete_len = len;
+            edits[n].text = (string){0};
+            n++;
+        }
+    }
+
+    buffer_apply_edits(b, edits, n);
+    free(edits);
+}
+
+void
+change_case_block(buffer *b, block_range r, case_mode mode)
+{
+    string text;
+    u64 i;
+
+    block_text(b, r, &text);
+
+    for (i = 0; i < text.len; i++)
+    {
+        u8 c = text.s[i];
+
+        if (mode == CASE_LOWER || (mode == CASE_TOGGLE && c >= 'A' && c <= 'Z'))
+        {
+            text.s[i] = (u8)tolower(c);
+        }
+        else
+        {
+            text.s[i] = (u8)toupper(c);
+        }
+    }
+
+    block_rewrite(b, r, text);
+    free(text.s);
+}
+
+void
+replace_chars_block(buffer *b, block_range r, u8 c)
+{
+    string text;
+    u64 i;
+
+    block_text(b, r, &text);
+
+    for (i = 0; i < text.len; i++)
+    {
+        if (text.s[i] != '\n')
+        {
+            text.s[i] = c;
+        }
+    }
+
+    block_rewrite(b, r, text);
+    free(text.s);
+}
+
+/*
+ * Inserts `text` at column `col` of every line in [first, last]. Lines
+ * shorter than `col` are skipped, or padded with spaces when `pad` is set.
+ */
+void
+insert_block(buffer *b, u64 first, u64 last, u64 col, string text, int pad)
+{
+    u64 count = last - first + 1;
+    buffer_edit *edits = block_alloc_edits(count);
+    u8 *padded = NULL;
+    u64 n = 0;
+    u64 line;
+    u64 j = 0;
+
+    if (pad)
+    {
+        padded = (u8 *)malloc((size_t)(count * (col + text.len) + 1));
+        if (padded == NULL)
+        {
+            perror("[error] unable to alloc block insert");
+            exit(1);
+        }
+    }
+
+    for (line = first; line <= last; line++)
+    {
+        u64 line_len = buffer_line_len(b, line);
+        u64 line_start = buffer_line_start(b, line);
+
+        if (line_len >= col)
+        {
+            edits[n].offset = line_start + col;
+            edits[n].text = text;
+        }
+        else if (pad)
+        {
+            edits[n].offset = line_start + line_len;
+            edits[n].text.s = padded + j;
+            edits[n].text.len = col - line_len + text.len;
+            memset(padded + j, ' ', (size_t)(col - line_len));
+            memcpy(padded + j + col - line_len, text.s, (size_t)text.len);
+            j += edits[n].text.len;
+        }
+        else
+        {
+            continue;
+        }
+
+        edits[n].delete_len = 0;
+        n++;
+    }
+
+    buffer_apply_edits(b, edits, n);
+    free(edits);
+    free(padded);
+}
+
+/*
+ * Pastes the '\n' separated rows of a blockwise register as a block whose
+ * top left corner is (line, col). Rows are padded to the block width when
+ * text follows them, and lines past the end of the file are added.
+ */
+void
+put_block(buffer *b, u64 line, u64 col, string text)
+{
+    u64 row_count = 1;
+    u64 row = 0;
+    u64 width = 0;
+    u64 row_len = 0;
+    u64 i;
+    u64 n = 0;
+    u64 j = 0;
+    u64 row_start = 0;
+    u64 extra_start = 0;
+    u64 extra_len = 0;
+    buffer_edit *edits;
+    u8 *data;
+
+    for (i = 0; i <= text.len; i++)
+    {
+        if (i == text.len || text.s[i] == '\n')
+        {
+            width = row_len > width ? row_len : width;
+            row_len = 0;
+            row_count += (i < text.len);
+        }
+        else
+        {
+            row_len++;
+        }
+    }
+
+    edits = block_alloc_edits(row_count);
+    data = (u8 *)malloc((size_t)(row_count * (col + width + 1) + 1));
+    if (data == NULL)
+    {
+        perror("[error] unable to alloc block put");
+        exit(1);
+    }
+
+    for (i = 0; i <= text.len; i++)
+    {
+        u64 target;
+        u64 len;
+        u64 line_len;
+
+        if (i < text.len && text.s[i] != '\n')
+        {
+            continue;
+        }
+
+        target = line + row++;
+        len = i - row_start;
+
+        if (target < b->lines.count)
+        {
+            u64 pad_before = 0;
+            u64 pad_after = 0;
+
+            line_len = buffer_line_len(b, target);
+            if (line_len < col)
+            {
+                pad_before = col - line_len;
+            }
+            else if (line_len > col)
+            {
+                pad_after = width - len;
+            }
+
+            edits[n].offset = buffer_line_start(b, target) + (line_len < col ? line_len : col);
+            edits[n].delete_len = 0;
+            edits[n].text.s = data + j;
+            memset(data + j, ' ', (size_t)pad_before);
+            j += pad_before;
+            memcpy(data + j, text.s + row_start, (size_t)len);
+            j += len;
+            memset(data + j, ' ', (size_t)pad_after);
+            j += pad_after;
+            edits[n].text.len = (u64)(data + j - edits[n].text.s);
+            n++;
+        }
+        else
+        {
+            /* rows past the last line become one insertion at the end */
+            if (extra_len == 0)
+            {
+                extra_start = j;
+            }
+
+            data[j++] = '\n';
+            memset(data + j, ' ', (size_t)col);
+            j += col;
+            memcpy(data + j, text.s + row_start, (size_t)len);
+            j += len;
+            extra_len = j - extra_start;
+        }
+
+        row_start = i + 1;
+    }
+
+    if (extra_len > 0)
+    {
+        edits[n].offset = b->total_len;
+        edits[n].delete_len = 0;
+        edits[n].text.s = data + extra_start;
+        edits[n].text.len = extra_len;
+        n++;
+    }
+
+    buffer_apply_edits(b, edits, n);
+    free(edits);
+    free(data);
+}
+
+/* The `len` bytes at `s` as a NUL terminated copy. */
+char *
+copy_cstr(const char *s, u64 len)
+{
+    char *out = (char *)malloc((size_t)len + 1);
+
+    if (out == NULL)
+    {
+        fprintf(stderr, "[error] copy_cstr unable to malloc\n");
+        exit(1);
+    }
+
+    memcpy(out, s, (size_t)len);
+    out[len] = '\0';
+    return out;
+}
+
+/* `dir` and `name` joined by a '/', or `name` alone when `dir` is "". */
+char *
+join_path(const char *dir, const char *name)
+{
+    u64 dir_len = strlen(dir);
+    u64 name_len = strlen(name);
+    char *out = (char *)malloc((size_t)(dir_len + name_len + 2));
+
+    if (out == NULL)
+    {
+        fprintf(stderr, "[error] join_path unable to malloc\n");
+        exit(1);
+    }
+
+    if (dir_len == 0)
+    {
+        memcpy(out, name, (size_t)name_len + 1);
+        return out;
+    }
+
+    memcpy(out, dir, (size_t)dir_len);
+    out[dir_len] = '/';
+    memcpy(out + dir_len + 1, name, (size_t)name_len + 1);
+    return out;
+}
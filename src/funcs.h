@@ -4,9 +4,40 @@
 #include "base.h"
 #include "buffer.h"
 
+typedef enum {
+    CASE_LOWER,
+    CASE_UPPER,
+    CASE_TOGGLE,
+} case_mode;
+
+/* Columns [left, right] of the lines [first_line, last_line]. */
+typedef struct
+{
+    u64 first_line;
+    u64 last_line;
+    u64 left;
+    u64 right;
+} block_range;
+
 void join_lines(buffer *b, u64 line);
 u64 insert_at_end_of_line(buffer *b, u64 line);
 u64 insert_above_current_line(buffer *b, u64 line);
 u64 insert_below_current_line(buffer *b, u64 line);
+void change_case_range(buffer *b, u64 start, u64 len, case_mode mode);
+void replace_chars_range(buffer *b, u64 start, u64 len, u8 c);
+void indent_lines(buffer *b, u64 first, u64 last, u64 levels);
+void dedent_lines(buffer *b, u64 first, u64 last, u64 levels);
+void lines_span(buffer *b, u64 first, u64 last, u64 *start, u64 *end);
+u64 delete_lines(buffer *b, u64 first, u64 last);
+u64 copy_lines(buffer *b, u64 first, u64 last, u64 dest);
+int move_lines(buffer *b, u64 first, u64 last, u64 dest, u64 *moved);
+void block_text(buffer *b, block_range r, string *out);
+void delete_block(buffer *b, block_range r);
+void change_case_block(buffer *b, block_range r, case_mode mode);
+void replace_chars_block(buffer *b, block_range r, u8 c);
+void insert_block(buffer *b, u64 first, u64 last, u64 col, string text, int pad);
+void put_block(buffer *b, u64 line, u64 col, string text);
+char *copy_cstr(const char *s, u64 len);
+char *join_path(const char *dir, const char *name);
 
 #endif
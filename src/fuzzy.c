@@ -0,0 +1,321 @@
+#include "fuzzy.h"
+#include "base.h"
+
+static u8
+fuzzy_fold(u8 c)
+{
+    return (c >= 'A' && c <= 'Z') ? (u8)(c + 32) : c;
+}
+
+static int
+fuzzy_is_subsequence(const char *path, string query)
+{
+    u64 q = 0;
+
+    for (; *path != '\0' && q < query.len; path++)
+    {
+        q += (fuzzy_fold((u8)*path) == fuzzy_fold(query.s[q]));
+    }
+
+    return q == query.len;
+}
+
+static int
+fuzzy_is_boundary(const char *path, u64 pos)
+{
+    u8 prev;
+
+    if (pos == 0)
+    {
+        return 1;
+    }
+
+    prev = (u8)path[pos - 1];
+    return prev == '/' || prev == '_' || prev == '-' || prev == '.' || prev == ' ' ||
+           (prev >= 'a' && prev <= 'z' && path[pos] >= 'A' && path[pos] <= 'Z');
+}
+
+/* Greedy alignment of `query` in `path` from `from`, 0 if it does not fit. */
+static int
+fuzzy_align(const char *path, u64 len, u64 from, u64 base, string query, s64 *score)
+{
+    u64 pos = from;
+    u64 prev = 0;
+    u64 q;
+
+    *score = 0;
+
+    for (q = 0; q < query.len; q++)
+    {
+        while (pos < len && fuzzy_fold((u8)path[pos]) != fuzzy_fold(query.s[q]))
+        {
+            pos++;
+        }
+
+        if (pos == len)
+        {
+            return 0;
+        }
+
+        if (q > 0 && pos == prev + 1)
+        {
+            *score += 16;
+        }
+        else if (q > 0)
+        {
+            *score -= pos - prev - 1 < 8 ? (s64)(pos - prev - 1) : 8;
+        }
+
+        if (fuzzy_is_boundary(path, pos))
+        {
+            *score += q == 0 && pos == base ? 24 : 10;
+        }
+
+        if (pos >= base)
+        {
+            *score += 4;
+        }
+
+        prev = pos++;
+    }
+
+    return 1;
+}
+
+/*
+ * Scores a path that contains `query`: consecutive characters, word
+ * starts and the file name count for it, gaps and length against it.
+ */
+int
+fuzzy_score(const char *path, u64 len, string query, s64 *score)
+{
+    const char *slash = strrchr(path, '/');
+    u64 base = slash ? (u64)(slash - path) + 1 : 0;
+    s64 in_base;
+
+    if (!fuzzy_align(path, len, 0, base, query, score))
+    {
+        return 0;
+    }
+
+    /* the leftmost alignment can miss a better one inside the file name */
+    if (base > 0 && fuzzy_align(path, len, base, base, query, &in_base) && in_base > *score)
+    {
+        *score = in_base;
+    }
+
+    *score -= (s64)(len / 16);
+    return 1;
+}
+
+static void
+fuzzy_keep(fuzzy_finder *f, u32 path)
+{
+    if (f->survivor_count == f->survivor_capacity)
+    {
+        f->survivor_capacity = f->survivor_capacity ? f->survivor_capacity * 2 : 1024;
+        f->survivors = (u32 *)realloc(f->survivors, sizeof(u32) * f->survivor_capacity);
+        if (f->survivors == NULL)
+        {
+            fprintf(stderr, "[error] fuzzy_keep unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    f->survivors[f->survivor_count++] = path;
+}
+
+static int
+fuzzy_worse(fuzzy_result a, fuzzy_result b)
+{
+    return a.score < b.score || (a.score == b.score && a.path > b.path);
+}
+
+/* Min-heap on score, so the root is the result to drop for a better one. */
+static void
+fuzzy_heap_sift_down(fuzzy_result *heap, u64 count, u64 i)
+{
+    for (;;)
+    {
+        u64 least = i;
+        u64 l = 2 * i + 1;
+        u64 r = l + 1;
+        fuzzy_result t;
+
+        if (l < count && fuzzy_worse(heap[l], heap[least]))
+        {
+            least = l;
+        }
+
+        if (r < count && fuzzy_worse(heap[r], heap[least]))
+        {
+            least = r;
+        }
+
+        if (least == i)
+        {
+            return;
+        }
+
+        t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+static void
+fuzzy_heap_push(fuzzy_result *heap, u64 *count, fuzzy_result item)
+{
+    u64 i = (*count)++;
+
+    heap[i] = item;
+    while (i > 0 && fuzzy_worse(heap[i], heap[(i - 1) / 2]))
+    {
+        fuzzy_result t = heap[i];
+
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+fuzzy_rank(fuzzy_finder *f, path_index *pi)
+{
+    string query = {.s = f->query, .len = f->query_len};
+    fuzzy_result heap[FUZZY_MAX_RESULTS];
+    u64 count = 0;
+    u64 i;
+
+    for (i = 0; i < f->survivor_count; i++)
+    {
+        const char *path = pi->pool + pi->offsets[f->survivors[i]];
+        fuzzy_result r;
+
+        r.path = f->survivors[i];
+        if (path[0] == '\0' || !fuzzy_score(path, strlen(path), query, &r.score))
+        {
+            continue;
+        }
+
+        if (count < FUZZY_MAX_RESULTS)
+        {
+            fuzzy_heap_push(heap, &count, r);
+        }
+        else if (fuzzy_worse(heap[0], r))
+        {
+            heap[0] = r;
+            fuzzy_heap_sift_down(heap, count, 0);
+        }
+    }
+
+    /* popping the min-heap fills the results from the back */
+    f->result_count = count;
+    while (count > 0)
+    {
+        f->results[count - 1] = heap[0];
+        heap[0] = heap[--count];
+        fuzzy_heap_sift_down(heap, count, 0);
+    }
+}
+
+/*
+ * Checks the paths added since the last call, re-ranking if the index
+ * changed at all. A rebuilt index invalidates every survivor.
+ */
+static int
+fuzzy_refresh(fuzzy_finder *f, path_index *pi, int force)
+{
+    string query = {.s = f->query, .len = f->query_len};
+    int changed;
+    u64 i;
+
+    pthread_mutex_lock(&pi->lock);
+
+    if (f->generation != pi->generation)
+    {
+        f->survivor_count = 0;
+        f->seen = 0;
+        f->generation = pi->generation;
+    }
+
+    changed = f->seen != pi->count || f->changes != pi->changes;
+    f->changes = pi->changes;
+    for (i = f->seen; i < pi->count; i++)
+    {
+        if (pi->pool[pi->offsets[i]] != '\0' && (pi->masks[i] & f->query_mask) == f->query_mask &&
+            fuzzy_is_subsequence(pi->pool + pi->offsets[i], query))
+        {
+            fuzzy_keep(f, (u32)i);
+        }
+    }
+    f->seen = pi->count;
+
+    if (changed || force)
+    {
+        fuzzy_rank(f, pi);
+    }
+
+    pthread_mutex_unlock(&pi->lock);
+    return changed;
+}
+
+int
+fuzzy_update(fuzzy_finder *f, path_index *pi)
+{
+    return fuzzy_refresh(f, pi, 0);
+}
+
+/*
+ * A query that extends the previous one can only match a subset of its
+ * survivors, anything else starts over from every path.
+ */
+void
+fuzzy_set_query(fuzzy_finder *f, path_index *pi, string query)
+{
+    int refine = query.len >= f->query_len && memcmp(query.s, f->query, (size_t)f->query_len) == 0;
+    u64 kept = 0;
+    u64 i;
+
+    if (query.len > FUZZY_MAX_QUERY)
+    {
+        query.len = FUZZY_MAX_QUERY;
+    }
+
+    memcpy(f->query, query.s, (size_t)query.len);
+    f->query_len = query.len;
+    f->query_mask = path_index_char_mask(query.s, query.len);
+
+    pthread_mutex_lock(&pi->lock);
+    if (!refine || f->generation != pi->generation)
+    {
+        f->survivor_count = 0;
+        f->seen = 0;
+    }
+    else
+    {
+        for (i = 0; i < f->survivor_count; i++)
+        {
+            u32 path = f->survivors[i];
+
+            if ((pi->masks[path] & f->query_mask) == f->query_mask &&
+                pi->pool[pi->offsets[path]] != '\0' &&
+                fuzzy_is_subsequence(pi->pool + pi->offsets[path], query))
+            {
+                f->survivors[kept++] = path;
+            }
+        }
+        f->survivor_count = kept;
+    }
+    pthread_mutex_unlock(&pi->lock);
+
+    fuzzy_refresh(f, pi, 1);
+}
+
+void
+fuzzy_free(fuzzy_finder *f)
+{
+    free(f->survivors);
+    memset(f, 0, sizeof(*f));
+}
@@ -0,0 +1,46 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include "base.h"
+#include "path_index.h"
+
+#define FUZZY_MAX_QUERY 128
+#define FUZZY_MAX_RESULTS 32
+
+typedef struct
+{
+    s64 score;
+    u64 path;
+} fuzzy_result;
+
+/*
+ * Ranks the paths of an index against a query. `survivors` are the paths
+ * below `seen` that contain the query as a subsequence; typing one more
+ * character only re-checks them, and paths added by the walk since the
+ * last update are checked once. The index's `generation` and `changes`
+ * as of the last update tell when to start over or to re-rank.
+ */
+typedef struct
+{
+    u8 query[FUZZY_MAX_QUERY];
+    u64 query_len;
+    u64 query_mask;
+
+    u32 *survivors;
+    u64 survivor_count;
+    u64 survivor_capacity;
+    u64 seen;
+    u64 generation;
+    u64 changes;
+
+    /* best first */
+    fuzzy_result results[FUZZY_MAX_RESULTS];
+    u64 result_count;
+} fuzzy_finder;
+
+void fuzzy_free(fuzzy_finder *f);
+void fuzzy_set_query(fuzzy_finder *f, path_index *pi, string query);
+int fuzzy_update(fuzzy_finder *f, path_index *pi);
+int fuzzy_score(const char *path, u64 len, string query, s64 *score);
+
+#endif
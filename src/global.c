@@ -0,0 +1,312 @@
+#include <pthread.h>
+
+#include "global.h"
+#include "regex.h"
+#include "search.h"
+#include "walk.h"
+#include "base.h"
+
+typedef struct
+{
+    buffer *b;
+    global_lines *gl;
+    string pattern;
+    u64 chunk_count;
+    u64 next;
+} global_job;
+
+typedef struct
+{
+    global_job *job;
+    /* NULL for a literal pattern */
+    regex *re;
+} global_worker;
+
+/* Sets the bit of every line in one chunk holding a match, at most one search per line. */
+static void
+global_match_chunk(global_worker *w, u64 chunk)
+{
+    buffer *b = w->job->b;
+    global_lines *gl = w->job->gl;
+    u64 first = gl->first_line + chunk * GLOBAL_CHUNK_LINES;
+    u64 last = first + GLOBAL_CHUNK_LINES - 1;
+    u64 line = first;
+    u64 cur;
+    u64 end;
+
+    if (last >= gl->first_line + gl->line_count)
+    {
+        last = gl->first_line + gl->line_count - 1;
+    }
+
+    cur = buffer_line_start(b, first);
+    end = buffer_line_start(b, last) + buffer_line_len(b, last) + 1;
+
+    while (cur < end)
+    {
+        u64 start;
+        u64 len;
+        int found;
+
+        if (w->re != NULL)
+        {
+            found = regex_search_range(w->re, b, cur, end, &start, &len);
+        }
+        else
+        {
+            found = search_forward_range(b, w->job->pattern, cur, end, &start);
+        }
+
+        if (!found)
+        {
+            break;
+        }
+
+        while (line < last && b->lines.items[line + 1].start <= start)
+        {
+            line++;
+        }
+
+        gl->bits[(line - gl->first_line) / 64] |= (u64)1 << ((line - gl->first_line) % 64);
+
+        if (line == last)
+        {
+            break;
+        }
+        cur = b->lines.items[++line].start;
+    }
+}
+
+static void *
+global_worker_main(void *arg)
+{
+    global_worker *w = (global_worker *)arg;
+    u64 chunk;
+
+    while ((chunk = __sync_fetch_and_add(&w->job->next, 1)) < w->job->chunk_count)
+    {
+        global_match_chunk(w, chunk);
+    }
+
+    return NULL;
+}
+
+/*
+ * Marks the lines of [first_line, last_line] with a match, or without one
+ * when `invert`. The range is cut into chunks of whole bitmap words that
+ * the workers take in turn, each with its own compiled regex since the
+ * lazy DFA is built while scanning.
+ */
+int
+global_match(buffer *b, u64 first_line, u64 last_line, string pattern, u8 invert,
+             global_lines *gl, char *error, u64 error_len)
+{
+    pthread_t threads[WALK_MAX_THREADS];
+    global_worker workers[WALK_MAX_THREADS];
+    regex *res = NULL;
+    global_job job;
+    u64 thread_count = walk_worker_count();
+    u64 words;
+    u64 i;
+
+    memset(gl, 0, sizeof(*gl));
+    gl->first_line = first_line;
+    gl->line_count = last_line - first_line + 1;
+    words = (gl->line_count + 63) / 64;
+
+    gl->bits = (u64 *)calloc((size_t)words, sizeof(u64));
+    if (gl->bits == NULL)
+    {
+        fprintf(stderr, "[error] global_match unable to calloc\n");
+        exit(1);
+    }
+
+    job.b = b;
+    job.gl = gl;
+    job.pattern = pattern;
+    job.chunk_count = (gl->line_count + GLOBAL_CHUNK_LINES - 1) / GLOBAL_CHUNK_LINES;
+    job.next = 0;
+
+    if (thread_count > job.chunk_count)
+    {
+        thread_count = job.chunk_count;
+    }
+
+    if (!regex_is_literal(pattern))
+    {
+        res = (regex *)calloc((size_t)thread_count, sizeof(regex));
+        if (res == NULL)
+        {
+            fprintf(stderr, "[error] global_match unable to calloc\n");
+            exit(1);
+        }
+
+        for (i = 0; i < thread_count; i++)
+        {
+            if (!regex_compile(&res[i], pattern))
+            {
+                snprintf(error, (size_t)error_len, "Invalid pattern: %s", res[i].error);
+                while (i > 0)
+                {
+                    regex_free(&res[--i]);
+                }
+                free(res);
+                global_lines_free(gl);
+                return 0;
+            }
+        }
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        workers[i].job = &job;
+        workers[i].re = res != NULL ? &res[i] : NULL;
+    }
+
+    /* a range of one chunk is not worth a thread */
+    if (thread_count == 1)
+    {
+        global_worker_main(&workers[0]);
+    }
+    else
+    {
+        for (i = 0; i < thread_count; i++)
+        {
+            if (pthread_create(&threads[i], NULL, global_worker_main, &workers[i]) != 0)
+            {
+                fprintf(stderr, "[error] global_match unable to create thread\n");
+                exit(1);
+            }
+        }
+
+        for (i = 0; i < thread_count; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    if (res != NULL)
+    {
+        for (i = 0; i < thread_count; i++)
+        {
+            regex_free(&res[i]);
+        }
+        free(res);
+    }
+
+    for (i = 0; i < words; i++)
+    {
+        if (invert)
+        {
+            gl->bits[i] = ~gl->bits[i];
+        }
+        if (i == words - 1 && gl->line_count % 64)
+        {
+            gl->bits[i] &= ((u64)1 << (gl->line_count % 64)) - 1;
+        }
+        gl->selected += (u64)__builtin_popcountll(gl->bits[i]);
+    }
+
+    return 1;
+}
+
+/*
+ * The next run of consecutive selected lines at or after `*line`, which is
+ * moved past it. Whole empty words are skipped at once.
+ */
+int
+global_next_run(global_lines *gl, u64 *line, u64 *run_first, u64 *run_last)
+{
+    u64 i = *line - gl->first_line;
+
+    while (i < gl->line_count)
+    {
+        u64 word = gl->bits[i / 64] >> (i % 64);
+
+        if (word == 0)
+        {
+            i = (i / 64 + 1) * 64;
+            continue;
+        }
+
+        i += (u64)__builtin_ctzll(word);
+        *run_first = gl->first_line + i;
+
+        while (i < gl->line_count && (gl->bits[i / 64] >> (i % 64)) & 1)
+        {
+            i++;
+        }
+
+        *run_last = gl->first_line + i - 1;
+        *line = gl->first_line + i;
+        return 1;
+    }
+
+    *line = gl->first_line + gl->line_count;
+    return 0;
+}
+
+/*
+ * Deletes the selected lines as one buffer_apply_edits, one edit per run.
+ * Returns the line the first line after the last run ends up on.
+ */
+u64
+global_delete(buffer *b, global_lines *gl)
+{
+    buffer_edit *edits;
+    u64 count = 0;
+    u64 deleted = 0;
+    u64 after = 0;
+    u64 line = gl->first_line;
+    u64 run_first;
+    u64 run_last;
+
+    /* never more runs than selected lines */
+    edits = (buffer_edit *)malloc(sizeof(buffer_edit) * (size_t)(gl->selected < 1 ? 1 : gl->selected));
+    if (edits == NULL)
+    {
+        fprintf(stderr, "[error] global_delete unable to malloc\n");
+        exit(1);
+    }
+
+    while (global_next_run(gl, &line, &run_first, &run_last))
+    {
+        u64 from = buffer_line_start(b, run_first);
+        u64 to;
+
+        if (run_last + 1 < b->lines.count)
+        {
+            to = b->lines.items[run_last + 1].start;
+        }
+        else
+        {
+            /* the last line has no newline of its own, take the one before it */
+            from -= from > 0;
+            to = b->total_len;
+        }
+
+        edits[count].offset = from;
+        edits[count].delete_len = to - from;
+        edits[count].text.s = NULL;
+        edits[count].text.len = 0;
+        count++;
+
+        deleted += run_last - run_first + 1;
+        after = run_last + 1 - deleted;
+    }
+
+    if (count > 0)
+    {
+        buffer_apply_edits(b, edits, count);
+    }
+    free(edits);
+
+    return after;
+}
+
+void
+global_lines_free(global_lines *gl)
+{
+    free(gl->bits);
+    memset(gl, 0, sizeof(*gl));
+}
@@ -0,0 +1,25 @@
+#ifndef GLOBAL_H
+#define GLOBAL_H
+
+#include "base.h"
+#include "buffer.h"
+
+/* lines searched by one worker at a time, a multiple of 64 so no two share a word */
+#define GLOBAL_CHUNK_LINES 4096
+
+/* The lines of [first_line, last_line] selected by :g or :v, one bit each. */
+typedef struct
+{
+    u64 *bits;
+    u64 first_line;
+    u64 line_count;
+    u64 selected;
+} global_lines;
+
+int global_match(buffer *b, u64 first_line, u64 last_line, string pattern, u8 invert,
+                 global_lines *gl, char *error, u64 error_len);
+int global_next_run(global_lines *gl, u64 *line, u64 *run_first, u64 *run_last);
+u64 global_delete(buffer *b, global_lines *gl);
+void global_lines_free(global_lines *gl);
+
+#endif
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include "grep.h"
+#include "funcs.h"
+#include "buffer.h"
+#include "regex.h"
+#include "search.h"
+#include "base.h"
+
+static void
+grep_add_hits(grep_search *g, grep_hit *hits, u64 count)
+{
+    u64 i;
+
+    pthread_mutex_lock(&g->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        if (g->count == GREP_MAX_HITS)
+        {
+            g->truncated = 1;
+            free(hits[i].path);
+            free(hits[i].text);
+            continue;
+        }
+
+        if (g->count == g->capacity)
+        {
+            g->capacity = g->capacity ? g->capacity * 2 : 256;
+            g->hits = (grep_hit *)realloc(g->hits, sizeof(grep_hit) * g->capacity);
+            if (g->hits == NULL)
+            {
+                fprintf(stderr, "[error] grep_add_hits unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        g->hits[g->count++] = hits[i];
+    }
+
+    pthread_mutex_unlock(&g->lock);
+}
+
+/* Reports the first match of every matching line, one batch per file. */
+static void
+grep_scan_buffer(grep_search *g, buffer *b, const char *path, regex *re)
+{
+    string pattern = {.s = g->pattern, .len = g->pattern_len};
+    u8 *data = b->orig.s;
+    u64 len = b->total_len;
+    grep_hit *hits = NULL;
+    u64 count = 0;
+    u64 capacity = 0;
+    u64 from = 0;
+    u64 line = 1;
+    u64 line_start = 0;
+
+    while (from <= len && !g->walk.cancel)
+    {
+        u64 to = len + 1 - from > GREP_CHUNK ? from + GREP_CHUNK : len + 1;
+        u64 start;
+        u64 match_len;
+        u64 line_end;
+        u8 *nl;
+        int hit;
+
+        if (re != NULL)
+        {
+            hit = regex_search_range(re, b, from, to, &start, &match_len);
+        }
+        else
+        {
+            hit = search_forward_range(b, pattern, from, to, &start);
+        }
+
+        if (!hit)
+        {
+            from = to;
+            continue;
+        }
+
+        while (line_start < start &&
+               (nl = (u8 *)memchr(data + line_start, '\n', (size_t)(start - line_start))) != NULL)
+        {
+            line++;
+            line_start = (u64)(nl - data) + 1;
+        }
+
+        nl = (u8 *)memchr(data + start, '\n', (size_t)(len - start));
+        line_end = nl ? (u64)(nl - data) : len;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            hits = (grep_hit *)realloc(hits, sizeof(grep_hit) * capacity);
+            if (hits == NULL)
+            {
+                fprintf(stderr, "[error] grep_scan_buffer unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        hits[count].path = copy_cstr(path, strlen(path));
+        hits[count].line = line;
+        hits[count].col = start - line_start + 1;
+        hits[count].text = copy_cstr((char *)data + line_start,
+                                        line_end - line_start > GREP_MAX_TEXT ?
+                                        GREP_MAX_TEXT : line_end - line_start);
+        count++;
+
+        from = line_end + 1;
+        line++;
+        line_start = from;
+    }
+
+    if (count > 0)
+    {
+        grep_add_hits(g, hits, count);
+    }
+
+    free(hits);
+}
+
+static void
+grep_search_file(grep_search *g, const char *path, regex *re)
+{
+    struct stat st;
+    buffer b;
+    u8 *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return;
+    }
+
+    data = (u8 *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return;
+    }
+
+    __sync_fetch_and_add(&g->files_searched, 1);
+
+    if (memchr(data, 0, (size_t)(st.st_size < GREP_SNIFF_LEN ? st.st_size : GREP_SNIFF_LEN)) == NULL)
+    {
+        buffer_init_text(&b, (string){.s = data, .len = (u64)st.st_size});
+        grep_scan_buffer(g, &b, path, re);
+        buffer_free(&b);
+    }
+
+    munmap(data, (size_t)st.st_size);
+}
+
+static void
+grep_on_file(void *ctx, u64 worker, const char *path)
+{
+    grep_search *g = (grep_search *)ctx;
+
+    grep_search_file(g, path, g->use_regex ? &g->res[worker] : NULL);
+}
+
+/* Validates the pattern and compiles it for `worker_count` workers. */
+static int
+grep_prepare(grep_search *g, string pattern, u64 worker_count, char *error, u64 error_len)
+{
+    regex re;
+    u64 i;
+
+    if (pattern.len == 0 || pattern.len > sizeof(g->pattern))
+    {
+        snprintf(error, (size_t)error_len, "Invalid pattern");
+        return 0;
+    }
+
+    memset(g, 0, sizeof(*g));
+
+    if (!regex_is_literal(pattern))
+    {
+        if (!regex_compile(&re, pattern))
+        {
+            snprintf(error, (size_t)error_len, "Invalid pattern: %s", re.error);
+            return 0;
+        }
+        regex_free(&re);
+        g->use_regex = 1;
+
+        /* the lazy DFA is a cache that changes while matching, so each worker has its own */
+        g->res = (regex *)malloc(sizeof(regex) * worker_count);
+        if (g->res == NULL)
+        {
+            fprintf(stderr, "[error] grep_prepare unable to malloc\n");
+            exit(1);
+        }
+
+        for (i = 0; i < worker_count; i++)
+        {
+            regex_compile(&g->res[i], pattern);
+        }
+    }
+
+    memcpy(g->pattern, pattern.s, (size_t)pattern.len);
+    g->pattern_len = pattern.len;
+    g->res_count = g->use_regex ? worker_count : 0;
+
+    pthread_mutex_init(&g->lock, NULL);
+    g->started = 1;
+    return 1;
+}
+
+/*
+ * Starts searching every file under `root` on one worker per core and
+ * returns at once, hits show up in `g` while the workers run.
+ */
+int
+grep_start(grep_search *g, string root, string pattern, char *error, u64 error_len)
+{
+    u64 worker_count = walk_worker_count();
+
+    if (!grep_prepare(g, pattern, worker_count, error, error_len))
+    {
+        return 0;
+    }
+
+    walk_start(&g->walk, root, worker_count, grep_on_file, NULL, g);
+    return 1;
+}
+
+/* Like grep_start over a known file list, e.g. the path index, owning `paths`. */
+int
+grep_start_files(grep_search *g, char **paths, u64 count, string pattern, char *error,
+                 u64 error_len)
+{
+    u64 worker_count = walk_worker_count();
+    u64 i;
+
+    if (!grep_prepare(g, pattern, worker_count, error, error_len))
+    {
+        for (i = 0; i < count; i++)
+        {
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    walk_start_files(&g->walk, paths, count, worker_count, grep_on_file, g);
+    return 1;
+}
+
+void
+grep_cancel(grep_search *g)
+{
+    walk_cancel(&g->walk);
+}
+
+void
+grep_wait(grep_search *g)
+{
+    walk_wait(&g->walk);
+}
+
+void
+grep_free(grep_search *g)
+{
+    u64 i;
+
+    if (!g->started)
+    {
+        return;
+    }
+
+    walk_free(&g->walk);
+
+    for (i = 0; i < g->count; i++)
+    {
+        free(g->hits[i].path);
+        free(g->hits[i].text);
+    }
+    free(g->hits);
+
+    for (i = 0; i < g->res_count; i++)
+    {
+        regex_free(&g->res[i]);
+    }
+    free(g->res);
+    pthread_mutex_destroy(&g->lock);
+
+    memset(g, 0, sizeof(*g));
+}
+
+int
+grep_running(grep_search *g)
+{
+    return g->started && walk_running(&g->walk);
+}
+
+u64
+grep_hit_count(grep_search *g)
+{
+    u64 count;
+
+    if (!g->started)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&g->lock);
+    count = g->count;
+    pthread_mutex_unlock(&g->lock);
+
+    return count;
+}
+
+/* A copy, the array may move while the workers append to it. */
+grep_hit
+grep_hit_at(grep_search *g, u64 index)
+{
+    grep_hit hit;
+
+    pthread_mutex_lock(&g->lock);
+    hit = g->hits[index];
+    pthread_mutex_unlock(&g->lock);
+
+    return hit;
+}
@@ -0,0 +1,57 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <pthread.h>
+
+#include "base.h"
+#include "regex.h"
+#include "walk.h"
+
+/* a file whose first block holds a NUL byte is taken as binary */
+#define GREP_SNIFF_LEN KB(4)
+/* bytes searched between checks for cancellation */
+#define GREP_CHUNK MB(8)
+#define GREP_MAX_HITS 100000
+#define GREP_MAX_TEXT 256
+
+typedef struct
+{
+    char *path;
+    u64 line;
+    u64 col;
+    char *text;
+} grep_hit;
+
+typedef struct
+{
+    u8 pattern[256];
+    u64 pattern_len;
+    u8 use_regex;
+    /* one compiled copy per walk worker */
+    regex *res;
+    u64 res_count;
+
+    walk walk;
+
+    /* hits are appended by the workers while the editor reads them */
+    pthread_mutex_t lock;
+    grep_hit *hits;
+    u64 count;
+    u64 capacity;
+    u64 files_searched;
+    u8 truncated;
+
+    u8 started;
+} grep_search;
+
+int grep_start(grep_search *g, string root, string pattern, char *error, u64 error_len);
+int grep_start_files(grep_search *g, char **paths, u64 count, string pattern, char *error,
+                     u64 error_len);
+void grep_cancel(grep_search *g);
+void grep_wait(grep_search *g);
+void grep_free(grep_search *g);
+int grep_running(grep_search *g);
+u64 grep_hit_count(grep_search *g);
+grep_hit grep_hit_at(grep_search *g, u64 index);
+
+#endif
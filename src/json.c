@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+
+#include "json.h"
+#include "base.h"
+
+typedef struct
+{
+    arena *a;
+    u8 *s;
+    u64 len;
+    u64 pos;
+    u64 depth;
+} json_parser;
+
+static json_value *
+json_new(json_parser *p, json_type type)
+{
+    json_value *v = (json_value *)arena_push_aligned(p->a, sizeof(json_value), 8);
+
+    memset(v, 0, sizeof(*v));
+    v->type = type;
+    return v;
+}
+
+static void
+json_skip_space(json_parser *p)
+{
+    while (p->pos < p->len &&
+           (p->s[p->pos] == ' ' || p->s[p->pos] == '\t' || p->s[p->pos] == '\n' || p->s[p->pos] == '\r'))
+    {
+        p->pos++;
+    }
+}
+
+/* The bytes of the string at the opening quote, escapes left in place. */
+static int
+json_parse_string(json_parser *p, string *out)
+{
+    u64 start = ++p->pos;
+
+    while (p->pos < p->len && p->s[p->pos] != '"')
+    {
+        if (p->s[p->pos] < 0x20)
+        {
+            return 0;
+        }
+
+        p->pos += p->s[p->pos] == '\\' ? 2 : 1;
+    }
+
+    if (p->pos >= p->len)
+    {
+        return 0;
+    }
+
+    out->s = p->s + start;
+    out->len = p->pos - start;
+    p->pos++;
+    return 1;
+}
+
+static int
+json_parse_literal(json_parser *p, const char *word)
+{
+    u64 len = strlen(word);
+
+    if (p->len - p->pos < len || memcmp(p->s + p->pos, word, (size_t)len) != 0)
+    {
+        return 0;
+    }
+
+    p->pos += len;
+    return 1;
+}
+
+static json_value *
+json_parse_value(json_parser *p)
+{
+    json_value *v;
+    json_value **tail;
+    u8 c;
+
+    json_skip_space(p);
+    if (p->pos >= p->len)
+    {
+        return NULL;
+    }
+
+    c = p->s[p->pos];
+    if (c == '"')
+    {
+        v = json_new(p, JSON_STRING);
+        return json_parse_string(p, &v->text) ? v : NULL;
+    }
+
+    if (c == '-' || (c >= '0' && c <= '9'))
+    {
+        u64 start = p->pos;
+
+        v = json_new(p, JSON_NUMBER);
+        while (p->pos < p->len &&
+               (p->s[p->pos] == '-' || p->s[p->pos] == '+' || p->s[p->pos] == '.' ||
+                p->s[p->pos] == 'e' || p->s[p->pos] == 'E' ||
+                (p->s[p->pos] >= '0' && p->s[p->pos] <= '9')))
+        {
+            p->pos++;
+        }
+
+        v->text.s = p->s + start;
+        v->text.len = p->pos - start;
+        return v;
+    }
+
+    if (c == 'n')
+    {
+        return json_parse_literal(p, "null") ? json_new(p, JSON_NULL) : NULL;
+    }
+    if (c == 't')
+    {
+        return json_parse_literal(p, "true") ? json_new(p, JSON_TRUE) : NULL;
+    }
+    if (c == 'f')
+    {
+        return json_parse_literal(p, "false") ? json_new(p, JSON_FALSE) : NULL;
+    }
+
+    if ((c != '[' && c != '{') || p->depth == JSON_MAX_DEPTH)
+    {
+        return NULL;
+    }
+
+    v = json_new(p, c == '[' ? JSON_ARRAY : JSON_OBJECT);
+    p->pos++;
+    p->depth++;
+    tail = &v->child;
+
+    json_skip_space(p);
+    if (p->pos < p->len && p->s[p->pos] == (c == '[' ? ']' : '}'))
+    {
+        p->pos++;
+        p->depth--;
+        return v;
+    }
+
+    for (;;)
+    {
+        string key = {0};
+        json_value *item;
+
+        if (c == '{')
+        {
+            json_skip_space(p);
+            if (p->pos >= p->len || p->s[p->pos] != '"' || !json_parse_string(p, &key))
+            {
+                return NULL;
+            }
+
+            json_skip_space(p);
+            if (p->pos >= p->len || p->s[p->pos] != ':')
+            {
+                return NULL;
+            }
+            p->pos++;
+        }
+
+        item = json_parse_value(p);
+        if (item == NULL)
+        {
+            return NULL;
+        }
+
+        item->key = key;
+        *tail = item;
+        tail = &item->next;
+        v->count++;
+
+        json_skip_space(p);
+        if (p->pos >= p->len)
+        {
+            return NULL;
+        }
+
+        if (p->s[p->pos] == ',')
+        {
+            p->pos++;
+            continue;
+        }
+
+        if (p->s[p->pos] != (c == '[' ? ']' : '}'))
+        {
+            return NULL;
+        }
+
+        p->pos++;
+        p->depth--;
+        return v;
+    }
+}
+
+/* Parses one document, or returns NULL if it is not one. */
+json_value *
+json_parse(arena *a, string text)
+{
+    json_parser p;
+    json_value *v;
+
+    p.a = a;
+    p.s = text.s;
+    p.len = text.len;
+    p.pos = 0;
+    p.depth = 0;
+
+    v = json_parse_value(&p);
+    json_skip_space(&p);
+
+    return p.pos == p.len ? v : NULL;
+}
+
+/*
+ * The most arena a document of `text_len` bytes can take: past the first,
+ * every value takes two bytes at least with the comma or colon before it.
+ */
+u64
+json_arena_size(u64 text_len)
+{
+    return (text_len / 2 + 2) * (sizeof(json_value) + 8);
+}
+
+json_value *
+json_get(json_value *object, const char *key)
+{
+    u64 len = strlen(key);
+    json_value *v;
+
+    if (object == NULL || object->type != JSON_OBJECT)
+    {
+        return NULL;
+    }
+
+    for (v = object->child; v != NULL; v = v->next)
+    {
+        if (v->key.len == len && memcmp(v->key.s, key, (size_t)len) == 0)
+        {
+            return v;
+        }
+    }
+
+    return NULL;
+}
+
+json_value *
+json_at(json_value *array, u64 index)
+{
+    json_value *v;
+
+    if (array == NULL || array->type != JSON_ARRAY)
+    {
+        return NULL;
+    }
+
+    for (v = array->child; v != NULL && index > 0; v = v->next)
+    {
+        index--;
+    }
+
+    return v;
+}
+
+/* Compares the raw string, so `s` must not need escaping. */
+int
+json_is_string(json_value *v, const char *s)
+{
+    u64 len = strlen(s);
+
+    return v != NULL && v->type == JSON_STRING && v->text.len == len &&
+           memcmp(v->text.s, s, (size_t)len) == 0;
+}
+
+int
+json_to_s64(json_value *v, s64 *out)
+{
+    s64 n = 0;
+    u64 i = 0;
+    int negative = 0;
+
+    if (v == NULL || v->type != JSON_NUMBER || v->text.len == 0)
+    {
+        return 0;
+    }
+
+    if (v->text.s[0] == '-')
+    {
+        negative = 1;
+        i++;
+    }
+
+    if (i == v->text.len)
+    {
+        return 0;
+    }
+
+    for (; i < v->text.len; i++)
+    {
+        if (v->text.s[i] < '0' || v->text.s[i] > '9')
+        {
+            return 0;
+        }
+        n = n * 10 + (v->text.s[i] - '0');
+    }
+
+    *out = negative ? -n : n;
+    return 1;
+}
+
+static u64
+json_hex4(const u8 *s)
+{
+    u64 n = 0;
+    u64 i;
+
+    for (i = 0; i < 4; i++)
+    {
+        u8 c = s[i];
+
+        n <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            n |= (u64)(c - '0');
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        {
+            n |= (u64)((c | 0x20) - 'a' + 10);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Decodes a string into `out`, which needs room for `v->text.len` bytes:
+ * no escape decodes to more bytes than it is written with.
+ */
+u64
+json_unescape(json_value *v, u8 *out)
+{
+    u8 *s = v->text.s;
+    u64 len = v->text.len;
+    u64 n = 0;
+    u64 i = 0;
+
+    while (i < len)
+    {
+        u64 cp;
+
+        if (s[i] != '\\' || i + 1 == len)
+        {
+            out[n++] = s[i++];
+            continue;
+        }
+
+        switch (s[i + 1]) {
+        case 'n': out[n++] = '\n'; i += 2; continue;
+        case 't': out[n++] = '\t'; i += 2; continue;
+        case 'r': out[n++] = '\r'; i += 2; continue;
+        case 'b': out[n++] = '\b'; i += 2; continue;
+        case 'f': out[n++] = '\f'; i += 2; continue;
+        case 'u': break;
+        default: out[n++] = s[i + 1]; i += 2; continue;
+        }
+
+        if (len - i < 6)
+        {
+            break;
+        }
+
+        cp = json_hex4(s + i + 2);
+        i += 6;
+        if (cp >= 0xd800 && cp < 0xdc00 && len - i >= 6 && s[i] == '\\' && s[i + 1] == 'u')
+        {
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (json_hex4(s + i + 2) - 0xdc00);
+            i += 6;
+        }
+
+        if (cp < 0x80)
+        {
+            out[n++] = (u8)cp;
+        }
+        else if (cp < 0x800)
+        {
+            out[n++] = (u8)(0xc0 | (cp >> 6));
+            out[n++] = (u8)(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            out[n++] = (u8)(0xe0 | (cp >> 12));
+            out[n++] = (u8)(0x80 | ((cp >> 6) & 0x3f));
+            out[n++] = (u8)(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            out[n++] = (u8)(0xf0 | (cp >> 18));
+            out[n++] = (u8)(0x80 | ((cp >> 12) & 0x3f));
+            out[n++] = (u8)(0x80 | ((cp >> 6) & 0x3f));
+            out[n++] = (u8)(0x80 | (cp & 0x3f));
+        }
+    }
+
+    return n;
+}
+
+void
+json_write(json_writer *w, const char *s, u64 len)
+{
+    if (w->len + len > w->capacity)
+    {
+        u64 capacity = w->capacity ? w->capacity : 256;
+
+        while (capacity < w->len + len)
+        {
+            capacity *= 2;
+        }
+
+        w->data = (u8 *)realloc(w->data, (size_t)capacity);
+        if (w->data == NULL)
+        {
+            fprintf(stderr, "[error] json_write unable to realloc\n");
+            exit(1);
+        }
+        w->capacity = capacity;
+    }
+
+    memcpy(w->data + w->len, s, (size_t)len);
+    w->len += len;
+}
+
+void
+json_write_cstr(json_writer *w, const char *s)
+{
+    json_write(w, s, strlen(s));
+}
+
+void
+json_write_u64(json_writer *w, u64 n)
+{
+    char digits[24];
+    int len = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)n);
+
+    json_write(w, digits, (u64)len);
+}
+
+/* Writes `s` escaped as JSON requires, UTF-8 passes through, for a string written in parts. */
+void
+json_write_escaped(json_writer *w, string s)
+{
+    static const char hex[] = "0123456789abcdef";
+    u64 start = 0;
+    u64 i;
+
+    for (i = 0; i < s.len; i++)
+    {
+        u8 c = s.s[i];
+        char escaped[6];
+
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        json_write(w, (const char *)s.s + start, i - start);
+        start = i + 1;
+
+        escaped[0] = '\\';
+        switch (c) {
+        case '"': escaped[1] = '"'; break;
+        case '\\': escaped[1] = '\\'; break;
+        case '\n': escaped[1] = 'n'; break;
+        case '\t': escaped[1] = 't'; break;
+        case '\r': escaped[1] = 'r'; break;
+        default:
+            escaped[1] = 'u';
+            escaped[2] = '0';
+            escaped[3] = '0';
+            escaped[4] = hex[c >> 4];
+            escaped[5] = hex[c & 15];
+            json_write(w, escaped, 6);
+            continue;
+        }
+        json_write(w, escaped, 2);
+    }
+
+    json_write(w, (const char *)s.s + start, s.len - start);
+}
+
+void
+json_write_string(json_writer *w, string s)
+{
+    json_write(w, "\"", 1);
+    json_write_escaped(w, s);
+    json_write(w, "\"", 1);
+}
+
+void
+json_writer_free(json_writer *w)
+{
+    free(w->data);
+    memset(w, 0, sizeof(*w));
+}
@@ -0,0 +1,60 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "base.h"
+#include "arena.h"
+
+/* deeper documents are rejected rather than recursed into */
+#define JSON_MAX_DEPTH 64
+
+typedef enum {
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} json_type;
+
+/*
+ * A parsed value, allocated from an arena. Nothing is copied: `text` and
+ * `key` point into the parsed input, strings still hold their escapes
+ * (json_unescape decodes them), so values live as long as both do.
+ */
+typedef struct json_value
+{
+    json_type type;
+    /* the literal of a number, the bytes between the quotes of a string */
+    string text;
+    /* set on the members of an object */
+    string key;
+    struct json_value *child;
+    struct json_value *next;
+    u64 count;
+} json_value;
+
+/* JSON text being written, grown as needed. */
+typedef struct
+{
+    u8 *data;
+    u64 len;
+    u64 capacity;
+} json_writer;
+
+json_value *json_parse(arena *a, string text);
+u64 json_arena_size(u64 text_len);
+json_value *json_get(json_value *object, const char *key);
+json_value *json_at(json_value *array, u64 index);
+int json_is_string(json_value *v, const char *s);
+int json_to_s64(json_value *v, s64 *out);
+u64 json_unescape(json_value *v, u8 *out);
+
+void json_write(json_writer *w, const char *s, u64 len);
+void json_write_cstr(json_writer *w, const char *s);
+void json_write_u64(json_writer *w, u64 n);
+void json_write_escaped(json_writer *w, string s);
+void json_write_string(json_writer *w, string s);
+void json_writer_free(json_writer *w);
+
+#endif
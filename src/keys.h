@@ -11,9 +11,12 @@ enum key_action{
         KEY_TAB = 9,            /* Tab */
         CTRL_L = 12,        /* Ctrl+l */
         ENTER = 13,         /* Enter */
+        CTRL_N = 14,        /* Ctrl-n */
+        CTRL_P = 16,        /* Ctrl-p */
         CTRL_Q = 17,        /* Ctrl-q */
         CTRL_S = 19,        /* Ctrl-s */
         CTRL_U = 21,        /* Ctrl-u */
+        CTRL_V = 22,        /* Ctrl-v */
         ESC = 27,           /* Escape */
         KEY_H = 104,
         KEY_J = 106,
@@ -0,0 +1,298 @@
+#include "line_class.h"
+#include "base.h"
+
+static void
+line_class_reserve(u64 **empty, u64 **blank, u64 *capacity, u64 words)
+{
+    if (words <= *capacity)
+    {
+        return;
+    }
+
+    *capacity = *capacity ? *capacity : 64;
+    while (*capacity < words)
+    {
+        *capacity *= 2;
+    }
+
+    *empty = (u64 *)realloc(*empty, sizeof(u64) * (size_t)*capacity);
+    *blank = (u64 *)realloc(*blank, sizeof(u64) * (size_t)*capacity);
+    if (*empty == NULL || *blank == NULL)
+    {
+        fprintf(stderr, "[error] line_class_reserve unable to realloc\n");
+        exit(1);
+    }
+}
+
+/* Reads a line only up to its first character that is not a space or tab. */
+static void
+line_class_classify(line_class_index *lc, buffer_reader *r, u64 line)
+{
+    u64 start = buffer_line_start(lc->b, line);
+    u64 len = buffer_line_len(lc->b, line);
+    u64 bit = (u64)1 << (line % 64);
+    u64 i;
+
+    lc->empty[line / 64] &= ~bit;
+    lc->blank[line / 64] &= ~bit;
+
+    for (i = 0; i < len; i++)
+    {
+        u8 c = buffer_reader_byte(r, start + i);
+
+        if (c != ' ' && c != '\t' && c != '\r')
+        {
+            return;
+        }
+    }
+
+    lc->blank[line / 64] |= bit;
+    if (len == 0)
+    {
+        lc->empty[line / 64] |= bit;
+    }
+}
+
+static void
+line_class_build(line_class_index *lc)
+{
+    buffer_reader r;
+    u64 words = (lc->b->lines.count + 63) / 64;
+    u64 line;
+
+    lc->count = lc->b->lines.count;
+    line_class_reserve(&lc->empty, &lc->blank, &lc->capacity, words + 1);
+    memset(lc->empty, 0, sizeof(u64) * (size_t)words);
+    memset(lc->blank, 0, sizeof(u64) * (size_t)words);
+
+    buffer_reader_init(&r, lc->b);
+    for (line = 0; line < lc->count; line++)
+    {
+        line_class_classify(lc, &r, line);
+    }
+
+    lc->built = 1;
+}
+
+/* The 64 bits starting at bit `pos`, which may straddle two words. */
+static u64
+line_class_word_at(u64 *bits, u64 words, u64 pos)
+{
+    u64 w = pos / 64;
+    u64 shift = pos % 64;
+    u64 value = w < words ? bits[w] >> shift : 0;
+
+    if (shift != 0 && w + 1 < words)
+    {
+        value |= bits[w + 1] << (64 - shift);
+    }
+
+    return value;
+}
+
+/*
+ * One edit of lines [first, old_last] into [first, new_last]. The bits
+ * before keep their place, those after move by whole words at a time and
+ * the lines in between are read again.
+ */
+static void
+line_class_splice(line_class_index *lc, u64 first, u64 old_last, u64 new_last)
+{
+    u64 old_words = (lc->count + 63) / 64;
+    u64 count = lc->b->lines.count;
+    u64 words = (count + 63) / 64;
+    s64 shift = (s64)new_last - (s64)old_last;
+    buffer_reader r;
+    u64 *swap;
+    u64 w;
+
+    line_class_reserve(&lc->spare_empty, &lc->spare_blank, &lc->spare_capacity, words + 1);
+
+    for (w = 0; w < words; w++)
+    {
+        u64 base = w * 64;
+
+        if (base + 64 <= first)
+        {
+            lc->spare_empty[w] = lc->empty[w];
+            lc->spare_blank[w] = lc->blank[w];
+        }
+        else if (base > new_last)
+        {
+            lc->spare_empty[w] = line_class_word_at(lc->empty, old_words, (u64)((s64)base - shift));
+            lc->spare_blank[w] = line_class_word_at(lc->blank, old_words, (u64)((s64)base - shift));
+        }
+        else
+        {
+            u64 i;
+
+            lc->spare_empty[w] = 0;
+            lc->spare_blank[w] = 0;
+            for (i = base; i < base + 64 && i < count; i++)
+            {
+                u64 from = i < first ? i : i > new_last ? (u64)((s64)i - shift) : lc->count;
+
+                if (from < lc->count)
+                {
+                    lc->spare_empty[w] |= ((lc->empty[from / 64] >> (from % 64)) & 1) << (i % 64);
+                    lc->spare_blank[w] |= ((lc->blank[from / 64] >> (from % 64)) & 1) << (i % 64);
+                }
+            }
+        }
+    }
+
+    if (count % 64)
+    {
+        lc->spare_empty[words - 1] &= ((u64)1 << (count % 64)) - 1;
+        lc->spare_blank[words - 1] &= ((u64)1 << (count % 64)) - 1;
+    }
+
+    swap = lc->empty;
+    lc->empty = lc->spare_empty;
+    lc->spare_empty = swap;
+    swap = lc->blank;
+    lc->blank = lc->spare_blank;
+    lc->spare_blank = swap;
+    w = lc->capacity;
+    lc->capacity = lc->spare_capacity;
+    lc->spare_capacity = w;
+    lc->count = count;
+
+    buffer_reader_init(&r, lc->b);
+    for (w = first; w <= new_last && w < count; w++)
+    {
+        line_class_classify(lc, &r, w);
+    }
+}
+
+/*
+ * A single edit is spliced in: the newlines it removed are the difference
+ * in line counts plus those it added. A batch does not say how many each
+ * of its changes removed, so it is classified again on the next query.
+ */
+static void
+line_class_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    line_class_index *lc = (line_class_index *)ctx;
+    u64 first;
+    u64 new_last;
+    u64 col;
+
+    if (!lc->built)
+    {
+        return;
+    }
+
+    if (count != 1)
+    {
+        lc->built = 0;
+        return;
+    }
+
+    buffer_offset_to_line_col(b, changes[0].offset, &first, &col);
+    buffer_offset_to_line_col(b, changes[0].offset + changes[0].new_len, &new_last, &col);
+    line_class_splice(lc, first, first + (new_last - first) + lc->count - b->lines.count, new_last);
+}
+
+void
+line_class_init(line_class_index *lc, buffer *b)
+{
+    memset(lc, 0, sizeof(*lc));
+    lc->b = b;
+    buffer_add_listener(b, line_class_on_change, lc);
+}
+
+void
+line_class_free(line_class_index *lc)
+{
+    buffer_remove_listener(lc->b, line_class_on_change, lc);
+    free(lc->empty);
+    free(lc->blank);
+    free(lc->spare_empty);
+    free(lc->spare_blank);
+    memset(lc, 0, sizeof(*lc));
+}
+
+u64
+line_class_count(line_class_index *lc)
+{
+    if (!lc->built)
+    {
+        line_class_build(lc);
+    }
+
+    return lc->count;
+}
+
+int
+line_class_is_empty(line_class_index *lc, u64 line)
+{
+    return line < line_class_count(lc) && (lc->empty[line / 64] >> (line % 64)) & 1;
+}
+
+int
+line_class_is_blank(line_class_index *lc, u64 line)
+{
+    return line < line_class_count(lc) && (lc->blank[line / 64] >> (line % 64)) & 1;
+}
+
+/* First line at or after `from` whose blank (or empty) bit is `set`, the line count if none. */
+u64
+line_class_next(line_class_index *lc, u8 blank, u64 from, int set)
+{
+    u64 count = line_class_count(lc);
+    u64 *bits = blank ? lc->blank : lc->empty;
+    u64 w = from / 64;
+    u64 word;
+
+    if (from >= count)
+    {
+        return count;
+    }
+
+    word = (set ? bits[w] : ~bits[w]) & (~(u64)0 << (from % 64));
+    while (word == 0)
+    {
+        if (++w * 64 >= count)
+        {
+            return count;
+        }
+        word = set ? bits[w] : ~bits[w];
+    }
+
+    from = w * 64 + (u64)__builtin_ctzll(word);
+    return from < count ? from : count;
+}
+
+/* Last line at or before `from` whose bit is `set`, the line count if none. */
+u64
+line_class_prev(line_class_index *lc, u8 blank, u64 from, int set)
+{
+    u64 count = line_class_count(lc);
+    u64 *bits = blank ? lc->blank : lc->empty;
+    u64 w;
+    u64 word;
+
+    if (count == 0)
+    {
+        return count;
+    }
+    if (from >= count)
+    {
+        from = count - 1;
+    }
+
+    w = from / 64;
+    word = (set ? bits[w] : ~bits[w]) & (~(u64)0 >> (63 - from % 64));
+    while (word == 0)
+    {
+        if (w == 0)
+        {
+            return count;
+        }
+        w--;
+        word = set ? bits[w] : ~bits[w];
+    }
+
+    return w * 64 + 63 - (u64)__builtin_clzll(word);
+}
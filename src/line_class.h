@@ -0,0 +1,37 @@
+#ifndef LINE_CLASS_H
+#define LINE_CLASS_H
+
+#include "base.h"
+#include "buffer.h"
+
+/*
+ * One bit per line of a buffer, built on first use and kept up to date on
+ * edits, so paragraph motions skip 64 lines per word instead of reading
+ * each one. `empty` lines have no characters, `blank` lines nothing but
+ * spaces and tabs (empty ones included).
+ */
+typedef struct
+{
+    buffer *b;
+    u8 built;
+    u64 count;
+
+    u64 *empty;
+    u64 *blank;
+    u64 capacity;
+
+    /* the words are rebuilt into these and swapped in */
+    u64 *spare_empty;
+    u64 *spare_blank;
+    u64 spare_capacity;
+} line_class_index;
+
+void line_class_init(line_class_index *lc, buffer *b);
+void line_class_free(line_class_index *lc);
+u64 line_class_count(line_class_index *lc);
+int line_class_is_empty(line_class_index *lc, u64 line);
+int line_class_is_blank(line_class_index *lc, u64 line);
+u64 line_class_next(line_class_index *lc, u8 blank, u64 from, int set);
+u64 line_class_prev(line_class_index *lc, u8 blank, u64 from, int set);
+
+#endif
@@ -0,0 +1,1058 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "lsp.h"
+#include "base.h"
+
+static void
+lsp_set_message(lsp_client *c, const char *message)
+{
+    snprintf(c->message, sizeof(c->message), "%s", message);
+    c->changed = 1;
+}
+
+/* A file URI for `path`, resolved and percent-encoded, or NULL if it does not exist. */
+static char *
+lsp_uri(const char *path)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char resolved[PATH_MAX];
+    char *uri;
+    u64 len;
+    u64 n;
+    u64 i;
+
+    if (path == NULL || realpath(path, resolved) == NULL)
+    {
+        return NULL;
+    }
+
+    len = strlen(resolved);
+    uri = (char *)malloc((size_t)(7 + len * 3 + 1));
+    if (uri == NULL)
+    {
+        fprintf(stderr, "[error] lsp_uri unable to alloc\n");
+        exit(1);
+    }
+
+    memcpy(uri, "file://", 7);
+    n = 7;
+    for (i = 0; i < len; i++)
+    {
+        u8 c = (u8)resolved[i];
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '/' || c == '-' || c == '.' || c == '_' || c == '~')
+        {
+            uri[n++] = (char)c;
+            continue;
+        }
+
+        uri[n++] = '%';
+        uri[n++] = hex[c >> 4];
+        uri[n++] = hex[c & 15];
+    }
+    uri[n] = '\0';
+
+    return uri;
+}
+
+static void
+lsp_close_pipes(lsp_client *c)
+{
+    int i;
+
+    close(c->to_server);
+    close(c->from_server);
+    c->running = 0;
+    c->initialized = 0;
+    c->pending_count = 0;
+
+    if (c->pid <= 0)
+    {
+        return;
+    }
+
+    /* a server told to exit gets a moment to do so */
+    for (i = 0; i < 50; i++)
+    {
+        struct timespec wait = {0, 10 * 1000 * 1000};
+
+        if (waitpid(c->pid, NULL, WNOHANG) != 0)
+        {
+            return;
+        }
+        nanosleep(&wait, NULL);
+    }
+
+    kill(c->pid, SIGKILL);
+    waitpid(c->pid, NULL, 0);
+}
+
+static void
+lsp_lost(lsp_client *c, const char *message)
+{
+    u64 i;
+
+    lsp_close_pipes(c);
+    for (i = 0; i < c->document_count; i++)
+    {
+        c->documents[i].opened = 0;
+    }
+
+    lsp_set_message(c, message);
+}
+
+/* Writes what is queued until the pipe is full. */
+static void
+lsp_flush(lsp_client *c)
+{
+    while (c->running && c->out_sent < c->out.len)
+    {
+        ssize_t n = write(c->to_server, c->out.data + c->out_sent, (size_t)(c->out.len - c->out_sent));
+
+        if (n > 0)
+        {
+            c->out_sent += (u64)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+
+        lsp_lost(c, "lsp: server exited");
+        return;
+    }
+
+    if (c->out_sent == c->out.len)
+    {
+        c->out.len = 0;
+        c->out_sent = 0;
+    }
+}
+
+/* Queues `body`, which the caller left open after the params, as one framed message. */
+static void
+lsp_send(lsp_client *c)
+{
+    char header[64];
+    int len;
+
+    json_write(&c->body, "}", 1);
+    if (c->running)
+    {
+        len = snprintf(header, sizeof(header), "Content-Length: %llu\r\n\r\n",
+                       (unsigned long long)c->body.len);
+        json_write(&c->out, header, (u64)len);
+        json_write(&c->out, (const char *)c->body.data, c->body.len);
+    }
+
+    c->body.len = 0;
+}
+
+static void
+lsp_begin_notification(lsp_client *c, const char *method)
+{
+    json_write_cstr(&c->body, "{\"jsonrpc\":\"2.0\",\"method\":\"");
+    json_write_cstr(&c->body, method);
+    json_write_cstr(&c->body, "\",\"params\":");
+}
+
+static void
+lsp_begin_request(lsp_client *c, const char *method, u8 kind, u64 document, u64 version)
+{
+    lsp_request *r;
+
+    /* a server that never answers should not stop new requests, the oldest is forgotten */
+    if (c->pending_count == LSP_MAX_PENDING)
+    {
+        memmove(c->pending, c->pending + 1, sizeof(lsp_request) * (LSP_MAX_PENDING - 1));
+        c->pending_count--;
+    }
+
+    r = &c->pending[c->pending_count++];
+    r->id = ++c->next_id;
+    r->kind = kind;
+    r->document = document;
+    r->version = version;
+
+    json_write_cstr(&c->body, "{\"jsonrpc\":\"2.0\",\"id\":");
+    json_write_u64(&c->body, r->id);
+    json_write_cstr(&c->body, ",\"method\":\"");
+    json_write_cstr(&c->body, method);
+    json_write_cstr(&c->body, "\",\"params\":");
+}
+
+static void
+lsp_write_cstring(json_writer *w, const char *s)
+{
+    json_write_string(w, (string){.s = (u8 *)s, .len = strlen(s)});
+}
+
+static void
+lsp_write_document(lsp_client *c, lsp_document *doc, int with_version)
+{
+    json_write_cstr(&c->body, "{\"uri\":");
+    lsp_write_cstring(&c->body, doc->uri);
+    if (with_version)
+    {
+        json_write_cstr(&c->body, ",\"version\":");
+        json_write_u64(&c->body, doc->version);
+    }
+    json_write_cstr(&c->body, "}");
+}
+
+static void
+lsp_write_position(json_writer *w, lsp_position p)
+{
+    json_write_cstr(w, "{\"line\":");
+    json_write_u64(w, p.line);
+    json_write_cstr(w, ",\"character\":");
+    json_write_u64(w, p.character);
+    json_write_cstr(w, "}");
+}
+
+/* The position of `offset`, counting UTF-16 code units unless the server takes bytes. */
+static lsp_position
+lsp_position_at(lsp_client *c, buffer *b, u64 offset)
+{
+    buffer_reader r;
+    lsp_position p;
+    u64 col;
+    u64 i;
+
+    buffer_offset_to_line_col(b, offset, &p.line, &col);
+    p.character = col;
+    if (c->utf8 || col == 0)
+    {
+        return p;
+    }
+
+    p.character = 0;
+    buffer_reader_init(&r, b);
+    for (i = offset - col; i < offset; i++)
+    {
+        u8 ch = buffer_reader_byte(&r, i);
+
+        /* four byte sequences are a surrogate pair */
+        if ((ch & 0xc0) != 0x80)
+        {
+            p.character += ch >= 0xf0 ? 2 : 1;
+        }
+    }
+
+    return p;
+}
+
+/* Writes [start, start + len) of `b` as a JSON string straight from its pieces. */
+static void
+lsp_write_text(json_writer *w, buffer *b, u64 start, u64 len)
+{
+    u64 end = start + len;
+
+    json_write(w, "\"", 1);
+    while (start < end)
+    {
+        string span;
+
+        span.len = buffer_span_at(b, start, &span.s);
+        if (span.len > end - start)
+        {
+            span.len = end - start;
+        }
+
+        json_write_escaped(w, span);
+        start += span.len;
+    }
+    json_write(w, "\"", 1);
+}
+
+static void
+lsp_did_open(lsp_client *c, lsp_document *doc)
+{
+
+    lsp_begin_notification(c, "textDocument/didOpen");
+    json_write_cstr(&c->body, "{\"textDocument\":{\"uri\":");
+    lsp_write_cstring(&c->body, doc->uri);
+    json_write_cstr(&c->body, ",\"languageId\":");
+    lsp_write_cstring(&c->body, doc->language);
+    json_write_cstr(&c->body, ",\"version\":");
+    json_write_u64(&c->body, doc->version);
+    json_write_cstr(&c->body, ",\"text\":");
+    lsp_write_text(&c->body, doc->b, 0, doc->b->total_len);
+    json_write_cstr(&c->body, "}}");
+    lsp_send(c);
+
+    doc->opened = 1;
+}
+
+/* Takes the range each change replaces while the text it replaces is still there. */
+static void
+lsp_before_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    lsp_document *doc = (lsp_document *)ctx;
+    lsp_client *c = doc->client;
+    u64 i;
+
+    if (!doc->opened || !c->incremental)
+    {
+        return;
+    }
+
+    if (count > doc->range_capacity)
+    {
+        doc->range_capacity = count;
+        doc->ranges = (lsp_range *)realloc(doc->ranges, sizeof(lsp_range) * (size_t)count);
+        if (doc->ranges == NULL)
+        {
+            fprintf(stderr, "[error] lsp_before_change unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        doc->ranges[i].start = lsp_position_at(c, b, changes[i].offset);
+        doc->ranges[i].end = lsp_position_at(c, b, changes[i].offset + changes[i].old_len);
+    }
+}
+
+/*
+ * Sends the edit as ranged changes, last first: the server applies them in
+ * order, and each range is in pre-edit positions that the changes after it
+ * in the document leave alone.
+ */
+static void
+lsp_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    lsp_document *doc = (lsp_document *)ctx;
+    lsp_client *c = doc->client;
+    s64 delta = 0;
+    u64 i;
+
+    doc->version++;
+    if (!doc->opened || !c->incremental)
+    {
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        delta += (s64)changes[i].new_len - (s64)changes[i].old_len;
+    }
+
+    lsp_begin_notification(c, "textDocument/didChange");
+    json_write_cstr(&c->body, "{\"textDocument\":");
+    lsp_write_document(c, doc, 1);
+    json_write_cstr(&c->body, ",\"contentChanges\":[");
+
+    for (i = count; i-- > 0;)
+    {
+        delta -= (s64)changes[i].new_len - (s64)changes[i].old_len;
+
+        json_write_cstr(&c->body, i + 1 < count ? ",{\"range\":{\"start\":" : "{\"range\":{\"start\":");
+        lsp_write_position(&c->body, doc->ranges[i].start);
+        json_write_cstr(&c->body, ",\"end\":");
+        lsp_write_position(&c->body, doc->ranges[i].end);
+        json_write_cstr(&c->body, "},\"text\":");
+        lsp_write_text(&c->body, b, (u64)((s64)changes[i].offset + delta), changes[i].new_len);
+        json_write_cstr(&c->body, "}");
+    }
+
+    json_write_cstr(&c->body, "]}");
+    lsp_send(c);
+}
+
+lsp_document *
+lsp_document_for(lsp_client *c, buffer *b)
+{
+    u64 i;
+
+    for (i = 0; i < c->document_count; i++)
+    {
+        if (c->documents[i].b == b)
+        {
+            return &c->documents[i];
+        }
+    }
+
+    return NULL;
+}
+
+static lsp_document *
+lsp_document_for_uri(lsp_client *c, json_value *uri)
+{
+    char decoded[KB(4)];
+    u64 len;
+    u64 i;
+
+    if (uri == NULL || uri->type != JSON_STRING || uri->text.len >= sizeof(decoded))
+    {
+        return NULL;
+    }
+
+    len = json_unescape(uri, (u8 *)decoded);
+    decoded[len] = '\0';
+    for (i = 0; i < c->document_count; i++)
+    {
+        if (strcmp(c->documents[i].uri, decoded) == 0)
+        {
+            return &c->documents[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Copies a string value into `out` as a C string, cut to fit. */
+static void
+lsp_copy_string(json_value *v, char *out, u64 size)
+{
+    u8 *decoded;
+    u64 len;
+
+    out[0] = '\0';
+    if (v == NULL || v->type != JSON_STRING)
+    {
+        return;
+    }
+
+    decoded = (u8 *)malloc((size_t)v->text.len + 1);
+    if (decoded == NULL)
+    {
+        fprintf(stderr, "[error] lsp_copy_string unable to alloc\n");
+        exit(1);
+    }
+
+    len = json_unescape(v, decoded);
+    snprintf(out, (size_t)size, "%.*s", (int)len, (char *)decoded);
+    free(decoded);
+}
+
+static void
+lsp_handle_initialize(lsp_client *c, json_value *result)
+{
+    json_value *capabilities = json_get(result, "capabilities");
+    json_value *sync = json_get(capabilities, "textDocumentSync");
+    s64 kind = 0;
+    u64 i;
+
+    if (capabilities == NULL)
+    {
+        lsp_set_message(c, "lsp: initialize failed");
+        return;
+    }
+
+    c->utf8 = (u8)json_is_string(json_get(capabilities, "positionEncoding"), "utf-8");
+    if (sync != NULL && sync->type == JSON_OBJECT)
+    {
+        sync = json_get(sync, "change");
+    }
+    json_to_s64(sync, &kind);
+    c->incremental = kind == 2;
+    c->initialized = 1;
+
+    lsp_begin_notification(c, "initialized");
+    json_write_cstr(&c->body, "{}");
+    lsp_send(c);
+
+    for (i = 0; i < c->document_count; i++)
+    {
+        lsp_did_open(c, &c->documents[i]);
+    }
+
+    lsp_set_message(c, c->incremental ? "lsp: initialized" :
+                                        "lsp: initialized, server does not take ranged changes");
+}
+
+/* MarkupContent, a MarkedString or an array of them, the first one is shown. */
+static json_value *
+lsp_markup_text(json_value *v)
+{
+    if (v == NULL)
+    {
+        return NULL;
+    }
+
+    if (v->type == JSON_ARRAY)
+    {
+        return lsp_markup_text(v->child);
+    }
+
+    if (v->type == JSON_OBJECT)
+    {
+        v = json_get(v, "value");
+    }
+
+    return v != NULL && v->type == JSON_STRING ? v : NULL;
+}
+
+static void
+lsp_handle_hover(lsp_client *c, json_value *result)
+{
+    json_value *text = lsp_markup_text(json_get(result, "contents"));
+    u64 len = text != NULL ? text->text.len : 0;
+
+    c->hover = (u8 *)realloc(c->hover, (size_t)len + 1);
+    if (c->hover == NULL)
+    {
+        fprintf(stderr, "[error] lsp_handle_hover unable to realloc\n");
+        exit(1);
+    }
+
+    c->hover_len = text != NULL ? json_unescape(text, c->hover) : 0;
+    c->hover[c->hover_len] = '\0';
+    c->hover_ready = 1;
+    c->changed = 1;
+}
+
+static void
+lsp_handle_response(lsp_client *c, json_value *id, json_value *msg)
+{
+    json_value *result = json_get(msg, "result");
+    lsp_request r;
+    s64 n;
+    u64 i;
+
+    if (!json_to_s64(id, &n))
+    {
+        return;
+    }
+
+    for (i = 0; i < c->pending_count && c->pending[i].id != (u64)n; i++)
+    {
+    }
+
+    if (i == c->pending_count)
+    {
+        return;
+    }
+
+    r = c->pending[i];
+    c->pending[i] = c->pending[--c->pending_count];
+
+    switch (r.kind) {
+    case LSP_REQUEST_INITIALIZE:
+        lsp_handle_initialize(c, result);
+        break;
+    case LSP_REQUEST_HOVER:
+        /* the answer is about text that has changed since */
+        if (r.document >= c->document_count || c->documents[r.document].version != r.version)
+        {
+            c->stale++;
+            return;
+        }
+
+        lsp_handle_hover(c, result);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+lsp_handle_diagnostics(lsp_client *c, json_value *params)
+{
+    lsp_document *doc = lsp_document_for_uri(c, json_get(params, "uri"));
+    json_value *diagnostics = json_get(params, "diagnostics");
+    json_value *first;
+    s64 version;
+    s64 line = 0;
+
+    if (doc == NULL || diagnostics == NULL || diagnostics->type != JSON_ARRAY)
+    {
+        return;
+    }
+
+    if (json_to_s64(json_get(params, "version"), &version) && (u64)version != doc->version)
+    {
+        c->stale++;
+        return;
+    }
+
+    first = diagnostics->child;
+    doc->diagnostic_count = diagnostics->count;
+    lsp_copy_string(json_get(first, "message"), doc->diagnostic, sizeof(doc->diagnostic));
+    json_to_s64(json_get(json_get(json_get(first, "range"), "start"), "line"), &line);
+    doc->diagnostic_line = (u64)line;
+    c->changed = 1;
+}
+
+/* Requests from the server get an empty answer, it wants one for each. */
+static void
+lsp_answer_server(lsp_client *c, json_value *id, json_value *method, json_value *msg)
+{
+    json_value *items = json_get(json_get(msg, "params"), "items");
+
+    json_write_cstr(&c->body, "{\"jsonrpc\":\"2.0\",\"id\":");
+    if (id->type == JSON_STRING)
+    {
+        json_write(&c->body, "\"", 1);
+        json_write(&c->body, (const char *)id->text.s, id->text.len);
+        json_write(&c->body, "\"", 1);
+    }
+    else if (id->type == JSON_NUMBER)
+    {
+        json_write(&c->body, (const char *)id->text.s, id->text.len);
+    }
+    else
+    {
+        json_write_cstr(&c->body, "null");
+    }
+
+    if (json_is_string(method, "workspace/configuration") && items != NULL && items->type == JSON_ARRAY)
+    {
+        u64 i;
+
+        json_write_cstr(&c->body, ",\"result\":[");
+        for (i = 0; i < items->count; i++)
+        {
+            json_write_cstr(&c->body, i > 0 ? ",null" : "null");
+        }
+        json_write_cstr(&c->body, "]");
+    }
+    else
+    {
+        json_write_cstr(&c->body, ",\"result\":null");
+    }
+
+    lsp_send(c);
+}
+
+static void
+lsp_handle(lsp_client *c, string body)
+{
+    json_value *msg;
+    json_value *id;
+    json_value *method;
+
+    if (json_arena_size(body.len) > c->json.reserved)
+    {
+        lsp_set_message(c, "lsp: message from server too large");
+        return;
+    }
+
+    arena_reset(&c->json);
+    msg = json_parse(&c->json, body);
+    if (msg == NULL)
+    {
+        return;
+    }
+
+    id = json_get(msg, "id");
+    method = json_get(msg, "method");
+    if (method != NULL && id != NULL)
+    {
+        lsp_answer_server(c, id, method, msg);
+    }
+    else if (json_is_string(method, "textDocument/publishDiagnostics"))
+    {
+        lsp_handle_diagnostics(c, json_get(msg, "params"));
+    }
+    else if (json_is_string(method, "window/showMessage"))
+    {
+        lsp_copy_string(json_get(json_get(msg, "params"), "message"), c->message, sizeof(c->message));
+        c->changed = 1;
+    }
+    else if (method == NULL && id != NULL)
+    {
+        lsp_handle_response(c, id, msg);
+    }
+}
+
+static int
+lsp_content_length(u8 *header, u64 len, u64 *out)
+{
+    u64 i = 0;
+
+    while (i < len)
+    {
+        u64 end = i;
+
+        while (end < len && header[end] != '\n')
+        {
+            end++;
+        }
+
+        if (end - i > 15 && strncasecmp((char *)header + i, "Content-Length:", 15) == 0)
+        {
+            u64 n = 0;
+            u64 j = i + 15;
+
+            while (j < end && header[j] == ' ')
+            {
+                j++;
+            }
+
+            if (j == end || header[j] < '0' || header[j] > '9')
+            {
+                return 0;
+            }
+
+            while (j < end && header[j] >= '0' && header[j] <= '9')
+            {
+                n = n * 10 + (u64)(header[j++] - '0');
+            }
+
+            *out = n;
+            return 1;
+        }
+
+        i = end + 1;
+    }
+
+    return 0;
+}
+
+/* Handles every whole message read so far and keeps the rest for the next read. */
+static void
+lsp_process(lsp_client *c)
+{
+    u64 at = 0;
+
+    while (c->running)
+    {
+        u8 *end = (u8 *)memmem(c->in + at, (size_t)(c->in_len - at), "\r\n\r\n", 4);
+        u64 header_len;
+        u64 body_len;
+
+        if (end == NULL)
+        {
+            if (c->in_len - at > LSP_MAX_HEADER)
+            {
+                lsp_lost(c, "lsp: unreadable message from server");
+            }
+            break;
+        }
+
+        header_len = (u64)(end - (c->in + at)) + 4;
+        if (!lsp_content_length(c->in + at, header_len, &body_len))
+        {
+            lsp_lost(c, "lsp: message without a length from server");
+            break;
+        }
+
+        if (c->in_len - at - header_len < body_len)
+        {
+            break;
+        }
+
+        lsp_handle(c, (string){.s = c->in + at + header_len, .len = body_len});
+        at += header_len + body_len;
+    }
+
+    if (at > 0 && at <= c->in_len)
+    {
+        memmove(c->in, c->in + at, (size_t)(c->in_len - at));
+        c->in_len -= at;
+    }
+}
+
+static void
+lsp_read(lsp_client *c)
+{
+    while (c->running)
+    {
+        ssize_t n;
+
+        if (c->in_capacity - c->in_len < KB(16))
+        {
+            c->in_capacity = c->in_capacity ? c->in_capacity * 2 : KB(64);
+            c->in = (u8 *)realloc(c->in, (size_t)c->in_capacity);
+            if (c->in == NULL)
+            {
+                fprintf(stderr, "[error] lsp_read unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        n = read(c->from_server, c->in + c->in_len, (size_t)(c->in_capacity - c->in_len));
+        if (n > 0)
+        {
+            c->in_len += (u64)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+
+        lsp_lost(c, "lsp: server exited");
+    }
+}
+
+/* Starts `command` with sh, its stdin and stdout are the pipes and stderr is dropped. */
+int
+lsp_start(lsp_client *c, const char *command, const char *root)
+{
+    int to[2];
+    int from[2];
+    pid_t pid;
+
+    if (pipe(to) != 0)
+    {
+        return 0;
+    }
+
+    if (pipe(from) != 0)
+    {
+        close(to[0]);
+        close(to[1]);
+        return 0;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        return 0;
+    }
+
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        if (null >= 0)
+        {
+            dup2(null, STDERR_FILENO);
+        }
+
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        setsid();
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    close(to[0]);
+    close(from[1]);
+    lsp_attach(c, to[1], from[0], pid, root);
+    return 1;
+}
+
+/* Takes over pipes to a server that is already running and sends it initialize. */
+void
+lsp_attach(lsp_client *c, int to_server, int from_server, pid_t pid, const char *root)
+{
+    memset(c, 0, sizeof(*c));
+    c->pid = pid;
+    c->to_server = to_server;
+    c->from_server = from_server;
+    c->running = 1;
+    c->root_uri = lsp_uri(root);
+    c->json = new_arena(LSP_JSON_RESERVE);
+
+    /* a server that exits must not take the editor with it */
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(to_server, F_SETFL, fcntl(to_server, F_GETFL) | O_NONBLOCK);
+    fcntl(from_server, F_SETFL, fcntl(from_server, F_GETFL) | O_NONBLOCK);
+    fcntl(to_server, F_SETFD, FD_CLOEXEC);
+    fcntl(from_server, F_SETFD, FD_CLOEXEC);
+
+    lsp_begin_request(c, "initialize", LSP_REQUEST_INITIALIZE, 0, 0);
+    json_write_cstr(&c->body, "{\"processId\":");
+    json_write_u64(&c->body, (u64)getpid());
+    json_write_cstr(&c->body, ",\"rootUri\":");
+    if (c->root_uri != NULL)
+    {
+        lsp_write_cstring(&c->body, c->root_uri);
+    }
+    else
+    {
+        json_write_cstr(&c->body, "null");
+    }
+    json_write_cstr(&c->body,
+                    ",\"capabilities\":{"
+                    "\"general\":{\"positionEncodings\":[\"utf-8\",\"utf-16\"]},"
+                    "\"textDocument\":{"
+                    "\"synchronization\":{\"didSave\":true},"
+                    "\"hover\":{\"contentFormat\":[\"plaintext\"]},"
+                    "\"publishDiagnostics\":{\"versionSupport\":true}}}}");
+    lsp_send(c);
+    lsp_flush(c);
+}
+
+void
+lsp_stop(lsp_client *c)
+{
+    u64 i;
+
+    if (c->running)
+    {
+        lsp_begin_request(c, "shutdown", LSP_REQUEST_SHUTDOWN, 0, 0);
+        json_write_cstr(&c->body, "null");
+        lsp_send(c);
+        lsp_begin_notification(c, "exit");
+        json_write_cstr(&c->body, "null");
+        lsp_send(c);
+        lsp_flush(c);
+        lsp_close_pipes(c);
+    }
+
+    for (i = 0; i < c->document_count; i++)
+    {
+        buffer_remove_listener(c->documents[i].b, lsp_on_change, &c->documents[i]);
+        free(c->documents[i].uri);
+        free(c->documents[i].ranges);
+    }
+
+    free(c->root_uri);
+    free(c->in);
+    arena_release(&c->json);
+    free(c->hover);
+    json_writer_free(&c->out);
+    json_writer_free(&c->body);
+    memset(c, 0, sizeof(*c));
+}
+
+/* Tracks `b` from now on, it is opened on the server once that has initialized. */
+int
+lsp_open(lsp_client *c, buffer *b, const char *language)
+{
+    char path[KB(4)];
+    lsp_document *doc;
+    char *uri;
+
+    if (lsp_document_for(c, b) != NULL)
+    {
+        return 1;
+    }
+
+    if (!c->running || c->document_count == LSP_MAX_DOCUMENTS ||
+        b->file_path.len == 0 || b->file_path.len >= sizeof(path))
+    {
+        return 0;
+    }
+
+    memcpy(path, b->file_path.s, (size_t)b->file_path.len);
+    path[b->file_path.len] = '\0';
+    uri = lsp_uri(path);
+    if (uri == NULL)
+    {
+        return 0;
+    }
+
+    doc = &c->documents[c->document_count++];
+    memset(doc, 0, sizeof(*doc));
+    doc->client = c;
+    doc->b = b;
+    doc->uri = uri;
+    doc->language = language;
+    doc->version = 1;
+    buffer_add_edit_listener(b, lsp_before_change, lsp_on_change, doc);
+
+    if (c->initialized)
+    {
+        lsp_did_open(c, doc);
+    }
+
+    return 1;
+}
+
+void
+lsp_saved(lsp_client *c, buffer *b)
+{
+    lsp_document *doc = lsp_document_for(c, b);
+
+    if (doc == NULL || !doc->opened)
+    {
+        return;
+    }
+
+    lsp_begin_notification(c, "textDocument/didSave");
+    json_write_cstr(&c->body, "{\"textDocument\":");
+    lsp_write_document(c, doc, 0);
+    json_write_cstr(&c->body, "}");
+    lsp_send(c);
+}
+
+/* Asks about `offset`, the answer is kept only if the document is still the same then. */
+int
+lsp_hover(lsp_client *c, buffer *b, u64 offset)
+{
+    lsp_document *doc = lsp_document_for(c, b);
+
+    if (doc == NULL || !doc->opened)
+    {
+        return 0;
+    }
+
+    lsp_begin_request(c, "textDocument/hover", LSP_REQUEST_HOVER, (u64)(doc - c->documents), doc->version);
+    json_write_cstr(&c->body, "{\"textDocument\":");
+    lsp_write_document(c, doc, 0);
+    json_write_cstr(&c->body, ",\"position\":");
+    lsp_write_position(&c->body, lsp_position_at(c, b, offset));
+    json_write_cstr(&c->body, "}");
+    lsp_send(c);
+    return 1;
+}
+
+/* The pipes to wait on: the reply pipe, and the request pipe while output is queued. */
+u64
+lsp_poll_fds(lsp_client *c, struct pollfd *fds)
+{
+    u64 n = 0;
+
+    if (!c->running)
+    {
+        return 0;
+    }
+
+    fds[n].fd = c->from_server;
+    fds[n].events = POLLIN;
+    fds[n].revents = 0;
+    n++;
+
+    if (c->out_sent < c->out.len)
+    {
+        fds[n].fd = c->to_server;
+        fds[n].events = POLLOUT;
+        fds[n].revents = 0;
+        n++;
+    }
+
+    return n;
+}
+
+/* Moves whatever the pipes allow without waiting, returns 1 if there is news to show. */
+int
+lsp_pump(lsp_client *c)
+{
+    if (!c->running)
+    {
+        return 0;
+    }
+
+    c->changed = 0;
+    lsp_flush(c);
+    lsp_read(c);
+    lsp_process(c);
+    lsp_flush(c);
+    return c->changed;
+}
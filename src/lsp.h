@@ -0,0 +1,122 @@
+#ifndef LSP_H
+#define LSP_H
+
+#include <poll.h>
+#include <sys/types.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "json.h"
+
+#define LSP_MAX_DOCUMENTS 32
+#define LSP_MAX_PENDING 64
+/* a header block longer than this is not from a language server */
+#define LSP_MAX_HEADER KB(4)
+/* address space for parsing one message, a message that could need more is dropped */
+#define LSP_JSON_RESERVE GB(1)
+
+typedef enum {
+    LSP_REQUEST_INITIALIZE = 1,
+    LSP_REQUEST_HOVER,
+    LSP_REQUEST_SHUTDOWN,
+} lsp_request_kind;
+
+/* A request sent and not answered yet, with the document version it was asked about. */
+typedef struct
+{
+    u64 id;
+    u8 kind;
+    u64 document;
+    u64 version;
+} lsp_request;
+
+/* A position as the server counts it, in bytes or UTF-16 code units. */
+typedef struct
+{
+    u64 line;
+    u64 character;
+} lsp_position;
+
+typedef struct
+{
+    lsp_position start;
+    lsp_position end;
+} lsp_range;
+
+struct lsp_client;
+
+typedef struct
+{
+    struct lsp_client *client;
+    buffer *b;
+    char *uri;
+    const char *language;
+    u64 version;
+    /* didOpen was sent, changes are sent from then on */
+    u8 opened;
+
+    /* the ranges an edit replaces, taken before it while the old text is there */
+    lsp_range *ranges;
+    u64 range_capacity;
+
+    u64 diagnostic_count;
+    u64 diagnostic_line;
+    char diagnostic[256];
+} lsp_document;
+
+/*
+ * A language server on the other end of two pipes. Nothing here blocks:
+ * lsp_pump writes what is queued and reads what has arrived as far as the
+ * pipes allow, and is called from the editor loop whenever lsp_poll_fds
+ * says a pipe is ready. Each message is parsed into `json` in place, so
+ * its strings point into `in` until the next one.
+ */
+typedef struct lsp_client
+{
+    pid_t pid;
+    int to_server;
+    int from_server;
+    u8 running;
+    u8 initialized;
+    /* positions count bytes, otherwise UTF-16 code units */
+    u8 utf8;
+    /* the server takes ranged changes, otherwise none are sent */
+    u8 incremental;
+    char *root_uri;
+
+    json_writer out;
+    u64 out_sent;
+    json_writer body;
+    u8 *in;
+    u64 in_len;
+    u64 in_capacity;
+    arena json;
+
+    u64 next_id;
+    lsp_request pending[LSP_MAX_PENDING];
+    u64 pending_count;
+
+    lsp_document documents[LSP_MAX_DOCUMENTS];
+    u64 document_count;
+
+    /* what arrived for the editor to show, `changed` is set by each */
+    u8 *hover;
+    u64 hover_len;
+    u8 hover_ready;
+    char message[256];
+    u8 changed;
+    /* answers dropped because their document changed after the request */
+    u64 stale;
+} lsp_client;
+
+int lsp_start(lsp_client *c, const char *command, const char *root);
+void lsp_attach(lsp_client *c, int to_server, int from_server, pid_t pid, const char *root);
+void lsp_stop(lsp_client *c);
+int lsp_open(lsp_client *c, buffer *b, const char *language);
+lsp_document *lsp_document_for(lsp_client *c, buffer *b);
+void lsp_saved(lsp_client *c, buffer *b);
+int lsp_hover(lsp_client *c, buffer *b, u64 offset);
+u64 lsp_poll_fds(lsp_client *c, struct pollfd *fds);
+int lsp_pump(lsp_client *c);
+
+#endif
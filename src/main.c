@@ -12,13 +12,15 @@ int main(int argc, char **argv)
 
     while(E.running)
     {
+        arena_checkpoint frame = arena_save(&E.scratch);
+
         editor_draw();
 
         int c = editor_read_key(STDIN_FILENO);
         editor_process_keypress(c);
 
         /* end of frame cleanup */
-        E.scratch.cur_pos = 0;
+        arena_restore(&E.scratch, frame);
     }
 
     /* cleanup / shutdown */
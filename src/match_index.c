@@ -0,0 +1,489 @@
+#include "match_index.h"
+#include "search.h"
+#include "base.h"
+
+static void
+match_index_reserve(match_index *mi, u64 needed)
+{
+    u64 new_capacity = mi->capacity ? mi->capacity : 64;
+    match_span *items;
+
+    if (needed <= mi->capacity)
+    {
+        return;
+    }
+
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    items = (match_span *)realloc(mi->items, sizeof(match_span) * new_capacity);
+    if (items == NULL)
+    {
+        fprintf(stderr, "[error] match_index_reserve unable to realloc\n");
+        exit(1);
+    }
+
+    mi->items = items;
+    mi->capacity = new_capacity;
+}
+
+static void
+match_index_reserve_dirty(match_index *mi, u64 needed)
+{
+    u64 new_capacity = mi->dirty_capacity ? mi->dirty_capacity : 8;
+    match_range *dirty;
+
+    if (needed <= mi->dirty_capacity)
+    {
+        return;
+    }
+
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    dirty = (match_range *)realloc(mi->dirty, sizeof(match_range) * new_capacity);
+    if (dirty == NULL)
+    {
+        fprintf(stderr, "[error] match_index_reserve_dirty unable to realloc\n");
+        exit(1);
+    }
+
+    mi->dirty = dirty;
+    mi->dirty_capacity = new_capacity;
+}
+
+static void
+match_index_dirty_all(match_index *mi)
+{
+    mi->count = 0;
+    match_index_reserve_dirty(mi, 1);
+    mi->dirty[0].start = 0;
+    /* one past the end so empty matches at the end of the text count */
+    mi->dirty[0].end = mi->b->total_len + 1;
+    mi->dirty_count = 1;
+}
+
+/*
+ * Maps a pre-edit offset to its post-edit position. `j` and `delta` carry
+ * the walk over the sorted changes, so mapping sorted offsets is one pass.
+ */
+static u64
+match_index_map(buffer_change *changes, u64 count, u64 *j, s64 *delta, u64 x, int *deleted)
+{
+    while (*j < count && changes[*j].offset + changes[*j].old_len <= x)
+    {
+        *delta += (s64)changes[*j].new_len - (s64)changes[*j].old_len;
+        (*j)++;
+    }
+
+    *deleted = (*j < count && changes[*j].offset <= x);
+    if (*deleted)
+    {
+        return (u64)((s64)changes[*j].offset + *delta);
+    }
+
+    return (u64)((s64)x + *delta);
+}
+
+/*
+ * Post-edit lines touched by each change, widened by `extra_lines` on both
+ * sides for literals that span lines, merged into sorted ranges.
+ */
+static u64
+match_index_windows(buffer *b, buffer_change *changes, u64 count, u64 extra_lines,
+                    match_range *out)
+{
+    s64 delta = 0;
+    u64 n = 0;
+    u64 i;
+
+    for (i = 0; i < count; i++)
+    {
+        u64 start = (u64)((s64)changes[i].offset + delta);
+        u64 end = start + changes[i].new_len;
+        u64 line;
+        u64 col;
+        match_range w;
+
+        buffer_offset_to_line_col(b, start, &line, &col);
+        w.start = buffer_line_start(b, line > extra_lines ? line - extra_lines : 0);
+        buffer_offset_to_line_col(b, end, &line, &col);
+        line = line + extra_lines < b->lines.count ? line + extra_lines : b->lines.count - 1;
+        w.end = buffer_line_start(b, line) + buffer_line_len(b, line) + 1;
+
+        if (n > 0 && w.start <= out[n - 1].end)
+        {
+            out[n - 1].end = w.end > out[n - 1].end ? w.end : out[n - 1].end;
+        }
+        else
+        {
+            out[n++] = w;
+        }
+
+        delta += (s64)changes[i].new_len - (s64)changes[i].old_len;
+    }
+
+    return n;
+}
+
+static void
+match_index_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    match_index *mi = (match_index *)ctx;
+    match_range *windows;
+    match_range *merged;
+    u64 window_count;
+    u64 merged_count = 0;
+    u64 w = 0;
+    u64 i;
+    u64 k;
+    u64 j;
+    s64 delta;
+    int deleted;
+
+    if (!mi->active)
+    {
+        return;
+    }
+
+    /* a match that can span lines may be changed by an edit far after it */
+    if (mi->use_regex && mi->re.multiline)
+    {
+        match_index_dirty_all(mi);
+        return;
+    }
+
+    if ((count + mi->dirty_count) * 2 + 1 > mi->window_capacity)
+    {
+        mi->window_capacity = (count + mi->dirty_count) * 4 + 8;
+        mi->windows = (match_range *)realloc(mi->windows, sizeof(match_range) * mi->window_capacity);
+        if (mi->windows == NULL)
+        {
+            fprintf(stderr, "[error] match_index_on_change unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    windows = mi->windows;
+    window_count = match_index_windows(b, changes, count, mi->extra_lines, windows);
+    merged = windows + count;
+
+    /* shift the surviving matches, dropping those in deleted or touched text */
+    j = 0;
+    delta = 0;
+    k = 0;
+    for (i = 0; i < mi->count; i++)
+    {
+        u64 start = match_index_map(changes, count, &j, &delta, mi->items[i].start, &deleted);
+
+        if (deleted)
+        {
+            continue;
+        }
+
+        while (w < window_count && windows[w].end <= start)
+        {
+            w++;
+        }
+
+        if (w < window_count && windows[w].start <= start)
+        {
+            continue;
+        }
+
+        mi->items[k].start = start;
+        mi->items[k].len = mi->items[i].len;
+        k++;
+    }
+    mi->count = k;
+
+    /* shift the unscanned ranges and merge the touched lines into them */
+    j = 0;
+    delta = 0;
+    w = 0;
+    for (i = 0; i < mi->dirty_count || w < window_count; )
+    {
+        match_range r;
+
+        if (i < mi->dirty_count)
+        {
+            u64 j_end;
+            s64 delta_end;
+
+            r.start = match_index_map(changes, count, &j, &delta, mi->dirty[i].start, &deleted);
+            j_end = j;
+            delta_end = delta;
+            r.end = match_index_map(changes, count, &j_end, &delta_end, mi->dirty[i].end, &deleted);
+        }
+
+        if (i >= mi->dirty_count || (w < window_count && windows[w].start < r.start))
+        {
+            r = windows[w++];
+        }
+        else
+        {
+            i++;
+        }
+
+        if (merged_count > 0 && r.start <= merged[merged_count - 1].end)
+        {
+            if (r.end > merged[merged_count - 1].end)
+            {
+                merged[merged_count - 1].end = r.end;
+            }
+        }
+        else
+        {
+            merged[merged_count++] = r;
+        }
+    }
+
+    match_index_reserve_dirty(mi, merged_count);
+    memcpy(mi->dirty, merged, sizeof(match_range) * merged_count);
+    mi->dirty_count = merged_count;
+}
+
+void
+match_index_init(match_index *mi, buffer *b)
+{
+    memset(mi, 0, sizeof(*mi));
+    mi->b = b;
+    buffer_add_listener(b, match_index_on_change, mi);
+}
+
+void
+match_index_free(match_index *mi)
+{
+    match_index_clear(mi);
+    buffer_remove_listener(mi->b, match_index_on_change, mi);
+    free(mi->items);
+    free(mi->dirty);
+    free(mi->windows);
+    mi->items = NULL;
+    mi->dirty = NULL;
+    mi->windows = NULL;
+    mi->window_capacity = 0;
+}
+
+/*
+ * Starts indexing `pattern`, scanning happens in match_index_scan. A
+ * `word` pattern is a literal that only matches as a whole keyword.
+ */
+int
+match_index_set_pattern(match_index *mi, string pattern, u8 word)
+{
+    u64 i;
+
+    if (mi->active && mi->word == word && pattern.len == mi->pattern_len &&
+        memcmp(pattern.s, mi->pattern, (size_t)pattern.len) == 0)
+    {
+        return 1;
+    }
+
+    match_index_clear(mi);
+
+    if (pattern.len == 0 || pattern.len > sizeof(mi->pattern))
+    {
+        return 0;
+    }
+
+    if (!word && !regex_is_literal(pattern))
+    {
+        if (!regex_compile(&mi->re, pattern))
+        {
+            return 0;
+        }
+        mi->use_regex = 1;
+    }
+
+    memcpy(mi->pattern, pattern.s, (size_t)pattern.len);
+    mi->pattern_len = pattern.len;
+    mi->word = word;
+    mi->extra_lines = 0;
+    for (i = 0; !mi->use_regex && i < pattern.len; i++)
+    {
+        mi->extra_lines += (pattern.s[i] == '\n');
+    }
+    mi->active = 1;
+    match_index_dirty_all(mi);
+
+    return 1;
+}
+
+void
+match_index_clear(match_index *mi)
+{
+    if (mi->use_regex)
+    {
+        regex_free(&mi->re);
+        mi->use_regex = 0;
+    }
+
+    mi->active = 0;
+    mi->pattern_len = 0;
+    mi->count = 0;
+    mi->dirty_count = 0;
+}
+
+/* Finds the matches starting in [from, to) and drops that span from dirty[d]. */
+static void
+match_index_scan_span(match_index *mi, u64 d, u64 from, u64 to)
+{
+    string pattern = {.s = mi->pattern, .len = mi->pattern_len};
+    u64 at = match_index_lower_bound(mi, from);
+    u64 span_start = from;
+    u64 found = 0;
+    u64 start;
+    u64 len = pattern.len;
+    u64 end = mi->dirty[d].end;
+
+    /* found matches are collected past the end, then moved into place */
+    for (;;)
+    {
+        int hit;
+
+        if (mi->use_regex)
+        {
+            hit = regex_search_range(&mi->re, mi->b, from, to, &start, &len);
+        }
+        else if (mi->word)
+        {
+            hit = search_forward_word_range(mi->b, pattern, from, to, &start);
+        }
+        else
+        {
+            hit = search_forward_range(mi->b, pattern, from, to, &start);
+        }
+
+        if (!hit)
+        {
+            break;
+        }
+
+        match_index_reserve(mi, mi->count + found + 1);
+        mi->items[mi->count + found].start = start;
+        mi->items[mi->count + found].len = len;
+        found++;
+        from = start + 1;
+    }
+
+    if (found > 0 && at < mi->count)
+    {
+        match_span *moved = (match_span *)malloc(sizeof(match_span) * found);
+
+        if (moved == NULL)
+        {
+            fprintf(stderr, "[error] match_index_scan_span unable to alloc\n");
+            exit(1);
+        }
+
+        memcpy(moved, mi->items + mi->count, sizeof(match_span) * found);
+        memmove(mi->items + at + found, mi->items + at,
+                sizeof(match_span) * (mi->count - at));
+        memcpy(mi->items + at, moved, sizeof(match_span) * found);
+        free(moved);
+    }
+    mi->count += found;
+
+    if (span_start == mi->dirty[d].start && to == end)
+    {
+        mi->dirty_count--;
+        memmove(mi->dirty + d, mi->dirty + d + 1, sizeof(match_range) * (mi->dirty_count - d));
+    }
+    else if (span_start == mi->dirty[d].start)
+    {
+        mi->dirty[d].start = to;
+    }
+    else if (to == end)
+    {
+        mi->dirty[d].end = span_start;
+    }
+    else
+    {
+        match_index_reserve_dirty(mi, mi->dirty_count + 1);
+        memmove(mi->dirty + d + 2, mi->dirty + d + 1,
+                sizeof(match_range) * (mi->dirty_count - d - 1));
+        mi->dirty[d].end = span_start;
+        mi->dirty[d + 1].start = to;
+        mi->dirty[d + 1].end = end;
+        mi->dirty_count++;
+    }
+}
+
+/*
+ * Scans up to `budget` bytes of the unscanned ranges, lowest first.
+ * Returns 1 while there is work left.
+ */
+int
+match_index_scan(match_index *mi, u64 budget)
+{
+    while (mi->active && mi->dirty_count > 0 && budget > 0)
+    {
+        match_range d = mi->dirty[0];
+        u64 to = d.end - d.start > budget ? d.start + budget : d.end;
+
+        budget -= to - d.start;
+        match_index_scan_span(mi, 0, d.start, to);
+    }
+
+    return mi->active && mi->dirty_count > 0;
+}
+
+/* Scans whatever is still unscanned in [from, to), e.g. the visible lines. */
+void
+match_index_scan_range(match_index *mi, u64 from, u64 to)
+{
+    u64 d;
+
+    if (!mi->active)
+    {
+        return;
+    }
+
+    /* from the back, so splitting or dropping a range leaves the rest in place */
+    for (d = mi->dirty_count; d > 0; d--)
+    {
+        match_range r = mi->dirty[d - 1];
+        u64 start = r.start > from ? r.start : from;
+        u64 end = r.end < to ? r.end : to;
+
+        if (start < end)
+        {
+            match_index_scan_span(mi, d - 1, start, end);
+        }
+    }
+}
+
+int
+match_index_complete(match_index *mi)
+{
+    return mi->active && mi->dirty_count == 0;
+}
+
+/* Index of the first match starting at or after `offset`. */
+u64
+match_index_lower_bound(match_index *mi, u64 offset)
+{
+    u64 lo = 0;
+    u64 hi = mi->count;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (mi->items[mid].start < offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
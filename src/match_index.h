@@ -0,0 +1,65 @@
+#ifndef MATCH_INDEX_H
+#define MATCH_INDEX_H
+
+#include "base.h"
+#include "buffer.h"
+#include "regex.h"
+
+/* bytes scanned per call to match_index_scan */
+#define MATCH_INDEX_SCAN_CHUNK MB(4)
+
+typedef struct
+{
+    u64 start;
+    u64 len;
+} match_span;
+
+typedef struct
+{
+    u64 start;
+    u64 end;
+} match_range;
+
+/*
+ * Sorted start offsets of every match of one pattern in a buffer. The
+ * ranges in `dirty` have not been scanned yet, everything outside them is
+ * exact. Edits only dirty the lines they touch (or everything after them
+ * when the pattern can span lines), the rest of the index is shifted.
+ */
+typedef struct
+{
+    buffer *b;
+    u8 active;
+
+    u8 pattern[256];
+    u64 pattern_len;
+    regex re;
+    u8 use_regex;
+    /* whole keyword matches only, for * and # */
+    u8 word;
+    /* newlines in a literal pattern, its matches reach that many lines on */
+    u64 extra_lines;
+
+    match_span *items;
+    u64 count;
+    u64 capacity;
+
+    match_range *dirty;
+    u64 dirty_count;
+    u64 dirty_capacity;
+
+    /* the lines each edit touches, kept between edits so typing does not allocate */
+    match_range *windows;
+    u64 window_capacity;
+} match_index;
+
+void match_index_init(match_index *mi, buffer *b);
+void match_index_free(match_index *mi);
+int match_index_set_pattern(match_index *mi, string pattern, u8 word);
+void match_index_clear(match_index *mi);
+int match_index_scan(match_index *mi, u64 budget);
+void match_index_scan_range(match_index *mi, u64 from, u64 to);
+int match_index_complete(match_index *mi);
+u64 match_index_lower_bound(match_index *mi, u64 offset);
+
+#endif
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+
+#include "mem.h"
+#include "base.h"
+
+#ifdef MEM_TRACKING
+
+mem_counter mem_counters[MEM_TAG_COUNT];
+
+static const char *mem_tag_names[MEM_TAG_COUNT] = {
+    "pieces",
+    "lines",
+    "add",
+    "registers",
+    "scratch",
+    "arenas",
+};
+
+const char *
+mem_tag_name(mem_tag tag)
+{
+    return mem_tag_names[tag];
+}
+
+/*
+ * A block of `tag` went from `old_size` to `new_size` bytes, 0 when there
+ * is none. Grep workers count too, so every update is atomic.
+ */
+void
+mem_count(mem_tag tag, u64 old_size, u64 new_size)
+{
+    mem_counter *c = &mem_counters[tag];
+    /* wraps to the difference when the block shrank */
+    u64 bytes = __sync_add_and_fetch(&c->bytes, new_size - old_size);
+    u64 peak = c->peak;
+
+    while (bytes > peak)
+    {
+        u64 seen = __sync_val_compare_and_swap(&c->peak, peak, bytes);
+
+        if (seen == peak)
+        {
+            break;
+        }
+        peak = seen;
+    }
+
+    if (new_size > 0)
+    {
+        __sync_fetch_and_add(&c->allocs, 1);
+    }
+    else if (old_size > 0)
+    {
+        __sync_fetch_and_add(&c->frees, 1);
+    }
+}
+
+void *
+mem_realloc(mem_tag tag, void *p, u64 old_size, u64 new_size)
+{
+    void *q = realloc(p, (size_t)new_size);
+
+    if (q != NULL)
+    {
+        mem_count(tag, old_size, new_size);
+    }
+
+    return q;
+}
+
+void
+mem_free(mem_tag tag, void *p, u64 size)
+{
+    if (p != NULL)
+    {
+        free(p);
+        mem_count(tag, size, 0);
+    }
+}
+
+/* One line for the status bar, the bytes of each tag in KB rounded up. */
+void
+mem_summary(char *out, u64 size)
+{
+    u64 total = 0;
+    u64 len = 0;
+    u64 i;
+
+    out[0] = '\0';
+    for (i = 0; i < MEM_TAG_COUNT && len < size; i++)
+    {
+        total += mem_counters[i].bytes;
+        len += (u64)snprintf(out + len, (size_t)(size - len), "%s%s %lluK", i == 0 ? "mem: " : ", ",
+                             mem_tag_names[i], (unsigned long long)((mem_counters[i].bytes + 1023) >> 10));
+    }
+
+    if (len < size)
+    {
+        snprintf(out + len, (size_t)(size - len), ", total %lluK", (unsigned long long)((total + 1023) >> 10));
+    }
+}
+
+/* A line per tag: name, bytes, peak bytes, allocations and frees, separated by tabs. */
+int
+mem_dump(FILE *f)
+{
+    u64 i;
+
+    for (i = 0; i < MEM_TAG_COUNT; i++)
+    {
+        mem_counter *c = &mem_counters[i];
+
+        if (fprintf(f, "%s\t%llu\t%llu\t%llu\t%llu\n", mem_tag_names[i], (unsigned long long)c->bytes,
+                    (unsigned long long)c->peak, (unsigned long long)c->allocs,
+                    (unsigned long long)c->frees) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdio.h>
+
+#include "base.h"
+
+typedef enum {
+    MEM_PIECES,
+    MEM_LINES,
+    MEM_ADD,
+    MEM_REGISTERS,
+    MEM_SCRATCH,
+    /* the pages of every other arena */
+    MEM_ARENAS,
+    MEM_TAG_COUNT,
+} mem_tag;
+
+typedef struct
+{
+    u64 bytes;
+    u64 peak;
+    u64 allocs;
+    u64 frees;
+} mem_counter;
+
+/*
+ * Allocations of the long-lived storage, counted per tag when built with
+ * -DMEM_TRACKING (bin/build mem) and plain malloc/realloc/free otherwise.
+ * The caller passes the sizes it already keeps as capacities, so nothing
+ * is stored next to the blocks and a free must name the size it allocated.
+ */
+#ifdef MEM_TRACKING
+
+extern mem_counter mem_counters[MEM_TAG_COUNT];
+
+void *mem_realloc(mem_tag tag, void *p, u64 old_size, u64 new_size);
+void mem_free(mem_tag tag, void *p, u64 size);
+void mem_count(mem_tag tag, u64 old_size, u64 new_size);
+const char *mem_tag_name(mem_tag tag);
+void mem_summary(char *out, u64 size);
+int mem_dump(FILE *f);
+
+#define MEM_MALLOC(tag, size) mem_realloc((tag), NULL, 0, (size))
+#define MEM_REALLOC(tag, p, old_size, new_size) mem_realloc((tag), (p), (old_size), (new_size))
+#define MEM_FREE(tag, p, size) mem_free((tag), (p), (size))
+#define MEM_COUNT(tag, old_size, new_size) mem_count((tag), (old_size), (new_size))
+#define MEM_TAG_ARENA(a, t) ((a)->tag = (t))
+
+#else
+
+#define MEM_MALLOC(tag, size) malloc((size_t)(size))
+#define MEM_REALLOC(tag, p, old_size, new_size) realloc((p), (size_t)(new_size))
+#define MEM_FREE(tag, p, size) free(p)
+#define MEM_COUNT(tag, old_size, new_size) ((void)0)
+#define MEM_TAG_ARENA(a, t) ((void)0)
+
+#endif
+
+#endif
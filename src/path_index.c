@@ -0,0 +1,772 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "path_index.h"
+#include "funcs.h"
+#include "base.h"
+
+#define PATH_INDEX_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                               IN_CLOSE_WRITE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/*
+ * One bit per letter (folded to lowercase), digit and a few separators. A
+ * path can only contain a query as a subsequence if its mask covers the
+ * query's, which rejects most paths with one AND.
+ */
+u64
+path_index_char_mask(const u8 *s, u64 len)
+{
+    u64 mask = 0;
+    u64 i;
+
+    for (i = 0; i < len; i++)
+    {
+        u8 c = s[i];
+
+        if (c >= 'A' && c <= 'Z')
+        {
+            mask |= (u64)1 << (c - 'A');
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            mask |= (u64)1 << (c - 'a');
+        }
+        else if (c >= '0' && c <= '9')
+        {
+            mask |= (u64)1 << (26 + c - '0');
+        }
+        else if (c == '/' || c == '.' || c == '_' || c == '-')
+        {
+            mask |= (u64)1 << (36 + (c == '/' ? 0 : c == '.' ? 1 : c == '_' ? 2 : 3));
+        }
+        else
+        {
+            mask |= (u64)1 << 40;
+        }
+    }
+
+    return mask;
+}
+
+static u64
+path_index_hash(const char *path)
+{
+    u64 h = 14695981039346656037ULL;
+
+    for (; *path != '\0'; path++)
+    {
+        h = (h ^ (u8)*path) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* Removed paths are empty strings in the pool, so they never compare equal. */
+static int
+path_index_lookup(path_index *pi, const char *path, u64 *index)
+{
+    u64 i;
+
+    if (pi->slot_count == 0)
+    {
+        return 0;
+    }
+
+    for (i = path_index_hash(path) & (pi->slot_count - 1); pi->slots[i] != 0;
+         i = (i + 1) & (pi->slot_count - 1))
+    {
+        if (strcmp(pi->pool + pi->offsets[pi->slots[i] - 1], path) == 0)
+        {
+            *index = pi->slots[i] - 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+path_index_insert_slot(path_index *pi, u64 index)
+{
+    u64 i = path_index_hash(pi->pool + pi->offsets[index]) & (pi->slot_count - 1);
+
+    while (pi->slots[i] != 0)
+    {
+        i = (i + 1) & (pi->slot_count - 1);
+    }
+
+    pi->slots[i] = (u32)(index + 1);
+}
+
+/*
+ * Keeps the live paths at most half of the table, leaving removed paths out
+ * when it is rebuilt. path_index_reclaim keeps those under a quarter.
+ */
+static void
+path_index_grow_slots(path_index *pi)
+{
+    u64 i;
+
+    if ((pi->live + 1) * 2 <= pi->slot_count)
+    {
+        return;
+    }
+
+    pi->slot_count = pi->slot_count ? pi->slot_count * 2 : 2048;
+    free(pi->slots);
+    pi->slots = (u32 *)calloc((size_t)pi->slot_count, sizeof(u32));
+    if (pi->slots == NULL)
+    {
+        fprintf(stderr, "[error] path_index_grow_slots unable to calloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < pi->count; i++)
+    {
+        if (pi->pool[pi->offsets[i]] != '\0')
+        {
+            path_index_insert_slot(pi, i);
+        }
+    }
+}
+
+int
+path_index_find(path_index *pi, const char *path, u64 *index)
+{
+    int found;
+
+    pthread_mutex_lock(&pi->lock);
+    found = path_index_lookup(pi, path, index);
+    pthread_mutex_unlock(&pi->lock);
+
+    return found;
+}
+
+/* Appends `path` unless it is there already, the walk and the watcher can both report it. */
+void
+path_index_add(path_index *pi, const char *path)
+{
+    u64 len = strlen(path);
+    u64 existing;
+
+    pthread_mutex_lock(&pi->lock);
+
+    if (len == 0 || path_index_lookup(pi, path, &existing))
+    {
+        pthread_mutex_unlock(&pi->lock);
+        return;
+    }
+
+    if (pi->pool_len + len + 1 > pi->pool_capacity)
+    {
+        u64 new_capacity = pi->pool_capacity ? pi->pool_capacity : KB(64);
+
+        while (new_capacity < pi->pool_len + len + 1)
+        {
+            new_capacity *= 2;
+        }
+
+        pi->pool = (char *)realloc(pi->pool, (size_t)new_capacity);
+        if (pi->pool == NULL)
+        {
+            fprintf(stderr, "[error] path_index_add unable to realloc\n");
+            exit(1);
+        }
+        pi->pool_capacity = new_capacity;
+    }
+
+    if (pi->count == pi->capacity)
+    {
+        pi->capacity = pi->capacity ? pi->capacity * 2 : 1024;
+        pi->offsets = (u64 *)realloc(pi->offsets, sizeof(u64) * pi->capacity);
+        pi->masks = (u64 *)realloc(pi->masks, sizeof(u64) * pi->capacity);
+        if (pi->offsets == NULL || pi->masks == NULL)
+        {
+            fprintf(stderr, "[error] path_index_add unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    memcpy(pi->pool + pi->pool_len, path, (size_t)len + 1);
+    pi->offsets[pi->count] = pi->pool_len;
+    pi->masks[pi->count] = path_index_char_mask((const u8 *)path, len);
+    pi->pool_len += len + 1;
+    path_index_grow_slots(pi);
+    path_index_insert_slot(pi, pi->count);
+    pi->count++;
+    pi->live++;
+    pi->changes++;
+
+    pthread_mutex_unlock(&pi->lock);
+}
+
+/* With the lock held, so a listener must not take it. */
+static void
+path_index_notify(path_index *pi, const char *path, int removed)
+{
+    if (pi->listener != NULL)
+    {
+        pi->listener(pi->listener_ctx, path, removed);
+    }
+}
+
+static void
+path_index_drop(path_index *pi, u64 index)
+{
+    path_index_notify(pi, pi->pool + pi->offsets[index], 1);
+    pi->pool[pi->offsets[index]] = '\0';
+    pi->masks[index] = 0;
+    pi->live--;
+    pi->changes++;
+}
+
+/*
+ * Removed paths keep their slot and their place in the pool. Once they
+ * hold a quarter of the slots, squeeze them out and rehash; the indices
+ * move, so this is a new generation.
+ */
+static void
+path_index_reclaim(path_index *pi)
+{
+    u64 pool_len = 0;
+    u64 kept = 0;
+    u64 i;
+
+    if (pi->count - pi->live <= pi->slot_count / 4)
+    {
+        return;
+    }
+
+    for (i = 0; i < pi->count; i++)
+    {
+        const char *path = pi->pool + pi->offsets[i];
+        u64 len;
+
+        if (path[0] == '\0')
+        {
+            continue;
+        }
+
+        len = strlen(path);
+        memmove(pi->pool + pool_len, path, (size_t)len + 1);
+        pi->offsets[kept] = pool_len;
+        pi->masks[kept] = pi->masks[i];
+        pool_len += len + 1;
+        kept++;
+    }
+
+    pi->pool_len = pool_len;
+    pi->count = kept;
+    memset(pi->slots, 0, sizeof(u32) * pi->slot_count);
+    for (i = 0; i < kept; i++)
+    {
+        path_index_insert_slot(pi, i);
+    }
+
+    pi->generation++;
+    pi->changes++;
+}
+
+void
+path_index_remove(path_index *pi, const char *path)
+{
+    u64 index;
+
+    pthread_mutex_lock(&pi->lock);
+    if (path_index_lookup(pi, path, &index))
+    {
+        path_index_drop(pi, index);
+        path_index_reclaim(pi);
+    }
+    pthread_mutex_unlock(&pi->lock);
+}
+
+/* Every path under the directory `dir`, and the watches on it and below it. */
+static void
+path_index_remove_dir(path_index *pi, const char *dir)
+{
+    u64 len = strlen(dir);
+    u64 i;
+
+    pthread_mutex_lock(&pi->lock);
+
+    for (i = 0; i < pi->count; i++)
+    {
+        const char *path = pi->pool + pi->offsets[i];
+
+        if (strncmp(path, dir, (size_t)len) == 0 && path[len] == '/')
+        {
+            path_index_drop(pi, i);
+        }
+    }
+    path_index_reclaim(pi);
+
+    for (i = 0; i < pi->watch_capacity; i++)
+    {
+        const char *watched = pi->watches[i].dir;
+
+        if (watched != NULL && strncmp(watched, dir, (size_t)len) == 0 &&
+            (watched[len] == '\0' || watched[len] == '/'))
+        {
+            /* a directory moved away is still watched where it went */
+            inotify_rm_watch(pi->inotify_fd, (int)i);
+            free(pi->watches[i].dir);
+            pi->watches[i].dir = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&pi->lock);
+}
+
+void
+path_index_listen(path_index *pi, path_index_listener listener, void *ctx)
+{
+    pthread_mutex_lock(&pi->lock);
+    pi->listener = listener;
+    pi->listener_ctx = ctx;
+    pthread_mutex_unlock(&pi->lock);
+}
+
+/* A file with new contents, the listener is told even if the path was known. */
+static void
+path_index_add_written(path_index *pi, const char *path)
+{
+    path_index_add(pi, path);
+
+    pthread_mutex_lock(&pi->lock);
+    path_index_notify(pi, path, 0);
+    pthread_mutex_unlock(&pi->lock);
+}
+
+/* Copies of the live paths, for a search that runs without the lock. */
+char **
+path_index_snapshot(path_index *pi, u64 *count)
+{
+    char **paths;
+    u64 n = 0;
+    u64 i;
+
+    pthread_mutex_lock(&pi->lock);
+
+    paths = (char **)malloc(sizeof(char *) * (pi->live + 1));
+    if (paths == NULL)
+    {
+        fprintf(stderr, "[error] path_index_snapshot unable to malloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < pi->count; i++)
+    {
+        const char *path = pi->pool + pi->offsets[i];
+
+        if (path[0] != '\0')
+        {
+            paths[n++] = join_path("", path);
+        }
+    }
+
+    pthread_mutex_unlock(&pi->lock);
+
+    *count = n;
+    return paths;
+}
+
+static void
+path_index_watch_dir(path_index *pi, const char *dir, walk_ignore *ignore)
+{
+    int wd = inotify_add_watch(pi->inotify_fd, dir[0] ? dir : ".", PATH_INDEX_WATCH_MASK);
+
+    /* past fs.inotify.max_user_watches a directory is indexed but not kept current */
+    if (wd < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pi->lock);
+
+    if ((u64)wd >= pi->watch_capacity)
+    {
+        u64 new_capacity = pi->watch_capacity ? pi->watch_capacity : 256;
+
+        while (new_capacity <= (u64)wd)
+        {
+            new_capacity *= 2;
+        }
+
+        pi->watches = (path_index_watch *)realloc(pi->watches, sizeof(path_index_watch) * new_capacity);
+        if (pi->watches == NULL)
+        {
+            fprintf(stderr, "[error] path_index_watch_dir unable to realloc\n");
+            exit(1);
+        }
+        memset(pi->watches + pi->watch_capacity, 0,
+               sizeof(path_index_watch) * (new_capacity - pi->watch_capacity));
+        pi->watch_capacity = new_capacity;
+    }
+
+    free(pi->watches[wd].dir);
+    pi->watches[wd].dir = join_path("", dir);
+    pi->watches[wd].ignore = ignore;
+
+    pthread_mutex_unlock(&pi->lock);
+}
+
+static void
+path_index_on_file(void *ctx, u64 worker, const char *path)
+{
+    (void)worker;
+    path_index_add((path_index *)ctx, path);
+}
+
+static void
+path_index_on_dir(void *ctx, const char *path, walk_ignore *ignore)
+{
+    path_index_watch_dir((path_index *)ctx, path, ignore);
+}
+
+/*
+ * A directory that appeared after the walk, unpacked or moved in. It is
+ * small next to the tree, so the watcher thread walks it by itself.
+ */
+static void
+path_index_add_tree(path_index *pi, const char *dir, walk_ignore *ignore)
+{
+    char *ignore_path = join_path(dir, ".gitignore");
+    struct dirent *e;
+    string text;
+    DIR *d;
+
+    if (readfile(ignore_path, &text, MB(1)) == 0)
+    {
+        ignore = walk_ignore_parse(ignore, dir, text);
+        free(text.s);
+        ignore->next_alloc = pi->ignores;
+        pi->ignores = ignore;
+    }
+    free(ignore_path);
+
+    /* watched before it is listed, so nothing created meanwhile is missed */
+    path_index_watch_dir(pi, dir, ignore);
+
+    d = opendir(dir);
+    if (d == NULL)
+    {
+        return;
+    }
+
+    while ((e = readdir(d)) != NULL)
+    {
+        struct stat st;
+        char *path;
+
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0 ||
+            strcmp(e->d_name, ".git") == 0)
+        {
+            continue;
+        }
+
+        path = join_path(dir, e->d_name);
+
+        if (lstat(path, &st) == 0 && !walk_ignored(ignore, path, S_ISDIR(st.st_mode)))
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                path_index_add_tree(pi, path, ignore);
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                path_index_add_written(pi, path);
+            }
+        }
+
+        free(path);
+    }
+
+    closedir(d);
+}
+
+static void
+path_index_handle_event(path_index *pi, struct inotify_event *ev)
+{
+    walk_ignore *ignore = NULL;
+    char *path = NULL;
+    struct stat st;
+
+    pthread_mutex_lock(&pi->lock);
+
+    if (ev->wd >= 0 && (u64)ev->wd < pi->watch_capacity && pi->watches[ev->wd].dir != NULL)
+    {
+        if (ev->mask & IN_IGNORED)
+        {
+            free(pi->watches[ev->wd].dir);
+            pi->watches[ev->wd].dir = NULL;
+        }
+        else if (ev->len > 0)
+        {
+            path = join_path(pi->watches[ev->wd].dir, ev->name);
+            ignore = pi->watches[ev->wd].ignore;
+        }
+    }
+
+    pthread_mutex_unlock(&pi->lock);
+
+    if (path == NULL)
+    {
+        return;
+    }
+
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE))
+    {
+        if (lstat(path, &st) == 0 && !walk_ignored(ignore, path, S_ISDIR(st.st_mode)))
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                path_index_add_tree(pi, path, ignore);
+            }
+            else if (S_ISREG(st.st_mode) && (ev->mask & IN_CREATE))
+            {
+                /* still empty, its contents come with IN_CLOSE_WRITE */
+                path_index_add(pi, path);
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                path_index_add_written(pi, path);
+            }
+        }
+    }
+    else if (ev->mask & IN_ISDIR)
+    {
+        path_index_remove_dir(pi, path);
+    }
+    else
+    {
+        path_index_remove(pi, path);
+    }
+
+    free(path);
+}
+
+static void
+path_index_free_watches(path_index *pi)
+{
+    u64 i;
+
+    for (i = 0; i < pi->watch_capacity; i++)
+    {
+        free(pi->watches[i].dir);
+    }
+    free(pi->watches);
+    pi->watches = NULL;
+    pi->watch_capacity = 0;
+
+    while (pi->ignores != NULL)
+    {
+        walk_ignore *next = pi->ignores->next_alloc;
+
+        for (i = 0; i < pi->ignores->count; i++)
+        {
+            free(pi->ignores->patterns[i]);
+        }
+        free(pi->ignores->patterns);
+        free(pi->ignores->flags);
+        free(pi->ignores->dir);
+        free(pi->ignores);
+        pi->ignores = next;
+    }
+}
+
+/*
+ * The event queue overflowed so some changes are lost: throw the index
+ * away and walk again. Readers see `rescanning` while the walk is being
+ * replaced, and a new `generation` tells them their indices are stale.
+ */
+static void
+path_index_rescan(path_index *pi)
+{
+    pthread_mutex_lock(&pi->lock);
+    pi->rescanning = 1;
+    pthread_mutex_unlock(&pi->lock);
+
+    walk_free(&pi->walk);
+
+    pthread_mutex_lock(&pi->lock);
+    close(pi->inotify_fd);
+    pi->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    path_index_free_watches(pi);
+    memset(pi->slots, 0, sizeof(u32) * pi->slot_count);
+    pi->pool_len = 0;
+    pi->count = 0;
+    pi->live = 0;
+    pi->generation++;
+    pi->changes++;
+    pthread_mutex_unlock(&pi->lock);
+
+    walk_start(&pi->walk, pi->root, walk_worker_count(), path_index_on_file, path_index_on_dir, pi);
+
+    pthread_mutex_lock(&pi->lock);
+    pi->rescanning = 0;
+    pthread_mutex_unlock(&pi->lock);
+}
+
+static u64
+path_index_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+}
+
+static void *
+path_index_watcher_main(void *arg)
+{
+    path_index *pi = (path_index *)arg;
+    char events[KB(16)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    u64 next_rescan = 0;
+    int rescan_due = 0;
+
+    for (;;)
+    {
+        struct pollfd fds[2];
+        int timeout = -1;
+        ssize_t n;
+        char *p;
+
+        if (rescan_due)
+        {
+            u64 now = path_index_now_ms();
+
+            /* a build that keeps flooding the queue costs one walk per interval */
+            if (now >= next_rescan)
+            {
+                path_index_rescan(pi);
+                next_rescan = now + PATH_INDEX_RESCAN_INTERVAL * 1000;
+                rescan_due = 0;
+                continue;
+            }
+
+            timeout = (int)(next_rescan - now);
+        }
+
+        fds[0].fd = pi->inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = pi->stop_pipe[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, timeout) < 0 || fds[1].revents != 0)
+        {
+            break;
+        }
+
+        if (!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        n = read(pi->inotify_fd, events, sizeof(events));
+
+        for (p = events; n > 0 && p < events + n; )
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                rescan_due = 1;
+            }
+            else if (!rescan_due)
+            {
+                path_index_handle_event(pi, ev);
+            }
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return NULL;
+}
+
+/* Starts filling the index from a parallel walk of `root`, then keeps it current. */
+void
+path_index_build(path_index *pi, string root)
+{
+    memset(pi, 0, sizeof(*pi));
+    pthread_mutex_init(&pi->lock, NULL);
+    pi->started = 1;
+
+    pi->root.s = (u8 *)malloc((size_t)root.len + 1);
+    if (pi->root.s == NULL)
+    {
+        fprintf(stderr, "[error] path_index_build unable to malloc\n");
+        exit(1);
+    }
+    memcpy(pi->root.s, root.s, (size_t)root.len);
+    pi->root.s[root.len] = '\0';
+    pi->root.len = root.len;
+
+    pi->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (pi->inotify_fd >= 0 && pipe(pi->stop_pipe) == 0 &&
+        pthread_create(&pi->watcher, NULL, path_index_watcher_main, pi) == 0)
+    {
+        pi->watching = 1;
+    }
+
+    walk_start(&pi->walk, pi->root, walk_worker_count(), path_index_on_file,
+               pi->watching ? path_index_on_dir : NULL, pi);
+}
+
+void
+path_index_free(path_index *pi)
+{
+    if (!pi->started)
+    {
+        return;
+    }
+
+    if (pi->watching)
+    {
+        if (write(pi->stop_pipe[1], "x", 1) != 1)
+        {
+            fprintf(stderr, "[error] path_index_free unable to stop the watcher\n");
+            exit(1);
+        }
+        pthread_join(pi->watcher, NULL);
+        close(pi->stop_pipe[0]);
+        close(pi->stop_pipe[1]);
+    }
+
+    walk_free(&pi->walk);
+    if (pi->inotify_fd >= 0)
+    {
+        close(pi->inotify_fd);
+    }
+    path_index_free_watches(pi);
+    free(pi->root.s);
+    free(pi->pool);
+    free(pi->offsets);
+    free(pi->masks);
+    free(pi->slots);
+    pthread_mutex_destroy(&pi->lock);
+
+    memset(pi, 0, sizeof(*pi));
+}
+
+int
+path_index_building(path_index *pi)
+{
+    int building;
+
+    if (!pi->started)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pi->lock);
+    building = pi->rescanning || walk_running(&pi->walk);
+    pthread_mutex_unlock(&pi->lock);
+
+    return building;
+}
@@ -0,0 +1,80 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <pthread.h>
+
+#include "base.h"
+#include "walk.h"
+
+/* seconds between two full rescans after the inotify queue overflowed */
+#define PATH_INDEX_RESCAN_INTERVAL 5
+
+/* Called on the watcher thread when a file was written, moved in or removed. */
+typedef void (*path_index_listener)(void *ctx, const char *path, int removed);
+
+/* A watched directory, `ignore` holds the rules that applied when it was walked. */
+typedef struct
+{
+    char *dir;
+    walk_ignore *ignore;
+} path_index_watch;
+
+/*
+ * Every file under a root, for the fuzzy finder. The paths live NUL
+ * terminated in one pool and `offsets[i]` is where path i starts, so the
+ * whole index is three allocations however many files there are.
+ *
+ * After the first walk an inotify thread keeps it current. A removed path
+ * stays in the pool as an empty string so indices held by readers remain
+ * valid; `generation` moves when the index is rebuilt from scratch, which
+ * does invalidate them, and `changes` on every add or remove.
+ */
+typedef struct
+{
+    walk walk;
+    string root;
+
+    /* held while appending, and by readers since the arrays may move */
+    pthread_mutex_t lock;
+    char *pool;
+    u64 pool_len;
+    u64 pool_capacity;
+    u64 *offsets;
+    /* path_index_char_mask of each path */
+    u64 *masks;
+    u64 count;
+    u64 capacity;
+    /* open addressing from path to index + 1, 0 is an empty slot */
+    u32 *slots;
+    u64 slot_count;
+    u64 live;
+    u64 generation;
+    u64 changes;
+
+    /* indexed by watch descriptor */
+    path_index_watch *watches;
+    u64 watch_capacity;
+    /* rules of the .gitignore files in directories added by the watcher */
+    walk_ignore *ignores;
+    path_index_listener listener;
+    void *listener_ctx;
+    int inotify_fd;
+    int stop_pipe[2];
+    pthread_t watcher;
+    u8 watching;
+    u8 rescanning;
+
+    u8 started;
+} path_index;
+
+void path_index_build(path_index *pi, string root);
+void path_index_free(path_index *pi);
+int path_index_building(path_index *pi);
+int path_index_find(path_index *pi, const char *path, u64 *index);
+void path_index_add(path_index *pi, const char *path);
+void path_index_remove(path_index *pi, const char *path);
+char **path_index_snapshot(path_index *pi, u64 *count);
+void path_index_listen(path_index *pi, path_index_listener listener, void *ctx);
+u64 path_index_char_mask(const u8 *s, u64 len);
+
+#endif
@@ -0,0 +1,1173 @@
+#include <ctype.h>
+
+#include "regex.h"
+#include "search.h"
+#include "base.h"
+
+#define REGEX_NONE          0xFFFFFFFFu
+#define REGEX_DFA_UNKNOWN   0xFFFFFFFFu
+#define REGEX_MATCH_BIT     0x80000000u
+#define REGEX_TABLE_SIZE    (2 * REGEX_DFA_MAX_STATES)
+#define REGEX_END_OF_TEXT   256
+
+/* dfa state flags */
+#define REGEX_DFA_SEARCHING 1
+#define REGEX_DFA_PREV_NL   2
+
+typedef enum {
+    REGEX_NODE_CLASS,
+    REGEX_NODE_EMPTY,
+    REGEX_NODE_CONCAT,
+    REGEX_NODE_ALT,
+    REGEX_NODE_STAR,
+    REGEX_NODE_PLUS,
+    REGEX_NODE_QUEST,
+    REGEX_NODE_BOL,
+    REGEX_NODE_EOL,
+} regex_node_kind;
+
+typedef struct
+{
+    u8 kind;
+    u32 a;
+    u32 b;
+    u32 cls;
+} regex_node;
+
+typedef struct
+{
+    regex *re;
+    string pattern;
+    u64 pos;
+    regex_node *nodes;
+    u32 count;
+    u32 capacity;
+    int failed;
+} regex_parser;
+
+static void *
+regex_grow(void *items, u32 *capacity, u32 needed, u64 item_size)
+{
+    u32 new_capacity = *capacity ? *capacity : 16;
+
+    if (needed <= *capacity)
+    {
+        return items;
+    }
+
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    items = realloc(items, (size_t)(item_size * new_capacity));
+    if (items == NULL)
+    {
+        fprintf(stderr, "[error] regex unable to realloc\n");
+        exit(1);
+    }
+
+    *capacity = new_capacity;
+    return items;
+}
+
+/* parsing */
+
+static void
+regex_fail(regex_parser *p, const char *message)
+{
+    if (!p->failed)
+    {
+        snprintf(p->re->error, sizeof(p->re->error), "%s", message);
+        p->failed = 1;
+    }
+}
+
+static u32
+regex_new_node(regex_parser *p, u8 kind, u32 a, u32 b)
+{
+    p->nodes = (regex_node *)regex_grow(p->nodes, &p->capacity, p->count + 1, sizeof(regex_node));
+    p->nodes[p->count] = (regex_node){.kind = kind, .a = a, .b = b, .cls = 0};
+    return p->count++;
+}
+
+static u32
+regex_new_class(regex_parser *p, u8 **bits)
+{
+    regex *re = p->re;
+    u32 node;
+
+    re->classes = (u8 (*)[32])regex_grow(re->classes, &re->class_capacity,
+                                        re->class_count + 1, 32);
+    memset(re->classes[re->class_count], 0, 32);
+
+    node = regex_new_node(p, REGEX_NODE_CLASS, 0, 0);
+    p->nodes[node].cls = re->class_count;
+    *bits = re->classes[re->class_count];
+    re->class_count++;
+
+    return node;
+}
+
+static void
+regex_class_set(u8 *bits, u8 c)
+{
+    bits[c >> 3] |= (u8)(1u << (c & 7));
+}
+
+static void
+regex_class_clear(u8 *bits, u8 c)
+{
+    bits[c >> 3] &= (u8)~(1u << (c & 7));
+}
+
+static int
+regex_class_has(u8 *bits, u32 c)
+{
+    return (bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static void
+regex_class_range(u8 *bits, u32 lo, u32 hi)
+{
+    u32 c;
+
+    for (c = lo; c <= hi; c++)
+    {
+        regex_class_set(bits, (u8)c);
+    }
+}
+
+/* \d \w \s and their negations, 0 if `e` is not one of them */
+static int
+regex_escape_class(u8 *bits, u8 e)
+{
+    u8 tmp[32];
+    u8 lower = (u8)tolower(e);
+    u32 i;
+
+    if (lower != 'd' && lower != 'w' && lower != 's')
+    {
+        return 0;
+    }
+
+    memset(tmp, 0, sizeof(tmp));
+    if (lower == 'd')
+    {
+        regex_class_range(tmp, '0', '9');
+    }
+    else if (lower == 'w')
+    {
+        regex_class_range(tmp, '0', '9');
+        regex_class_range(tmp, 'a', 'z');
+        regex_class_range(tmp, 'A', 'Z');
+        regex_class_set(tmp, '_');
+    }
+    else
+    {
+        regex_class_set(tmp, ' ');
+        regex_class_range(tmp, '\t', '\r');
+    }
+
+    /* a negation stays within the line, as . does */
+    if (e != lower)
+    {
+        regex_class_set(tmp, '\n');
+    }
+
+    for (i = 0; i < 32; i++)
+    {
+        bits[i] |= (e != lower) ? (u8)~tmp[i] : tmp[i];
+    }
+
+    return 1;
+}
+
+static u8
+regex_escape_char(u8 e)
+{
+    if (e == 'n')
+    {
+        return '\n';
+    }
+
+    if (e == 't')
+    {
+        return '\t';
+    }
+
+    return e;
+}
+
+static u32
+regex_parse_class(regex_parser *p)
+{
+    u8 *bits;
+    u32 node = regex_new_class(p, &bits);
+    int negate = 0;
+    int first = 1;
+    u32 i;
+
+    if (p->pos < p->pattern.len && p->pattern.s[p->pos] == '^')
+    {
+        negate = 1;
+        p->pos++;
+    }
+
+    while (p->pos < p->pattern.len && (p->pattern.s[p->pos] != ']' || first))
+    {
+        u8 lo = p->pattern.s[p->pos++];
+
+        first = 0;
+        if (lo == '\\' && p->pos < p->pattern.len)
+        {
+            u8 e = p->pattern.s[p->pos++];
+
+            if (regex_escape_class(bits, e))
+            {
+                continue;
+            }
+
+            lo = regex_escape_char(e);
+        }
+
+        if (p->pos + 1 < p->pattern.len && p->pattern.s[p->pos] == '-' &&
+            p->pattern.s[p->pos + 1] != ']')
+        {
+            u8 hi = p->pattern.s[p->pos + 1];
+
+            p->pos += 2;
+            if (hi < lo)
+            {
+                regex_fail(p, "Invalid range in []");
+                return node;
+            }
+
+            regex_class_range(bits, lo, hi);
+        }
+        else
+        {
+            regex_class_set(bits, lo);
+        }
+    }
+
+    if (p->pos >= p->pattern.len)
+    {
+        regex_fail(p, "Missing ]");
+        return node;
+    }
+    p->pos++;
+
+    if (negate)
+    {
+        for (i = 0; i < 32; i++)
+        {
+            bits[i] = (u8)~bits[i];
+        }
+        regex_class_clear(bits, '\n');
+    }
+
+    return node;
+}
+
+static u32 regex_parse_alt(regex_parser *p);
+
+static u32
+regex_parse_atom(regex_parser *p)
+{
+    u8 c = p->pattern.s[p->pos++];
+    u8 *bits;
+    u32 node;
+
+    switch (c) {
+    case '(':
+        node = regex_parse_alt(p);
+        if (p->pos >= p->pattern.len || p->pattern.s[p->pos] != ')')
+        {
+            regex_fail(p, "Missing )");
+            return node;
+        }
+        p->pos++;
+        return node;
+    case '*':
+    case '+':
+    case '?':
+        regex_fail(p, "Nothing to repeat");
+        return regex_new_node(p, REGEX_NODE_EMPTY, 0, 0);
+    case '[':
+        return regex_parse_class(p);
+    case '.':
+        node = regex_new_class(p, &bits);
+        regex_class_range(bits, 0, 255);
+        regex_class_clear(bits, '\n');
+        return node;
+    case '^':
+        return regex_new_node(p, REGEX_NODE_BOL, 0, 0);
+    case '$':
+        return regex_new_node(p, REGEX_NODE_EOL, 0, 0);
+    case '\\':
+        if (p->pos >= p->pattern.len)
+        {
+            regex_fail(p, "Trailing \\");
+            return regex_new_node(p, REGEX_NODE_EMPTY, 0, 0);
+        }
+
+        c = p->pattern.s[p->pos++];
+        node = regex_new_class(p, &bits);
+        if (!regex_escape_class(bits, c))
+        {
+            regex_class_set(bits, regex_escape_char(c));
+        }
+        return node;
+    default:
+        node = regex_new_class(p, &bits);
+        regex_class_set(bits, c);
+        return node;
+    }
+}
+
+static u32
+regex_parse_repeat(regex_parser *p)
+{
+    u32 node = regex_parse_atom(p);
+
+    while (!p->failed && p->pos < p->pattern.len)
+    {
+        u8 c = p->pattern.s[p->pos];
+        u8 kind;
+
+        if (c == '*')
+        {
+            kind = REGEX_NODE_STAR;
+        }
+        else if (c == '+')
+        {
+            kind = REGEX_NODE_PLUS;
+        }
+        else if (c == '?')
+        {
+            kind = REGEX_NODE_QUEST;
+        }
+        else
+        {
+            break;
+        }
+
+        p->pos++;
+        node = regex_new_node(p, kind, node, 0);
+    }
+
+    return node;
+}
+
+static u32
+regex_parse_concat(regex_parser *p)
+{
+    u32 node = REGEX_NONE;
+
+    while (!p->failed && p->pos < p->pattern.len &&
+           p->pattern.s[p->pos] != '|' && p->pattern.s[p->pos] != ')')
+    {
+        u32 item = regex_parse_repeat(p);
+
+        node = (node == REGEX_NONE) ? item : regex_new_node(p, REGEX_NODE_CONCAT, node, item);
+    }
+
+    if (node == REGEX_NONE)
+    {
+        node = regex_new_node(p, REGEX_NODE_EMPTY, 0, 0);
+    }
+
+    return node;
+}
+
+static u32
+regex_parse_alt(regex_parser *p)
+{
+    u32 node = regex_parse_concat(p);
+
+    while (!p->failed && p->pos < p->pattern.len && p->pattern.s[p->pos] == '|')
+    {
+        p->pos++;
+        node = regex_new_node(p, REGEX_NODE_ALT, node, regex_parse_concat(p));
+    }
+
+    return node;
+}
+
+/* literal extraction */
+
+static s32
+regex_node_literal(regex_parser *p, u32 node)
+{
+    u8 *bits;
+    s32 found = -1;
+    u32 c;
+
+    if (p->nodes[node].kind != REGEX_NODE_CLASS)
+    {
+        return -1;
+    }
+
+    bits = p->re->classes[p->nodes[node].cls];
+    for (c = 0; c < 256; c++)
+    {
+        if (regex_class_has(bits, c))
+        {
+            if (found >= 0)
+            {
+                return -1;
+            }
+            found = (s32)c;
+        }
+    }
+
+    return found;
+}
+
+static void
+regex_collect_concat(regex_parser *p, u32 node, u32 *items, u32 *count, u32 max)
+{
+    if (p->nodes[node].kind == REGEX_NODE_CONCAT)
+    {
+        regex_collect_concat(p, p->nodes[node].a, items, count, max);
+        regex_collect_concat(p, p->nodes[node].b, items, count, max);
+        return;
+    }
+
+    if (*count < max)
+    {
+        items[(*count)++] = node;
+    }
+}
+
+/*
+ * Runs of single byte atoms in the top level concatenation are literals
+ * every match must contain, the first one (after any ^) is its prefix.
+ */
+static void
+regex_extract_literals(regex_parser *p, u32 root)
+{
+    regex *re = p->re;
+    u32 items[256];
+    u32 count = 0;
+    u32 i = 0;
+    int at_start = 1;
+
+    regex_collect_concat(p, root, items, &count, 256);
+
+    while (i < count && p->nodes[items[i]].kind == REGEX_NODE_BOL)
+    {
+        i++;
+    }
+
+    while (i < count)
+    {
+        u8 run[64];
+        u64 run_len = 0;
+
+        while (i < count && regex_node_literal(p, items[i]) >= 0)
+        {
+            if (run_len < sizeof(run))
+            {
+                run[run_len++] = (u8)regex_node_literal(p, items[i]);
+            }
+            i++;
+        }
+
+        if (at_start)
+        {
+            memcpy(re->prefix, run, (size_t)run_len);
+            re->prefix_len = run_len;
+            at_start = 0;
+        }
+
+        if (run_len > re->required_len)
+        {
+            memcpy(re->required, run, (size_t)run_len);
+            re->required_len = run_len;
+        }
+
+        i++;
+    }
+}
+
+/* NFA construction, continuation passing so the reversed NFA is the same walk */
+
+static u32
+regex_nfa_add(regex_prog *prog, u8 kind, u32 out, u32 out1, u32 cls)
+{
+    prog->states = (regex_nfa_state *)regex_grow(prog->states, &prog->capacity,
+                                                 prog->count + 1, sizeof(regex_nfa_state));
+    prog->states[prog->count] = (regex_nfa_state){.kind = kind, .out = out, .out1 = out1, .cls = cls};
+    return prog->count++;
+}
+
+static u32
+regex_compile_node(regex_parser *p, regex_prog *prog, u32 node, u32 next, int reverse)
+{
+    regex_node n = p->nodes[node];
+    u32 split;
+    u32 body;
+
+    switch (n.kind) {
+    case REGEX_NODE_CLASS:
+        return regex_nfa_add(prog, REGEX_NFA_CLASS, next, 0, n.cls);
+    case REGEX_NODE_CONCAT:
+        if (reverse)
+        {
+            return regex_compile_node(p, prog, n.b,
+                                      regex_compile_node(p, prog, n.a, next, reverse), reverse);
+        }
+        return regex_compile_node(p, prog, n.a,
+                                  regex_compile_node(p, prog, n.b, next, reverse), reverse);
+    case REGEX_NODE_ALT:
+        body = regex_compile_node(p, prog, n.a, next, reverse);
+        return regex_nfa_add(prog, REGEX_NFA_SPLIT, body,
+                             regex_compile_node(p, prog, n.b, next, reverse), 0);
+    case REGEX_NODE_STAR:
+        split = regex_nfa_add(prog, REGEX_NFA_SPLIT, 0, next, 0);
+        body = regex_compile_node(p, prog, n.a, split, reverse);
+        prog->states[split].out = body;
+        return split;
+    case REGEX_NODE_PLUS:
+        split = regex_nfa_add(prog, REGEX_NFA_SPLIT, 0, next, 0);
+        body = regex_compile_node(p, prog, n.a, split, reverse);
+        prog->states[split].out = body;
+        return body;
+    case REGEX_NODE_QUEST:
+        body = regex_compile_node(p, prog, n.a, next, reverse);
+        return regex_nfa_add(prog, REGEX_NFA_SPLIT, body, next, 0);
+    case REGEX_NODE_BOL:
+        return regex_nfa_add(prog, reverse ? REGEX_NFA_NEXT_NL : REGEX_NFA_PREV_NL, next, 0, 0);
+    case REGEX_NODE_EOL:
+        return regex_nfa_add(prog, reverse ? REGEX_NFA_PREV_NL : REGEX_NFA_NEXT_NL, next, 0, 0);
+    default:
+        return next;
+    }
+}
+
+/* lazy DFA */
+
+static u32 *
+regex_alloc_u32(u64 count)
+{
+    u32 *items = (u32 *)calloc((size_t)(count ? count : 1), sizeof(u32));
+
+    if (items == NULL)
+    {
+        fprintf(stderr, "[error] regex unable to alloc\n");
+        exit(1);
+    }
+
+    return items;
+}
+
+/* Epsilon closure of `state` appended to `list` in priority order. */
+static void
+regex_closure(regex_prog *p, u32 state, u8 prev_nl, u8 next_nl,
+              u32 *list, u32 *count, u32 *marks, u32 gen)
+{
+    u32 top = 0;
+
+    p->stack[top++] = state;
+    while (top > 0)
+    {
+        u32 s = p->stack[--top];
+        regex_nfa_state *st;
+
+        if (marks[s] == gen)
+        {
+            continue;
+        }
+
+        marks[s] = gen;
+        st = &p->states[s];
+
+        switch (st->kind) {
+        case REGEX_NFA_SPLIT:
+            p->stack[top++] = st->out1;
+            p->stack[top++] = st->out;
+            break;
+        case REGEX_NFA_PREV_NL:
+            if (prev_nl)
+            {
+                p->stack[top++] = st->out;
+            }
+            break;
+        case REGEX_NFA_NEXT_NL:
+            if (next_nl)
+            {
+                p->stack[top++] = st->out;
+            }
+            else
+            {
+                list[(*count)++] = s;
+            }
+            break;
+        default:
+            list[(*count)++] = s;
+            break;
+        }
+    }
+}
+
+static u32
+regex_hash(u32 *threads, u32 count, u8 flags)
+{
+    u32 h = 2166136261u ^ flags;
+    u32 i;
+
+    for (i = 0; i < count; i++)
+    {
+        h = (h ^ threads[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+static u32
+regex_dfa_lookup(regex_prog *p, u32 *threads, u32 count, u8 flags)
+{
+    u32 h = regex_hash(threads, count, flags) & (REGEX_TABLE_SIZE - 1);
+    regex_dfa_state *d;
+
+    while (p->table[h] != 0)
+    {
+        d = &p->dfa[p->table[h] - 1];
+        if (d->flags == flags && d->thread_count == count &&
+            memcmp(p->pool + d->first_thread, threads, sizeof(u32) * count) == 0)
+        {
+            return p->table[h] - 1;
+        }
+
+        h = (h + 1) & (REGEX_TABLE_SIZE - 1);
+    }
+
+    p->dfa = (regex_dfa_state *)regex_grow(p->dfa, &p->dfa_capacity, p->dfa_count + 1,
+                                           sizeof(regex_dfa_state));
+
+    if (p->pool_len + count > p->pool_capacity)
+    {
+        u64 new_capacity = p->pool_capacity ? p->pool_capacity : 256;
+
+        while (new_capacity < p->pool_len + count)
+        {
+            new_capacity *= 2;
+        }
+
+        p->pool = (u32 *)realloc(p->pool, sizeof(u32) * new_capacity);
+        if (p->pool == NULL)
+        {
+            fprintf(stderr, "[error] regex unable to realloc dfa pool\n");
+            exit(1);
+        }
+        p->pool_capacity = new_capacity;
+    }
+
+    d = &p->dfa[p->dfa_count];
+    d->first_thread = (u32)p->pool_len;
+    d->thread_count = count;
+    d->flags = flags;
+    memset(d->next, 0xFF, sizeof(d->next));
+    if (count > 0)
+    {
+        memcpy(p->pool + p->pool_len, threads, sizeof(u32) * count);
+        p->pool_len += count;
+    }
+
+    p->table[h] = ++p->dfa_count;
+    return p->dfa_count - 1;
+}
+
+static u32
+regex_dfa_start(regex_prog *p, u8 prev_nl, u8 searching)
+{
+    u32 count = 0;
+    u8 flags = (u8)((searching ? REGEX_DFA_SEARCHING : 0) | (prev_nl ? REGEX_DFA_PREV_NL : 0));
+
+    regex_closure(p, p->start, prev_nl, 0, p->list, &count, p->marks, ++p->mark_gen);
+    return regex_dfa_lookup(p, p->list, count, flags);
+}
+
+/* Empties the cache, the searching start states are always 0 and 1. */
+static void
+regex_dfa_reset(regex_prog *p)
+{
+    p->dfa_count = 0;
+    p->pool_len = 0;
+    memset(p->table, 0, sizeof(u32) * REGEX_TABLE_SIZE);
+
+    regex_dfa_start(p, 0, 1);
+    regex_dfa_start(p, 1, 1);
+}
+
+static int
+regex_dfa_dead(regex_prog *p, u32 s)
+{
+    return p->dfa[s].thread_count == 0 && !(p->dfa[s].flags & REGEX_DFA_SEARCHING);
+}
+
+static void
+regex_step_thread(regex *re, regex_prog *p, u32 t, u32 c, u32 *count, u32 gen, u8 *matched)
+{
+    regex_nfa_state *st = &p->states[t];
+
+    if (st->kind == REGEX_NFA_MATCH)
+    {
+        *matched = 1;
+    }
+    else if (st->kind == REGEX_NFA_CLASS && c < REGEX_END_OF_TEXT &&
+             regex_class_has(re->classes[st->cls], c))
+    {
+        regex_closure(p, st->out, (u8)(c == '\n'), 0, p->list, count, p->marks, gen);
+    }
+}
+
+/*
+ * Builds the transition of state `s` on `c`. The match bit of the result
+ * says whether a match ends before `c`, which needs `c` as lookahead for $.
+ */
+static u32
+regex_dfa_step(regex *re, regex_prog *p, u32 s, u32 c)
+{
+    regex_dfa_state *d;
+    u32 count = 0;
+    u32 gen;
+    u32 next;
+    u32 i;
+    u8 matched = 0;
+    u8 searching;
+    u8 prev_nl;
+    u8 next_nl = (u8)(c == '\n' || c == REGEX_END_OF_TEXT);
+
+    if (p->dfa_count + 1 >= REGEX_DFA_MAX_STATES)
+    {
+        /* keep the current state, its threads go through p->expand */
+        u32 kept = p->dfa[s].thread_count;
+        u8 flags = p->dfa[s].flags;
+
+        memcpy(p->expand, p->pool + p->dfa[s].first_thread, sizeof(u32) * kept);
+        regex_dfa_reset(p);
+        s = regex_dfa_lookup(p, p->expand, kept, flags);
+    }
+
+    d = &p->dfa[s];
+    searching = d->flags & REGEX_DFA_SEARCHING;
+    prev_nl = (d->flags & REGEX_DFA_PREV_NL) ? 1 : 0;
+    gen = ++p->mark_gen;
+
+    for (i = 0; i < d->thread_count && !(matched && p->truncate); i++)
+    {
+        u32 t = p->pool[d->first_thread + i];
+
+        if (p->states[t].kind == REGEX_NFA_NEXT_NL)
+        {
+            u32 n = 0;
+            u32 j;
+
+            if (!next_nl)
+            {
+                continue;
+            }
+
+            regex_closure(p, p->states[t].out, prev_nl, 1, p->expand, &n,
+                          p->expand_marks, ++p->mark_gen);
+            for (j = 0; j < n && !(matched && p->truncate); j++)
+            {
+                regex_step_thread(re, p, p->expand[j], c, &count, gen, &matched);
+            }
+            continue;
+        }
+
+        regex_step_thread(re, p, t, c, &count, gen, &matched);
+    }
+
+    if (matched && p->truncate)
+    {
+        searching = 0;
+    }
+
+    if (searching && c < REGEX_END_OF_TEXT)
+    {
+        regex_closure(p, p->start, (u8)(c == '\n'), 0, p->list, &count, p->marks, gen);
+    }
+
+    next = regex_dfa_lookup(p, p->list, count,
+                            (u8)((searching ? REGEX_DFA_SEARCHING : 0) |
+                                 (c == '\n' ? REGEX_DFA_PREV_NL : 0)));
+    next |= matched ? REGEX_MATCH_BIT : 0;
+    p->dfa[s].next[c] = next;
+
+    return next;
+}
+
+static u32
+regex_dfa_next(regex *re, regex_prog *p, u32 s, u32 c)
+{
+    u32 t = p->dfa[s].next[c];
+
+    if (t == REGEX_DFA_UNKNOWN)
+    {
+        t = regex_dfa_step(re, p, s, c);
+    }
+
+    return t;
+}
+
+static void
+regex_prog_init(regex_parser *p, regex_prog *prog, u32 root, int reverse)
+{
+    u32 match = regex_nfa_add(prog, REGEX_NFA_MATCH, 0, 0, 0);
+
+    prog->start = regex_compile_node(p, prog, root, match, reverse);
+    prog->truncate = (u8)!reverse;
+
+    prog->list = regex_alloc_u32(prog->count);
+    prog->expand = regex_alloc_u32(prog->count);
+    prog->stack = regex_alloc_u32(2 * (u64)prog->count + 2);
+    prog->marks = regex_alloc_u32(prog->count);
+    prog->expand_marks = regex_alloc_u32(prog->count);
+    prog->table = regex_alloc_u32(REGEX_TABLE_SIZE);
+
+    regex_dfa_reset(prog);
+}
+
+static void
+regex_prog_free(regex_prog *prog)
+{
+    free(prog->states);
+    free(prog->dfa);
+    free(prog->pool);
+    free(prog->table);
+    free(prog->list);
+    free(prog->expand);
+    free(prog->stack);
+    free(prog->marks);
+    free(prog->expand_marks);
+}
+
+/* scanning */
+
+static u8
+regex_prev_nl(buffer *b, u64 offset)
+{
+    return (u8)(offset == 0 || buffer_byte_at(b, offset - 1) == '\n');
+}
+
+/* The same threads with no new ones started after this point. */
+static u32
+regex_dfa_stop_searching(regex_prog *p, u32 s)
+{
+    u32 count = p->dfa[s].thread_count;
+
+    if (!(p->dfa[s].flags & REGEX_DFA_SEARCHING))
+    {
+        return s;
+    }
+
+    memcpy(p->expand, p->pool + p->dfa[s].first_thread, sizeof(u32) * count);
+    return regex_dfa_lookup(p, p->expand, count, (u8)(p->dfa[s].flags & ~REGEX_DFA_SEARCHING));
+}
+
+/*
+ * Leftmost-first scan from `from`, sets `end` to where the match ends.
+ * Unanchored, new threads are only started up to `stop`, and a scan that
+ * has nothing in flight jumps to the next occurrence of the literal prefix
+ * instead of feeding the DFA byte by byte.
+ */
+static int
+regex_scan_forward(regex *re, buffer *b, u64 from, u64 stop, int anchored, u64 *end)
+{
+    regex_prog *p = &re->forward;
+    string prefix = {.s = re->prefix, .len = re->prefix_len};
+    int searching = !anchored;
+    u64 pos = from;
+    int found = 0;
+    u32 s;
+    u32 t;
+
+    s = anchored ? regex_dfa_start(p, regex_prev_nl(b, from), 0) : regex_prev_nl(b, from);
+
+    while (pos < b->total_len)
+    {
+        u8 *data;
+        u64 span_len;
+        u64 i;
+
+        if (searching && pos >= stop)
+        {
+            s = regex_dfa_stop_searching(p, s);
+            searching = 0;
+            if (regex_dfa_dead(p, s))
+            {
+                return found;
+            }
+        }
+
+        if (searching && prefix.len > 0 && s <= 1)
+        {
+            if (!search_forward_range(b, prefix, pos, stop, &pos))
+            {
+                return found;
+            }
+
+            s = regex_prev_nl(b, pos);
+        }
+
+        span_len = buffer_span_at(b, pos, &data);
+        if (searching && span_len > stop - pos)
+        {
+            span_len = stop - pos;
+        }
+
+        for (i = 0; i < span_len; )
+        {
+            t = regex_dfa_next(re, p, s, data[i]);
+            if (t & REGEX_MATCH_BIT)
+            {
+                found = 1;
+                *end = pos + i;
+            }
+
+            s = t & ~REGEX_MATCH_BIT;
+            i++;
+
+            if (regex_dfa_dead(p, s))
+            {
+                return found;
+            }
+
+            if (searching && prefix.len > 0 && s <= 1)
+            {
+                break;
+            }
+        }
+
+        pos += i;
+    }
+
+    t = regex_dfa_next(re, p, s, REGEX_END_OF_TEXT);
+    if (t & REGEX_MATCH_BIT)
+    {
+        found = 1;
+        *end = b->total_len;
+    }
+
+    return found;
+}
+
+/*
+ * Scans the reversed program backward from `from` down to `lower`.
+ * Anchored, it finds the smallest start of a match ending at `from`.
+ * Unanchored, it returns the first match start found below `limit`.
+ */
+static int
+regex_scan_reverse(regex *re, buffer *b, u64 from, u64 lower, int anchored, u64 limit, u64 *start)
+{
+    regex_prog *p = &re->reverse;
+    u8 prev_nl = (u8)(from == b->total_len || buffer_byte_at(b, from) == '\n');
+    u64 pos = from;
+    int found = 0;
+    u32 s;
+    u32 t;
+
+    s = anchored ? regex_dfa_start(p, prev_nl, 0) : prev_nl;
+
+    while (pos > lower)
+    {
+        u8 *data;
+        u64 full = buffer_span_before(b, pos, &data);
+        u64 span_len = full < pos - lower ? full : pos - lower;
+        u64 i;
+
+        for (i = 0; i < span_len; i++)
+        {
+            t = regex_dfa_next(re, p, s, data[full - 1 - i]);
+            if ((t & REGEX_MATCH_BIT) && (anchored || pos - i < limit))
+            {
+                found = 1;
+                *start = pos - i;
+                if (!anchored)
+                {
+                    return 1;
+                }
+            }
+
+            s = t & ~REGEX_MATCH_BIT;
+            if (regex_dfa_dead(p, s))
+            {
+                return found;
+            }
+        }
+
+        pos -= span_len;
+    }
+
+    /* the byte before `lower` is only looked at, never consumed */
+    t = regex_dfa_next(re, p, s, lower == 0 ? REGEX_END_OF_TEXT : buffer_byte_at(b, lower - 1));
+    if ((t & REGEX_MATCH_BIT) && (anchored || lower < limit))
+    {
+        found = 1;
+        *start = lower;
+    }
+
+    return found;
+}
+
+int
+regex_is_literal(string pattern)
+{
+    u64 i;
+
+    for (i = 0; i < pattern.len; i++)
+    {
+        if (strchr("\\.[]()*+?|^$", pattern.s[i]) != NULL)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+regex_compile(regex *re, string pattern)
+{
+    regex_parser p = {0};
+    u32 root;
+    u32 i;
+
+    memset(re, 0, sizeof(*re));
+    p.re = re;
+    p.pattern = pattern;
+
+    root = regex_parse_alt(&p);
+    if (!p.failed && p.pos < pattern.len)
+    {
+        regex_fail(&p, "Unmatched )");
+    }
+
+    if (p.failed)
+    {
+        free(p.nodes);
+        free(re->classes);
+        re->classes = NULL;
+        return 0;
+    }
+
+    regex_extract_literals(&p, root);
+
+    for (i = 0; i < re->class_count; i++)
+    {
+        if (regex_class_has(re->classes[i], '\n'))
+        {
+            re->multiline = 1;
+        }
+    }
+
+    regex_prog_init(&p, &re->forward, root, 0);
+    regex_prog_init(&p, &re->reverse, root, 1);
+
+    free(p.nodes);
+    return 1;
+}
+
+void
+regex_free(regex *re)
+{
+    regex_prog_free(&re->forward);
+    regex_prog_free(&re->reverse);
+    free(re->classes);
+    memset(re, 0, sizeof(*re));
+}
+
+/* Leftmost match starting in [from, to). */
+int
+regex_search_range(regex *re, buffer *b, u64 from, u64 to, u64 *start, u64 *len)
+{
+    string required = {.s = re->required, .len = re->required_len};
+    u64 end;
+    u64 s;
+
+    if (to > b->total_len + 1)
+    {
+        to = b->total_len + 1;
+    }
+
+    if (from >= to)
+    {
+        return 0;
+    }
+
+    /* only worth it when the scan could otherwise run to the end */
+    if (required.len > 0 && to > b->total_len && !search_forward(b, required, from, &s))
+    {
+        return 0;
+    }
+
+    if (!regex_scan_forward(re, b, from, to, 0, &end))
+    {
+        return 0;
+    }
+
+    if (!regex_scan_reverse(re, b, end, from, 1, 0, &s))
+    {
+        s = end;
+    }
+
+    /* a preferred match would have started earlier, so none is in range */
+    if (s >= to)
+    {
+        return 0;
+    }
+
+    *start = s;
+    *len = end - s;
+    return 1;
+}
+
+/* Leftmost match starting at or after `from`. */
+int
+regex_search_forward(regex *re, buffer *b, u64 from, u64 *start, u64 *len)
+{
+    return regex_search_range(re, b, from, b->total_len + 1, start, len);
+}
+
+/* Last match starting before `before`. */
+int
+regex_search_backward(regex *re, buffer *b, u64 before, u64 *start, u64 *len)
+{
+    u64 from = b->total_len;
+    u64 end;
+    u64 s;
+
+    if (before == 0)
+    {
+        return 0;
+    }
+
+    /* without '\n' in the pattern a match ends on the line it starts on */
+    if (!re->multiline && before <= b->total_len)
+    {
+        u64 line;
+        u64 col;
+
+        buffer_offset_to_line_col(b, before - 1, &line, &col);
+        from = buffer_line_start(b, line) + buffer_line_len(b, line);
+    }
+
+    if (!regex_scan_reverse(re, b, from, 0, 0, before, &s))
+    {
+        return 0;
+    }
+
+    if (!regex_scan_forward(re, b, s, s, 1, &end))
+    {
+        end = s;
+    }
+
+    *start = s;
+    *len = end - s;
+    return 1;
+}
@@ -0,0 +1,104 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include "base.h"
+#include "buffer.h"
+
+/*
+ * Regex search that never backtracks. The pattern is compiled to a
+ * Thompson NFA, once as written and once reversed, and each NFA is turned
+ * into DFA states lazily while scanning, so the time spent is linear in
+ * the bytes scanned whatever the pattern.
+ *
+ * Supported: literals, `.`, [...] classes with ranges and ^, \d \w \s and
+ * their negations, \n \t, grouping, |, *, +, ? and the line anchors ^ $.
+ */
+
+#define REGEX_DFA_MAX_STATES 2048
+
+typedef enum {
+    REGEX_NFA_CLASS,
+    REGEX_NFA_SPLIT,
+    /* zero width, the byte before is '\n' or there is none */
+    REGEX_NFA_PREV_NL,
+    /* zero width, the byte after is '\n' or there is none */
+    REGEX_NFA_NEXT_NL,
+    REGEX_NFA_MATCH,
+} regex_nfa_kind;
+
+typedef struct
+{
+    u8 kind;
+    u32 out;
+    u32 out1;
+    u32 cls;
+} regex_nfa_state;
+
+/* transitions are indexed by byte, 256 is the end of the text */
+typedef struct
+{
+    u32 first_thread;
+    u32 thread_count;
+    u8 flags;
+    u32 next[257];
+} regex_dfa_state;
+
+typedef struct
+{
+    regex_nfa_state *states;
+    u32 count;
+    u32 capacity;
+    u32 start;
+
+    /* leftmost-first: threads below a match in priority are dropped */
+    u8 truncate;
+
+    regex_dfa_state *dfa;
+    u32 dfa_count;
+    u32 dfa_capacity;
+
+    u32 *pool;
+    u64 pool_len;
+    u64 pool_capacity;
+
+    /* open addressing, dfa index + 1 */
+    u32 *table;
+
+    /* scratch lists and marks, sized to the NFA */
+    u32 *list;
+    u32 *expand;
+    u32 *stack;
+    u32 *marks;
+    u32 *expand_marks;
+    u32 mark_gen;
+} regex_prog;
+
+typedef struct
+{
+    regex_prog forward;
+    regex_prog reverse;
+
+    u8 (*classes)[32];
+    u32 class_count;
+    u32 class_capacity;
+
+    /* literal every match starts with, and the longest one every match contains */
+    u8 prefix[64];
+    u64 prefix_len;
+    u8 required[64];
+    u64 required_len;
+
+    /* a match may contain '\n', so it cannot be bounded by its line */
+    u8 multiline;
+
+    char error[64];
+} regex;
+
+int regex_is_literal(string pattern);
+int regex_compile(regex *re, string pattern);
+void regex_free(regex *re);
+int regex_search_range(regex *re, buffer *b, u64 from, u64 to, u64 *start, u64 *len);
+int regex_search_forward(regex *re, buffer *b, u64 from, u64 *start, u64 *len);
+int regex_search_backward(regex *re, buffer *b, u64 before, u64 *start, u64 *len);
+
+#endif
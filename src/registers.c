@@ -0,0 +1,470 @@
+#include "registers.h"
+#include "base.h"
+#include "mem.h"
+
+static void
+registers_reserve_pieces(registers *r, u64 needed_capacity)
+{
+    u64 new_capacity = r->pieces.capacity ? r->pieces.capacity : 8;
+    piece *new_items;
+
+    if (needed_capacity <= r->pieces.capacity)
+    {
+        return;
+    }
+
+    while (new_capacity < needed_capacity)
+    {
+        new_capacity *= 2;
+    }
+
+    new_items = (piece *)MEM_REALLOC(MEM_REGISTERS, r->pieces.items, sizeof(piece) * r->pieces.capacity,
+                                     sizeof(piece) * new_capacity);
+    if (new_items == NULL)
+    {
+        fprintf(stderr, "[error] registers_reserve_pieces unable to realloc\n");
+        exit(1);
+    }
+
+    r->pieces.items = new_items;
+    r->pieces.capacity = new_capacity;
+}
+
+static u64
+registers_bytes_append(registers *r, u8 *data, u64 len)
+{
+    u64 start = r->bytes.len;
+    u64 needed_capacity = r->bytes.len + len;
+    u64 new_capacity;
+    u8 *new_data;
+
+    if (needed_capacity > r->bytes_capacity)
+    {
+        new_capacity = r->bytes_capacity ? r->bytes_capacity : 64;
+        while (new_capacity < needed_capacity)
+        {
+            new_capacity *= 2;
+        }
+
+        new_data = (u8 *)MEM_REALLOC(MEM_REGISTERS, r->bytes.s, r->bytes_capacity, new_capacity);
+        if (new_data == NULL)
+        {
+            fprintf(stderr, "[error] registers_bytes_append unable to realloc\n");
+            exit(1);
+        }
+
+        r->bytes.s = new_data;
+        r->bytes_capacity = new_capacity;
+    }
+
+    if (len > 0)
+    {
+        memcpy(r->bytes.s + start, data, len);
+    }
+
+    r->bytes.len += len;
+    return start;
+}
+
+static s64
+registers_slot_index(registers *r, u8 name)
+{
+    if (name == REGISTER_YANK)
+    {
+        return 0;
+    }
+
+    if (name >= '1' && name <= '9')
+    {
+        return 1 + (s64)((r->ring_head + (u64)(name - '1')) % REGISTER_RING_LEN);
+    }
+
+    if (name >= 'A' && name <= 'Z')
+    {
+        name = (u8)(name - 'A' + 'a');
+    }
+
+    if (name >= 'a' && name <= 'z')
+    {
+        return 1 + REGISTER_RING_LEN + (s64)(name - 'a');
+    }
+
+    return -1;
+}
+
+static void
+registers_release(registers *r, register_slot *slot)
+{
+    if (!slot->in_use)
+    {
+        return;
+    }
+
+    r->live_pieces -= slot->piece_count;
+    if (slot->source == NULL)
+    {
+        r->live_bytes -= slot->len;
+    }
+
+    slot->in_use = 0;
+    slot->source = NULL;
+    slot->first_piece = 0;
+    slot->piece_count = 0;
+    slot->len = 0;
+}
+
+/*
+ * Old descriptors and bytes are abandoned when a register is overwritten.
+ * Once the dead space outweighs the live data, both stores are rebuilt
+ * from the slots that are still in use.
+ */
+static void
+registers_compact(registers *r)
+{
+    u64 i;
+    u64 j;
+
+    if (r->bytes.len > 2 * r->live_bytes + KB(4))
+    {
+        u64 capacity = r->live_bytes > 64 ? r->live_bytes : 64;
+        u8 *bytes = (u8 *)MEM_MALLOC(MEM_REGISTERS, capacity);
+        u64 len = 0;
+
+        if (bytes == NULL)
+        {
+            fprintf(stderr, "[error] registers_compact unable to malloc\n");
+            exit(1);
+        }
+
+        for (i = 0; i < REGISTER_SLOT_COUNT; i++)
+        {
+            register_slot *slot = &r->slots[i];
+
+            if (!slot->in_use || slot->source != NULL)
+            {
+                continue;
+            }
+
+            for (j = 0; j < slot->piece_count; j++)
+            {
+                piece *p = &r->pieces.items[slot->first_piece + j];
+
+                memcpy(bytes + len, r->bytes.s + p->start, (size_t)p->len);
+                p->start = len;
+                len += p->len;
+            }
+        }
+
+        MEM_FREE(MEM_REGISTERS, r->bytes.s, r->bytes_capacity);
+        r->bytes.s = bytes;
+        r->bytes.len = len;
+        r->bytes_capacity = capacity;
+    }
+
+    if (r->pieces.count > 2 * r->live_pieces + 64)
+    {
+        piece_array old_pieces = r->pieces;
+
+        r->pieces = (piece_array){0};
+        registers_reserve_pieces(r, r->live_pieces + 8);
+
+        for (i = 0; i < REGISTER_SLOT_COUNT; i++)
+        {
+            register_slot *slot = &r->slots[i];
+
+            if (!slot->in_use)
+            {
+                continue;
+            }
+
+            memcpy(r->pieces.items + r->pieces.count,
+                   old_pieces.items + slot->first_piece,
+                   sizeof(piece) * slot->piece_count);
+            slot->first_piece = r->pieces.count;
+            r->pieces.count += slot->piece_count;
+        }
+
+        MEM_FREE(MEM_REGISTERS, old_pieces.items, sizeof(piece) * old_pieces.capacity);
+    }
+}
+
+static void
+registers_store(registers *r, register_slot *slot, buffer *b, u64 start, u64 len, register_kind kind, int append)
+{
+    u64 before;
+
+    if (append && slot->in_use && slot->source != b)
+    {
+        string old_text;
+        string new_text;
+        piece p;
+
+        registers_materialize(r, slot, &old_text);
+        buffer_slice(b, start, len, &new_text);
+
+        registers_release(r, slot);
+
+        p.source = BUFFER_SRC_ADD;
+        p.start = registers_bytes_append(r, old_text.s, old_text.len);
+        registers_bytes_append(r, new_text.s, new_text.len);
+        p.len = old_text.len + new_text.len;
+
+        registers_reserve_pieces(r, r->pieces.count + 1);
+        slot->first_piece = r->pieces.count;
+        slot->piece_count = 1;
+        r->pieces.items[r->pieces.count++] = p;
+
+        slot->source = NULL;
+        slot->len = p.len;
+        slot->kind = kind;
+        slot->in_use = 1;
+        r->live_pieces += 1;
+        r->live_bytes += p.len;
+
+        free(old_text.s);
+        free(new_text.s);
+        return;
+    }
+
+    if (append && slot->in_use)
+    {
+        /* keep the slot's descriptors contiguous before growing it */
+        if (slot->first_piece + slot->piece_count != r->pieces.count)
+        {
+            registers_reserve_pieces(r, r->pieces.count + slot->piece_count);
+            memcpy(r->pieces.items + r->pieces.count,
+                   r->pieces.items + slot->first_piece,
+                   sizeof(piece) * slot->piece_count);
+            slot->first_piece = r->pieces.count;
+            r->pieces.count += slot->piece_count;
+        }
+
+        if (kind == REGISTER_LINEWISE)
+        {
+            slot->kind = REGISTER_LINEWISE;
+        }
+    }
+    else
+    {
+        registers_release(r, slot);
+        slot->source = b;
+        slot->first_piece = r->pieces.count;
+        slot->kind = kind;
+        slot->in_use = 1;
+    }
+
+    before = r->pieces.count;
+    buffer_collect_pieces(b, start, len, &r->pieces, MEM_REGISTERS);
+
+    slot->piece_count += r->pieces.count - before;
+    slot->len += len;
+    r->live_pieces += r->pieces.count - before;
+
+    registers_compact(r);
+}
+
+void
+registers_init(registers *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+void
+registers_free(registers *r)
+{
+    MEM_FREE(MEM_REGISTERS, r->pieces.items, sizeof(piece) * r->pieces.capacity);
+    MEM_FREE(MEM_REGISTERS, r->bytes.s, r->bytes_capacity);
+    memset(r, 0, sizeof(*r));
+}
+
+int
+registers_valid_name(u8 name)
+{
+    return name == REGISTER_UNNAMED ||
+           (name >= '0' && name <= '9') ||
+           (name >= 'a' && name <= 'z') ||
+           (name >= 'A' && name <= 'Z');
+}
+
+register_slot *
+registers_get(registers *r, u8 name)
+{
+    s64 index;
+
+    if (name == REGISTER_UNNAMED || name == 0)
+    {
+        if (r->unnamed == 0)
+        {
+            return NULL;
+        }
+
+        name = r->unnamed;
+    }
+
+    index = registers_slot_index(r, name);
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    return &r->slots[index];
+}
+
+void
+registers_yank(registers *r, u8 name, buffer *b, u64 start, u64 len, register_kind kind)
+{
+    s64 index;
+    int append = (name >= 'A' && name <= 'Z');
+
+    if (name == REGISTER_UNNAMED || name == 0)
+    {
+        name = REGISTER_YANK;
+    }
+
+    index = registers_slot_index(r, name);
+    if (index < 0)
+    {
+        return;
+    }
+
+    registers_store(r, &r->slots[index], b, start, len, kind, append);
+    r->unnamed = append ? (u8)(name - 'A' + 'a') : name;
+}
+
+void
+registers_delete(registers *r, u8 name, buffer *b, u64 start, u64 len, register_kind kind)
+{
+    if (name == REGISTER_UNNAMED || name == 0)
+    {
+        /* the old "9 becomes the new "1, nothing else moves */
+        r->ring_head = (r->ring_head + REGISTER_RING_LEN - 1) % REGISTER_RING_LEN;
+        registers_store(r, &r->slots[1 + r->ring_head], b, start, len, kind, 0);
+        r->unnamed = '1';
+        return;
+    }
+
+    registers_yank(r, name, b, start, len, kind);
+}
+
+static void
+registers_store_text(registers *r, register_slot *slot, string text, register_kind kind)
+{
+    registers_release(r, slot);
+
+    registers_reserve_pieces(r, r->pieces.count + 1);
+    slot->first_piece = r->pieces.count;
+    slot->piece_count = 1;
+    r->pieces.items[r->pieces.count++] = (piece){
+        .source = BUFFER_SRC_ADD,
+        .start = registers_bytes_append(r, text.s, text.len),
+        .len = text.len,
+    };
+
+    slot->source = NULL;
+    slot->len = text.len;
+    slot->kind = kind;
+    slot->in_use = 1;
+    r->live_pieces += 1;
+    r->live_bytes += text.len;
+
+    registers_compact(r);
+}
+
+void
+registers_set_text(registers *r, u8 name, string text, register_kind kind)
+{
+    s64 index;
+
+    if (name == REGISTER_UNNAMED || name == 0)
+    {
+        name = REGISTER_YANK;
+    }
+
+    index = registers_slot_index(r, name);
+    if (index < 0)
+    {
+        return;
+    }
+
+    registers_store_text(r, &r->slots[index], text, kind);
+    r->unnamed = (name >= 'A' && name <= 'Z') ? (u8)(name - 'A' + 'a') : name;
+}
+
+/* Like registers_delete, for text that is not a range of one buffer. */
+void
+registers_delete_text(registers *r, u8 name, string text, register_kind kind)
+{
+    if (name == REGISTER_UNNAMED || name == 0)
+    {
+        r->ring_head = (r->ring_head + REGISTER_RING_LEN - 1) % REGISTER_RING_LEN;
+        registers_store_text(r, &r->slots[1 + r->ring_head], text, kind);
+        r->unnamed = '1';
+        return;
+    }
+
+    registers_set_text(r, name, text, kind);
+}
+
+u64
+registers_put(registers *r, u8 name, buffer *b, u64 offset)
+{
+    register_slot *slot = registers_get(r, name);
+    string text;
+
+    if (slot == NULL || !slot->in_use || slot->len == 0)
+    {
+        return 0;
+    }
+
+    if (slot->source == b)
+    {
+        buffer_insert_pieces(b, offset, r->pieces.items + slot->first_piece, slot->piece_count);
+        return slot->len;
+    }
+
+    registers_materialize(r, slot, &text);
+    buffer_insert(b, offset, text);
+    free(text.s);
+
+    return slot->len;
+}
+
+void
+registers_materialize(registers *r, register_slot *slot, string *out)
+{
+    u64 i;
+    u64 idx = 0;
+    u8 *data;
+
+    data = (u8 *)malloc(slot->len == 0 ? 1 : (size_t)slot->len);
+    if (data == NULL)
+    {
+        perror("[error] unable to alloc register contents");
+        exit(1);
+    }
+
+    for (i = 0; i < slot->piece_count; i++)
+    {
+        piece p = r->pieces.items[slot->first_piece + i];
+        u8 *src;
+
+        if (slot->source == NULL)
+        {
+            src = r->bytes.s;
+        }
+        else if (p.source == BUFFER_SRC_ORIG)
+        {
+            src = slot->source->orig.s;
+        }
+        else
+        {
+            src = slot->source->add.s;
+        }
+
+        memcpy(data + idx, src + p.start, (size_t)p.len);
+        idx += p.len;
+    }
+
+    out->s = data;
+    out->len = idx;
+}
@@ -0,0 +1,67 @@
+#ifndef REGISTERS_H
+#define REGISTERS_H
+
+#include "base.h"
+#include "buffer.h"
+
+#define REGISTER_UNNAMED '"'
+#define REGISTER_YANK    '0'
+
+/* "0, "1-"9 and "a-"z */
+#define REGISTER_RING_LEN   9
+#define REGISTER_SLOT_COUNT (1 + REGISTER_RING_LEN + 26)
+
+typedef enum {
+    REGISTER_CHARWISE = 0,
+    REGISTER_LINEWISE,
+    /* rows of a visual block separated by '\n' */
+    REGISTER_BLOCKWISE,
+} register_kind;
+
+/*
+ * A register never owns a copy of the text it holds when it can avoid it.
+ * Its pieces point into the orig/add storage of `source`, which the piece
+ * table only ever appends to, so the bytes stay valid after the range is
+ * deleted. Text that has no backing buffer lives in registers.bytes and
+ * `source` is NULL.
+ */
+typedef struct
+{
+    buffer *source;
+    u64 first_piece;
+    u64 piece_count;
+    u64 len;
+    register_kind kind;
+    u8 in_use;
+} register_slot;
+
+typedef struct
+{
+    piece_array pieces;
+    u64 live_pieces;
+
+    string bytes;
+    u64 bytes_capacity;
+    u64 live_bytes;
+
+    register_slot slots[REGISTER_SLOT_COUNT];
+
+    /* physical slot holding "1, the ring rotates instead of copying */
+    u64 ring_head;
+
+    /* name of the register "" currently aliases */
+    u8 unnamed;
+} registers;
+
+void registers_init(registers *r);
+void registers_free(registers *r);
+int registers_valid_name(u8 name);
+register_slot *registers_get(registers *r, u8 name);
+void registers_yank(registers *r, u8 name, buffer *b, u64 start, u64 len, register_kind kind);
+void registers_delete(registers *r, u8 name, buffer *b, u64 start, u64 len, register_kind kind);
+void registers_set_text(registers *r, u8 name, string text, register_kind kind);
+void registers_delete_text(registers *r, u8 name, string text, register_kind kind);
+u64 registers_put(registers *r, u8 name, buffer *b, u64 offset);
+void registers_materialize(registers *r, register_slot *slot, string *out);
+
+#endif
@@ -0,0 +1,365 @@
+#include "search.h"
+#include "base.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Written out, one row per 16 bytes: blanks, keyword characters and the rest. */
+#define B SEARCH_CLASS_BLANK
+#define K SEARCH_CLASS_KEYWORD
+#define O SEARCH_CLASS_OTHER
+const u8 search_word_class[256] = {
+    /* 00 */ O, O, O, O, O, O, O, O, O, B, B, O, O, B, O, O,
+    /* 10 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* 20 */ B, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* 30 */ K, K, K, K, K, K, K, K, K, K, O, O, O, O, O, O,
+    /* 40 */ O, K, K, K, K, K, K, K, K, K, K, K, K, K, K, K,
+    /* 50 */ K, K, K, K, K, K, K, K, K, K, K, O, O, O, O, K,
+    /* 60 */ O, K, K, K, K, K, K, K, K, K, K, K, K, K, K, K,
+    /* 70 */ K, K, K, K, K, K, K, K, K, K, K, O, O, O, O, O,
+    /* 80 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* 90 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* a0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* b0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* c0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* d0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* e0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+    /* f0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+};
+#undef B
+#undef K
+#undef O
+
+/*
+ * Literal search over piece spans. Inside a span, 16 candidate starts at
+ * a time are filtered by comparing their first and last byte against the
+ * needle's, and only the survivors are compared in full. Starts close
+ * enough to the end of a span that the match may run into the next piece
+ * are checked through a buffer_reader.
+ *
+ * The span functions look for starts in [0, starts) of `hay` and may read
+ * up to `avail` bytes, callers guarantee starts + needle.len - 1 <= avail.
+ */
+
+#if defined(__SSE2__)
+static u32
+search_block_mask(u8 *p, __m128i first, __m128i last, u64 n)
+{
+    __m128i a = _mm_loadu_si128((__m128i *)p);
+    __m128i z = _mm_loadu_si128((__m128i *)(p + n - 1));
+
+    return (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                _mm_cmpeq_epi8(z, last)));
+}
+#endif
+
+int
+search_span_forward(u8 *hay, u64 starts, u64 avail, string needle, u64 *out)
+{
+    u64 n = needle.len;
+    u64 i = 0;
+
+    if (n == 0 || starts == 0 || starts + n - 1 > avail)
+    {
+        return 0;
+    }
+
+#if defined(__SSE2__)
+    {
+        __m128i first = _mm_set1_epi8((char)needle.s[0]);
+        __m128i last = _mm_set1_epi8((char)needle.s[n - 1]);
+
+        for (; i + 16 <= starts; i += 16)
+        {
+            u32 mask = search_block_mask(hay + i, first, last, n);
+
+            while (mask != 0)
+            {
+                u64 bit = (u64)__builtin_ctz(mask);
+
+                if (memcmp(hay + i + bit, needle.s, (size_t)n) == 0)
+                {
+                    *out = i + bit;
+                    return 1;
+                }
+
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    for (; i < starts; i++)
+    {
+        if (hay[i] == needle.s[0] && hay[i + n - 1] == needle.s[n - 1] &&
+            memcmp(hay + i, needle.s, (size_t)n) == 0)
+        {
+            *out = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+search_span_backward(u8 *hay, u64 starts, u64 avail, string needle, u64 *out)
+{
+    u64 n = needle.len;
+    u64 i = starts;
+
+    if (n == 0 || starts == 0 || starts + n - 1 > avail)
+    {
+        return 0;
+    }
+
+#if defined(__SSE2__)
+    {
+        __m128i first = _mm_set1_epi8((char)needle.s[0]);
+        __m128i last = _mm_set1_epi8((char)needle.s[n - 1]);
+
+        for (; i >= 16; i -= 16)
+        {
+            u32 mask = search_block_mask(hay + i - 16, first, last, n);
+
+            while (mask != 0)
+            {
+                u64 bit = (u64)(31 - __builtin_clz(mask));
+
+                if (memcmp(hay + i - 16 + bit, needle.s, (size_t)n) == 0)
+                {
+                    *out = i - 16 + bit;
+                    return 1;
+                }
+
+                mask &= ~(1u << bit);
+            }
+        }
+    }
+#endif
+
+    while (i > 0)
+    {
+        i--;
+        if (hay[i] == needle.s[0] && hay[i + n - 1] == needle.s[n - 1] &&
+            memcmp(hay + i, needle.s, (size_t)n) == 0)
+        {
+            *out = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+search_matches_at(buffer_reader *r, string needle, u64 offset)
+{
+    u64 i;
+
+    if (offset + needle.len > r->b->total_len)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < needle.len; i++)
+    {
+        if (buffer_reader_byte(r, offset + i) != needle.s[i])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* First match starting in [from, to). */
+int
+search_forward_range(buffer *b, string needle, u64 from, u64 to, u64 *out)
+{
+    buffer_reader r;
+    u64 n = needle.len;
+    u64 off = from;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    /* past `last` a match would not fit or would start too late */
+    if (to > b->total_len - n + 1 || n > b->total_len)
+    {
+        to = n > b->total_len ? 0 : b->total_len - n + 1;
+    }
+
+    buffer_reader_init(&r, b);
+
+    while (off < to)
+    {
+        u8 *data;
+        u64 span_len = buffer_span_at(b, off, &data);
+        u64 starts = span_len;
+        u64 straddle = off;
+        u64 i;
+
+        if (starts > to - off)
+        {
+            starts = to - off;
+        }
+
+        if (span_len >= n)
+        {
+            u64 inside = span_len - n + 1 < starts ? span_len - n + 1 : starts;
+
+            if (search_span_forward(data, inside, span_len, needle, &i))
+            {
+                *out = off + i;
+                return 1;
+            }
+
+            straddle = off + inside;
+        }
+
+        for (i = straddle; i < off + starts; i++)
+        {
+            if (search_matches_at(&r, needle, i))
+            {
+                *out = i;
+                return 1;
+            }
+        }
+
+        off += span_len;
+    }
+
+    return 0;
+}
+
+/* First match starting at or after `from`. */
+int
+search_forward(buffer *b, string needle, u64 from, u64 *out)
+{
+    return search_forward_range(b, needle, from, b->total_len, out);
+}
+
+/* Last match starting before `before`. */
+int
+search_backward(buffer *b, string needle, u64 before, u64 *out)
+{
+    buffer_reader r;
+    u64 n = needle.len;
+    u64 end;
+
+    if (n == 0 || n > b->total_len)
+    {
+        return 0;
+    }
+
+    if (before > b->total_len - n + 1)
+    {
+        before = b->total_len - n + 1;
+    }
+
+    buffer_reader_init(&r, b);
+    end = before + n - 1;
+
+    while (end > 0 && before > 0)
+    {
+        u8 *data;
+        u64 span_len = buffer_span_before(b, end, &data);
+        u64 span_start = end - span_len;
+        u64 i;
+
+        /* starts whose match runs past the end of this span */
+        i = before < end ? before : end;
+        while (i > span_start && i + n > end)
+        {
+            i--;
+            if (search_matches_at(&r, needle, i))
+            {
+                *out = i;
+                return 1;
+            }
+        }
+
+        if (i > span_start &&
+            search_span_backward(data, i - span_start, span_len, needle, out))
+        {
+            *out += span_start;
+            return 1;
+        }
+
+        end = span_start;
+        if (before > end)
+        {
+            before = end;
+        }
+    }
+
+    return 0;
+}
+
+/* The `len` bytes at `offset` are not part of a longer keyword on either side. */
+int
+search_is_word_at(buffer_reader *r, u64 offset, u64 len)
+{
+    if (offset > 0 &&
+        search_word_class[buffer_reader_byte(r, offset - 1)] == SEARCH_CLASS_KEYWORD)
+    {
+        return 0;
+    }
+
+    return offset + len >= r->b->total_len ||
+           search_word_class[buffer_reader_byte(r, offset + len)] != SEARCH_CLASS_KEYWORD;
+}
+
+/*
+ * Whole word matches of a keyword, for * and #. Candidates come from the
+ * literal scan, only their two neighbouring bytes are then looked up.
+ */
+int
+search_forward_word_range(buffer *b, string needle, u64 from, u64 to, u64 *out)
+{
+    buffer_reader r;
+
+    buffer_reader_init(&r, b);
+
+    while (search_forward_range(b, needle, from, to, out))
+    {
+        if (search_is_word_at(&r, *out, needle.len))
+        {
+            return 1;
+        }
+
+        from = *out + 1;
+    }
+
+    return 0;
+}
+
+int
+search_forward_word(buffer *b, string needle, u64 from, u64 *out)
+{
+    return search_forward_word_range(b, needle, from, b->total_len, out);
+}
+
+int
+search_backward_word(buffer *b, string needle, u64 before, u64 *out)
+{
+    buffer_reader r;
+
+    buffer_reader_init(&r, b);
+
+    while (search_backward(b, needle, before, out))
+    {
+        if (search_is_word_at(&r, *out, needle.len))
+        {
+            return 1;
+        }
+
+        before = *out;
+    }
+
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "base.h"
+#include "buffer.h"
+
+/* word classes of bytes, as w, b and e see them */
+#define SEARCH_CLASS_BLANK   0
+#define SEARCH_CLASS_KEYWORD 1
+#define SEARCH_CLASS_OTHER   2
+
+extern const u8 search_word_class[256];
+
+int search_span_forward(u8 *hay, u64 starts, u64 avail, string needle, u64 *out);
+int search_span_backward(u8 *hay, u64 starts, u64 avail, string needle, u64 *out);
+int search_matches_at(buffer_reader *r, string needle, u64 offset);
+int search_forward_range(buffer *b, string needle, u64 from, u64 to, u64 *out);
+int search_forward(buffer *b, string needle, u64 from, u64 *out);
+int search_backward(buffer *b, string needle, u64 before, u64 *out);
+int search_is_word_at(buffer_reader *r, u64 offset, u64 len);
+int search_forward_word_range(buffer *b, string needle, u64 from, u64 to, u64 *out);
+int search_forward_word(buffer *b, string needle, u64 from, u64 *out);
+int search_backward_word(buffer *b, string needle, u64 before, u64 *out);
+
+#endif
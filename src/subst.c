@@ -0,0 +1,317 @@
+#include "subst.h"
+#include "regex.h"
+#include "search.h"
+#include "base.h"
+
+static u8 *
+subst_copy(string s)
+{
+    u8 *out = (u8 *)malloc((size_t)s.len + 1);
+
+    if (out == NULL)
+    {
+        fprintf(stderr, "[error] subst_copy unable to malloc\n");
+        exit(1);
+    }
+
+    memcpy(out, s.s, (size_t)s.len);
+    return out;
+}
+
+/*
+ * Copies one delimited field starting at `*i`, turning `\<delim>` into
+ * the delimiter and leaving every other escape for the regex or the
+ * replacement to read.
+ */
+string
+subst_field(string cmd, u64 *i, u8 delim)
+{
+    string out;
+    u64 start = *i;
+
+    out.s = subst_copy((string){.s = cmd.s + start, .len = cmd.len - start});
+    out.len = 0;
+
+    while (*i < cmd.len && cmd.s[*i] != delim)
+    {
+        if (cmd.s[*i] == '\\' && *i + 1 < cmd.len)
+        {
+            if (cmd.s[*i + 1] != delim)
+            {
+                out.s[out.len++] = '\\';
+            }
+            (*i)++;
+        }
+
+        out.s[out.len++] = cmd.s[(*i)++];
+    }
+
+    return out;
+}
+
+/*
+ * Parses "/pattern/replacement/flags" with any punctuation as delimiter.
+ * The pattern and replacement are allocated, an empty pattern means the
+ * last search.
+ */
+int
+subst_parse(string cmd, string *pattern, string *replacement, u64 *flags, char *error,
+            u64 error_len)
+{
+    u64 i = 1;
+    u8 delim;
+
+    if (cmd.len == 0 || cmd.s[0] == '\\' || cmd.s[0] == '"' || cmd.s[0] == '|' ||
+        (cmd.s[0] >= 'a' && cmd.s[0] <= 'z') || (cmd.s[0] >= 'A' && cmd.s[0] <= 'Z') ||
+        (cmd.s[0] >= '0' && cmd.s[0] <= '9') || cmd.s[0] == ' ')
+    {
+        snprintf(error, (size_t)error_len, "Invalid substitute delimiter");
+        return 0;
+    }
+
+    delim = cmd.s[0];
+    *pattern = subst_field(cmd, &i, delim);
+    i += i < cmd.len;
+    *replacement = subst_field(cmd, &i, delim);
+    i += i < cmd.len;
+
+    *flags = 0;
+    for (; i < cmd.len; i++)
+    {
+        if (cmd.s[i] == 'g')
+        {
+            *flags |= SUBST_GLOBAL;
+        }
+        else if (cmd.s[i] == 'n')
+        {
+            *flags |= SUBST_COUNT;
+        }
+        else if (cmd.s[i] != ' ' && cmd.s[i] != '\t')
+        {
+            snprintf(error, (size_t)error_len, "Invalid substitute flag %c", cmd.s[i]);
+            free(pattern->s);
+            free(replacement->s);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void
+subst_reserve(u8 **text, u64 *capacity, u64 need)
+{
+    if (need <= *capacity)
+    {
+        return;
+    }
+
+    *capacity = *capacity ? *capacity : KB(4);
+    while (*capacity < need)
+    {
+        *capacity *= 2;
+    }
+
+    *text = (u8 *)realloc(*text, (size_t)*capacity);
+    if (*text == NULL)
+    {
+        fprintf(stderr, "[error] subst_reserve unable to realloc\n");
+        exit(1);
+    }
+}
+
+/* Appends the replacement for the match at `start`, `&` being the match itself. */
+static void
+subst_expand(buffer *b, string replacement, u64 start, u64 len, u8 **text, u64 *text_len,
+             u64 *capacity)
+{
+    u64 i;
+
+    for (i = 0; i < replacement.len; i++)
+    {
+        u8 c = replacement.s[i];
+
+        if (c == '&')
+        {
+            subst_reserve(text, capacity, *text_len + len);
+            buffer_read(b, start, len, *text + *text_len);
+            *text_len += len;
+            continue;
+        }
+
+        if (c == '\\' && i + 1 < replacement.len)
+        {
+            c = replacement.s[++i];
+            c = (c == 'n' || c == 'r') ? '\n' : c == 't' ? '\t' : c;
+        }
+
+        subst_reserve(text, capacity, *text_len + 1);
+        (*text)[(*text_len)++] = c;
+    }
+}
+
+int
+subst_begin(subst_batch *sb, buffer *b, string pattern, string replacement, u64 flags,
+            char *error, u64 error_len)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->b = b;
+    sb->pattern = pattern;
+    sb->replacement = replacement;
+    sb->flags = flags;
+    sb->use_regex = (u8)!regex_is_literal(pattern);
+    sb->prev_end = (u64)-1;
+    sb->counted_line = (u64)-1;
+
+    if (sb->use_regex && !regex_compile(&sb->re, pattern))
+    {
+        snprintf(error, (size_t)error_len, "Invalid pattern: %s", sb->re.error);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Adds the matches starting on lines [first_line, last_line], after any collected before. */
+void
+subst_collect(subst_batch *sb, u64 first_line, u64 last_line)
+{
+    buffer *b = sb->b;
+    u64 line = first_line;
+    u64 range_end = buffer_line_start(b, last_line) + buffer_line_len(b, last_line);
+    u64 cur = buffer_line_start(b, first_line);
+
+    while (cur <= range_end)
+    {
+        u64 start;
+        u64 len = sb->pattern.len;
+        u64 text_start = sb->text_len;
+        int found;
+
+        if (sb->use_regex)
+        {
+            found = regex_search_range(&sb->re, b, cur, range_end + 1, &start, &len);
+        }
+        else
+        {
+            found = search_forward_range(b, sb->pattern, cur, range_end + 1, &start);
+        }
+
+        if (!found)
+        {
+            break;
+        }
+
+        while (line + 1 < b->lines.count && b->lines.items[line + 1].start <= start)
+        {
+            line++;
+        }
+
+        /* an empty match where a match ended belongs to it: x* turns "axc" into "-a-c-" */
+        if (len == 0 && start == sb->prev_end)
+        {
+            cur = start + 1;
+            continue;
+        }
+
+        if (sb->count == sb->capacity)
+        {
+            sb->capacity = sb->capacity ? sb->capacity * 2 : 256;
+            sb->edits = (buffer_edit *)realloc(sb->edits, sizeof(buffer_edit) * sb->capacity);
+            if (sb->edits == NULL)
+            {
+                fprintf(stderr, "[error] subst_collect unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        subst_expand(b, sb->replacement, start, len, &sb->text, &sb->text_len, &sb->text_capacity);
+        sb->edits[sb->count].offset = start;
+        sb->edits[sb->count].delete_len = len;
+        sb->edits[sb->count].text.s = NULL;
+        sb->edits[sb->count].text.len = text_start;
+        sb->count++;
+
+        sb->last_offset = (u64)((s64)start + sb->delta);
+        sb->delta += (s64)(sb->text_len - text_start) - (s64)len;
+
+        if (line != sb->counted_line)
+        {
+            sb->lines++;
+            sb->counted_line = line;
+        }
+
+        sb->prev_end = start + len;
+        if (sb->flags & SUBST_GLOBAL)
+        {
+            cur = len > 0 ? start + len : start + 1;
+        }
+        else
+        {
+            u64 next = line + 1 < b->lines.count ? b->lines.items[line + 1].start : b->total_len + 1;
+
+            cur = next > start + len ? next : start + len;
+        }
+    }
+}
+
+/*
+ * Applies the collected edits in one buffer_apply_edits, unless only
+ * counting, and frees the batch. The replacements were expanded into one
+ * block, so the add buffer is written once and the pieces and line index
+ * are rebuilt once, whatever the number of matches.
+ */
+void
+subst_finish(subst_batch *sb, subst_result *result)
+{
+    u64 line;
+    u64 col;
+    u64 i;
+
+    memset(result, 0, sizeof(*result));
+    result->count = sb->count;
+    result->lines = sb->lines;
+
+    if (sb->count > 0 && !(sb->flags & SUBST_COUNT))
+    {
+        for (i = 0; i < sb->count; i++)
+        {
+            u64 from = sb->edits[i].text.len;
+            u64 to = i + 1 < sb->count ? sb->edits[i + 1].text.len : sb->text_len;
+
+            sb->edits[i].text.s = sb->text + from;
+            sb->edits[i].text.len = to - from;
+        }
+
+        buffer_apply_edits(sb->b, sb->edits, sb->count);
+
+        buffer_offset_to_line_col(sb->b, sb->last_offset, &line, &col);
+        result->last_line_start = buffer_line_start(sb->b, line);
+    }
+
+    if (sb->use_regex)
+    {
+        regex_free(&sb->re);
+    }
+    free(sb->edits);
+    free(sb->text);
+    memset(sb, 0, sizeof(*sb));
+}
+
+/* Replaces the matches starting on lines [first_line, last_line] as one edit. */
+int
+subst_apply(buffer *b, u64 first_line, u64 last_line, string pattern, string replacement,
+            u64 flags, subst_result *result, char *error, u64 error_len)
+{
+    subst_batch sb;
+
+    if (!subst_begin(&sb, b, pattern, replacement, flags, error, error_len))
+    {
+        memset(result, 0, sizeof(*result));
+        return 0;
+    }
+
+    subst_collect(&sb, first_line, last_line);
+    subst_finish(&sb, result);
+    return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef SUBST_H
+#define SUBST_H
+
+#include "base.h"
+#include "buffer.h"
+#include "regex.h"
+
+/* every match on a line instead of the first */
+#define SUBST_GLOBAL 1
+/* count the matches, change nothing */
+#define SUBST_COUNT  2
+
+typedef struct
+{
+    u64 count;
+    u64 lines;
+    /* post-edit offset of the last line changed */
+    u64 last_line_start;
+} subst_result;
+
+/*
+ * The edits of one substitution, collected over one or more line ranges
+ * in order and applied together by subst_finish.
+ */
+typedef struct
+{
+    buffer *b;
+    string pattern;
+    string replacement;
+    u64 flags;
+    u8 use_regex;
+    regex re;
+
+    buffer_edit *edits;
+    u64 count;
+    u64 capacity;
+    /* every replacement, back to back; edits hold offsets into it until the end */
+    u8 *text;
+    u64 text_len;
+    u64 text_capacity;
+
+    s64 delta;
+    u64 last_offset;
+    u64 prev_end;
+    u64 lines;
+    u64 counted_line;
+} subst_batch;
+
+string subst_field(string cmd, u64 *i, u8 delim);
+int subst_parse(string cmd, string *pattern, string *replacement, u64 *flags, char *error,
+                u64 error_len);
+int subst_begin(subst_batch *sb, buffer *b, string pattern, string replacement, u64 flags,
+                char *error, u64 error_len);
+void subst_collect(subst_batch *sb, u64 first_line, u64 last_line);
+void subst_finish(subst_batch *sb, subst_result *result);
+int subst_apply(buffer *b, u64 first_line, u64 last_line, string pattern, string replacement,
+                u64 flags, subst_result *result, char *error, u64 error_len);
+
+#endif
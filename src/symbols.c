@@ -0,0 +1,1260 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbols.h"
+#include "file.h"
+#include "funcs.h"
+#include "walk.h"
+#include "base.h"
+
+typedef enum {
+    SYMBOL_TOKEN_END,
+    SYMBOL_TOKEN_IDENT,
+    SYMBOL_TOKEN_PUNCT,
+    /* literals and numbers */
+    SYMBOL_TOKEN_OTHER,
+} symbol_token_kind;
+
+typedef struct
+{
+    symbol_token_kind kind;
+    u64 start;
+    u64 len;
+    u32 line;
+} symbol_token;
+
+/*
+ * Tokens come from the bytes of each line and the classes the language's
+ * highlighting lexer gives them, so comments and literals are found by
+ * the same code that draws them.
+ */
+typedef struct
+{
+    const syntax_language *lang;
+    buffer b;
+    buffer_reader r;
+    const u8 *data;
+    u64 len;
+    /* the line being read is [line_start, line_end) */
+    u64 line_start;
+    u64 line_end;
+    u64 pos;
+    u32 line;
+    syntax_state state;
+    u8 *classes;
+    u64 classes_capacity;
+} symbol_lexer;
+
+/* What the declaration at the top level seen so far says, reset at each ';'. */
+typedef struct
+{
+    u32 depth;
+    u32 paren;
+    /* depth of the enumerators of the enum being read, 0 outside one */
+    u32 enum_depth;
+    u8 enum_expect;
+    u8 is_typedef;
+    u8 is_extern;
+    u8 in_init;
+    /* SYMBOL_STRUCT, SYMBOL_UNION or SYMBOL_ENUM after the keyword */
+    u8 aggregate;
+    u8 expect_aggregate_name;
+    u8 function_body;
+    u8 fnptr_pending;
+    symbol_token last;
+    symbol_token aggregate_name;
+    symbol_token function;
+    symbol_token fnptr;
+} symbol_parser;
+
+/* One symbol to write, pointing at its name and path in a doc or the old map. */
+typedef struct
+{
+    const char *name;
+    const char *path;
+    s64 mtime;
+    u32 line;
+    u8 kind;
+} symbol_out;
+
+typedef struct
+{
+    const char *path;
+    s64 mtime;
+    u64 offset;
+} symbol_out_file;
+
+static int
+symbol_is_ident(u8 c)
+{
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static void
+symbol_add(symbol_doc *doc, symbol_lexer *lx, symbol_token *t, u8 kind)
+{
+    if (t->kind != SYMBOL_TOKEN_IDENT)
+    {
+        return;
+    }
+
+    if (doc->count == doc->capacity)
+    {
+        doc->capacity = doc->capacity ? doc->capacity * 2 : 64;
+        doc->items = (symbol_item *)realloc(doc->items, sizeof(symbol_item) * (size_t)doc->capacity);
+        if (doc->items == NULL)
+        {
+            fprintf(stderr, "[error] symbol_add unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    if (doc->names_len + t->len + 1 > doc->names_capacity)
+    {
+        doc->names_capacity = doc->names_capacity ? doc->names_capacity : KB(4);
+        while (doc->names_len + t->len + 1 > doc->names_capacity)
+        {
+            doc->names_capacity *= 2;
+        }
+        doc->names = (char *)realloc(doc->names, (size_t)doc->names_capacity);
+        if (doc->names == NULL)
+        {
+            fprintf(stderr, "[error] symbol_add unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    doc->items[doc->count].name = doc->names_len;
+    doc->items[doc->count].line = t->line;
+    doc->items[doc->count].kind = kind;
+    doc->count++;
+
+    memcpy(doc->names + doc->names_len, lx->data + t->start, (size_t)t->len);
+    doc->names_len += t->len;
+    doc->names[doc->names_len++] = '\0';
+}
+
+static int
+symbol_token_is(symbol_lexer *lx, symbol_token *t, const char *word)
+{
+    return t->kind == SYMBOL_TOKEN_IDENT && strlen(word) == t->len &&
+           memcmp(lx->data + t->start, word, (size_t)t->len) == 0;
+}
+
+/* Lexes the line from `start` with the state the previous one ended in. */
+static void
+symbol_lex_line(symbol_lexer *lx, u64 start)
+{
+    const u8 *end = (const u8 *)memchr(lx->data + start, '\n', (size_t)(lx->len - start));
+    u64 len;
+
+    lx->line_start = start;
+    lx->line_end = end != NULL ? (u64)(end - lx->data) : lx->len;
+    lx->pos = start;
+    len = lx->line_end - start;
+
+    /* an empty first line still needs somewhere to write */
+    if (len > lx->classes_capacity || lx->classes == NULL)
+    {
+        lx->classes_capacity = len > 256 ? len : 256;
+        lx->classes = (u8 *)realloc(lx->classes, (size_t)lx->classes_capacity);
+        if (lx->classes == NULL)
+        {
+            fprintf(stderr, "[error] symbol_lex_line unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    memset(lx->classes, SYNTAX_NORMAL, (size_t)len);
+    lx->state = lx->lang->lex(&lx->r, start, len, lx->state, lx->classes, 0, len);
+}
+
+/* Moves to the next line, 0 at the end of the file. */
+static int
+symbol_next_line(symbol_lexer *lx)
+{
+    if (lx->line_end == lx->len)
+    {
+        return 0;
+    }
+
+    lx->line++;
+    symbol_lex_line(lx, lx->line_end + 1);
+    return 1;
+}
+
+static u8
+symbol_class(symbol_lexer *lx, u64 pos)
+{
+    return lx->classes[pos - lx->line_start];
+}
+
+/*
+ * A directive: #define NAME is a symbol, the rest of it and the lines it
+ * is continued onto are skipped.
+ */
+static void
+symbol_preproc(symbol_lexer *lx, symbol_doc *doc)
+{
+    symbol_token name;
+    u64 word;
+
+    /* the lexer marks the '#' and the directive's name */
+    for (lx->pos++; lx->pos < lx->line_end && !symbol_is_ident(lx->data[lx->pos]); lx->pos++)
+    {
+    }
+    for (word = lx->pos; lx->pos < lx->line_end && symbol_class(lx, lx->pos) == SYNTAX_PREPROC; lx->pos++)
+    {
+    }
+
+    if (lx->pos - word == 6 && memcmp(lx->data + word, "define", 6) == 0)
+    {
+        while (lx->pos < lx->line_end && (lx->data[lx->pos] == ' ' || lx->data[lx->pos] == '\t'))
+        {
+            lx->pos++;
+        }
+
+        name.kind = SYMBOL_TOKEN_IDENT;
+        name.start = lx->pos;
+        name.line = lx->line;
+        while (lx->pos < lx->line_end && symbol_is_ident(lx->data[lx->pos]))
+        {
+            lx->pos++;
+        }
+        name.len = lx->pos - name.start;
+        if (name.len > 0)
+        {
+            symbol_add(doc, lx, &name, SYMBOL_MACRO);
+        }
+    }
+
+    while (lx->line_end > lx->line_start && lx->data[lx->line_end - 1] == '\\' && symbol_next_line(lx))
+    {
+    }
+    lx->pos = lx->line_end;
+}
+
+/* The next token outside comments and directives. */
+static void
+symbol_next(symbol_lexer *lx, symbol_doc *doc, symbol_token *t)
+{
+    for (;;)
+    {
+        u8 c;
+        u8 cls;
+
+        if (lx->pos == lx->line_end)
+        {
+            if (!symbol_next_line(lx))
+            {
+                break;
+            }
+            continue;
+        }
+
+        c = lx->data[lx->pos];
+        cls = symbol_class(lx, lx->pos);
+
+        if (cls == SYNTAX_COMMENT || c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+        {
+            lx->pos++;
+            continue;
+        }
+
+        if (cls == SYNTAX_PREPROC)
+        {
+            symbol_preproc(lx, doc);
+            continue;
+        }
+
+        t->start = lx->pos;
+        t->line = lx->line;
+
+        if (cls == SYNTAX_STRING || cls == SYNTAX_NUMBER)
+        {
+            while (lx->pos < lx->line_end && symbol_class(lx, lx->pos) == cls)
+            {
+                lx->pos++;
+            }
+            t->kind = SYMBOL_TOKEN_OTHER;
+        }
+        else if (symbol_is_ident(c))
+        {
+            while (lx->pos < lx->line_end && symbol_is_ident(lx->data[lx->pos]))
+            {
+                lx->pos++;
+            }
+            t->kind = SYMBOL_TOKEN_IDENT;
+        }
+        else
+        {
+            lx->pos++;
+            t->kind = SYMBOL_TOKEN_PUNCT;
+        }
+
+        t->len = lx->pos - t->start;
+        return;
+    }
+
+    t->kind = SYMBOL_TOKEN_END;
+    t->len = 0;
+}
+
+static void
+symbol_parser_reset(symbol_parser *p)
+{
+    u32 depth = p->depth;
+    u32 enum_depth = p->enum_depth;
+
+    memset(p, 0, sizeof(*p));
+    p->depth = depth;
+    p->enum_depth = enum_depth;
+}
+
+/* One declarator of a top level declaration ends, at a ',' '=' or ';'. */
+static void
+symbol_declarator(symbol_parser *p, symbol_lexer *lx, symbol_doc *doc)
+{
+    if (p->is_typedef)
+    {
+        symbol_add(doc, lx, p->fnptr.kind ? &p->fnptr : &p->last, SYMBOL_TYPEDEF);
+    }
+    else if (!p->is_extern && p->fnptr.kind)
+    {
+        symbol_add(doc, lx, &p->fnptr, SYMBOL_VARIABLE);
+    }
+    else if (!p->is_extern && !p->function.kind)
+    {
+        /* a name followed by ( and ; is a prototype */
+        symbol_add(doc, lx, &p->last, SYMBOL_VARIABLE);
+    }
+
+    p->last.kind = SYMBOL_TOKEN_END;
+    p->function.kind = SYMBOL_TOKEN_END;
+    p->fnptr.kind = SYMBOL_TOKEN_END;
+}
+
+static void
+symbol_ident(symbol_parser *p, symbol_lexer *lx, symbol_doc *doc, symbol_token *t)
+{
+    if (p->depth > 0)
+    {
+        if (p->enum_depth == p->depth && p->enum_expect)
+        {
+            symbol_add(doc, lx, t, SYMBOL_ENUMERATOR);
+            p->enum_expect = 0;
+        }
+        return;
+    }
+
+    if (p->paren > 0)
+    {
+        if (p->fnptr_pending)
+        {
+            p->fnptr = *t;
+            p->fnptr_pending = 0;
+        }
+        return;
+    }
+
+    if (p->in_init)
+    {
+        return;
+    }
+
+    if (symbol_token_is(lx, t, "typedef"))
+    {
+        p->is_typedef = 1;
+    }
+    else if (symbol_token_is(lx, t, "extern"))
+    {
+        p->is_extern = 1;
+    }
+    else if (symbol_token_is(lx, t, "struct") || symbol_token_is(lx, t, "union") ||
+             symbol_token_is(lx, t, "enum"))
+    {
+        p->aggregate = symbol_token_is(lx, t, "struct") ? SYMBOL_STRUCT :
+                       symbol_token_is(lx, t, "union") ? SYMBOL_UNION : SYMBOL_ENUM;
+        p->expect_aggregate_name = 1;
+        p->aggregate_name.kind = SYMBOL_TOKEN_END;
+    }
+    else if (p->expect_aggregate_name)
+    {
+        p->aggregate_name = *t;
+        p->expect_aggregate_name = 0;
+    }
+    else
+    {
+        p->last = *t;
+    }
+}
+
+static void
+symbol_punct(symbol_parser *p, symbol_lexer *lx, symbol_doc *doc, symbol_token *t,
+             symbol_token *prev)
+{
+    u8 c = lx->data[t->start];
+
+    if (c == '{')
+    {
+        if (p->depth == 0 && p->paren == 0 && !p->in_init)
+        {
+            p->expect_aggregate_name = 0;
+            if (p->function.kind && !p->is_typedef)
+            {
+                symbol_add(doc, lx, &p->function, SYMBOL_FUNCTION);
+                p->function_body = 1;
+            }
+            else if (p->aggregate)
+            {
+                symbol_add(doc, lx, &p->aggregate_name, p->aggregate);
+                if (p->aggregate == SYMBOL_ENUM)
+                {
+                    p->enum_depth = 1;
+                    p->enum_expect = 1;
+                }
+            }
+        }
+        p->depth++;
+        return;
+    }
+
+    if (c == '}')
+    {
+        if (p->depth > 0)
+        {
+            p->depth--;
+        }
+        if (p->enum_depth > p->depth)
+        {
+            p->enum_depth = 0;
+        }
+        if (p->depth == 0)
+        {
+            if (p->function_body)
+            {
+                symbol_parser_reset(p);
+            }
+            p->aggregate = 0;
+        }
+        return;
+    }
+
+    if (c == ',' && p->enum_depth != 0 && p->depth == p->enum_depth)
+    {
+        p->enum_expect = 1;
+        return;
+    }
+
+    if (p->depth > 0)
+    {
+        return;
+    }
+
+    switch (c) {
+    case '(':
+        if (p->paren == 0 && prev->kind == SYMBOL_TOKEN_IDENT && !p->function.kind && !p->in_init)
+        {
+            p->function = p->last;
+        }
+        /* fallthrough */
+    case '[':
+        p->paren++;
+        break;
+    case ')':
+    case ']':
+        p->paren -= p->paren > 0;
+        break;
+    case '*':
+        if (p->paren == 1 && prev->kind == SYMBOL_TOKEN_PUNCT && lx->data[prev->start] == '(')
+        {
+            p->fnptr_pending = 1;
+        }
+        break;
+    case ',':
+        if (p->paren == 0)
+        {
+            if (!p->in_init)
+            {
+                symbol_declarator(p, lx, doc);
+            }
+            p->in_init = 0;
+        }
+        break;
+    case '=':
+        if (p->paren == 0 && !p->in_init)
+        {
+            symbol_declarator(p, lx, doc);
+            p->in_init = 1;
+        }
+        break;
+    case ';':
+        if (p->paren == 0)
+        {
+            if (!p->in_init)
+            {
+                symbol_declarator(p, lx, doc);
+            }
+            symbol_parser_reset(p);
+        }
+        break;
+    }
+}
+
+/*
+ * Finds the top level declarations of a C-like file: functions with a
+ * body, macros, tags of structs, unions and enums, enumerators, typedefs
+ * and variables. Prototypes and extern declarations are left out, as
+ * ctags does by default.
+ */
+void
+symbol_scan(symbol_doc *doc, const syntax_language *lang, const u8 *data, u64 len)
+{
+    symbol_lexer lx;
+    symbol_parser p;
+    symbol_token t;
+    symbol_token prev;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    memset(&lx, 0, sizeof(lx));
+    memset(&p, 0, sizeof(p));
+    memset(&prev, 0, sizeof(prev));
+    lx.lang = lang;
+    lx.data = data;
+    lx.len = len;
+    lx.line = 1;
+    buffer_init_text(&lx.b, (string){.s = (u8 *)data, .len = len});
+    buffer_reader_init(&lx.r, &lx.b);
+    symbol_lex_line(&lx, 0);
+
+    for (symbol_next(&lx, doc, &t); t.kind != SYMBOL_TOKEN_END; symbol_next(&lx, doc, &t))
+    {
+        if (t.kind == SYMBOL_TOKEN_IDENT)
+        {
+            symbol_ident(&p, &lx, doc, &t);
+        }
+        else if (t.kind == SYMBOL_TOKEN_PUNCT)
+        {
+            symbol_punct(&p, &lx, doc, &t, &prev);
+        }
+        prev = t;
+    }
+
+    free(lx.classes);
+    buffer_free(&lx.b);
+}
+
+void
+symbol_doc_free(symbol_doc *doc)
+{
+    free(doc->path);
+    free(doc->names);
+    free(doc->items);
+    memset(doc, 0, sizeof(*doc));
+}
+
+static const syntax_language *
+symbol_language(const char *path)
+{
+    return syntax_language_for((string){.s = (u8 *)path, .len = strlen(path)});
+}
+
+static void
+symbol_read_doc(const char *path, const syntax_language *lang, symbol_doc *doc)
+{
+    struct stat st;
+    u8 *data;
+    int fd;
+
+    memset(doc, 0, sizeof(*doc));
+    doc->path = copy_cstr(path, strlen(path));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        doc->removed = 1;
+        return;
+    }
+
+    doc->mtime = (s64)st.st_mtime;
+    if (st.st_size == 0 || st.st_size > SYMBOL_MAX_FILE)
+    {
+        close(fd);
+        return;
+    }
+
+    data = (u8 *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return;
+    }
+
+    symbol_scan(doc, lang, data, (u64)st.st_size);
+    munmap(data, (size_t)st.st_size);
+}
+
+
+static const char *
+symbol_string(symbol_index *si, u64 offset)
+{
+    return (const char *)si->map + si->header->strings + offset;
+}
+
+static void
+symbol_unmap(symbol_index *si)
+{
+    if (si->map != NULL)
+    {
+        munmap(si->map, (size_t)si->map_len);
+    }
+
+    free(si->stale);
+    si->map = NULL;
+    si->map_len = 0;
+    si->header = NULL;
+    si->files = NULL;
+    si->symbols = NULL;
+    si->stale = NULL;
+    si->loaded = 0;
+}
+
+static int
+symbol_map(symbol_index *si)
+{
+    symbol_header *h;
+
+    si->map = file_map(si->path, SYMBOL_MAGIC, sizeof(symbol_header), &si->map_len);
+    if (si->map == NULL)
+    {
+        return 0;
+    }
+
+    h = (symbol_header *)si->map;
+    if (h->size != si->map_len || h->files + h->file_count * sizeof(symbol_file) > h->size ||
+        h->symbols + h->symbol_count * sizeof(symbol_entry) > h->size)
+    {
+        symbol_unmap(si);
+        return 0;
+    }
+
+    si->header = h;
+    si->files = (symbol_file *)(si->map + h->files);
+    si->symbols = (symbol_entry *)(si->map + h->symbols);
+    si->stale = (u8 *)calloc((size_t)h->file_count + 1, 1);
+    if (si->stale == NULL)
+    {
+        fprintf(stderr, "[error] symbol_map unable to calloc\n");
+        exit(1);
+    }
+    si->loaded = 1;
+    return 1;
+}
+
+/* Finds `path` in the mapped file table, which is sorted by path. */
+static int
+symbol_find_file(symbol_index *si, const char *path, u64 *id)
+{
+    u64 lo = 0;
+    u64 hi;
+
+    if (!si->loaded)
+    {
+        return 0;
+    }
+
+    hi = si->header->file_count;
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+        int c = strcmp(symbol_string(si, si->files[mid].path), path);
+
+        if (c == 0)
+        {
+            *id = mid;
+            return 1;
+        }
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return 0;
+}
+
+/* Takes ownership of `doc` and hides the mapped copy of its file. */
+static void
+symbol_put_doc(symbol_index *si, symbol_doc *doc)
+{
+    u64 id;
+    u64 i;
+
+    if (symbol_find_file(si, doc->path, &id))
+    {
+        si->stale[id] = 1;
+    }
+
+    for (i = 0; i < si->doc_count; i++)
+    {
+        if (strcmp(si->docs[i].path, doc->path) == 0)
+        {
+            symbol_doc_free(&si->docs[i]);
+            si->docs[i] = *doc;
+            return;
+        }
+    }
+
+    if (si->doc_count == si->doc_capacity)
+    {
+        si->doc_capacity = si->doc_capacity ? si->doc_capacity * 2 : 64;
+        si->docs = (symbol_doc *)realloc(si->docs, sizeof(symbol_doc) * si->doc_capacity);
+        if (si->docs == NULL)
+        {
+            fprintf(stderr, "[error] symbol_put_doc unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    si->docs[si->doc_count++] = *doc;
+}
+
+static void
+symbol_free_docs(symbol_index *si)
+{
+    u64 i;
+
+    for (i = 0; i < si->doc_count; i++)
+    {
+        symbol_doc_free(&si->docs[i]);
+    }
+    si->doc_count = 0;
+}
+
+/* Maps the index at `path` if there is one, 0 otherwise. */
+int
+symbol_index_open(symbol_index *si, const char *path)
+{
+    memset(si, 0, sizeof(*si));
+    si->path = copy_cstr(path, strlen(path));
+
+    return symbol_map(si);
+}
+
+static int
+symbol_compare_out(const void *a, const void *b)
+{
+    const symbol_out *x = (const symbol_out *)a;
+    const symbol_out *y = (const symbol_out *)b;
+    int c = strcmp(x->name, y->name);
+
+    if (c == 0)
+    {
+        c = strcmp(x->path, y->path);
+    }
+    if (c == 0)
+    {
+        c = x->line < y->line ? -1 : x->line > y->line;
+    }
+
+    return c;
+}
+
+static int
+symbol_compare_out_file(const void *a, const void *b)
+{
+    return strcmp(((const symbol_out_file *)a)->path, ((const symbol_out_file *)b)->path);
+}
+
+static u32
+symbol_file_id(symbol_out_file *files, u64 count, const char *path)
+{
+    u64 lo = 0;
+    u64 hi = count;
+
+    while (lo + 1 < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (strcmp(files[mid].path, path) <= 0)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return (u32)lo;
+}
+
+/*
+ * Writes the symbols of the docs and those of the mapped index from files
+ * not stale over the index, then maps it and lets the docs go.
+ */
+int
+symbol_index_write(symbol_index *si)
+{
+    symbol_doc *docs = si->docs;
+    u64 doc_count = si->doc_count;
+    symbol_header header;
+    symbol_out *out;
+    symbol_out_file *files;
+    u64 out_count = 0;
+    u64 file_count = 0;
+    file_image image = {0};
+    u64 capacity = 0;
+    u64 offset = 0;
+    u64 i;
+    u64 j;
+    u64 file_capacity = doc_count;
+    int ok;
+
+    for (i = 0; i < doc_count; i++)
+    {
+        capacity += docs[i].count;
+    }
+
+    if (si->loaded)
+    {
+        capacity += si->header->symbol_count;
+        file_capacity += si->header->file_count;
+    }
+
+    out = (symbol_out *)malloc(sizeof(symbol_out) * (size_t)(capacity + 1));
+    files = (symbol_out_file *)malloc(sizeof(symbol_out_file) * (size_t)(file_capacity + 1));
+    if (out == NULL || files == NULL)
+    {
+        fprintf(stderr, "[error] symbol_index_write unable to malloc\n");
+        exit(1);
+    }
+
+    if (si->loaded)
+    {
+        for (i = 0; i < si->header->symbol_count; i++)
+        {
+            symbol_entry *e = &si->symbols[i];
+
+            if (!si->stale[e->file])
+            {
+                out[out_count].name = symbol_string(si, e->name);
+                out[out_count].path = symbol_string(si, si->files[e->file].path);
+                out[out_count].mtime = si->files[e->file].mtime;
+                out[out_count].line = e->line;
+                out[out_count].kind = e->kind;
+                out_count++;
+            }
+        }
+    }
+
+    for (i = 0; i < doc_count; i++)
+    {
+        for (j = 0; j < docs[i].count && !docs[i].removed; j++)
+        {
+            out[out_count].name = docs[i].names + docs[i].items[j].name;
+            out[out_count].path = docs[i].path;
+            out[out_count].mtime = docs[i].mtime;
+            out[out_count].line = docs[i].items[j].line;
+            out[out_count].kind = docs[i].items[j].kind;
+            out_count++;
+        }
+    }
+
+    qsort(out, (size_t)out_count, sizeof(symbol_out), symbol_compare_out);
+
+    /* every file read is listed, symbols or not, so a refresh knows it has seen it */
+    for (i = 0; si->loaded && i < si->header->file_count; i++)
+    {
+        if (!si->stale[i])
+        {
+            files[file_count].path = symbol_string(si, si->files[i].path);
+            files[file_count].mtime = si->files[i].mtime;
+            file_count++;
+        }
+    }
+    for (i = 0; i < doc_count; i++)
+    {
+        if (!docs[i].removed)
+        {
+            files[file_count].path = docs[i].path;
+            files[file_count].mtime = docs[i].mtime;
+            file_count++;
+        }
+    }
+    qsort(files, (size_t)file_count, sizeof(symbol_out_file), symbol_compare_out_file);
+    for (i = 0, j = 0; i < file_count; i++)
+    {
+        if (j == 0 || strcmp(files[j - 1].path, files[i].path) != 0)
+        {
+            files[j++] = files[i];
+        }
+    }
+    file_count = j;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMBOL_MAGIC, 8);
+    header.symbol_count = out_count;
+    header.file_count = file_count;
+    file_image_push(&image, &header, sizeof(header));
+
+    header.strings = image.len;
+    for (i = 0; i < file_count; i++)
+    {
+        u64 len = strlen(files[i].path) + 1;
+
+        file_image_push(&image, files[i].path, len);
+        files[i].offset = offset;
+        offset += len;
+    }
+    for (i = 0; i < out_count; i++)
+    {
+        file_image_push(&image, out[i].name, strlen(out[i].name) + 1);
+    }
+    file_image_align(&image);
+
+    header.files = image.len;
+    for (i = 0; i < file_count; i++)
+    {
+        symbol_file file;
+
+        file.path = files[i].offset;
+        file.mtime = files[i].mtime;
+        file_image_push(&image, &file, sizeof(file));
+    }
+
+    header.symbols = image.len;
+    for (i = 0; i < out_count; i++)
+    {
+        symbol_entry entry;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.name = offset;
+        entry.file = symbol_file_id(files, file_count, out[i].path);
+        entry.line = out[i].line;
+        entry.kind = out[i].kind;
+        offset += strlen(out[i].name) + 1;
+        file_image_push(&image, &entry, sizeof(entry));
+    }
+    header.size = image.len;
+    memcpy(image.s, &header, sizeof(header));
+
+    ok = file_write_atomic(si->path, image.s, image.len);
+
+    free(image.s);
+    free(out);
+    free(files);
+
+    if (!ok)
+    {
+        return 0;
+    }
+
+    symbol_free_docs(si);
+    symbol_unmap(si);
+    return symbol_map(si);
+}
+
+/* Each worker takes the next free doc; indexed files whose mtime has not moved are skipped. */
+static void
+symbol_on_file(void *ctx, u64 worker, const char *path)
+{
+    symbol_index *si = (symbol_index *)ctx;
+    struct stat st;
+    u64 id;
+
+    if (symbol_find_file(si, path, &id) && stat(path, &st) == 0 && (s64)st.st_mtime == si->files[id].mtime)
+    {
+        return;
+    }
+
+    symbol_read_doc(path, symbol_language(path), &si->scanned[__sync_fetch_and_add(&si->scanned_count, 1)]);
+}
+
+static int
+symbol_compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Indexes the C-like files among `paths` from scratch and writes the index to `path`. */
+int
+symbol_index_build(symbol_index *si, const char *path, char **paths, u64 count)
+{
+    if (si->path == NULL)
+    {
+        symbol_index_open(si, path);
+    }
+
+    /* nothing of the old index survives a build */
+    symbol_free_docs(si);
+    symbol_unmap(si);
+    return symbol_index_refresh(si, paths, count);
+}
+
+/*
+ * Scans one file again, e.g. after the editor saved it. The index is only
+ * written again once too many files wait in memory.
+ */
+void
+symbol_index_update(symbol_index *si, const char *path)
+{
+    const syntax_language *lang = symbol_language(path);
+    symbol_doc doc;
+
+    if (si->path == NULL || lang == NULL)
+    {
+        return;
+    }
+
+    if (si->scanning)
+    {
+        if (si->pending_count == si->pending_capacity)
+        {
+            si->pending_capacity = si->pending_capacity ? si->pending_capacity * 2 : 16;
+            si->pending = (char **)realloc(si->pending, sizeof(char *) * si->pending_capacity);
+            if (si->pending == NULL)
+            {
+                fprintf(stderr, "[error] symbol_index_update unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        si->pending[si->pending_count++] = copy_cstr(path, strlen(path));
+        return;
+    }
+
+    symbol_read_doc(path, lang, &doc);
+    symbol_put_doc(si, &doc);
+
+    if (si->doc_count > SYMBOL_MAX_DOCS)
+    {
+        symbol_index_write(si);
+    }
+}
+
+/*
+ * Starts bringing the index in line with `paths`, every file there is now:
+ * on the walk pool the C-like files it has not read or whose mtime moved
+ * are scanned, and the indexed files no longer among them are dropped.
+ */
+void
+symbol_index_start(symbol_index *si, char **paths, u64 count)
+{
+    char **sources;
+    symbol_doc doc;
+    u64 source_count = 0;
+    u64 file_count = si->loaded ? si->header->file_count : 0;
+    u64 i;
+
+    sources = (char **)malloc(sizeof(char *) * (size_t)(count + 1));
+    si->scanned = (symbol_doc *)calloc((size_t)count + 1, sizeof(symbol_doc));
+    if (sources == NULL || si->scanned == NULL)
+    {
+        fprintf(stderr, "[error] symbol_index_start unable to malloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (symbol_language(paths[i]) != NULL)
+        {
+            sources[source_count++] = paths[i];
+        }
+    }
+    qsort(sources, (size_t)source_count, sizeof(char *), symbol_compare_paths);
+
+    for (i = 0; i < file_count; i++)
+    {
+        const char *path = symbol_string(si, si->files[i].path);
+
+        if (bsearch(&path, sources, (size_t)source_count, sizeof(char *), symbol_compare_paths) == NULL)
+        {
+            memset(&doc, 0, sizeof(doc));
+            doc.path = copy_cstr(path, strlen(path));
+            doc.removed = 1;
+            symbol_put_doc(si, &doc);
+        }
+    }
+
+    /* the walk frees its paths */
+    for (i = 0; i < source_count; i++)
+    {
+        sources[i] = copy_cstr(sources[i], strlen(sources[i]));
+    }
+
+    si->scanned_count = 0;
+    si->scanning = 1;
+    walk_start_files(&si->scan, sources, source_count, walk_worker_count(), symbol_on_file, si);
+}
+
+int
+symbol_index_scanning(symbol_index *si)
+{
+    return si->scanning && walk_running(&si->scan);
+}
+
+/* Joins the scan and writes the index if anything changed, 1 if it was written. */
+int
+symbol_index_finish(symbol_index *si)
+{
+    u64 i;
+
+    if (!si->scanning)
+    {
+        return 0;
+    }
+
+    walk_wait(&si->scan);
+    walk_free(&si->scan);
+    si->scanning = 0;
+
+    for (i = 0; i < si->scanned_count; i++)
+    {
+        symbol_put_doc(si, &si->scanned[i]);
+    }
+    free(si->scanned);
+    si->scanned = NULL;
+    si->scanned_count = 0;
+
+    for (i = 0; i < si->pending_count; i++)
+    {
+        symbol_index_update(si, si->pending[i]);
+        free(si->pending[i]);
+    }
+    si->pending_count = 0;
+
+    /* an empty index is still written, so the next start opens it */
+    if (si->doc_count > 0 || !si->loaded)
+    {
+        return symbol_index_write(si);
+    }
+
+    return 0;
+}
+
+/* symbol_index_start, waiting for it. 1 if the index was written again. */
+int
+symbol_index_refresh(symbol_index *si, char **paths, u64 count)
+{
+    if (si->path == NULL)
+    {
+        return 0;
+    }
+
+    symbol_index_start(si, paths, count);
+    return symbol_index_finish(si);
+}
+
+/*
+ * The definitions of `name`, at most `max` of them: a binary search of the
+ * mapped index, then the files scanned since.
+ */
+u64
+symbol_index_find(symbol_index *si, string name, symbol_match *out, u64 max)
+{
+    char key[256];
+    u64 lo = 0;
+    u64 hi;
+    u64 count = 0;
+    u64 i;
+    u64 j;
+
+    if (!si->loaded || name.len == 0 || name.len >= sizeof(key))
+    {
+        return 0;
+    }
+
+    memcpy(key, name.s, (size_t)name.len);
+    key[name.len] = '\0';
+
+    hi = si->header->symbol_count;
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (strcmp(symbol_string(si, si->symbols[mid].name), key) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (; lo < si->header->symbol_count && count < max &&
+           strcmp(symbol_string(si, si->symbols[lo].name), key) == 0; lo++)
+    {
+        if (si->stale[si->symbols[lo].file])
+        {
+            continue;
+        }
+
+        out[count].path = symbol_string(si, si->files[si->symbols[lo].file].path);
+        out[count].line = si->symbols[lo].line;
+        out[count].kind = si->symbols[lo].kind;
+        count++;
+    }
+
+    for (i = 0; i < si->doc_count; i++)
+    {
+        symbol_doc *doc = &si->docs[i];
+
+        for (j = 0; j < doc->count && count < max; j++)
+        {
+            if (strcmp(doc->names + doc->items[j].name, key) == 0)
+            {
+                out[count].path = doc->path;
+                out[count].line = doc->items[j].line;
+                out[count].kind = doc->items[j].kind;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void
+symbol_index_free(symbol_index *si)
+{
+    u64 i;
+
+    if (si->scanning)
+    {
+        walk_wait(&si->scan);
+        walk_free(&si->scan);
+        for (i = 0; i < si->scanned_count; i++)
+        {
+            symbol_doc_free(&si->scanned[i]);
+        }
+        free(si->scanned);
+    }
+
+    for (i = 0; i < si->pending_count; i++)
+    {
+        free(si->pending[i]);
+    }
+    free(si->pending);
+
+    symbol_free_docs(si);
+    free(si->docs);
+    symbol_unmap(si);
+    free(si->path);
+    memset(si, 0, sizeof(*si));
+}
@@ -0,0 +1,129 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "base.h"
+#include "syntax.h"
+#include "walk.h"
+
+#define SYMBOL_INDEX_FILE ".editor-tags"
+#define SYMBOL_MAGIC "EDTAGS01"
+/* files scanned again in memory before the mapped index is rewritten */
+#define SYMBOL_MAX_DOCS 1024
+/* larger files are not scanned */
+#define SYMBOL_MAX_FILE MB(16)
+
+/* kinds, as ctags names them */
+#define SYMBOL_FUNCTION   'f'
+#define SYMBOL_MACRO      'd'
+#define SYMBOL_STRUCT     's'
+#define SYMBOL_UNION      'u'
+#define SYMBOL_ENUM       'g'
+#define SYMBOL_ENUMERATOR 'e'
+#define SYMBOL_TYPEDEF    't'
+#define SYMBOL_VARIABLE   'v'
+
+/*
+ * The index file is a header, the NUL terminated paths and names, the
+ * file table sorted by path and the symbol table sorted by name, then
+ * file and line, so a lookup is a binary search of the mapped file.
+ */
+typedef struct
+{
+    u8 magic[8];
+    u64 symbol_count;
+    u64 file_count;
+    u64 strings;
+    u64 files;
+    u64 symbols;
+    u64 size;
+} symbol_header;
+
+typedef struct
+{
+    u64 path;
+    s64 mtime;
+} symbol_file;
+
+typedef struct
+{
+    u64 name;
+    u32 file;
+    u32 line;
+    u8 kind;
+    u8 pad[7];
+} symbol_entry;
+
+typedef struct
+{
+    /* offset in `names` */
+    u64 name;
+    u32 line;
+    u8 kind;
+} symbol_item;
+
+/* The declarations found in one file. */
+typedef struct
+{
+    char *path;
+    s64 mtime;
+    char *names;
+    u64 names_len;
+    u64 names_capacity;
+    symbol_item *items;
+    u64 count;
+    u64 capacity;
+    u8 removed;
+} symbol_doc;
+
+/*
+ * The mapped index never changes; files scanned since are marked `stale`
+ * in it and live in `docs` until the next write merges the two.
+ */
+typedef struct
+{
+    char *path;
+    u8 *map;
+    u64 map_len;
+    symbol_header *header;
+    symbol_file *files;
+    symbol_entry *symbols;
+    u8 *stale;
+
+    symbol_doc *docs;
+    u64 doc_count;
+    u64 doc_capacity;
+
+    /* a scan on the walk pool, its docs join `docs` when it is over */
+    walk scan;
+    symbol_doc *scanned;
+    volatile u64 scanned_count;
+    /* saved while it ran, read again after it so they win */
+    char **pending;
+    u64 pending_count;
+    u64 pending_capacity;
+    u8 scanning;
+
+    u8 loaded;
+} symbol_index;
+
+typedef struct
+{
+    const char *path;
+    u64 line;
+    u8 kind;
+} symbol_match;
+
+void symbol_scan(symbol_doc *doc, const syntax_language *lang, const u8 *data, u64 len);
+void symbol_doc_free(symbol_doc *doc);
+int symbol_index_open(symbol_index *si, const char *path);
+int symbol_index_build(symbol_index *si, const char *path, char **paths, u64 count);
+int symbol_index_write(symbol_index *si);
+void symbol_index_update(symbol_index *si, const char *path);
+void symbol_index_start(symbol_index *si, char **paths, u64 count);
+int symbol_index_scanning(symbol_index *si);
+int symbol_index_finish(symbol_index *si);
+int symbol_index_refresh(symbol_index *si, char **paths, u64 count);
+u64 symbol_index_find(symbol_index *si, string name, symbol_match *out, u64 max);
+void symbol_index_free(symbol_index *si);
+
+#endif
@@ -0,0 +1,454 @@
+#include "syntax.h"
+#include "base.h"
+
+/* C lexer states besides the start of a line outside anything */
+#define SYNTAX_C_COMMENT 1
+#define SYNTAX_C_STRING  2
+
+static const char *syntax_c_keywords[] = {
+    "break", "case", "continue", "default", "do", "else", "for", "goto", "if", "return",
+    "sizeof", "switch", "while", "NULL",
+};
+
+static const char *syntax_c_types[] = {
+    "auto", "char", "const", "double", "enum", "extern", "float", "inline", "int", "long",
+    "register", "restrict", "short", "signed", "static", "struct", "typedef", "union",
+    "unsigned", "void", "volatile", "_Bool", "size_t", "ssize_t", "int8_t", "int16_t", "int32_t",
+    "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t", "uintptr_t", "intptr_t",
+};
+
+static const char *syntax_c_extensions[] = {
+    ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL,
+};
+
+static int
+syntax_is_ident(u8 c)
+{
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+static void
+syntax_mark(u8 *classes, u64 from, u64 count, u64 start, u64 end, u8 cls)
+{
+    u64 i;
+
+    if (classes == NULL)
+    {
+        return;
+    }
+
+    start = start > from ? start : from;
+    end = end < from + count ? end : from + count;
+    for (i = start; i < end; i++)
+    {
+        classes[i - from] = cls;
+    }
+}
+
+static u8
+syntax_c_word_class(u8 *word, u64 len)
+{
+    u64 i;
+
+    for (i = 0; i < sizeof(syntax_c_keywords) / sizeof(syntax_c_keywords[0]); i++)
+    {
+        if (strlen(syntax_c_keywords[i]) == len && memcmp(syntax_c_keywords[i], word, (size_t)len) == 0)
+        {
+            return SYNTAX_KEYWORD;
+        }
+    }
+
+    for (i = 0; i < sizeof(syntax_c_types) / sizeof(syntax_c_types[0]); i++)
+    {
+        if (strlen(syntax_c_types[i]) == len && memcmp(syntax_c_types[i], word, (size_t)len) == 0)
+        {
+            return SYNTAX_TYPE;
+        }
+    }
+
+    return SYNTAX_NORMAL;
+}
+
+/* Index just past the end of a block comment from `i`, or `len` with `*closed` unset. */
+static u64
+syntax_c_comment_end(buffer_reader *r, u64 start, u64 len, u64 i, int *closed)
+{
+    for (; i + 1 < len; i++)
+    {
+        if (buffer_reader_byte(r, start + i) == '*' && buffer_reader_byte(r, start + i + 1) == '/')
+        {
+            *closed = 1;
+            return i + 2;
+        }
+    }
+
+    *closed = 0;
+    return len;
+}
+
+/*
+ * Index just past the `quote` closing a literal from `i`, or `len` with
+ * `*closed` unset. `*continued` is set when the line ends in a backslash.
+ */
+static u64
+syntax_c_string_end(buffer_reader *r, u64 start, u64 len, u64 i, u8 quote, int *closed,
+                    int *continued)
+{
+    *closed = 0;
+    *continued = 0;
+
+    for (; i < len; i++)
+    {
+        u8 c = buffer_reader_byte(r, start + i);
+
+        if (c == '\\')
+        {
+            if (++i == len)
+            {
+                *continued = 1;
+            }
+        }
+        else if (c == quote)
+        {
+            *closed = 1;
+            return i + 1;
+        }
+    }
+
+    return len;
+}
+
+static syntax_state
+syntax_lex_c(buffer_reader *r, u64 start, u64 len, syntax_state state, u8 *classes, u64 from,
+             u64 count)
+{
+    int first_token = 1;
+    int closed;
+    int continued;
+    u64 i = 0;
+    u64 j;
+
+    if (state == SYNTAX_C_COMMENT)
+    {
+        i = syntax_c_comment_end(r, start, len, 0, &closed);
+        syntax_mark(classes, from, count, 0, i, SYNTAX_COMMENT);
+        if (!closed)
+        {
+            return SYNTAX_C_COMMENT;
+        }
+    }
+    else if (state == SYNTAX_C_STRING)
+    {
+        i = syntax_c_string_end(r, start, len, 0, '"', &closed, &continued);
+        syntax_mark(classes, from, count, 0, i, SYNTAX_STRING);
+        if (!closed)
+        {
+            return continued ? SYNTAX_C_STRING : 0;
+        }
+    }
+
+    while (i < len)
+    {
+        u8 c = buffer_reader_byte(r, start + i);
+        u8 next = i + 1 < len ? buffer_reader_byte(r, start + i + 1) : 0;
+
+        if (c == ' ' || c == '\t')
+        {
+            i++;
+            continue;
+        }
+
+        if (c == '/' && next == '/')
+        {
+            syntax_mark(classes, from, count, i, len, SYNTAX_COMMENT);
+            return 0;
+        }
+
+        if (c == '/' && next == '*')
+        {
+            j = syntax_c_comment_end(r, start, len, i + 2, &closed);
+            syntax_mark(classes, from, count, i, j, SYNTAX_COMMENT);
+            if (!closed)
+            {
+                return SYNTAX_C_COMMENT;
+            }
+        }
+        else if (c == '"' || c == '\'')
+        {
+            j = syntax_c_string_end(r, start, len, i + 1, c, &closed, &continued);
+            syntax_mark(classes, from, count, i, j, SYNTAX_STRING);
+            if (!closed)
+            {
+                return c == '"' && continued ? SYNTAX_C_STRING : 0;
+            }
+        }
+        else if (c == '#' && first_token)
+        {
+            u8 word[8];
+            u64 word_len = 0;
+
+            for (j = i + 1; j < len && (buffer_reader_byte(r, start + j) == ' ' ||
+                                        buffer_reader_byte(r, start + j) == '\t'); j++)
+            {
+            }
+            for (; j < len && syntax_is_ident(buffer_reader_byte(r, start + j)); j++)
+            {
+                if (word_len < sizeof(word))
+                {
+                    word[word_len++] = buffer_reader_byte(r, start + j);
+                }
+            }
+            syntax_mark(classes, from, count, i, j, SYNTAX_PREPROC);
+
+            /* #include <file> reads as a string */
+            if (word_len == 7 && memcmp(word, "include", 7) == 0)
+            {
+                for (i = j; i < len && buffer_reader_byte(r, start + i) != '<'; i++)
+                {
+                }
+                for (j = i; j < len && buffer_reader_byte(r, start + j) != '>'; j++)
+                {
+                }
+                if (j < len)
+                {
+                    syntax_mark(classes, from, count, i, ++j, SYNTAX_STRING);
+                }
+            }
+        }
+        else if ((c >= '0' && c <= '9') || (c == '.' && next >= '0' && next <= '9'))
+        {
+            for (j = i + 1; j < len; j++)
+            {
+                u8 d = buffer_reader_byte(r, start + j);
+                u8 prev = buffer_reader_byte(r, start + j - 1);
+                u8 exponent = prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P';
+
+                if (!syntax_is_ident(d) && d != '.' && !((d == '+' || d == '-') && exponent))
+                {
+                    break;
+                }
+            }
+            syntax_mark(classes, from, count, i, j, SYNTAX_NUMBER);
+        }
+        else if (syntax_is_ident(c))
+        {
+            u8 word[16];
+            u64 word_len = 0;
+
+            for (j = i; j < len && syntax_is_ident(buffer_reader_byte(r, start + j)); j++)
+            {
+                if (word_len < sizeof(word))
+                {
+                    word[word_len++] = buffer_reader_byte(r, start + j);
+                }
+            }
+
+            if (j - i <= sizeof(word))
+            {
+                syntax_mark(classes, from, count, i, j, syntax_c_word_class(word, word_len));
+            }
+        }
+        else
+        {
+            j = i + 1;
+        }
+
+        first_token = 0;
+        i = j;
+    }
+
+    return 0;
+}
+
+static const syntax_language syntax_languages[] = {
+    {"c", syntax_c_extensions, syntax_lex_c},
+};
+
+const syntax_language *
+syntax_language_for(string path)
+{
+    u64 i;
+
+    for (i = 0; i < sizeof(syntax_languages) / sizeof(syntax_languages[0]); i++)
+    {
+        const char **ext;
+
+        for (ext = syntax_languages[i].extensions; *ext != NULL; ext++)
+        {
+            u64 n = strlen(*ext);
+
+            if (path.len > n && memcmp(path.s + path.len - n, *ext, (size_t)n) == 0)
+            {
+                return &syntax_languages[i];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void
+syntax_reserve(syntax_index *si, u64 count)
+{
+    if (count <= si->capacity)
+    {
+        return;
+    }
+
+    si->capacity = si->capacity ? si->capacity : 1024;
+    while (si->capacity < count)
+    {
+        si->capacity *= 2;
+    }
+
+    si->states = (syntax_state *)realloc(si->states, (size_t)si->capacity);
+    if (si->states == NULL)
+    {
+        fprintf(stderr, "[error] syntax_reserve unable to realloc\n");
+        exit(1);
+    }
+}
+
+/*
+ * A single edit of lines [first, old_last] into [first, new_last] moves
+ * the states after it along and leaves them to be checked. The states of
+ * a batch are dropped from its first line on, since the newlines each of
+ * its changes removed are not known.
+ */
+static void
+syntax_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    syntax_index *si = (syntax_index *)ctx;
+    u64 old_count = si->count;
+    u64 old_valid = si->valid;
+    u64 first;
+    u64 new_last;
+    u64 old_last;
+    u64 col;
+
+    buffer_offset_to_line_col(b, changes[0].offset, &first, &col);
+    syntax_reserve(si, b->lines.count);
+    si->count = b->lines.count;
+
+    if (si->valid > first + 1)
+    {
+        si->valid = first + 1;
+    }
+
+    if (count != 1)
+    {
+        si->resume = si->valid;
+        si->known = si->valid;
+        return;
+    }
+
+    buffer_offset_to_line_col(b, changes[0].offset + changes[0].new_len, &new_last, &col);
+    old_last = new_last + old_count - si->count;
+
+    memmove(si->states + new_last + 1, si->states + old_last + 1, (size_t)(old_count - old_last - 1));
+
+    /* states that were right after the edit are again once the first of them is */
+    if (old_valid > old_last + 1)
+    {
+        si->resume = new_last + 1;
+        si->known = old_valid - old_last + new_last;
+        return;
+    }
+
+    si->resume = si->resume > old_last ? si->resume - old_last + new_last : new_last + 1;
+    si->known = si->known > old_last ? si->known - old_last + new_last : si->resume;
+    if (si->known < si->resume)
+    {
+        si->known = si->resume;
+    }
+}
+
+void
+syntax_index_init(syntax_index *si, buffer *b)
+{
+    memset(si, 0, sizeof(*si));
+    si->b = b;
+    si->lang = syntax_language_for(b->file_path);
+
+    if (si->lang == NULL)
+    {
+        return;
+    }
+
+    syntax_reserve(si, b->lines.count);
+    si->count = b->lines.count;
+    si->states[0] = 0;
+    si->valid = 1;
+    si->resume = 1;
+    si->known = 1;
+    buffer_add_listener(b, syntax_on_change, si);
+}
+
+void
+syntax_index_free(syntax_index *si)
+{
+    if (si->lang != NULL)
+    {
+        buffer_remove_listener(si->b, syntax_on_change, si);
+    }
+    free(si->states);
+    memset(si, 0, sizeof(*si));
+}
+
+syntax_state
+syntax_lex_line(syntax_index *si, u64 line, syntax_state state, u8 *classes, u64 from, u64 count)
+{
+    buffer_reader r;
+
+    if (classes != NULL)
+    {
+        memset(classes, SYNTAX_NORMAL, (size_t)count);
+    }
+
+    if (si->lang == NULL || line >= si->b->lines.count)
+    {
+        return 0;
+    }
+
+    si->lexed++;
+    buffer_reader_init(&r, si->b);
+    return si->lang->lex(&r, buffer_line_start(si->b, line), buffer_line_len(si->b, line), state,
+                         classes, from, count);
+}
+
+/* The state `line` starts in, lexing forward from the last line known to be right. */
+syntax_state
+syntax_state_at(syntax_index *si, u64 line)
+{
+    if (si->lang == NULL || line >= si->count)
+    {
+        return 0;
+    }
+
+    while (si->valid <= line)
+    {
+        u64 next = si->valid;
+        syntax_state state = syntax_lex_line(si, next - 1, si->states[next - 1], NULL, 0, 0);
+
+        /* the lines after the edit were lexed from this state before */
+        if (next >= si->resume && next < si->known && si->states[next] == state)
+        {
+            si->valid = si->known;
+            si->resume = si->known;
+            continue;
+        }
+
+        si->states[next] = state;
+        si->valid = next + 1;
+        if (si->resume < si->valid)
+        {
+            si->resume = si->valid;
+        }
+        if (si->known < si->resume)
+        {
+            si->known = si->resume;
+        }
+    }
+
+    return si->states[line];
+}
@@ -0,0 +1,69 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include "base.h"
+#include "buffer.h"
+
+/* what each byte of a line is drawn as */
+typedef enum {
+    SYNTAX_NORMAL = 0,
+    SYNTAX_KEYWORD,
+    SYNTAX_TYPE,
+    SYNTAX_STRING,
+    SYNTAX_NUMBER,
+    SYNTAX_COMMENT,
+    SYNTAX_PREPROC,
+    SYNTAX_CLASS_COUNT,
+} syntax_class;
+
+/* where a lexer is at the start of a line, 0 at the start of the file */
+typedef u8 syntax_state;
+
+/*
+ * Lexes the `len` bytes of a line from `start` in `state` and returns the
+ * state the next line starts in. The classes of bytes [from, from + count)
+ * go to `classes`, which may be NULL when only the state is wanted.
+ */
+typedef syntax_state (*syntax_lex_fn)(buffer_reader *r, u64 start, u64 len, syntax_state state,
+                                      u8 *classes, u64 from, u64 count);
+
+typedef struct
+{
+    const char *name;
+    /* NULL terminated */
+    const char **extensions;
+    syntax_lex_fn lex;
+} syntax_language;
+
+/*
+ * The lexer state at the start of every line, lexed on demand up to the
+ * lines being drawn. States of lines [0, valid) are right. An edit leaves
+ * the states of the lines after it in place, shifted: those of [resume,
+ * known) are right again as soon as re-lexing the edited lines arrives at
+ * one of them in the same state, so an edit inside a line costs a line.
+ */
+typedef struct
+{
+    buffer *b;
+    /* NULL when the file has no language */
+    const syntax_language *lang;
+
+    syntax_state *states;
+    u64 count;
+    u64 capacity;
+    u64 valid;
+    u64 resume;
+    u64 known;
+
+    /* lines lexed so far */
+    u64 lexed;
+} syntax_index;
+
+const syntax_language *syntax_language_for(string path);
+void syntax_index_init(syntax_index *si, buffer *b);
+void syntax_index_free(syntax_index *si);
+syntax_state syntax_state_at(syntax_index *si, u64 line);
+syntax_state syntax_lex_line(syntax_index *si, u64 line, syntax_state state, u8 *classes, u64 from,
+                             u64 count);
+
+#endif
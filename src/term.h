@@ -55,5 +55,25 @@ void term_update_window_size();
 #define CURSOR_LINE_BG          "\x1b[48;5;235m"
 #define CURSOR_LINE_BG_LEN      11
 
+#define POPUP_BG                "\x1b[48;5;238m"
+#define POPUP_BG_LEN            11
+
+#define RESET_ATTRS             "\x1b[0m"
+#define RESET_ATTRS_LEN         4
+
+#define SELECTION_BG            "\x1b[7m"
+#define SELECTION_BG_LEN        4
+
+#define SEARCH_BG               "\x1b[30;43m"
+#define SEARCH_BG_LEN           8
+
+#define KEYWORD_FG              "\x1b[33m"
+#define TYPE_FG                 "\x1b[32m"
+#define STRING_FG               "\x1b[31m"
+#define NUMBER_FG               "\x1b[35m"
+#define COMMENT_FG              "\x1b[36m"
+#define PREPROC_FG              "\x1b[35m"
+#define SYNTAX_FG_LEN           5
+
 
 #endif
@@ -0,0 +1,1173 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include "trigram.h"
+#include "file.h"
+#include "funcs.h"
+#include "walk.h"
+#include "base.h"
+
+/* a doc whose file changed and has not been read again, kept in memory only */
+#define TRIGRAM_FILE_PENDING 2
+
+/* The ids of the new docs having one trigram, while an index is written. */
+typedef struct
+{
+    u32 trigram;
+    u32 count;
+    u32 last;
+    file_image ids;
+} trigram_list;
+
+/* Walks a posting list, renumbering through `remap` if set; removed ids map to -1. */
+typedef struct
+{
+    const u8 *p;
+    u64 left;
+    u64 prev;
+    u32 *remap;
+    u64 value;
+    int valid;
+} trigram_cursor;
+
+typedef struct
+{
+    const char *path;
+    s64 mtime;
+    u64 size;
+    u64 flags;
+    trigram_doc *doc;
+    u64 base;
+    u64 path_offset;
+} trigram_out_file;
+
+static void
+trigram_put_varint(file_image *b, u64 v)
+{
+    u8 out[10];
+    u64 n = 0;
+
+    while (v >= 0x80)
+    {
+        out[n++] = (u8)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (u8)v;
+
+    file_image_push(b, out, n);
+}
+
+static u64
+trigram_get_varint(const u8 **p)
+{
+    u64 v = 0;
+    u64 shift = 0;
+
+    while (**p & 0x80)
+    {
+        v |= (u64)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (u64)*(*p)++ << shift;
+
+    return v;
+}
+
+static void
+trigram_cursor_next(trigram_cursor *c)
+{
+    c->valid = 0;
+
+    while (c->left > 0)
+    {
+        c->prev += trigram_get_varint(&c->p);
+        c->left--;
+        c->value = c->remap ? c->remap[c->prev] : c->prev;
+
+        if (c->value != (u32)-1)
+        {
+            c->valid = 1;
+            return;
+        }
+    }
+}
+
+static int
+trigram_compare_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* The distinct trigrams of `data`, sorted, in `sc->list`. */
+static void
+trigram_extract(trigram_scratch *sc, const u8 *data, u64 len)
+{
+    u64 i;
+
+    sc->count = 0;
+
+    for (i = 0; i + 2 < len; i++)
+    {
+        u32 t = ((u32)data[i] << 16) | ((u32)data[i + 1] << 8) | data[i + 2];
+
+        if (sc->seen[t >> 6] & ((u64)1 << (t & 63)))
+        {
+            continue;
+        }
+        sc->seen[t >> 6] |= (u64)1 << (t & 63);
+
+        if (sc->count == sc->capacity)
+        {
+            sc->capacity = sc->capacity ? sc->capacity * 2 : 4096;
+            sc->list = (u32 *)realloc(sc->list, sizeof(u32) * sc->capacity);
+            if (sc->list == NULL)
+            {
+                fprintf(stderr, "[error] trigram_extract unable to realloc\n");
+                exit(1);
+            }
+        }
+        sc->list[sc->count++] = t;
+    }
+
+    /* clearing only what was set keeps small files cheap */
+    for (i = 0; i < sc->count; i++)
+    {
+        sc->seen[sc->list[i] >> 6] = 0;
+    }
+
+    qsort(sc->list, (size_t)sc->count, sizeof(u32), trigram_compare_u32);
+}
+
+static void
+trigram_scratch_init(trigram_scratch *sc)
+{
+    memset(sc, 0, sizeof(*sc));
+    sc->seen = (u64 *)calloc((size_t)1 << 18, sizeof(u64));
+    if (sc->seen == NULL)
+    {
+        fprintf(stderr, "[error] trigram_scratch_init unable to calloc\n");
+        exit(1);
+    }
+}
+
+static void
+trigram_scratch_free(trigram_scratch *sc)
+{
+    free(sc->seen);
+    free(sc->list);
+}
+
+/* Reads `path` into `doc`; binary files have no trigrams, so no literal matches them. */
+static void
+trigram_read_doc(trigram_scratch *sc, const char *path, trigram_doc *doc)
+{
+    struct stat st;
+    u8 *data;
+    int fd;
+
+    memset(doc, 0, sizeof(*doc));
+    doc->path = copy_cstr(path, strlen(path));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        doc->removed = 1;
+        return;
+    }
+
+    doc->mtime = (s64)st.st_mtime;
+    doc->size = (u64)st.st_size;
+
+    if (st.st_size > TRIGRAM_MAX_FILE)
+    {
+        close(fd);
+        doc->flags = TRIGRAM_FILE_UNINDEXED;
+        return;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    data = (u8 *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        doc->flags = TRIGRAM_FILE_UNINDEXED;
+        return;
+    }
+
+    /* the same test as :grep's */
+    if (memchr(data, 0, (size_t)(st.st_size < KB(4) ? st.st_size : KB(4))) == NULL)
+    {
+        trigram_extract(sc, data, (u64)st.st_size);
+        doc->count = sc->count;
+        doc->trigrams = (u32 *)malloc(sizeof(u32) * (sc->count + 1));
+        if (doc->trigrams == NULL)
+        {
+            fprintf(stderr, "[error] trigram_read_doc unable to malloc\n");
+            exit(1);
+        }
+        memcpy(doc->trigrams, sc->list, sizeof(u32) * sc->count);
+    }
+
+    munmap(data, (size_t)st.st_size);
+}
+
+static void
+trigram_doc_free(trigram_doc *doc)
+{
+    free(doc->path);
+    free(doc->trigrams);
+}
+
+static const char *
+trigram_file_path(trigram_index *ti, u64 id)
+{
+    return (const char *)ti->map + ti->header->paths + ti->files[id].path;
+}
+
+/* Binary search of the mapped file table. */
+static int
+trigram_find_file(trigram_index *ti, const char *path, u64 *id)
+{
+    u64 lo = 0;
+    u64 hi = ti->map ? ti->header->file_count : 0;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+        int c = strcmp(trigram_file_path(ti, mid), path);
+
+        if (c == 0)
+        {
+            *id = mid;
+            return 1;
+        }
+
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return 0;
+}
+
+static trigram_entry *
+trigram_find_entry(trigram_index *ti, u32 trigram)
+{
+    u64 lo = 0;
+    u64 hi = ti->map ? ti->header->trigram_count : 0;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (ti->table[mid].trigram == trigram)
+        {
+            return &ti->table[mid];
+        }
+
+        if (ti->table[mid].trigram < trigram)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+/* With the lock held. Takes ownership of `doc` and hides the mapped copy of its file. */
+static void
+trigram_put_doc(trigram_index *ti, trigram_doc *doc)
+{
+    u64 id;
+    u64 i;
+
+    doc->edit = ++ti->edits;
+    if (trigram_find_file(ti, doc->path, &id))
+    {
+        ti->stale[id] = 1;
+    }
+
+    for (i = 0; i < ti->doc_count; i++)
+    {
+        if (strcmp(ti->docs[i].path, doc->path) == 0)
+        {
+            trigram_doc_free(&ti->docs[i]);
+            ti->docs[i] = *doc;
+            return;
+        }
+    }
+
+    if (ti->doc_count == ti->doc_capacity)
+    {
+        ti->doc_capacity = ti->doc_capacity ? ti->doc_capacity * 2 : 64;
+        ti->docs = (trigram_doc *)realloc(ti->docs, sizeof(trigram_doc) * ti->doc_capacity);
+        if (ti->docs == NULL)
+        {
+            fprintf(stderr, "[error] trigram_put_doc unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    ti->docs[ti->doc_count++] = *doc;
+}
+
+static void
+trigram_unmap(trigram_index *ti)
+{
+    if (ti->map != NULL)
+    {
+        munmap(ti->map, (size_t)ti->map_len);
+    }
+
+    free(ti->stale);
+    ti->map = NULL;
+    ti->map_len = 0;
+    ti->header = NULL;
+    ti->files = NULL;
+    ti->table = NULL;
+    ti->stale = NULL;
+    ti->loaded = 0;
+}
+
+static int
+trigram_map(trigram_index *ti)
+{
+    trigram_header *h;
+
+    ti->map = file_map(ti->path, TRIGRAM_MAGIC, sizeof(trigram_header), &ti->map_len);
+    if (ti->map == NULL)
+    {
+        return 0;
+    }
+
+    h = (trigram_header *)ti->map;
+    if (h->size != ti->map_len || h->files + h->file_count * sizeof(trigram_file) > h->size ||
+        h->table + h->trigram_count * sizeof(trigram_entry) > h->size)
+    {
+        trigram_unmap(ti);
+        return 0;
+    }
+
+    ti->header = h;
+    ti->files = (trigram_file *)(ti->map + h->files);
+    ti->table = (trigram_entry *)(ti->map + h->table);
+    ti->stale = (u8 *)calloc((size_t)h->file_count + 1, 1);
+    if (ti->stale == NULL)
+    {
+        fprintf(stderr, "[error] trigram_map unable to calloc\n");
+        exit(1);
+    }
+    ti->loaded = 1;
+    return 1;
+}
+
+/* Maps the index at `path` if there is one, 0 otherwise. */
+int
+trigram_index_open(trigram_index *ti, const char *path)
+{
+    memset(ti, 0, sizeof(*ti));
+    pthread_mutex_init(&ti->lock, NULL);
+    ti->path = copy_cstr(path, strlen(path));
+    ti->started = 1;
+
+    return trigram_map(ti);
+}
+
+static void
+trigram_on_build_file(void *ctx, u64 worker, const char *path)
+{
+    trigram_index *ti = (trigram_index *)ctx;
+
+    trigram_read_doc(&ti->scratch[worker], path, &ti->built[__sync_fetch_and_add(&ti->built_count, 1)]);
+}
+
+/*
+ * Indexes `paths` from scratch on the walk pool, which frees them, while
+ * the caller goes on. trigram_index_finish writes the index once
+ * trigram_index_building says the walk is over.
+ */
+void
+trigram_index_start(trigram_index *ti, const char *path, char **paths, u64 count)
+{
+    u64 i;
+
+    if (!ti->started)
+    {
+        trigram_index_open(ti, path);
+    }
+
+    ti->scratch_count = walk_worker_count();
+    ti->scratch = (trigram_scratch *)malloc(sizeof(trigram_scratch) * (size_t)ti->scratch_count);
+    ti->built = (trigram_doc *)calloc((size_t)count + 1, sizeof(trigram_doc));
+    if (ti->scratch == NULL || ti->built == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_start unable to malloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < ti->scratch_count; i++)
+    {
+        trigram_scratch_init(&ti->scratch[i]);
+    }
+
+    pthread_mutex_lock(&ti->lock);
+    ti->built_count = 0;
+    ti->built_edits = ti->edits;
+    pthread_mutex_unlock(&ti->lock);
+
+    ti->building = 1;
+    walk_start_files(&ti->walk, paths, count, ti->scratch_count, trigram_on_build_file, ti);
+}
+
+int
+trigram_index_building(trigram_index *ti)
+{
+    return ti->building && walk_running(&ti->walk);
+}
+
+/*
+ * Joins the build and writes the index, 1 if it was written. Files put
+ * while the build ran were read after it did and win over its docs.
+ */
+int
+trigram_index_finish(trigram_index *ti)
+{
+    u64 kept = 0;
+    u64 i;
+    u64 j;
+    int ok;
+
+    if (!ti->building)
+    {
+        return 0;
+    }
+
+    walk_wait(&ti->walk);
+    walk_free(&ti->walk);
+    for (i = 0; i < ti->scratch_count; i++)
+    {
+        trigram_scratch_free(&ti->scratch[i]);
+    }
+    free(ti->scratch);
+    ti->scratch = NULL;
+    ti->scratch_count = 0;
+    ti->building = 0;
+
+    pthread_mutex_lock(&ti->lock);
+
+    /* nothing of the old index survives a build */
+    for (i = 0; i < ti->doc_count; i++)
+    {
+        if (ti->docs[i].edit > ti->built_edits)
+        {
+            ti->docs[kept++] = ti->docs[i];
+        }
+        else
+        {
+            trigram_doc_free(&ti->docs[i]);
+        }
+    }
+
+    ti->doc_capacity = kept + ti->built_count + 1;
+    ti->docs = (trigram_doc *)realloc(ti->docs, sizeof(trigram_doc) * ti->doc_capacity);
+    if (ti->docs == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_finish unable to realloc\n");
+        exit(1);
+    }
+
+    ti->doc_count = kept;
+    for (i = 0; i < ti->built_count; i++)
+    {
+        for (j = 0; j < kept && strcmp(ti->docs[j].path, ti->built[i].path) != 0; j++)
+        {
+        }
+
+        if (j < kept)
+        {
+            trigram_doc_free(&ti->built[i]);
+        }
+        else
+        {
+            ti->docs[ti->doc_count++] = ti->built[i];
+        }
+    }
+    free(ti->built);
+    ti->built = NULL;
+    ti->built_count = 0;
+
+    if (ti->map != NULL)
+    {
+        memset(ti->stale, 1, (size_t)ti->header->file_count);
+    }
+
+    pthread_mutex_unlock(&ti->lock);
+
+    ok = trigram_index_write(ti);
+    ti->refreshed = 1;
+    return ok;
+}
+
+/* Indexes `paths` from scratch and writes the index to `path`, waiting for it. */
+void
+trigram_index_build(trigram_index *ti, const char *path, char **paths, u64 count)
+{
+    char **copies = (char **)malloc(sizeof(char *) * (size_t)(count + 1));
+    u64 i;
+
+    if (copies == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_build unable to malloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        copies[i] = copy_cstr(paths[i], strlen(paths[i]));
+    }
+
+    trigram_index_start(ti, path, copies, count);
+    trigram_index_finish(ti);
+}
+
+static int
+trigram_compare_out_file(const void *a, const void *b)
+{
+    return strcmp(((const trigram_out_file *)a)->path, ((const trigram_out_file *)b)->path);
+}
+
+static int
+trigram_compare_list(const void *a, const void *b)
+{
+    return trigram_compare_u32(&((const trigram_list *)a)->trigram, &((const trigram_list *)b)->trigram);
+}
+
+static trigram_list *
+trigram_lists_get(trigram_list **slots, u64 *slot_count, u64 *used, u32 trigram)
+{
+    u64 i;
+
+    if ((*used + 1) * 2 > *slot_count)
+    {
+        u64 old_count = *slot_count;
+        trigram_list *old = *slots;
+
+        *slot_count = old_count ? old_count * 2 : 4096;
+        *slots = (trigram_list *)calloc((size_t)*slot_count, sizeof(trigram_list));
+        if (*slots == NULL)
+        {
+            fprintf(stderr, "[error] trigram_lists_get unable to calloc\n");
+            exit(1);
+        }
+
+        for (i = 0; i < old_count; i++)
+        {
+            if (old[i].count > 0)
+            {
+                u64 j = (old[i].trigram * 2654435761u) & (*slot_count - 1);
+
+                while ((*slots)[j].count > 0)
+                {
+                    j = (j + 1) & (*slot_count - 1);
+                }
+                (*slots)[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    for (i = (trigram * 2654435761u) & (*slot_count - 1); (*slots)[i].count > 0;
+         i = (i + 1) & (*slot_count - 1))
+    {
+        if ((*slots)[i].trigram == trigram)
+        {
+            return &(*slots)[i];
+        }
+    }
+
+    (*used)++;
+    (*slots)[i].trigram = trigram;
+    return &(*slots)[i];
+}
+
+/*
+ * Re-reads files whose change was only noted by the watcher. The paths are
+ * copied out so the files are read without the lock.
+ */
+static void
+trigram_index_update_pending(trigram_index *ti)
+{
+    char **paths = NULL;
+    u64 count = 0;
+    u64 i;
+
+    pthread_mutex_lock(&ti->lock);
+    for (i = 0; i < ti->doc_count; i++)
+    {
+        if (ti->docs[i].flags & TRIGRAM_FILE_PENDING)
+        {
+            paths = (char **)realloc(paths, sizeof(char *) * (count + 1));
+            if (paths == NULL)
+            {
+                fprintf(stderr, "[error] trigram_index_update_pending unable to realloc\n");
+                exit(1);
+            }
+            paths[count++] = copy_cstr(ti->docs[i].path, strlen(ti->docs[i].path));
+        }
+    }
+    pthread_mutex_unlock(&ti->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        trigram_index_update(ti, paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+/*
+ * Merges the mapped index and the docs into a new file, renamed over the
+ * old one so a crash leaves either. The ids are positions in the file
+ * table, sorted by path on both sides, so a mapped posting list stays
+ * sorted after renumbering and merges with the docs' list in one pass.
+ *
+ * The file is built in memory under the lock and written after it, so the
+ * watcher is not held up by the disk.
+ */
+int
+trigram_index_write(trigram_index *ti)
+{
+    trigram_header header;
+    trigram_out_file *out = NULL;
+    u32 *base_ids = NULL;
+    trigram_list *slots = NULL;
+    trigram_list *lists;
+    trigram_entry *table = NULL;
+    file_image postings = {0};
+    file_image image = {0};
+    u64 slot_count = 0;
+    u64 used = 0;
+    u64 out_count = 0;
+    u64 base_count;
+    u64 base_trigrams;
+    u64 table_count = 0;
+    u64 edits;
+    u64 a;
+    u64 b;
+    u64 i;
+    u64 j;
+    int ok;
+
+    trigram_index_update_pending(ti);
+
+    pthread_mutex_lock(&ti->lock);
+
+    base_count = ti->map ? ti->header->file_count : 0;
+    base_trigrams = ti->map ? ti->header->trigram_count : 0;
+    out = (trigram_out_file *)malloc(sizeof(trigram_out_file) * (base_count + ti->doc_count + 1));
+    base_ids = (u32 *)malloc(sizeof(u32) * (base_count + 1));
+    if (out == NULL || base_ids == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_write unable to malloc\n");
+        exit(1);
+    }
+
+    for (i = 0; i < base_count; i++)
+    {
+        base_ids[i] = (u32)-1;
+        if (!ti->stale[i])
+        {
+            out[out_count].path = trigram_file_path(ti, i);
+            out[out_count].mtime = ti->files[i].mtime;
+            out[out_count].size = ti->files[i].size;
+            out[out_count].flags = ti->files[i].flags;
+            out[out_count].doc = NULL;
+            out[out_count].base = i;
+            out_count++;
+        }
+    }
+
+    for (i = 0; i < ti->doc_count; i++)
+    {
+        if (!ti->docs[i].removed)
+        {
+            out[out_count].path = ti->docs[i].path;
+            out[out_count].mtime = ti->docs[i].mtime;
+            out[out_count].size = ti->docs[i].size;
+            /* noted by the watcher since the update above: searched always, read on the next open */
+            out[out_count].flags = ti->docs[i].flags ? TRIGRAM_FILE_UNINDEXED : 0;
+            out[out_count].doc = &ti->docs[i];
+            out[out_count].base = (u64)-1;
+            out_count++;
+        }
+    }
+
+    qsort(out, (size_t)out_count, sizeof(trigram_out_file), trigram_compare_out_file);
+
+    for (i = 0; i < out_count; i++)
+    {
+        if (out[i].doc == NULL)
+        {
+            base_ids[out[i].base] = (u32)i;
+            continue;
+        }
+
+        for (j = 0; j < out[i].doc->count; j++)
+        {
+            trigram_list *l = trigram_lists_get(&slots, &slot_count, &used, out[i].doc->trigrams[j]);
+
+            trigram_put_varint(&l->ids, i - (l->count > 0 ? l->last : 0));
+            l->last = (u32)i;
+            l->count++;
+        }
+    }
+
+    /* the used slots, sorted, to merge with the mapped table */
+    lists = (trigram_list *)malloc(sizeof(trigram_list) * (used + 1));
+    table = (trigram_entry *)malloc(sizeof(trigram_entry) * (used + base_trigrams + 1));
+    if (lists == NULL || table == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_write unable to malloc\n");
+        exit(1);
+    }
+    for (i = 0, j = 0; i < slot_count; i++)
+    {
+        if (slots[i].count > 0)
+        {
+            lists[j++] = slots[i];
+        }
+    }
+    qsort(lists, (size_t)used, sizeof(trigram_list), trigram_compare_list);
+
+    a = 0;
+    b = 0;
+    while (a < base_trigrams || b < used)
+    {
+        trigram_entry *base_entry = a < base_trigrams ? &ti->table[a] : NULL;
+        trigram_list *list = b < used ? &lists[b] : NULL;
+        trigram_cursor ca = {0};
+        trigram_cursor cb = {0};
+        u64 last = 0;
+        u32 trigram;
+        trigram_entry entry;
+
+        if (base_entry != NULL && (list == NULL || base_entry->trigram <= list->trigram))
+        {
+            trigram = base_entry->trigram;
+        }
+        else
+        {
+            trigram = list->trigram;
+        }
+
+        if (base_entry != NULL && base_entry->trigram == trigram)
+        {
+            ca.p = ti->map + ti->header->postings + base_entry->offset;
+            ca.left = base_entry->count;
+            ca.remap = base_ids;
+            a++;
+        }
+
+        if (list != NULL && list->trigram == trigram)
+        {
+            cb.p = list->ids.s;
+            cb.left = list->count;
+            b++;
+        }
+
+        entry.trigram = trigram;
+        entry.count = 0;
+        entry.offset = postings.len;
+
+        trigram_cursor_next(&ca);
+        trigram_cursor_next(&cb);
+        while (ca.valid || cb.valid)
+        {
+            trigram_cursor *c = ca.valid && (!cb.valid || ca.value < cb.value) ? &ca : &cb;
+
+            trigram_put_varint(&postings, c->value - (entry.count > 0 ? last : 0));
+            last = c->value;
+            entry.count++;
+            trigram_cursor_next(c);
+        }
+
+        if (entry.count > 0)
+        {
+            table[table_count++] = entry;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRIGRAM_MAGIC, 8);
+    header.file_count = out_count;
+    header.trigram_count = table_count;
+    file_image_push(&image, &header, sizeof(header));
+
+    header.paths = image.len;
+    for (i = 0, j = 0; i < out_count; i++)
+    {
+        u64 len = strlen(out[i].path) + 1;
+
+        file_image_push(&image, out[i].path, len);
+        out[i].path_offset = j;
+        j += len;
+    }
+    file_image_align(&image);
+
+    header.files = image.len;
+    for (i = 0; i < out_count; i++)
+    {
+        trigram_file file;
+
+        file.path = out[i].path_offset;
+        file.mtime = out[i].mtime;
+        file.size = out[i].size;
+        file.flags = out[i].flags;
+        file_image_push(&image, &file, sizeof(file));
+    }
+
+    header.postings = image.len;
+    file_image_push(&image, postings.s, postings.len);
+    file_image_align(&image);
+
+    header.table = image.len;
+    file_image_push(&image, table, sizeof(trigram_entry) * table_count);
+    header.size = image.len;
+    memcpy(image.s, &header, sizeof(header));
+
+    for (i = 0; i < slot_count; i++)
+    {
+        free(slots[i].ids.s);
+    }
+    free(slots);
+    free(lists);
+    free(table);
+    free(postings.s);
+    free(base_ids);
+    free(out);
+
+    edits = ti->edits;
+    pthread_mutex_unlock(&ti->lock);
+
+    ok = file_write_atomic(ti->path, image.s, image.len);
+    free(image.s);
+    if (!ok)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ti->lock);
+
+    /* docs put while the file was written may be newer than it, so they stay */
+    if (ti->edits == edits)
+    {
+        for (i = 0; i < ti->doc_count; i++)
+        {
+            trigram_doc_free(&ti->docs[i]);
+        }
+        ti->doc_count = 0;
+    }
+    trigram_unmap(ti);
+    trigram_map(ti);
+    for (i = 0; i < ti->doc_count && ti->map != NULL; i++)
+    {
+        if (trigram_find_file(ti, ti->docs[i].path, &j))
+        {
+            ti->stale[j] = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&ti->lock);
+    return 1;
+}
+
+/* Re-reads one file, e.g. after the editor saved it. */
+void
+trigram_index_update(trigram_index *ti, const char *path)
+{
+    trigram_scratch sc;
+    trigram_doc doc;
+
+    trigram_scratch_init(&sc);
+    trigram_read_doc(&sc, path, &doc);
+    trigram_scratch_free(&sc);
+
+    pthread_mutex_lock(&ti->lock);
+    trigram_put_doc(ti, &doc);
+    pthread_mutex_unlock(&ti->lock);
+}
+
+void
+trigram_index_remove(trigram_index *ti, const char *path)
+{
+    trigram_doc doc;
+
+    memset(&doc, 0, sizeof(doc));
+    doc.path = copy_cstr(path, strlen(path));
+    doc.removed = 1;
+
+    pthread_mutex_lock(&ti->lock);
+    trigram_put_doc(ti, &doc);
+    pthread_mutex_unlock(&ti->lock);
+}
+
+/*
+ * A path_index_listener. It runs on the watcher thread with the path
+ * index locked, so it only notes the change: the file is searched
+ * whatever it holds until the next refresh reads it.
+ */
+void
+trigram_index_on_path(void *ctx, const char *path, int removed)
+{
+    trigram_index *ti = (trigram_index *)ctx;
+
+    if (!removed)
+    {
+        trigram_doc doc;
+
+        memset(&doc, 0, sizeof(doc));
+        doc.path = copy_cstr(path, strlen(path));
+        doc.flags = TRIGRAM_FILE_PENDING;
+
+        pthread_mutex_lock(&ti->lock);
+        trigram_put_doc(ti, &doc);
+        pthread_mutex_unlock(&ti->lock);
+        return;
+    }
+
+    trigram_index_remove(ti, path);
+}
+
+/*
+ * Brings the index up to date with `paths`, the files that exist now. The
+ * first call compares every mapped file's mtime and size with the disk and
+ * reads the changed and new ones; later calls only read what the watcher
+ * noted. Too many docs and the index is written again.
+ */
+void
+trigram_index_refresh(trigram_index *ti, char **paths, u64 count)
+{
+    struct stat st;
+    u64 id;
+    u64 i;
+    u64 j;
+
+    if (!ti->refreshed)
+    {
+        /* the mapped table only changes on this thread, so it is read unlocked */
+        for (i = 0; ti->map != NULL && i < ti->header->file_count; i++)
+        {
+            const char *path = trigram_file_path(ti, i);
+
+            if (stat(path, &st) != 0)
+            {
+                trigram_index_remove(ti, path);
+            }
+            else if ((s64)st.st_mtime != ti->files[i].mtime || (u64)st.st_size != ti->files[i].size)
+            {
+                trigram_index_update(ti, path);
+            }
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            int known = trigram_find_file(ti, paths[i], &id);
+
+            pthread_mutex_lock(&ti->lock);
+            for (j = 0; !known && j < ti->doc_count; j++)
+            {
+                known = strcmp(ti->docs[j].path, paths[i]) == 0;
+            }
+            pthread_mutex_unlock(&ti->lock);
+
+            if (!known)
+            {
+                trigram_index_update(ti, paths[i]);
+            }
+        }
+
+        ti->refreshed = 1;
+    }
+
+    trigram_index_update_pending(ti);
+
+    if (ti->doc_count > TRIGRAM_MAX_DOCS)
+    {
+        trigram_index_write(ti);
+    }
+}
+
+static int
+trigram_compare_doc(const void *a, const void *b)
+{
+    return strcmp(((const trigram_doc *)a)->path, ((const trigram_doc *)b)->path);
+}
+
+static int
+trigram_doc_has_all(trigram_doc *doc, u32 *trigrams, u64 count)
+{
+    u64 i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (bsearch(&trigrams[i], doc->trigrams, (size_t)doc->count, sizeof(u32), trigram_compare_u32) == NULL)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Keeps the paths that can contain `literal`, freeing the others. A file
+ * the index knows nothing about is kept, it is only ever a candidate.
+ */
+char **
+trigram_index_filter(trigram_index *ti, string literal, char **paths, u64 *count)
+{
+    trigram_scratch sc;
+    u32 *hits = NULL;
+    u64 base_count;
+    u64 kept = 0;
+    u64 id;
+    u64 i;
+    u64 j;
+
+    if (literal.len < 3)
+    {
+        return paths;
+    }
+
+    trigram_scratch_init(&sc);
+    trigram_extract(&sc, literal.s, literal.len);
+
+    pthread_mutex_lock(&ti->lock);
+
+    /* a file of the mapped index matches if every trigram's list counts it */
+    base_count = ti->map ? ti->header->file_count : 0;
+    hits = (u32 *)calloc((size_t)base_count + 1, sizeof(u32));
+    if (hits == NULL)
+    {
+        fprintf(stderr, "[error] trigram_index_filter unable to calloc\n");
+        exit(1);
+    }
+
+    for (i = 0; base_count > 0 && i < sc.count; i++)
+    {
+        trigram_entry *entry = trigram_find_entry(ti, sc.list[i]);
+        const u8 *p;
+        u64 prev = 0;
+
+        if (entry == NULL)
+        {
+            break;
+        }
+
+        p = ti->map + ti->header->postings + entry->offset;
+        for (j = 0; j < entry->count; j++)
+        {
+            prev += trigram_get_varint(&p);
+            hits[prev]++;
+        }
+    }
+
+    qsort(ti->docs, (size_t)ti->doc_count, sizeof(trigram_doc), trigram_compare_doc);
+
+    for (i = 0; i < *count; i++)
+    {
+        trigram_doc key;
+        trigram_doc *doc;
+        int keep = 1;
+
+        key.path = paths[i];
+        doc = (trigram_doc *)bsearch(&key, ti->docs, (size_t)ti->doc_count, sizeof(trigram_doc),
+                                     trigram_compare_doc);
+
+        if (doc != NULL)
+        {
+            keep = doc->removed || (doc->flags & (TRIGRAM_FILE_UNINDEXED | TRIGRAM_FILE_PENDING)) ||
+                   trigram_doc_has_all(doc, sc.list, sc.count);
+        }
+        else if (trigram_find_file(ti, paths[i], &id) && !ti->stale[id])
+        {
+            keep = (ti->files[id].flags & TRIGRAM_FILE_UNINDEXED) || hits[id] == sc.count;
+        }
+
+        if (keep)
+        {
+            paths[kept++] = paths[i];
+        }
+        else
+        {
+            free(paths[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&ti->lock);
+
+    free(hits);
+    trigram_scratch_free(&sc);
+    *count = kept;
+    return paths;
+}
+
+void
+trigram_index_free(trigram_index *ti)
+{
+    u64 i;
+
+    if (!ti->started)
+    {
+        return;
+    }
+
+    if (ti->building)
+    {
+        walk_wait(&ti->walk);
+        walk_free(&ti->walk);
+        for (i = 0; i < ti->scratch_count; i++)
+        {
+            trigram_scratch_free(&ti->scratch[i]);
+        }
+        for (i = 0; i < ti->built_count; i++)
+        {
+            trigram_doc_free(&ti->built[i]);
+        }
+        free(ti->scratch);
+        free(ti->built);
+    }
+
+    for (i = 0; i < ti->doc_count; i++)
+    {
+        trigram_doc_free(&ti->docs[i]);
+    }
+    free(ti->docs);
+    trigram_unmap(ti);
+    free(ti->path);
+    pthread_mutex_destroy(&ti->lock);
+
+    memset(ti, 0, sizeof(*ti));
+}
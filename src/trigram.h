@@ -0,0 +1,125 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <pthread.h>
+
+#include "base.h"
+#include "walk.h"
+
+#define TRIGRAM_INDEX_FILE ".editor-trigrams"
+#define TRIGRAM_MAGIC "EDTRGM01"
+/* files re-indexed in memory before the mapped index is rewritten */
+#define TRIGRAM_MAX_DOCS 1024
+/* larger files are not indexed, a search always reads them */
+#define TRIGRAM_MAX_FILE MB(64)
+
+#define TRIGRAM_FILE_UNINDEXED 1
+
+/*
+ * The index file is a header, the NUL terminated paths, the file table
+ * sorted by path, the posting lists and the trigram table sorted by
+ * trigram. A posting list holds the ids of the files containing a trigram
+ * as varint encoded deltas.
+ */
+typedef struct
+{
+    u8 magic[8];
+    u64 file_count;
+    u64 trigram_count;
+    u64 paths;
+    u64 files;
+    u64 postings;
+    u64 table;
+    u64 size;
+} trigram_header;
+
+typedef struct
+{
+    u64 path;
+    s64 mtime;
+    u64 size;
+    u64 flags;
+} trigram_file;
+
+typedef struct
+{
+    u32 trigram;
+    u32 count;
+    u64 offset;
+} trigram_entry;
+
+/* A file indexed or removed since the mapped index was written. */
+typedef struct
+{
+    char *path;
+    s64 mtime;
+    u64 size;
+    u64 flags;
+    /* sorted */
+    u32 *trigrams;
+    u64 count;
+    /* the `edits` it was put at */
+    u64 edit;
+    u8 removed;
+} trigram_doc;
+
+/* Per worker, marks the trigrams of the file being read in a 2 MB bitmap. */
+typedef struct
+{
+    u64 *seen;
+    u32 *list;
+    u64 count;
+    u64 capacity;
+} trigram_scratch;
+
+/*
+ * The mapped index never changes; files that changed since are marked
+ * `stale` in it and live in `docs` until the next write merges the two.
+ */
+typedef struct
+{
+    /* held by the watcher thread's updates and by readers of `docs` */
+    pthread_mutex_t lock;
+    char *path;
+
+    u8 *map;
+    u64 map_len;
+    trigram_header *header;
+    trigram_file *files;
+    trigram_entry *table;
+    u8 *stale;
+
+    trigram_doc *docs;
+    u64 doc_count;
+    u64 doc_capacity;
+    /* moved by every put, so a write can tell the docs changed while it was on disk */
+    u64 edits;
+
+    /* a build on the walk pool, its docs replace the index's when it is over */
+    walk walk;
+    trigram_scratch *scratch;
+    u64 scratch_count;
+    trigram_doc *built;
+    volatile u64 built_count;
+    u64 built_edits;
+    u8 building;
+
+    u8 refreshed;
+    u8 loaded;
+    u8 started;
+} trigram_index;
+
+int trigram_index_open(trigram_index *ti, const char *path);
+void trigram_index_start(trigram_index *ti, const char *path, char **paths, u64 count);
+int trigram_index_building(trigram_index *ti);
+int trigram_index_finish(trigram_index *ti);
+void trigram_index_build(trigram_index *ti, const char *path, char **paths, u64 count);
+int trigram_index_write(trigram_index *ti);
+void trigram_index_refresh(trigram_index *ti, char **paths, u64 count);
+void trigram_index_update(trigram_index *ti, const char *path);
+void trigram_index_remove(trigram_index *ti, const char *path);
+void trigram_index_on_path(void *ctx, const char *path, int removed);
+char **trigram_index_filter(trigram_index *ti, string literal, char **paths, u64 *count);
+void trigram_index_free(trigram_index *ti);
+
+#endif
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include "walk.h"
+#include "funcs.h"
+#include "trigram.h"
+#include "symbols.h"
+#include "base.h"
+
+#define WALK_IGNORE_NEGATE   1
+#define WALK_IGNORE_DIR_ONLY 2
+#define WALK_IGNORE_ANCHORED 4
+/* contains **, matched without FNM_PATHNAME so it can cross directories */
+#define WALK_IGNORE_DEEP     8
+
+/* Parses the lines of a .gitignore found in `dir`. */
+walk_ignore *
+walk_ignore_parse(walk_ignore *parent, const char *dir, string text)
+{
+    walk_ignore *ignore = (walk_ignore *)malloc(sizeof(walk_ignore));
+    u64 capacity = 0;
+    u64 pos = 0;
+
+    if (ignore == NULL)
+    {
+        fprintf(stderr, "[error] walk_ignore_parse unable to malloc\n");
+        exit(1);
+    }
+
+    ignore->parent = parent;
+    ignore->next_alloc = NULL;
+    ignore->dir = copy_cstr(dir, strlen(dir));
+    ignore->patterns = NULL;
+    ignore->flags = NULL;
+    ignore->count = 0;
+
+    while (pos < text.len)
+    {
+        u64 start = pos;
+        u64 end;
+        u8 flags = 0;
+        u64 i;
+
+        while (pos < text.len && text.s[pos] != '\n')
+        {
+            pos++;
+        }
+        end = pos++;
+
+        while (end > start && (text.s[end - 1] == '\r' || text.s[end - 1] == ' '))
+        {
+            end--;
+        }
+
+        if (start == end || text.s[start] == '#')
+        {
+            continue;
+        }
+
+        if (text.s[start] == '!')
+        {
+            flags |= WALK_IGNORE_NEGATE;
+            start++;
+        }
+        else if (text.s[start] == '\\')
+        {
+            start++;
+        }
+
+        if (end > start && text.s[end - 1] == '/')
+        {
+            flags |= WALK_IGNORE_DIR_ONLY;
+            end--;
+        }
+
+        for (i = start; i < end; i++)
+        {
+            if (text.s[i] == '/')
+            {
+                flags |= WALK_IGNORE_ANCHORED;
+            }
+
+            if (i + 1 < end && text.s[i] == '*' && text.s[i + 1] == '*')
+            {
+                flags |= WALK_IGNORE_DEEP;
+            }
+        }
+
+        if (end > start && text.s[start] == '/')
+        {
+            start++;
+        }
+
+        if (start == end)
+        {
+            continue;
+        }
+
+        if (ignore->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 8;
+            ignore->patterns = (char **)realloc(ignore->patterns, sizeof(char *) * capacity);
+            ignore->flags = (u8 *)realloc(ignore->flags, capacity);
+            if (ignore->patterns == NULL || ignore->flags == NULL)
+            {
+                fprintf(stderr, "[error] walk_ignore_parse unable to realloc\n");
+                exit(1);
+            }
+        }
+
+        ignore->patterns[ignore->count] = copy_cstr((char *)text.s + start, end - start);
+        ignore->flags[ignore->count] = flags;
+        ignore->count++;
+    }
+
+    return ignore;
+}
+
+static int
+walk_ignore_match(const char *pattern, u8 flags, const char *rel, const char *base, int is_dir)
+{
+    if ((flags & WALK_IGNORE_DIR_ONLY) && !is_dir)
+    {
+        return 0;
+    }
+
+    if (!(flags & WALK_IGNORE_ANCHORED))
+    {
+        return fnmatch(pattern, base, 0) == 0;
+    }
+
+    if (flags & WALK_IGNORE_DEEP)
+    {
+        return fnmatch(pattern, rel, 0) == 0 ||
+               (strncmp(pattern, "**/", 3) == 0 && fnmatch(pattern + 3, rel, 0) == 0);
+    }
+
+    return fnmatch(pattern, rel, FNM_PATHNAME) == 0;
+}
+
+/* The editor's own index files, and the temporaries they are written to before the rename. */
+static int
+walk_is_index_file(const char *base)
+{
+    static const char *names[] = {TRIGRAM_INDEX_FILE, SYMBOL_INDEX_FILE};
+    u64 i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        u64 len = strlen(names[i]);
+
+        if (strncmp(base, names[i], (size_t)len) == 0 && (base[len] == '\0' || base[len] == '.'))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Whether `path` (relative to the search root) is ignored. The deepest
+ * .gitignore decides first, and within a file the last matching line wins.
+ */
+int
+walk_ignored(walk_ignore *ignore, const char *path, int is_dir)
+{
+    const char *base = strrchr(path, '/');
+
+    base = base ? base + 1 : path;
+
+    if (!is_dir && walk_is_index_file(base))
+    {
+        return 1;
+    }
+
+    for (; ignore != NULL; ignore = ignore->parent)
+    {
+        u64 dir_len = strlen(ignore->dir);
+        const char *rel = path;
+        u64 i;
+
+        if (dir_len > 0)
+        {
+            if (strncmp(path, ignore->dir, (size_t)dir_len) != 0 || path[dir_len] != '/')
+            {
+                continue;
+            }
+            rel = path + dir_len + 1;
+        }
+
+        for (i = ignore->count; i > 0; i--)
+        {
+            if (walk_ignore_match(ignore->patterns[i - 1], ignore->flags[i - 1], rel, base, is_dir))
+            {
+                return !(ignore->flags[i - 1] & WALK_IGNORE_NEGATE);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void
+walk_deque_push(walk_deque *d, walk_job job)
+{
+    pthread_mutex_lock(&d->lock);
+
+    if (d->tail == d->capacity && d->head > 0)
+    {
+        memmove(d->items, d->items + d->head, sizeof(walk_job) * (d->tail - d->head));
+        d->tail -= d->head;
+        d->head = 0;
+    }
+
+    if (d->tail == d->capacity)
+    {
+        d->capacity = d->capacity ? d->capacity * 2 : 64;
+        d->items = (walk_job *)realloc(d->items, sizeof(walk_job) * d->capacity);
+        if (d->items == NULL)
+        {
+            fprintf(stderr, "[error] walk_deque_push unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    d->items[d->tail++] = job;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int
+walk_deque_take(walk_deque *d, walk_job *out, int from_head)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+
+    if (d->tail > d->head)
+    {
+        *out = from_head ? d->items[d->head++] : d->items[--d->tail];
+        found = 1;
+
+        if (d->head == d->tail)
+        {
+            d->head = 0;
+            d->tail = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static void
+walk_push(walk_worker *worker, char *path, u8 is_dir, walk_ignore *ignore)
+{
+    walk_job job;
+
+    job.path = path;
+    job.is_dir = is_dir;
+    job.ignore = ignore;
+
+    __sync_fetch_and_add(&worker->w->pending, 1);
+    walk_deque_push(&worker->jobs, job);
+}
+
+static int
+walk_steal(walk_worker *worker, walk_job *out)
+{
+    walk *w = worker->w;
+    u64 k;
+
+    for (k = 1; k < w->worker_count; k++)
+    {
+        if (walk_deque_take(&w->workers[(worker->id + k) % w->worker_count].jobs, out, 1))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+walk_dir(walk_worker *worker, walk_job *job)
+{
+    walk *w = worker->w;
+    walk_ignore *ignore = job->ignore;
+    char *ignore_path = join_path(job->path, ".gitignore");
+    string text;
+    struct dirent *e;
+    DIR *d;
+
+    if (readfile(ignore_path, &text, MB(1)) == 0)
+    {
+        ignore = walk_ignore_parse(ignore, job->path, text);
+        free(text.s);
+
+        pthread_mutex_lock(&w->lock);
+        ignore->next_alloc = w->ignores;
+        w->ignores = ignore;
+        pthread_mutex_unlock(&w->lock);
+    }
+    free(ignore_path);
+
+    if (w->on_dir != NULL)
+    {
+        w->on_dir(w->ctx, job->path, ignore);
+    }
+
+    d = opendir(job->path[0] ? job->path : ".");
+    if (d == NULL)
+    {
+        return;
+    }
+
+    while ((e = readdir(d)) != NULL && !w->cancel)
+    {
+        char *path;
+        int is_dir;
+        int is_file;
+
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0 ||
+            strcmp(e->d_name, ".git") == 0)
+        {
+            continue;
+        }
+
+        path = join_path(job->path, e->d_name);
+
+        if (e->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+
+            if (lstat(path, &st) != 0)
+            {
+                free(path);
+                continue;
+            }
+
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+        else
+        {
+            is_dir = e->d_type == DT_DIR;
+            is_file = e->d_type == DT_REG;
+        }
+
+        /* symlinks are not followed, so the walk cannot loop */
+        if ((!is_dir && !is_file) || walk_ignored(ignore, path, is_dir))
+        {
+            free(path);
+            continue;
+        }
+
+        walk_push(worker, path, (u8)is_dir, ignore);
+    }
+
+    closedir(d);
+}
+
+static void *
+walk_worker_main(void *arg)
+{
+    walk_worker *worker = (walk_worker *)arg;
+    walk *w = worker->w;
+    struct timespec nap = {0, 100000};
+    walk_job job;
+
+    while (!w->cancel)
+    {
+        if (walk_deque_take(&worker->jobs, &job, 0) || walk_steal(worker, &job))
+        {
+            if (job.is_dir)
+            {
+                walk_dir(worker, &job);
+            }
+            else if (!w->cancel)
+            {
+                w->on_file(w->ctx, worker->id, job.path);
+            }
+
+            free(job.path);
+            __sync_fetch_and_sub(&w->pending, 1);
+        }
+        else if (w->pending == 0)
+        {
+            break;
+        }
+        else
+        {
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    while (walk_deque_take(&worker->jobs, &job, 0))
+    {
+        free(job.path);
+    }
+
+    __sync_fetch_and_sub(&w->running, 1);
+    return NULL;
+}
+
+/* One worker per core. */
+u64
+walk_worker_count(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1)
+    {
+        return 1;
+    }
+
+    return (u64)cpus < WALK_MAX_THREADS ? (u64)cpus : WALK_MAX_THREADS;
+}
+
+static void
+walk_init(walk *w, u64 worker_count, walk_file_fn on_file, walk_dir_fn on_dir, void *ctx)
+{
+    u64 i;
+
+    memset(w, 0, sizeof(*w));
+    w->on_file = on_file;
+    w->on_dir = on_dir;
+    w->ctx = ctx;
+    w->worker_count = worker_count;
+
+    w->workers = (walk_worker *)malloc(sizeof(walk_worker) * worker_count);
+    if (w->workers == NULL)
+    {
+        fprintf(stderr, "[error] walk_init unable to malloc\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    for (i = 0; i < worker_count; i++)
+    {
+        memset(&w->workers[i], 0, sizeof(walk_worker));
+        w->workers[i].w = w;
+        w->workers[i].id = i;
+        pthread_mutex_init(&w->workers[i].jobs.lock, NULL);
+    }
+}
+
+static void
+walk_launch(walk *w)
+{
+    u64 i;
+
+    w->running = w->worker_count;
+    w->started = 1;
+    for (i = 0; i < w->worker_count; i++)
+    {
+        pthread_create(&w->workers[i].thread, NULL, walk_worker_main, &w->workers[i]);
+    }
+}
+
+/*
+ * Walks every file under `root` on `worker_count` threads and returns at
+ * once. Paths handed to `on_file` are relative to the working directory;
+ * `on_dir`, if set, sees each directory with its .gitignore rules loaded.
+ */
+void
+walk_start(walk *w, string root, u64 worker_count, walk_file_fn on_file, walk_dir_fn on_dir,
+           void *ctx)
+{
+    walk_init(w, worker_count, on_file, on_dir, ctx);
+
+    if (root.len == 1 && root.s[0] == '.')
+    {
+        root.len = 0;
+    }
+    walk_push(&w->workers[0], copy_cstr((char *)root.s, root.len), 1, NULL);
+
+    walk_launch(w);
+}
+
+/* Like walk_start over a known list of files, taking ownership of `paths`. */
+void
+walk_start_files(walk *w, char **paths, u64 count, u64 worker_count, walk_file_fn on_file,
+                 void *ctx)
+{
+    u64 i;
+
+    walk_init(w, worker_count, on_file, NULL, ctx);
+
+    for (i = 0; i < count; i++)
+    {
+        walk_push(&w->workers[i % worker_count], paths[i], 0, NULL);
+    }
+    free(paths);
+
+    walk_launch(w);
+}
+
+void
+walk_cancel(walk *w)
+{
+    w->cancel = 1;
+    walk_wait(w);
+}
+
+void
+walk_wait(walk *w)
+{
+    u64 i;
+
+    if (!w->started || w->joined)
+    {
+        return;
+    }
+
+    for (i = 0; i < w->worker_count; i++)
+    {
+        pthread_join(w->workers[i].thread, NULL);
+    }
+
+    w->joined = 1;
+}
+
+void
+walk_free(walk *w)
+{
+    walk_ignore *ignore;
+    u64 i;
+
+    if (!w->started)
+    {
+        return;
+    }
+
+    walk_cancel(w);
+
+    for (ignore = w->ignores; ignore != NULL; )
+    {
+        walk_ignore *next = ignore->next_alloc;
+
+        for (i = 0; i < ignore->count; i++)
+        {
+            free(ignore->patterns[i]);
+        }
+        free(ignore->patterns);
+        free(ignore->flags);
+        free(ignore->dir);
+        free(ignore);
+        ignore = next;
+    }
+
+    for (i = 0; i < w->worker_count; i++)
+    {
+        free(w->workers[i].jobs.items);
+        pthread_mutex_destroy(&w->workers[i].jobs.lock);
+    }
+    free(w->workers);
+    pthread_mutex_destroy(&w->lock);
+
+    memset(w, 0, sizeof(*w));
+}
+
+int
+walk_running(walk *w)
+{
+    return w->started && w->running > 0;
+}
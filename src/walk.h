@@ -0,0 +1,88 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <pthread.h>
+
+#include "base.h"
+
+#define WALK_MAX_THREADS 64
+
+/* The rules of one .gitignore, falling back to those of the directories above. */
+typedef struct walk_ignore
+{
+    struct walk_ignore *parent;
+    struct walk_ignore *next_alloc;
+    char *dir;
+    char **patterns;
+    u8 *flags;
+    u64 count;
+} walk_ignore;
+
+typedef struct
+{
+    char *path;
+    u8 is_dir;
+    walk_ignore *ignore;
+} walk_job;
+
+/*
+ * Jobs of one worker. The owner pushes and pops at the tail so it walks
+ * depth first, idle workers steal from the head where the big directories
+ * near the root are.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    walk_job *items;
+    u64 head;
+    u64 tail;
+    u64 capacity;
+} walk_deque;
+
+typedef struct walk walk;
+
+typedef struct
+{
+    walk *w;
+    u64 id;
+    walk_deque jobs;
+    pthread_t thread;
+} walk_worker;
+
+/* Called on a worker thread for each file not ignored, `worker` is its index. */
+typedef void (*walk_file_fn)(void *ctx, u64 worker, const char *path);
+typedef void (*walk_dir_fn)(void *ctx, const char *path, walk_ignore *ignore);
+
+struct walk
+{
+    walk_file_fn on_file;
+    walk_dir_fn on_dir;
+    void *ctx;
+
+    walk_worker *workers;
+    u64 worker_count;
+    /* jobs pushed and not finished yet, the walk is over at 0 */
+    volatile u64 pending;
+    volatile u64 cancel;
+    volatile u64 running;
+
+    pthread_mutex_t lock;
+    walk_ignore *ignores;
+
+    u8 started;
+    u8 joined;
+};
+
+u64 walk_worker_count(void);
+void walk_start(walk *w, string root, u64 worker_count, walk_file_fn on_file, walk_dir_fn on_dir,
+                void *ctx);
+void walk_start_files(walk *w, char **paths, u64 count, u64 worker_count, walk_file_fn on_file,
+                      void *ctx);
+void walk_cancel(walk *w);
+void walk_wait(walk *w);
+void walk_free(walk *w);
+int walk_running(walk *w);
+int walk_ignored(walk_ignore *ignore, const char *path, int is_dir);
+walk_ignore *walk_ignore_parse(walk_ignore *parent, const char *dir, string text);
+
+#endif
@@ -0,0 +1,616 @@
+#define _GNU_SOURCE
+
+#include "words.h"
+#include "search.h"
+#include "base.h"
+
+static void
+word_reserve(void **items, u64 *capacity, u64 needed, u64 size)
+{
+    u64 new_capacity = *capacity ? *capacity : 64;
+    void *grown;
+
+    if (needed <= *capacity)
+    {
+        return;
+    }
+
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    grown = realloc(*items, (size_t)(size * new_capacity));
+    if (grown == NULL)
+    {
+        fprintf(stderr, "[error] word_reserve unable to realloc\n");
+        exit(1);
+    }
+
+    *items = grown;
+    *capacity = new_capacity;
+}
+
+static int
+word_compare_text(const u8 *a, u64 a_len, const u8 *b, u64 b_len)
+{
+    int c = memcmp(a, b, (size_t)(a_len < b_len ? a_len : b_len));
+
+    if (c != 0)
+    {
+        return c;
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static u32
+word_hash(const u8 *s, u64 len)
+{
+    u32 h = 2166136261u;
+    u64 i;
+
+    for (i = 0; i < len; i++)
+    {
+        h = (h ^ s[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+/* The slot holding `s`, or the empty slot where it would go. */
+static u64
+word_index_slot(word_index *wi, const u8 *s, u64 len, u32 hash)
+{
+    u64 mask = wi->slot_count - 1;
+    u64 at = hash & mask;
+
+    for (;;)
+    {
+        u32 id = wi->slots[at];
+        word_entry *e;
+
+        if (id == 0)
+        {
+            return at;
+        }
+
+        e = &wi->entries[id - 1];
+        if (e->hash == hash && e->len == len && memcmp(wi->text + e->text, s, (size_t)len) == 0)
+        {
+            return at;
+        }
+
+        at = (at + 1) & mask;
+    }
+}
+
+static void
+word_index_grow_slots(word_index *wi)
+{
+    u64 count = wi->slot_count ? wi->slot_count * 2 : 1024;
+    u64 mask = count - 1;
+    u64 i;
+
+    free(wi->slots);
+    wi->slots = (u32 *)calloc((size_t)count, sizeof(u32));
+    if (wi->slots == NULL)
+    {
+        fprintf(stderr, "[error] word_index_grow_slots unable to alloc\n");
+        exit(1);
+    }
+    wi->slot_count = count;
+
+    for (i = 0; i < wi->entry_count; i++)
+    {
+        u64 at = wi->entries[i].hash & mask;
+
+        while (wi->slots[at] != 0)
+        {
+            at = (at + 1) & mask;
+        }
+        wi->slots[at] = (u32)(i + 1);
+    }
+}
+
+static void
+word_index_add(word_index *wi, const u8 *s, u64 len, s64 delta)
+{
+    u32 hash = word_hash(s, len);
+    u64 entry_capacity = wi->entry_capacity;
+    word_entry *e;
+    u64 at;
+
+    if ((wi->entry_count + 1) * 2 > wi->slot_count)
+    {
+        word_index_grow_slots(wi);
+    }
+
+    at = word_index_slot(wi, s, len, hash);
+    if (wi->slots[at] != 0)
+    {
+        e = &wi->entries[wi->slots[at] - 1];
+        if (delta > 0 || e->count > 0)
+        {
+            e->count = (u64)((s64)e->count + delta);
+        }
+        return;
+    }
+
+    /* taking back a word that was never counted, nothing to do */
+    if (delta < 0)
+    {
+        return;
+    }
+
+    word_reserve((void **)&wi->text, &wi->text_capacity, wi->text_len + len, 1);
+    word_reserve((void **)&wi->entries, &wi->entry_capacity, wi->entry_count + 1, sizeof(word_entry));
+    if (wi->entry_capacity != entry_capacity)
+    {
+        wi->order = (u32 *)realloc(wi->order, sizeof(u32) * (size_t)wi->entry_capacity);
+        if (wi->order == NULL)
+        {
+            fprintf(stderr, "[error] word_index_add unable to realloc\n");
+            exit(1);
+        }
+    }
+
+    memcpy(wi->text + wi->text_len, s, (size_t)len);
+    e = &wi->entries[wi->entry_count];
+    e->text = wi->text_len;
+    e->len = (u32)len;
+    e->hash = hash;
+    e->count = (u64)delta;
+    wi->text_len += len;
+
+    wi->order[wi->entry_count] = (u32)wi->entry_count;
+    wi->slots[at] = (u32)(wi->entry_count + 1);
+    wi->entry_count++;
+}
+
+static void
+word_index_add_word(word_index *wi, const u8 *s, u64 len, s64 delta)
+{
+    if (len >= WORD_INDEX_MIN_LEN && len <= WORD_INDEX_MAX_LEN)
+    {
+        word_index_add(wi, s, len, delta);
+    }
+}
+
+/*
+ * Counts each word that starts in [from, to) with `delta`, reading on to
+ * the end of the last one. Returns where it stopped, which is never inside
+ * a word.
+ */
+static u64
+word_index_walk(word_index *wi, u64 from, u64 to, s64 delta)
+{
+    u8 word[WORD_INDEX_MAX_LEN];
+    u64 len = 0;
+    u64 i = from;
+
+    while (i < wi->b->total_len)
+    {
+        u8 *data;
+        u64 n = buffer_span_at(wi->b, i, &data);
+        u64 k;
+
+        for (k = 0; k < n; k++, i++)
+        {
+            if (search_word_class[data[k]] == SEARCH_CLASS_KEYWORD)
+            {
+                if (len == 0 && i >= to)
+                {
+                    return i;
+                }
+
+                if (len < WORD_INDEX_MAX_LEN)
+                {
+                    word[len] = data[k];
+                }
+                len++;
+                continue;
+            }
+
+            if (len > 0)
+            {
+                word_index_add_word(wi, word, len, delta);
+                len = 0;
+            }
+
+            if (i >= to)
+            {
+                return i;
+            }
+        }
+    }
+
+    if (len > 0)
+    {
+        word_index_add_word(wi, word, len, delta);
+    }
+
+    return i;
+}
+
+static u64
+word_index_left(buffer_reader *r, u64 offset)
+{
+    while (offset > 0 && search_word_class[buffer_reader_byte(r, offset - 1)] == SEARCH_CLASS_KEYWORD)
+    {
+        offset--;
+    }
+
+    return offset;
+}
+
+static u64
+word_index_right(buffer_reader *r, u64 offset)
+{
+    while (offset < r->b->total_len && search_word_class[buffer_reader_byte(r, offset)] == SEARCH_CLASS_KEYWORD)
+    {
+        offset++;
+    }
+
+    return offset;
+}
+
+/*
+ * The words touched by changes[*i], and by the changes after it that share
+ * a word with it, as [*start, *end). Reads the text before the edit, or
+ * after it when `delta` is given, which then carries the shift of each
+ * change passed. Both read the same unchanged text between changes, so
+ * they group the changes alike.
+ */
+static void
+word_index_group(buffer_reader *r, buffer_change *changes, u64 count, u64 *i, s64 *delta,
+                 u64 *start, u64 *end)
+{
+    u64 first = *i;
+
+    while (*i < count)
+    {
+        buffer_change *c = &changes[*i];
+        u64 at = delta ? (u64)((s64)c->offset + *delta) : c->offset;
+        u64 len = delta ? c->new_len : c->old_len;
+        u64 left = word_index_left(r, at);
+        u64 right;
+
+        if (*i > first && left > *end)
+        {
+            return;
+        }
+
+        right = word_index_right(r, at + len);
+        if (*i == first)
+        {
+            *start = left;
+            *end = right;
+        }
+        else if (right > *end)
+        {
+            *end = right;
+        }
+
+        if (delta)
+        {
+            *delta += (s64)c->new_len - (s64)c->old_len;
+        }
+        (*i)++;
+    }
+}
+
+static u64
+word_index_change_len(buffer_change *changes, u64 count)
+{
+    u64 total = 0;
+    u64 i;
+
+    for (i = 0; i < count; i++)
+    {
+        total += changes[i].old_len + changes[i].new_len;
+    }
+
+    return total;
+}
+
+static void
+word_index_reset(word_index *wi)
+{
+    wi->scanned = 0;
+    wi->text_len = 0;
+    wi->entry_count = 0;
+    wi->sorted = 0;
+    if (wi->slots != NULL)
+    {
+        memset(wi->slots, 0, sizeof(u32) * (size_t)wi->slot_count);
+    }
+}
+
+/* Takes back the counted words the edit is about to change. */
+static void
+word_index_before_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    word_index *wi = (word_index *)ctx;
+    buffer_reader r;
+    u64 i = 0;
+
+    if (word_index_change_len(changes, count) > WORD_INDEX_RESET_LEN)
+    {
+        word_index_reset(wi);
+        return;
+    }
+
+    buffer_reader_init(&r, b);
+    while (i < count)
+    {
+        u64 start;
+        u64 end;
+
+        word_index_group(&r, changes, count, &i, NULL, &start, &end);
+        if (end <= wi->scanned)
+        {
+            word_index_walk(wi, start, end, -1);
+            continue;
+        }
+
+        /* the scan stops short of the group, it is read again later */
+        if (start < wi->scanned)
+        {
+            word_index_walk(wi, start, wi->scanned, -1);
+            wi->scanned = start;
+        }
+        break;
+    }
+}
+
+/* Counts the words the edit made where it took words back, and shifts the scan. */
+static void
+word_index_on_change(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    word_index *wi = (word_index *)ctx;
+    buffer_reader r;
+    s64 delta = 0;
+    s64 shift = 0;
+    u64 i = 0;
+
+    if (word_index_change_len(changes, count) > WORD_INDEX_RESET_LEN)
+    {
+        return;
+    }
+
+    buffer_reader_init(&r, b);
+    while (i < count)
+    {
+        u64 start;
+        u64 end;
+
+        word_index_group(&r, changes, count, &i, &delta, &start, &end);
+        if ((u64)((s64)end - delta) > wi->scanned)
+        {
+            break;
+        }
+
+        word_index_walk(wi, start, end, 1);
+        shift = delta;
+    }
+
+    wi->scanned = (u64)((s64)wi->scanned + shift);
+}
+
+void
+word_index_init(word_index *wi, buffer *b)
+{
+    memset(wi, 0, sizeof(*wi));
+    wi->b = b;
+    buffer_add_edit_listener(b, word_index_before_change, word_index_on_change, wi);
+}
+
+void
+word_index_free(word_index *wi)
+{
+    buffer_remove_listener(wi->b, word_index_on_change, wi);
+    free(wi->text);
+    free(wi->entries);
+    free(wi->slots);
+    free(wi->order);
+    memset(wi, 0, sizeof(*wi));
+}
+
+/* Counts the next `budget` bytes or so, returns 0 when there were none left. */
+int
+word_index_scan(word_index *wi, u64 budget)
+{
+    u64 to;
+
+    if (wi->scanned >= wi->b->total_len)
+    {
+        return 0;
+    }
+
+    to = wi->b->total_len - wi->scanned > budget ? wi->scanned + budget : wi->b->total_len;
+    wi->scanned = word_index_walk(wi, wi->scanned, to, 1);
+    return 1;
+}
+
+int
+word_index_complete(word_index *wi)
+{
+    return wi->scanned >= wi->b->total_len;
+}
+
+u64
+word_index_count(word_index *wi, string word)
+{
+    u64 at;
+
+    if (wi->slot_count == 0)
+    {
+        return 0;
+    }
+
+    at = word_index_slot(wi, word.s, word.len, word_hash(word.s, word.len));
+    return wi->slots[at] ? wi->entries[wi->slots[at] - 1].count : 0;
+}
+
+static int
+word_index_compare_ids(const void *a, const void *b, void *ctx)
+{
+    word_index *wi = (word_index *)ctx;
+    word_entry *x = &wi->entries[*(const u32 *)a];
+    word_entry *y = &wi->entries[*(const u32 *)b];
+
+    return word_compare_text(wi->text + x->text, x->len, wi->text + y->text, y->len);
+}
+
+/* Sorts the words interned since the last query and merges them into `order`. */
+static void
+word_index_sort(word_index *wi)
+{
+    u64 added = wi->entry_count - wi->sorted;
+    u32 *merged;
+    u64 i = 0;
+    u64 j = wi->sorted;
+    u64 k = 0;
+
+    if (added == 0)
+    {
+        return;
+    }
+
+    qsort_r(wi->order + wi->sorted, (size_t)added, sizeof(u32), word_index_compare_ids, wi);
+
+    merged = (u32 *)malloc(sizeof(u32) * (size_t)wi->entry_count);
+    if (merged == NULL)
+    {
+        fprintf(stderr, "[error] word_index_sort unable to alloc\n");
+        exit(1);
+    }
+
+    while (i < wi->sorted || j < wi->entry_count)
+    {
+        if (j == wi->entry_count ||
+            (i < wi->sorted && word_index_compare_ids(&wi->order[i], &wi->order[j], wi) <= 0))
+        {
+            merged[k++] = wi->order[i++];
+        }
+        else
+        {
+            merged[k++] = wi->order[j++];
+        }
+    }
+
+    memcpy(wi->order, merged, sizeof(u32) * (size_t)wi->entry_count);
+    free(merged);
+    wi->sorted = wi->entry_count;
+}
+
+static void
+word_list_add(word_list *wl, const u8 *s, u64 len)
+{
+    word_reserve((void **)&wl->text, &wl->text_capacity, wl->text_len + len, 1);
+    word_reserve((void **)&wl->items, &wl->capacity, wl->count + 1, sizeof(word_candidate));
+
+    memcpy(wl->text + wl->text_len, s, (size_t)len);
+    wl->items[wl->count].text = wl->text_len;
+    wl->items[wl->count].len = len;
+    wl->text_len += len;
+    wl->count++;
+}
+
+/* Adds the first `max` words by name that occur in the buffer and extend `prefix`. */
+void
+word_index_matches(word_index *wi, string prefix, word_list *out, u64 max)
+{
+    u64 lo = 0;
+    u64 hi;
+    u64 added = 0;
+
+    word_index_sort(wi);
+
+    hi = wi->sorted;
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+        word_entry *e = &wi->entries[wi->order[mid]];
+
+        if (word_compare_text(wi->text + e->text, e->len, prefix.s, prefix.len) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    for (; lo < wi->sorted && added < max; lo++)
+    {
+        word_entry *e = &wi->entries[wi->order[lo]];
+
+        if (e->len < prefix.len || memcmp(wi->text + e->text, prefix.s, (size_t)prefix.len) != 0)
+        {
+            break;
+        }
+
+        if (e->count > 0 && e->len > prefix.len)
+        {
+            word_list_add(out, wi->text + e->text, e->len);
+            added++;
+        }
+    }
+}
+
+static int
+word_list_compare(const void *a, const void *b, void *ctx)
+{
+    word_list *wl = (word_list *)ctx;
+    const word_candidate *x = (const word_candidate *)a;
+    const word_candidate *y = (const word_candidate *)b;
+
+    return word_compare_text(wl->text + x->text, x->len, wl->text + y->text, y->len);
+}
+
+/* Sorts what the indexes added, drops repeats and keeps the first `max`. */
+void
+word_list_finish(word_list *wl, u64 max)
+{
+    u64 kept = 0;
+    u64 i;
+
+    if (wl->count > 1)
+    {
+        qsort_r(wl->items, (size_t)wl->count, sizeof(word_candidate), word_list_compare, wl);
+    }
+
+    for (i = 0; i < wl->count && kept < max; i++)
+    {
+        if (kept == 0 || word_list_compare(&wl->items[kept - 1], &wl->items[i], wl) != 0)
+        {
+            wl->items[kept++] = wl->items[i];
+        }
+    }
+
+    wl->count = kept;
+}
+
+string
+word_list_get(word_list *wl, u64 i)
+{
+    return (string){.s = wl->text + wl->items[i].text, .len = wl->items[i].len};
+}
+
+void
+word_list_clear(word_list *wl)
+{
+    wl->text_len = 0;
+    wl->count = 0;
+}
+
+void
+word_list_free(word_list *wl)
+{
+    free(wl->text);
+    free(wl->items);
+    memset(wl, 0, sizeof(*wl));
+}
@@ -0,0 +1,83 @@
+#ifndef WORDS_H
+#define WORDS_H
+
+#include "base.h"
+#include "buffer.h"
+
+/* bytes scanned per call to word_index_scan */
+#define WORD_INDEX_SCAN_CHUNK MB(4)
+/* shorter and longer keywords are not worth offering */
+#define WORD_INDEX_MIN_LEN 2
+#define WORD_INDEX_MAX_LEN 128
+/* edits larger than this drop the counts, the buffer is scanned again */
+#define WORD_INDEX_RESET_LEN MB(8)
+
+typedef struct
+{
+    /* offset in `text` */
+    u64 text;
+    u32 len;
+    u32 hash;
+    u64 count;
+} word_entry;
+
+/*
+ * Every keyword of a buffer, interned once with the number of times it
+ * occurs. The buffer is counted up to `scanned` in the background, edits
+ * take back the words around the text they remove and count the ones
+ * around the text they add, so nothing is read twice. Words whose count
+ * drops to zero stay interned and are skipped by queries.
+ */
+typedef struct
+{
+    buffer *b;
+    /* [0, scanned) is counted, no word straddles it */
+    u64 scanned;
+
+    u8 *text;
+    u64 text_len;
+    u64 text_capacity;
+
+    word_entry *entries;
+    u64 entry_count;
+    u64 entry_capacity;
+
+    /* open addressing, entry index + 1 and 0 for an empty slot */
+    u32 *slots;
+    u64 slot_count;
+
+    /* entry indexes by name, the ones past `sorted` are merged in by the next query */
+    u32 *order;
+    u64 sorted;
+} word_index;
+
+typedef struct
+{
+    u64 text;
+    u64 len;
+} word_candidate;
+
+/* Completions gathered from several indexes, copied out of them. */
+typedef struct
+{
+    u8 *text;
+    u64 text_len;
+    u64 text_capacity;
+
+    word_candidate *items;
+    u64 count;
+    u64 capacity;
+} word_list;
+
+void word_index_init(word_index *wi, buffer *b);
+void word_index_free(word_index *wi);
+int word_index_scan(word_index *wi, u64 budget);
+int word_index_complete(word_index *wi);
+u64 word_index_count(word_index *wi, string word);
+void word_index_matches(word_index *wi, string prefix, word_list *out, u64 max);
+void word_list_finish(word_list *wl, u64 max);
+string word_list_get(word_list *wl, u64 i);
+void word_list_clear(word_list *wl);
+void word_list_free(word_list *wl);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TESTS_ALLOC_COUNT_H
+#define TESTS_ALLOC_COUNT_H
+
+#include <stdlib.h>
+
+#include "../src/base.h"
+
+/*
+ * Included before the sources, so every malloc, calloc and realloc they
+ * make is counted. Tests read the count around code that should make none.
+ */
+static u64 test_alloc_count;
+
+static void *
+test_count_malloc(size_t size)
+{
+    test_alloc_count++;
+    return malloc(size);
+}
+
+static void *
+test_count_calloc(size_t count, size_t size)
+{
+    test_alloc_count++;
+    return calloc(count, size);
+}
+
+static void *
+test_count_realloc(void *p, size_t size)
+{
+    test_alloc_count++;
+    return realloc(p, size);
+}
+
+#define malloc(size) test_count_malloc(size)
+#define calloc(count, size) test_count_calloc(count, size)
+#define realloc(p, size) test_count_realloc(p, size)
+
+#endif
@@ -1,3 +1,8 @@
+#ifndef TESTS_COMMON_H
+#define TESTS_COMMON_H
+
+#include <stdio.h>
+
 #include "../src/buffer.h"
 
 static void
@@ -17,21 +22,75 @@ test_buffer_init(buffer *b, const char *text)
 static void
 test_buffer_free(buffer *b)
 {
-    if (b->pieces.items != NULL)
-    {
-        free(b->pieces.items);
-    }
+    buffer_free(b);
+    b->add.len = 0;
+}
 
-    if (b->add.s != NULL)
+/* Writes `len` bytes to `path`, replacing what it held. */
+static void
+test_write_bytes(const char *path, const char *data, u64 len)
+{
+    FILE *f = fopen(path, "wb");
+
+    ASSERT(f != NULL);
+    ASSERT(fwrite(data, 1, (size_t)len, f) == len);
+    fclose(f);
+}
+
+/* Writes `text` to `name` under `dir`. */
+static void
+test_write_file(const char *dir, const char *name, const char *text)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    test_write_bytes(path, text, strlen(text));
+}
+
+/* Runs after each edit of test_buffer_edit_randomly, `at` being where it landed. */
+typedef void (*test_edit_fn)(buffer *b, u64 step, u64 at, void *ctx);
+
+/*
+ * `count` edits at random offsets of `b`, each one inserting one of
+ * `words`, deleting up to `max_delete` bytes or applying a pair of edits
+ * at once. `check` compares the index under test with the text after each.
+ */
+static void
+test_buffer_edit_randomly(buffer *b, const char **words, u64 word_count, u64 max_delete, u64 count,
+                          test_edit_fn check, void *ctx)
+{
+    u64 i;
+
+    for (i = 0; i < count; i++)
     {
-        free(b->add.s);
-    }
+        u64 total = b->total_len;
+        u64 at = (u64)rand() % (total + 1);
+        const char *w = words[rand() % word_count];
+        string text = {.s = (u8 *)w, .len = strlen(w)};
 
-    b->pieces.items = NULL;
-    b->pieces.count = 0;
-    b->pieces.capacity = 0;
-    b->add.s = NULL;
-    b->add.len = 0;
-    b->add_capacity = 0;
+        if (rand() % 3 == 0 && at < total)
+        {
+            buffer_delete(b, at, 1 + (u64)rand() % (total - at < max_delete ? total - at : max_delete));
+        }
+        else if (rand() % 4 == 0)
+        {
+            buffer_edit edits[2];
+
+            edits[0].offset = at / 2;
+            edits[0].delete_len = at / 2 < at ? 1 : 0;
+            edits[0].text = text;
+            edits[1].offset = at;
+            edits[1].delete_len = 0;
+            edits[1].text = text;
+            buffer_apply_edits(b, edits, 2);
+        }
+        else
+        {
+            buffer_insert(b, at, text);
+        }
+
+        check(b, i, at, ctx);
+    }
 }
 
+#endif
@@ -1,14 +1,78 @@
+#define _GNU_SOURCE
+#define MEM_TRACKING
+
 #include "../src/editor.h"
 
 editor E;
 
+#include "alloc_count.h"
+
+#include "../src/arena.c"
+#include "../src/mem.c"
 #include "../src/buffer.c"
 #include "../src/funcs.c"
+#include "../src/file.c"
+#include "../src/registers.c"
+#include "../src/search.c"
+#include "../src/regex.c"
+#include "../src/match_index.c"
+#include "../src/walk.c"
+#include "../src/grep.c"
+#include "../src/path_index.c"
+#include "../src/fuzzy.c"
+#include "../src/trigram.c"
+#include "../src/subst.c"
+#include "../src/global.c"
+#include "../src/bracket.c"
+#include "../src/line_class.c"
+#include "../src/syntax.c"
+#include "../src/symbols.c"
+#include "../src/words.c"
+#include "../src/json.c"
+#include "../src/lsp.c"
+#include "test_arena.c"
+#include "test_mem.c"
+#include "test_buffer.c"
 #include "test_funcs.c"
+#include "test_registers.c"
+#include "test_search.c"
+#include "test_regex.c"
+#include "test_match_index.c"
+#include "test_grep.c"
+#include "test_fuzzy.c"
+#include "test_trigram.c"
+#include "test_subst.c"
+#include "test_global.c"
+#include "test_bracket.c"
+#include "test_line_class.c"
+#include "test_syntax.c"
+#include "test_symbols.c"
+#include "test_words.c"
+#include "test_lsp.c"
+#include "test_alloc.c"
 
 int main()
 {
     printf("[starting tests]\n");
+    test_arena_init();
+    test_mem_init();
+    test_buffer_tests_init();
     test_funcs_init();
+    test_registers_init();
+    test_search_init();
+    test_regex_init();
+    test_match_index_init();
+    test_grep_init();
+    test_fuzzy_init();
+    test_trigram_init();
+    test_subst_init();
+    test_global_init();
+    test_bracket_init();
+    test_line_class_init();
+    test_syntax_init();
+    test_symbols_init();
+    test_words_init();
+    test_lsp_init();
+    test_alloc_init();
     return 0;
 }
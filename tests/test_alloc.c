@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "alloc_count.h"
+#include "../src/arena.h"
+#include "../src/buffer.h"
+#include "../src/match_index.h"
+#include "../src/bracket.h"
+#include "../src/line_class.h"
+#include "../src/syntax.h"
+#include "../src/words.h"
+#include "../src/base.h"
+
+static void
+test_alloc_slices()
+{
+    arena scratch = new_arena(MB(16));
+    arena_checkpoint frame = arena_save(&scratch);
+    buffer b = {0};
+    string s;
+    u64 before;
+    u64 i;
+
+    test_buffer_init(&b, "one\ntwo\nthree\n");
+    buffer_insert(&b, 4, (string){.s = (u8 *)"TWO ", .len = 4});
+
+    before = test_alloc_count;
+    s = buffer_slice_arena(&b, &scratch, 2, 8);
+    ASSERT(s.len == 8 && memcmp(s.s, "e\nTWO tw", 8) == 0);
+    s = buffer_to_string_arena(&b, &scratch);
+    ASSERT(s.len == 18 && memcmp(s.s, "one\nTWO two\nthree\n", 18) == 0);
+    ASSERT(buffer_slice_arena(&b, &scratch, 18, 0).len == 0);
+
+    /* the frames of a session reuse the same committed pages */
+    for (i = 0; i < 1000; i++)
+    {
+        arena_restore(&scratch, frame);
+        buffer_to_string_arena(&b, &scratch);
+    }
+    ASSERT(test_alloc_count == before);
+    ASSERT(scratch.cur_pos == 18);
+
+    arena_release(&scratch);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_alloc_slices");
+}
+
+/* Types `n` keys at `at` with a backspace now and then, returns where the cursor ends. */
+static u64
+test_alloc_type(buffer *b, syntax_index *si, u64 at, u64 n)
+{
+    u64 line = b->lines.count / 2;
+    u64 i;
+
+    for (i = 0; i < n; i++)
+    {
+        u8 c = (u8)"ab cd_(e)\n{x} \"f\" /*g*/"[i % 22];
+
+        buffer_insert(b, at++, (string){.s = &c, .len = 1});
+        if (i % 50 == 49)
+        {
+            buffer_delete(b, --at, 1);
+        }
+
+        /* as drawing the line does */
+        syntax_state_at(si, line + 1);
+    }
+
+    return at;
+}
+
+/* Typing into a buffer with every index the editor keeps, once their arrays have grown. */
+static void
+test_alloc_keystroke()
+{
+    const char *line = "    if (x[i] == '(') { total += f(x, \"{\"); } /* y */\n";
+    u64 lines = 2000;
+    char *text = (char *)malloc((size_t)lines * strlen(line) + 1);
+    buffer b = {0};
+    match_index mi;
+    bracket_index bi;
+    line_class_index lc;
+    syntax_index si;
+    word_index wi;
+    u64 before;
+    u64 start;
+    u64 end;
+    u64 pad;
+    u64 out;
+    u64 i;
+
+    for (i = 0; i < lines; i++)
+    {
+        memcpy(text + i * strlen(line), line, strlen(line));
+    }
+    text[lines * strlen(line)] = '\0';
+
+    test_buffer_init(&b, text);
+    b.file_path = (string){.s = (u8 *)"typing.c", .len = 8};
+    match_index_init(&mi, &b);
+    bracket_index_init(&bi, &b);
+    line_class_init(&lc, &b);
+    syntax_index_init(&si, &b);
+    word_index_init(&wi, &b);
+
+    ASSERT(match_index_set_pattern(&mi, (string){.s = (u8 *)"total", .len = 5}, 0));
+    while (match_index_scan(&mi, MATCH_INDEX_SCAN_CHUNK))
+    {
+    }
+    while (word_index_scan(&wi, MB(1)))
+    {
+    }
+    bracket_index_match(&bi, 7, &out);
+    line_class_count(&lc);
+    syntax_state_at(&si, lines / 2);
+
+    /* a first run grows what typing grows and interns the words it makes */
+    start = buffer_line_start(&b, lines / 2) + 10;
+    end = test_alloc_type(&b, &si, start, 400);
+    buffer_delete(&b, start, end - start);
+
+    /* and the add buffer doubles past what the measured run appends */
+    pad = KB(4) + 1 - b.add.len;
+    buffer_insert(&b, 0, (string){.s = (u8 *)text, .len = pad});
+    buffer_delete(&b, 0, pad);
+    ASSERT(b.add_capacity - b.add.len >= 400);
+
+    /* typing the same again allocates nothing */
+    before = test_alloc_count;
+    end = test_alloc_type(&b, &si, start, 400);
+    ASSERT(test_alloc_count == before);
+    ASSERT(bracket_index_match(&bi, start + 6, &out) && out == start + 8);
+
+    word_index_free(&wi);
+    syntax_index_free(&si);
+    line_class_free(&lc);
+    bracket_index_free(&bi);
+    match_index_free(&mi);
+    test_buffer_free(&b);
+    free(text);
+    printf("%s... OK\n", "test_alloc_keystroke");
+}
+
+static void
+test_alloc_init()
+{
+    test_alloc_slices();
+    test_alloc_keystroke();
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/arena.h"
+#include "../src/base.h"
+
+static void
+test_arena_growth()
+{
+    arena a = new_arena(MB(8));
+    u8 *first = (u8 *)arena_push(&a, 3);
+    u64 *aligned;
+    u8 *big;
+    u64 i;
+
+    ASSERT(a.reserved == MB(8) && a.committed == ARENA_COMMIT_SIZE);
+    memcpy(first, "abc", 3);
+
+    aligned = (u64 *)arena_push_aligned(&a, sizeof(u64) * 4, 8);
+    ASSERT(((u64)aligned & 7) == 0 && (u8 *)aligned == first + 8);
+
+    /* growing past what is committed commits more without moving anything */
+    big = (u8 *)arena_push(&a, ARENA_COMMIT_SIZE * 3 + 5);
+    memset(big, 0x5a, ARENA_COMMIT_SIZE * 3 + 5);
+    ASSERT(a.committed == ARENA_COMMIT_SIZE * 4);
+    ASSERT(memcmp(a.data, "abc", 3) == 0 && first == a.data);
+
+    for (i = 0; i < 1000; i++)
+    {
+        arena_push_array(&a, (u8 *)"0123456789", 10);
+    }
+    ASSERT(memcmp(a.data + a.cur_pos - 10, "0123456789", 10) == 0);
+    ASSERT(big[ARENA_COMMIT_SIZE * 3 + 4] == 0x5a);
+
+    arena_release(&a);
+    ASSERT(a.data == NULL && a.cur_pos == 0);
+    printf("%s... OK\n", "test_arena_growth");
+}
+
+static void
+test_arena_checkpoints()
+{
+    arena a = new_arena(MB(1));
+    arena_checkpoint outer;
+    arena_checkpoint inner;
+    u8 *kept;
+    u8 *temp;
+
+    kept = (u8 *)arena_push(&a, 16);
+    outer = arena_save(&a);
+    temp = (u8 *)arena_push(&a, KB(200));
+    inner = arena_save(&a);
+    arena_push(&a, 100);
+
+    /* scopes unwind in order, the space after a checkpoint is handed out again */
+    arena_restore(&a, inner);
+    ASSERT(a.cur_pos == 16 + KB(200));
+    arena_restore(&a, outer);
+    ASSERT(a.cur_pos == 16 && (u8 *)arena_push(&a, 1) == temp);
+
+    /* a checkpoint past the current end, already unwound, changes nothing */
+    arena_restore(&a, inner);
+    ASSERT(a.cur_pos == 17);
+
+    arena_reset(&a);
+    ASSERT(a.cur_pos == 0 && (u8 *)arena_push(&a, 1) == kept);
+
+    arena_release(&a);
+    printf("%s... OK\n", "test_arena_checkpoints");
+}
+
+static void
+test_arena_init()
+{
+    test_arena_growth();
+    test_arena_checkpoints();
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/bracket.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* The index kept up to date across edits must pair every offset as one built from scratch. */
+static void
+test_bracket_check(buffer *b, bracket_index *bi)
+{
+    bracket_index fresh;
+    u64 i;
+
+    bracket_index_init(&fresh, b);
+    fresh.lex = 1;
+
+    for (i = 0; i < b->total_len; i++)
+    {
+        u64 got = 0;
+        u64 expected = 0;
+        int found = bracket_index_match(&fresh, i, &expected);
+
+        ASSERT(bracket_index_match(bi, i, &got) == found);
+        ASSERT(!found || got == expected);
+    }
+
+    bracket_index_free(&fresh);
+}
+
+static void
+test_bracket_cases()
+{
+    buffer b = {0};
+    bracket_index bi;
+    const char *text = "f(a[1], \"(\", ')') /* ( */ {\n  g(x); // }\n}\n";
+    u64 out = 0;
+    u64 start = 0;
+    u64 end = 0;
+
+    test_buffer_init(&b, text);
+    bracket_index_init(&bi, &b);
+    bi.lex = 1;
+
+    ASSERT(bracket_index_match(&bi, 1, &out) && out == 16);
+    ASSERT(bracket_index_match(&bi, 16, &out) && out == 1);
+    ASSERT(bracket_index_match(&bi, 3, &out) && out == 5);
+    ASSERT(bracket_index_match(&bi, 26, &out) && out == 41);
+    ASSERT(!bracket_index_match(&bi, 9, &out));
+    ASSERT(!bracket_index_match(&bi, 21, &out));
+    ASSERT(bracket_index_next(&bi, 17, 40, &out) && out == 26);
+
+    ASSERT(bracket_index_enclosing(&bi, 4, '(', 1, &start, &end) && start == 1 && end == 16);
+    ASSERT(bracket_index_enclosing(&bi, 32, '(', 1, &start, &end) && start == 31 && end == 33);
+    ASSERT(bracket_index_enclosing(&bi, 32, '{', 1, &start, &end) && start == 26 && end == 41);
+    ASSERT(!bracket_index_enclosing(&bi, 32, '(', 2, &start, &end));
+
+    /* the new comment runs to the old one's end, and is gone again once deleted */
+    buffer_insert(&b, 0, (string){.s = (u8 *)"/*", .len = 2});
+    ASSERT(!bracket_index_match(&bi, 3, &out));
+    ASSERT(bracket_index_match(&bi, 28, &out) && out == 43);
+    buffer_delete(&b, 0, 2);
+    ASSERT(bracket_index_match(&bi, 1, &out) && out == 16);
+    test_bracket_check(&b, &bi);
+
+    bracket_index_free(&bi);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_bracket_cases");
+}
+
+static void
+test_bracket_after_edit(buffer *b, u64 step, u64 at, void *ctx)
+{
+    if (step % 5 == 0)
+    {
+        test_bracket_check(b, (bracket_index *)ctx);
+    }
+}
+
+static void
+test_bracket_edits()
+{
+    const char *words[] = {"(", ")", "{", "}", "[", "]", "\n", "x", "/*", "*/", "\"", "//", "'"};
+    buffer b = {0};
+    bracket_index bi;
+
+    srand(17);
+    test_buffer_init(&b, "int f(int a[2]) {\n    if (a[0]) { g(\"}\"); }\n    /* ) */ return (a[1]);\n}\n");
+    bracket_index_init(&bi, &b);
+    bi.lex = 1;
+    test_bracket_check(&b, &bi);
+
+    test_buffer_edit_randomly(&b, words, 13, 5, 400, test_bracket_after_edit, &bi);
+
+    test_bracket_check(&b, &bi);
+    bracket_index_free(&bi);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_bracket_edits");
+}
+
+static void
+test_bracket_init()
+{
+    test_bracket_cases();
+    test_bracket_edits();
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* Checks contents and every line start against a flat copy of the text. */
+static void
+test_buffer_check(buffer *b, const char *expected, u64 len)
+{
+    string out = buffer_to_string(b);
+    u64 line = 0;
+    u64 i;
+
+    ASSERT(out.len == len);
+    ASSERT(b->total_len == len);
+    ASSERT(memcmp(out.s, expected, len) == 0);
+
+    ASSERT(buffer_line_start(b, 0) == 0);
+    for (i = 0; i < len; i++)
+    {
+        if (expected[i] == '\n')
+        {
+            line++;
+            ASSERT(buffer_line_start(b, line) == i + 1);
+        }
+    }
+    ASSERT(b->lines.count == line + 1);
+
+    free(out.s);
+}
+
+static void
+test_buffer_random_edits()
+{
+    buffer b = {0};
+    char model[4096];
+    u64 model_len;
+    u64 i;
+    const char *seed_text = "alpha\nbeta\ngamma\n";
+    const char *words[] = {"x", "\n", "yz\n", "\n\nq", "lorem ipsum"};
+
+    srand(7);
+    test_buffer_init(&b, seed_text);
+    model_len = strlen(seed_text);
+    memcpy(model, seed_text, model_len);
+
+    for (i = 0; i < 2000; i++)
+    {
+        int op = rand() % 3;
+        u64 at = model_len ? (u64)rand() % (model_len + 1) : 0;
+        const char *w = words[rand() % 5];
+        string text = {.s = (u8 *)w, .len = strlen(w)};
+        u64 len = 0;
+
+        if (op != 0 && at < model_len)
+        {
+            len = (u64)rand() % (model_len - at + 1);
+            if (len > 16)
+            {
+                len = 16;
+            }
+        }
+
+        if (model_len + text.len >= sizeof(model))
+        {
+            op = 1;
+        }
+
+        if (op == 0)
+        {
+            buffer_insert(&b, at, text);
+            memmove(model + at + text.len, model + at, model_len - at);
+            memcpy(model + at, w, text.len);
+            model_len += text.len;
+        }
+        else if (op == 1)
+        {
+            buffer_delete(&b, at, len);
+            memmove(model + at, model + at + len, model_len - at - len);
+            model_len -= len;
+        }
+        else
+        {
+            buffer_replace(&b, at, len, text);
+            memmove(model + at + text.len, model + at + len, model_len - at - len);
+            memcpy(model + at, w, text.len);
+            model_len = model_len - len + text.len;
+        }
+
+        test_buffer_check(&b, model, model_len);
+    }
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_buffer_random_edits");
+}
+
+static void
+test_buffer_reader()
+{
+    buffer b = {0};
+    buffer_reader r;
+    string text = {.s = (u8 *)"XY", .len = 2};
+    u64 line;
+    u64 col;
+
+    test_buffer_init(&b, "abc\ndef");
+    buffer_insert(&b, 5, text);
+
+    buffer_reader_init(&r, &b);
+    ASSERT(buffer_reader_byte(&r, 0) == 'a');
+    ASSERT(buffer_reader_byte(&r, 5) == 'X');
+    ASSERT(buffer_reader_byte(&r, 7) == 'e');
+    ASSERT(buffer_reader_byte(&r, 4) == 'd');
+
+    buffer_offset_to_line_col(&b, 6, &line, &col);
+    ASSERT(line == 1 && col == 2);
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_buffer_reader");
+}
+
+/* A batch must leave the same text as applying its edits back to front. */
+static void
+test_buffer_apply_edits()
+{
+    buffer b = {0};
+    buffer one_by_one = {0};
+    buffer_edit edits[8];
+    string expected;
+    u64 round;
+    u64 i;
+    const char *words[] = {"", "x", "\n", "ab\ncd", "\n\n"};
+
+    srand(11);
+    test_buffer_init(&b, "one\ntwo\nthree\nfour\nfive\nsix\n");
+    test_buffer_init(&one_by_one, "one\ntwo\nthree\nfour\nfive\nsix\n");
+
+    for (round = 0; round < 300; round++)
+    {
+        u64 count = 1 + (u64)rand() % 8;
+        u64 at = 0;
+        u64 n = 0;
+
+        for (i = 0; i < count && at <= b.total_len; i++)
+        {
+            const char *w = words[rand() % 5];
+            u64 room = b.total_len - at;
+
+            edits[n].offset = at + (room ? (u64)rand() % (room / 2 + 1) : 0);
+            room = b.total_len - edits[n].offset;
+            edits[n].delete_len = room ? (u64)rand() % (room < 4 ? room + 1 : 4) : 0;
+            edits[n].text = (string){.s = (u8 *)w, .len = strlen(w)};
+            at = edits[n].offset + edits[n].delete_len + 1;
+            n++;
+        }
+
+        buffer_apply_edits(&b, edits, n);
+        for (i = n; i > 0; i--)
+        {
+            buffer_replace(&one_by_one, edits[i - 1].offset, edits[i - 1].delete_len, edits[i - 1].text);
+        }
+
+        expected = buffer_to_string(&one_by_one);
+        test_buffer_check(&b, (char *)expected.s, expected.len);
+        free(expected.s);
+    }
+
+    test_buffer_free(&b);
+    test_buffer_free(&one_by_one);
+    printf("%s... OK\n", "test_buffer_apply_edits");
+}
+
+static void
+test_buffer_tests_init()
+{
+    test_buffer_random_edits();
+    test_buffer_reader();
+    test_buffer_apply_edits();
+}
@@ -97,6 +97,206 @@ test_insert_below_current_line()
     printf("%s... OK\n", "test_insert_below_current_line");
 }
 
+static void
+test_change_case_range()
+{
+    buffer b = {0};
+    string out;
+    const char *expected = "FOO bar BAZ";
+
+    test_buffer_init(&b, "foo bar baz");
+
+    change_case_range(&b, 0, 3, CASE_UPPER);
+    change_case_range(&b, 4, 7, CASE_TOGGLE);
+    change_case_range(&b, 4, 3, CASE_LOWER);
+
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(expected));
+    ASSERT(memcmp(out.s, expected, out.len) == 0);
+
+    free(out.s);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_change_case_range");
+}
+
+static void
+test_indent_lines()
+{
+    buffer b = {0};
+    string out;
+    const char *expected = "a\n    b\n\n    c\nd";
+
+    test_buffer_init(&b, "a\nb\n\nc\nd");
+
+    indent_lines(&b, 1, 3, 1);
+
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(expected));
+    ASSERT(memcmp(out.s, expected, out.len) == 0);
+    ASSERT(b.lines.count == 5);
+    free(out.s);
+
+    dedent_lines(&b, 0, 4, 1);
+
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen("a\nb\n\nc\nd"));
+    ASSERT(memcmp(out.s, "a\nb\n\nc\nd", out.len) == 0);
+
+    free(out.s);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_indent_lines");
+}
+
+static void
+test_block_edits()
+{
+    buffer b = {0};
+    block_range r = {.first_line = 0, .last_line = 2, .left = 1, .right = 2};
+    string text;
+    string out;
+    const char *after_delete = "a\nd\ng\nz";
+    const char *after_put = "a  bc\nd  ef\ng  h\nz";
+    const char *after_insert = "a--  bc\nd--  ef\ng--  h\nz";
+
+    test_buffer_init(&b, "abc\ndef\ngh\nz");
+
+    block_text(&b, r, &text);
+    ASSERT(text.len == 7);
+    ASSERT(memcmp(text.s, "bc\nef\nh", 7) == 0);
+
+    delete_block(&b, r);
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(after_delete));
+    ASSERT(memcmp(out.s, after_delete, out.len) == 0);
+    free(out.s);
+
+    /* every line is shorter than column 3 and gets padded */
+    put_block(&b, 0, 3, text);
+    free(text.s);
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(after_put));
+    ASSERT(memcmp(out.s, after_put, out.len) == 0);
+    free(out.s);
+
+    text = (string){.s = (u8 *)"--", .len = 2};
+    insert_block(&b, 0, 2, 1, text, 0);
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(after_insert));
+    ASSERT(memcmp(out.s, after_insert, out.len) == 0);
+    ASSERT(b.lines.count == 4);
+    ASSERT(buffer_line_start(&b, 3) == strlen(after_insert) - 1);
+    free(out.s);
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_block_edits");
+}
+
+static int
+test_funcs_text_is(buffer *b, const char *expected)
+{
+    string out = buffer_to_string(b);
+    int same = out.len == strlen(expected) && memcmp(out.s, expected, out.len) == 0;
+
+    if (!same)
+    {
+        fprintf(stderr, "expected \"%s\", got \"%.*s\"\n", expected, (int)out.len, (char *)out.s);
+    }
+
+    free(out.s);
+    return same;
+}
+
+/* Runs move_lines on `text` and compares with `expected`, and where the lines went. */
+static void
+test_move_lines_case(const char *text, u64 first, u64 last, u64 dest, const char *expected, u64 moved_at)
+{
+    buffer b = {0};
+    u64 moved;
+
+    test_buffer_init(&b, text);
+    ASSERT(move_lines(&b, first, last, dest, &moved));
+    ASSERT(test_funcs_text_is(&b, expected));
+    ASSERT(moved == moved_at);
+    test_buffer_free(&b);
+}
+
+static void
+test_line_ranges()
+{
+    buffer b = {0};
+    u64 moved;
+
+    test_buffer_init(&b, "a\nb\nc\nd");
+    ASSERT(copy_lines(&b, 0, 1, 4) == 8);
+    ASSERT(test_funcs_text_is(&b, "a\nb\nc\nd\na\nb"));
+    ASSERT(copy_lines(&b, 3, 3, 0) == 0);
+    ASSERT(test_funcs_text_is(&b, "d\na\nb\nc\nd\na\nb"));
+    ASSERT(b.lines.count == 7);
+
+    ASSERT(delete_lines(&b, 1, 2) == 2);
+    ASSERT(test_funcs_text_is(&b, "d\nc\nd\na\nb"));
+    ASSERT(delete_lines(&b, 3, 4) == 5);
+    ASSERT(test_funcs_text_is(&b, "d\nc\nd"));
+    ASSERT(!move_lines(&b, 0, 1, 1, &moved));
+    test_buffer_free(&b);
+
+    test_move_lines_case("a\nb\nc\nd\n", 0, 1, 3, "c\na\nb\nd\n", 2);
+    test_move_lines_case("a\nb\nc\nd\n", 2, 3, 0, "c\nd\na\nb\n", 0);
+    test_move_lines_case("a\nb\nc\nd", 3, 3, 1, "a\nd\nb\nc", 2);
+    test_move_lines_case("a\nb\nc\nd", 0, 0, 4, "b\nc\nd\na", 6);
+    test_move_lines_case("a\nb\nc", 1, 1, 1, "a\nb\nc", 2);
+    test_move_lines_case("a\nb\n", 2, 2, 0, "b\na\n", 0);
+
+    /* the empty line after a final newline is not a line of its own */
+    test_buffer_init(&b, "a\nb\n");
+    ASSERT(buffer_last_line(&b) == 1);
+    ASSERT(delete_lines(&b, 2, 2) == 2);
+    ASSERT(test_funcs_text_is(&b, "a\n"));
+    ASSERT(delete_lines(&b, 0, 0) == 0);
+    ASSERT(test_funcs_text_is(&b, ""));
+    ASSERT(buffer_last_line(&b) == 0);
+    test_buffer_free(&b);
+
+    printf("%s... OK\n", "test_line_ranges");
+}
+
+static u64 test_funcs_changes;
+
+static void
+test_funcs_count_changes(buffer *b, buffer_change *changes, u64 count, void *ctx)
+{
+    test_funcs_changes += count;
+}
+
+/* :1,5000000d on a file that long is one edit whatever the line count. */
+static void
+test_delete_lines_batched()
+{
+    u64 lines = 5000000;
+    char *text = (char *)malloc((size_t)lines * 2 + 1);
+    buffer b = {0};
+    u64 i;
+
+    for (i = 0; i < lines; i++)
+    {
+        text[i * 2] = 'x';
+        text[i * 2 + 1] = '\n';
+    }
+    text[lines * 2] = '\0';
+
+    test_buffer_init(&b, text);
+    buffer_add_listener(&b, test_funcs_count_changes, NULL);
+    test_funcs_changes = 0;
+
+    ASSERT(delete_lines(&b, 0, lines - 1) == 0);
+    ASSERT(test_funcs_changes == 1);
+    ASSERT(b.total_len == 0 && b.lines.count == 1);
+
+    test_buffer_free(&b);
+    free(text);
+    printf("%s... OK\n", "test_delete_lines_batched");
+}
+
 static void
 test_funcs_init()
 {
@@ -104,4 +304,9 @@ test_funcs_init()
     test_insert_at_end_of_line();
     test_insert_above_current_line();
     test_insert_below_current_line();
+    test_change_case_range();
+    test_indent_lines();
+    test_block_edits();
+    test_line_ranges();
+    test_delete_lines_batched();
 }
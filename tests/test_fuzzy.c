@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/fuzzy.h"
+#include "../src/path_index.h"
+#include "../src/base.h"
+
+static void
+test_fuzzy_index(path_index *pi, const char **paths, u64 count)
+{
+    u64 i;
+
+    memset(pi, 0, sizeof(*pi));
+    pthread_mutex_init(&pi->lock, NULL);
+    pi->started = 1;
+
+    for (i = 0; i < count; i++)
+    {
+        path_index_add(pi, paths[i]);
+    }
+}
+
+static void
+test_fuzzy_ranking()
+{
+    const char *paths[] = {
+        "src/editor.c", "src/editor.h", "docs/everything_do_c.md", "src/regex.c",
+        "tests/test_editor.c", "README.md", "src/base.h", "bin/build",
+    };
+    path_index pi;
+    fuzzy_finder f = {0};
+
+    test_fuzzy_index(&pi, paths, 8);
+
+    fuzzy_set_query(&f, &pi, (string){.s = (u8 *)"edc", .len = 3});
+    ASSERT(f.survivor_count == 3);
+    ASSERT(strcmp(pi.pool + pi.offsets[f.results[0].path], "src/editor.c") == 0);
+
+    /* typing on only re-checks the survivors */
+    fuzzy_set_query(&f, &pi, (string){.s = (u8 *)"edcx", .len = 4});
+    ASSERT(f.survivor_count == 0);
+    ASSERT(f.result_count == 0);
+
+    fuzzy_set_query(&f, &pi, (string){.s = (u8 *)"REG", .len = 3});
+    ASSERT(f.result_count == 1);
+    ASSERT(strcmp(pi.pool + pi.offsets[f.results[0].path], "src/regex.c") == 0);
+
+    /* paths added after the query are picked up by the next update */
+    path_index_add(&pi, "src/regex.h");
+    ASSERT(fuzzy_update(&f, &pi));
+    ASSERT(f.result_count == 2);
+    ASSERT(!fuzzy_update(&f, &pi));
+
+    /* adding a path twice keeps one, removing it re-ranks without it */
+    path_index_add(&pi, "src/regex.h");
+    ASSERT(pi.count == 9);
+    path_index_remove(&pi, "src/regex.c");
+    ASSERT(fuzzy_update(&f, &pi));
+    ASSERT(f.result_count == 1);
+    ASSERT(strcmp(pi.pool + pi.offsets[f.results[0].path], "src/regex.h") == 0);
+    fuzzy_set_query(&f, &pi, (string){.s = (u8 *)"", .len = 0});
+    ASSERT(f.survivor_count == 8);
+
+    fuzzy_free(&f);
+    pi.started = 0;
+    free(pi.pool);
+    free(pi.offsets);
+    free(pi.masks);
+    free(pi.slots);
+    pthread_mutex_destroy(&pi.lock);
+
+    printf("%s... OK\n", "test_fuzzy_ranking");
+}
+
+/* The heap must keep exactly the best FUZZY_MAX_RESULTS, best first. */
+static void
+test_fuzzy_top_k()
+{
+    static char names[500][32];
+    const char *paths[500];
+    path_index pi;
+    fuzzy_finder f = {0};
+    string query = {.s = (u8 *)"ab", .len = 2};
+    u64 better;
+    u64 i;
+    u64 j;
+
+    srand(5);
+    for (i = 0; i < 500; i++)
+    {
+        u64 len = 2 + (u64)rand() % 20;
+
+        for (j = 0; j < len; j++)
+        {
+            names[i][j] = "ab/_x"[rand() % 5];
+        }
+        names[i][len] = '\0';
+        paths[i] = names[i];
+    }
+
+    test_fuzzy_index(&pi, paths, 500);
+    fuzzy_set_query(&f, &pi, query);
+    ASSERT(f.result_count == FUZZY_MAX_RESULTS);
+
+    for (i = 1; i < f.result_count; i++)
+    {
+        ASSERT(f.results[i - 1].score >= f.results[i].score);
+    }
+
+    /* nothing left out scores above the worst kept result */
+    better = 0;
+    for (i = 0; i < 500; i++)
+    {
+        s64 score;
+
+        if (fuzzy_score(paths[i], strlen(paths[i]), query, &score) &&
+            score > f.results[f.result_count - 1].score)
+        {
+            better++;
+        }
+    }
+    ASSERT(better <= FUZZY_MAX_RESULTS);
+
+    fuzzy_free(&f);
+    free(pi.pool);
+    free(pi.offsets);
+    free(pi.masks);
+    free(pi.slots);
+    pthread_mutex_destroy(&pi.lock);
+
+    printf("%s... OK\n", "test_fuzzy_top_k");
+}
+
+/* Paths saved by rename are removed and added again, the table must not fill with them. */
+static void
+test_path_index_reclaim()
+{
+    const char *paths[] = {"keep.c"};
+    path_index pi;
+    char path[32];
+    u64 generation;
+    u64 index;
+    u64 i;
+
+    test_fuzzy_index(&pi, paths, 1);
+    generation = pi.generation;
+
+    for (i = 0; i < 5000; i++)
+    {
+        snprintf(path, sizeof(path), "save%llu.c", (unsigned long long)(i % 3));
+        path_index_add(&pi, path);
+        path_index_remove(&pi, path);
+    }
+
+    ASSERT(pi.slot_count == 2048);
+    ASSERT(pi.count - pi.live <= pi.slot_count / 4);
+    ASSERT(pi.generation != generation);
+    ASSERT(pi.live == 1);
+    ASSERT(path_index_find(&pi, "keep.c", &index));
+    ASSERT(strcmp(pi.pool + pi.offsets[index], "keep.c") == 0);
+    ASSERT(!path_index_find(&pi, "save0.c", &index));
+
+    free(pi.pool);
+    free(pi.offsets);
+    free(pi.masks);
+    free(pi.slots);
+    pthread_mutex_destroy(&pi.lock);
+
+    printf("%s... OK\n", "test_path_index_reclaim");
+}
+
+/* Waits up to two seconds for the watcher to catch up. */
+static int
+test_path_index_has(path_index *pi, const char *root, const char *name, int want)
+{
+    struct timespec nap = {0, 10000000};
+    char path[256];
+    u64 index;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    for (i = 0; i < 200; i++)
+    {
+        if (path_index_find(pi, path, &index) == want)
+        {
+            return 1;
+        }
+        nanosleep(&nap, NULL);
+    }
+
+    return 0;
+}
+
+/* Files and directories created, removed and moved after the walk. */
+static void
+test_path_index_watch()
+{
+    char root[] = "/tmp/editor_paths_XXXXXX";
+    char path[256];
+    char moved[256];
+    path_index pi;
+
+    ASSERT(mkdtemp(root) != NULL);
+    test_write_file(root, "a.c", "");
+    test_write_file(root, ".gitignore", "*.o\n");
+    snprintf(path, sizeof(path), "%s/sub", root);
+    ASSERT(mkdir(path, 0700) == 0);
+    test_write_file(root, "sub/b.c", "");
+
+    path_index_build(&pi, (string){.s = (u8 *)root, .len = strlen(root)});
+    while (path_index_building(&pi))
+    {
+        struct timespec nap = {0, 1000000};
+        nanosleep(&nap, NULL);
+    }
+    ASSERT(pi.watching);
+    ASSERT(test_path_index_has(&pi, root, "a.c", 1));
+    ASSERT(test_path_index_has(&pi, root, "sub/b.c", 1));
+
+    test_write_file(root, "new.c", "");
+    test_write_file(root, "skip.o", "");
+    snprintf(path, sizeof(path), "%s/sub/deep", root);
+    ASSERT(mkdir(path, 0700) == 0);
+    test_write_file(root, "sub/deep/c.c", "");
+    ASSERT(test_path_index_has(&pi, root, "new.c", 1));
+    ASSERT(test_path_index_has(&pi, root, "sub/deep/c.c", 1));
+    ASSERT(test_path_index_has(&pi, root, "skip.o", 0));
+
+    snprintf(path, sizeof(path), "%s/a.c", root);
+    ASSERT(unlink(path) == 0);
+    ASSERT(test_path_index_has(&pi, root, "a.c", 0));
+
+    snprintf(path, sizeof(path), "%s/sub", root);
+    snprintf(moved, sizeof(moved), "%s/moved", root);
+    ASSERT(rename(path, moved) == 0);
+    ASSERT(test_path_index_has(&pi, root, "sub/deep/c.c", 0));
+    ASSERT(test_path_index_has(&pi, root, "moved/deep/c.c", 1));
+    ASSERT(test_path_index_has(&pi, root, "moved/b.c", 1));
+
+    /* the moved tree is watched under its new name */
+    test_write_file(root, "moved/deep/d.c", "");
+    ASSERT(test_path_index_has(&pi, root, "moved/deep/d.c", 1));
+    ASSERT(pi.live == 5);
+
+    path_index_free(&pi);
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    ASSERT(system(path) == 0);
+
+    printf("%s... OK\n", "test_path_index_watch");
+}
+
+static void
+test_fuzzy_init()
+{
+    test_fuzzy_ranking();
+    test_fuzzy_top_k();
+    test_path_index_reclaim();
+    test_path_index_watch();
+}
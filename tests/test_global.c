@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/global.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* Runs :g/pattern/d, or :v with `invert`, over lines [first, last] of `text`. */
+static void
+test_global_delete_case(const char *text, u64 first, u64 last, const char *pattern, u8 invert,
+                        const char *expected)
+{
+    buffer b = {0};
+    global_lines gl;
+    string out;
+    char error[128];
+
+    test_buffer_init(&b, text);
+    ASSERT(global_match(&b, first, last, (string){.s = (u8 *)pattern, .len = strlen(pattern)},
+                        invert, &gl, error, sizeof(error)));
+    global_delete(&b, &gl);
+
+    out = buffer_to_string(&b);
+    if (out.len != strlen(expected) || memcmp(out.s, expected, (size_t)out.len) != 0)
+    {
+        fprintf(stderr, "%c/%s/d on \"%s\" gave \"%.*s\"\n", invert ? 'v' : 'g', pattern, text,
+                (int)out.len, (char *)out.s);
+        ASSERT(0);
+    }
+
+    free(out.s);
+    global_lines_free(&gl);
+    test_buffer_free(&b);
+}
+
+static void
+test_global_cases()
+{
+    const char *text = "DEBUG a\nERROR b\nDEBUG c\nINFO d\nERROR e\n";
+
+    test_global_delete_case(text, 0, 4, "DEBUG", 0, "ERROR b\nINFO d\nERROR e\n");
+    test_global_delete_case(text, 0, 4, "ERROR", 1, "ERROR b\nERROR e\n");
+    test_global_delete_case(text, 0, 4, "^(DEBUG|INFO)", 0, "ERROR b\nERROR e\n");
+    test_global_delete_case(text, 2, 3, "DEBUG", 0, "DEBUG a\nERROR b\nINFO d\nERROR e\n");
+    test_global_delete_case("a\nb\nx", 0, 2, "x", 0, "a\nb");
+    test_global_delete_case("x\nx", 0, 1, "x", 0, "");
+    test_global_delete_case(text, 0, 4, "zzz", 0, text);
+
+    printf("%s... OK\n", "test_global_cases");
+}
+
+/* Enough lines for several chunks, the result must match a buffer built from it. */
+static void
+test_global_many()
+{
+    buffer b = {0};
+    buffer fresh = {0};
+    global_lines gl;
+    string text;
+    char error[128];
+    char *data = (char *)malloc(20000 * 8 + 1);
+    char *expected = (char *)malloc(20000 * 8 + 1);
+    u64 expected_len = 0;
+    u64 i;
+
+    for (i = 0; i < 20000; i++)
+    {
+        const char *line = i % 3 == 0 ? "DEBUG x\n" : i % 3 == 1 ? "ERROR y\n" : "INFO zz\n";
+
+        memcpy(data + i * 8, line, 8);
+        if (i % 3 != 0)
+        {
+            memcpy(expected + expected_len, line, 8);
+            expected_len += 8;
+        }
+    }
+    data[20000 * 8] = '\0';
+
+    test_buffer_init(&b, data);
+    ASSERT(global_match(&b, 0, buffer_last_line(&b), (string){.s = (u8 *)"DEBUG", .len = 5}, 0, &gl,
+                        error, sizeof(error)));
+    ASSERT(gl.selected == 6667);
+    global_delete(&b, &gl);
+    global_lines_free(&gl);
+
+    text = buffer_to_string(&b);
+    ASSERT(text.len == expected_len);
+    ASSERT(memcmp(text.s, expected, (size_t)expected_len) == 0);
+
+    expected[expected_len] = '\0';
+    test_buffer_init(&fresh, expected);
+    ASSERT(b.lines.count == fresh.lines.count);
+    for (i = 0; i < b.lines.count; i++)
+    {
+        ASSERT(b.lines.items[i].start == fresh.lines.items[i].start);
+    }
+
+    /* :v/ERROR/ with a regex leaves the ERROR lines */
+    ASSERT(global_match(&b, 0, buffer_last_line(&b), (string){.s = (u8 *)"^E.*y$", .len = 6}, 1,
+                        &gl, error, sizeof(error)));
+    ASSERT(gl.selected == 6666);
+    global_delete(&b, &gl);
+    global_lines_free(&gl);
+    ASSERT(b.lines.count == 6667 + 1);
+    ASSERT(b.total_len == 6667 * 8);
+
+    free(text.s);
+    test_buffer_free(&b);
+    test_buffer_free(&fresh);
+    free(data);
+    free(expected);
+    printf("%s... OK\n", "test_global_many");
+}
+
+static void
+test_global_init()
+{
+    test_global_cases();
+    test_global_many();
+}
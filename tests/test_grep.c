@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/grep.h"
+#include "../src/base.h"
+
+static void
+test_walk_ignore_rules()
+{
+    const char *root_rules = "# comment\n*.o\nbuild/\n/top.txt\n!keep.o\ndocs/**/*.md\n";
+    const char *sub_rules = "*.txt\n";
+    walk_ignore *root = walk_ignore_parse(NULL, "", (string){.s = (u8 *)root_rules, .len = strlen(root_rules)});
+    walk_ignore *sub = walk_ignore_parse(root, "src", (string){.s = (u8 *)sub_rules, .len = strlen(sub_rules)});
+
+    ASSERT(root->count == 5);
+    ASSERT(walk_ignored(root, "main.o", 0));
+    ASSERT(walk_ignored(root, "src/deep/x.o", 0));
+    ASSERT(!walk_ignored(root, "keep.o", 0));
+    ASSERT(walk_ignored(root, "build", 1));
+    ASSERT(!walk_ignored(root, "build", 0));
+    ASSERT(walk_ignored(root, "top.txt", 0));
+    ASSERT(!walk_ignored(root, "src/top.txt", 0));
+    ASSERT(walk_ignored(root, "docs/a/b/c.md", 0));
+    ASSERT(!walk_ignored(root, "docs.md", 0));
+    ASSERT(walk_ignored(NULL, ".editor-trigrams", 0));
+    ASSERT(walk_ignored(NULL, "src/.editor-tags.Ab12Cd", 0));
+    ASSERT(!walk_ignored(NULL, ".editor-tagsx", 0));
+
+    ASSERT(walk_ignored(sub, "src/notes.txt", 0));
+    ASSERT(!walk_ignored(sub, "notes.txt", 0));
+    ASSERT(walk_ignored(sub, "src/a.o", 0));
+
+    free(sub->patterns[0]);
+    free(sub->patterns);
+    free(sub->flags);
+    free(sub->dir);
+    free(sub);
+    while (root->count > 0)
+    {
+        free(root->patterns[--root->count]);
+    }
+    free(root->patterns);
+    free(root->flags);
+    free(root->dir);
+    free(root);
+
+    printf("%s... OK\n", "test_walk_ignore_rules");
+}
+
+static int
+test_grep_has(grep_search *g, const char *path, u64 line, u64 col)
+{
+    u64 i;
+
+    for (i = 0; i < g->count; i++)
+    {
+        if (strcmp(g->hits[i].path, path) == 0 && g->hits[i].line == line && g->hits[i].col == col)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Walks a small tree with ignored, binary and nested files. */
+static void
+test_grep_tree()
+{
+    char root[] = "/tmp/editor_grep_XXXXXX";
+    char path[256];
+    char binary[64];
+    grep_search g;
+    char error[128];
+    string pattern = {.s = (u8 *)"needle", .len = 6};
+
+    ASSERT(mkdtemp(root) != NULL);
+
+    snprintf(path, sizeof(path), "%s/a.c", root);
+    test_write_bytes(path, "x\nfind the needle\nnone\n  needle\n", 32);
+    snprintf(path, sizeof(path), "%s/sub", root);
+    ASSERT(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof(path), "%s/sub/b.txt", root);
+    test_write_bytes(path, "needle", 6);
+    snprintf(path, sizeof(path), "%s/sub/skip.log", root);
+    test_write_bytes(path, "needle\n", 7);
+    snprintf(path, sizeof(path), "%s/.gitignore", root);
+    test_write_bytes(path, "*.log\n", 6);
+    memset(binary, 'a', sizeof(binary));
+    memcpy(binary, "needle", 6);
+    binary[20] = '\0';
+    snprintf(path, sizeof(path), "%s/data.bin", root);
+    test_write_bytes(path, binary, sizeof(binary));
+
+    ASSERT(grep_start(&g, (string){.s = (u8 *)root, .len = strlen(root)}, pattern, error, sizeof(error)));
+    grep_wait(&g);
+
+    ASSERT(!grep_running(&g));
+    ASSERT(g.count == 3);
+    snprintf(path, sizeof(path), "%s/a.c", root);
+    ASSERT(test_grep_has(&g, path, 2, 10));
+    ASSERT(test_grep_has(&g, path, 4, 3));
+    snprintf(path, sizeof(path), "%s/sub/b.txt", root);
+    ASSERT(test_grep_has(&g, path, 1, 1));
+    grep_free(&g);
+
+    pattern = (string){.s = (u8 *)"^ +ne+dle$", .len = 10};
+    ASSERT(grep_start(&g, (string){.s = (u8 *)root, .len = strlen(root)}, pattern, error, sizeof(error)));
+    grep_wait(&g);
+    ASSERT(g.count == 1);
+    snprintf(path, sizeof(path), "%s/a.c", root);
+    ASSERT(test_grep_has(&g, path, 4, 1));
+    grep_free(&g);
+
+    /* a given file list is searched as is, ignore rules already applied */
+    {
+        char **paths = (char **)malloc(sizeof(char *) * 2);
+
+        snprintf(path, sizeof(path), "%s/sub/skip.log", root);
+        paths[0] = strdup(path);
+        snprintf(path, sizeof(path), "%s/sub/b.txt", root);
+        paths[1] = strdup(path);
+        pattern = (string){.s = (u8 *)"needle", .len = 6};
+        ASSERT(grep_start_files(&g, paths, 2, pattern, error, sizeof(error)));
+        grep_wait(&g);
+        ASSERT(g.count == 2);
+        ASSERT(test_grep_has(&g, path, 1, 1));
+        grep_free(&g);
+    }
+
+    pattern = (string){.s = (u8 *)"(a", .len = 2};
+    ASSERT(!grep_start(&g, (string){.s = (u8 *)root, .len = strlen(root)}, pattern, error, sizeof(error)));
+
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    ASSERT(system(path) == 0);
+
+    printf("%s... OK\n", "test_grep_tree");
+}
+
+static void
+test_grep_init()
+{
+    test_walk_ignore_rules();
+    test_grep_tree();
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/line_class.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* Every bit kept up to date across edits must equal the one read from the text. */
+static void
+test_line_class_check(buffer *b, line_class_index *lc)
+{
+    line_class_index fresh;
+    u64 i;
+
+    line_class_init(&fresh, b);
+    ASSERT(line_class_count(lc) == line_class_count(&fresh));
+
+    for (i = 0; i < line_class_count(&fresh); i++)
+    {
+        ASSERT(line_class_is_empty(lc, i) == line_class_is_empty(&fresh, i));
+        ASSERT(line_class_is_blank(lc, i) == line_class_is_blank(&fresh, i));
+    }
+
+    line_class_free(&fresh);
+}
+
+static void
+test_line_class_cases()
+{
+    buffer b = {0};
+    line_class_index lc;
+
+    test_buffer_init(&b, "a\n\n  \nb\n\t\nc");
+    line_class_init(&lc, &b);
+
+    ASSERT(line_class_count(&lc) == 6);
+    ASSERT(!line_class_is_blank(&lc, 0));
+    ASSERT(line_class_is_empty(&lc, 1) && line_class_is_blank(&lc, 1));
+    ASSERT(!line_class_is_empty(&lc, 2) && line_class_is_blank(&lc, 2));
+    ASSERT(line_class_next(&lc, 0, 2, 1) == 6);
+    ASSERT(line_class_next(&lc, 1, 2, 0) == 3);
+    ASSERT(line_class_prev(&lc, 1, 4, 0) == 3);
+    ASSERT(line_class_prev(&lc, 0, 5, 1) == 1);
+    ASSERT(line_class_prev(&lc, 0, 0, 1) == 6);
+
+    /* joining the empty line into the first makes it the only empty one no more */
+    buffer_delete(&b, 1, 1);
+    ASSERT(line_class_count(&lc) == 5);
+    ASSERT(line_class_next(&lc, 0, 0, 1) == 5);
+    buffer_insert(&b, 0, (string){.s = (u8 *)"\n", .len = 1});
+    ASSERT(line_class_next(&lc, 0, 0, 1) == 0);
+    test_line_class_check(&b, &lc);
+
+    line_class_free(&lc);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_line_class_cases");
+}
+
+static void
+test_line_class_after_edit(buffer *b, u64 step, u64 at, void *ctx)
+{
+    if (step % 5 == 0)
+    {
+        test_line_class_check(b, (line_class_index *)ctx);
+    }
+}
+
+static void
+test_line_class_edits()
+{
+    const char *words[] = {"\n", "\n\n", "x", " ", "\t", "\n  \n", "ab\ncd", "\n\n\n\n"};
+    char text[4096];
+    buffer b = {0};
+    line_class_index lc;
+    u64 len = 0;
+    u64 i;
+
+    srand(23);
+    for (i = 0; i < 300; i++)
+    {
+        const char *line = i % 7 == 0 ? "" : i % 11 == 0 ? "   " : "text";
+
+        len += (u64)sprintf(text + len, "%s\n", line);
+    }
+
+    test_buffer_init(&b, text);
+    line_class_init(&lc, &b);
+    test_line_class_check(&b, &lc);
+
+    test_buffer_edit_randomly(&b, words, 8, 200, 600, test_line_class_after_edit, &lc);
+
+    test_line_class_check(&b, &lc);
+    line_class_free(&lc);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_line_class_edits");
+}
+
+static void
+test_line_class_init()
+{
+    test_line_class_cases();
+    test_line_class_edits();
+}
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "../src/lsp.h"
+#include "../src/json.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+#define TEST_LSP_TEXT(text) (string){.s = (u8 *)(text), .len = strlen(text)}
+
+/* Pumps until `cond` holds or a few seconds have passed. */
+#define TEST_LSP_WAIT(c, cond)                                                  \
+    do                                                                          \
+    {                                                                           \
+        u64 tries_;                                                             \
+        for (tries_ = 0; tries_ < 300 && !(cond); tries_++)                     \
+        {                                                                       \
+            struct pollfd fds_[2];                                              \
+            poll(fds_, (nfds_t)lsp_poll_fds((c), fds_), 10);                    \
+            lsp_pump(c);                                                        \
+        }                                                                       \
+        ASSERT(cond);                                                           \
+    } while (0)
+
+/* A server on blocking pipes: it mirrors the document and answers hover with the mirror. */
+typedef struct
+{
+    int in;
+    int out;
+    u8 *text;
+    u64 len;
+    u64 capacity;
+    u8 *read;
+    u64 read_len;
+    arena json;
+} test_lsp_stub;
+
+static void
+test_lsp_stub_write(test_lsp_stub *s, const u8 *data, u64 len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(s->out, data, (size_t)len);
+
+        if (n <= 0)
+        {
+            _exit(1);
+        }
+        data += n;
+        len -= (u64)n;
+    }
+}
+
+static void
+test_lsp_stub_send(test_lsp_stub *s, json_writer *body)
+{
+    char header[64];
+    int len = snprintf(header, sizeof(header), "Content-Length: %llu\r\n\r\n", (unsigned long long)body->len);
+
+    test_lsp_stub_write(s, (u8 *)header, (u64)len);
+    test_lsp_stub_write(s, body->data, body->len);
+    body->len = 0;
+}
+
+/* The byte offset of a position counted in UTF-16 code units. */
+static u64
+test_lsp_stub_offset(test_lsp_stub *s, json_value *position)
+{
+    s64 line = 0;
+    s64 character = 0;
+    u64 at = 0;
+
+    json_to_s64(json_get(position, "line"), &line);
+    json_to_s64(json_get(position, "character"), &character);
+
+    while (line > 0 && at < s->len)
+    {
+        if (s->text[at++] == '\n')
+        {
+            line--;
+        }
+    }
+
+    while (character > 0 && at < s->len && s->text[at] != '\n')
+    {
+        character -= s->text[at] >= 0xf0 ? 2 : 1;
+        at++;
+        while (at < s->len && (s->text[at] & 0xc0) == 0x80)
+        {
+            at++;
+        }
+    }
+
+    return at;
+}
+
+static void
+test_lsp_stub_replace(test_lsp_stub *s, u64 start, u64 end, json_value *text)
+{
+    u64 new_len = text->text.len;
+
+    if (s->len - (end - start) + new_len > s->capacity)
+    {
+        s->capacity = (s->len + new_len) * 2 + 64;
+        s->text = (u8 *)realloc(s->text, (size_t)s->capacity);
+    }
+
+    memmove(s->text + start + new_len, s->text + end, (size_t)(s->len - end));
+    s->len = s->len - (end - start) + new_len;
+    /* unescaping never grows, so it is done in the gap and the tail pulled back */
+    new_len = json_unescape(text, s->text + start);
+    memmove(s->text + start + new_len, s->text + start + text->text.len,
+            (size_t)(s->len - start - text->text.len));
+    s->len -= text->text.len - new_len;
+}
+
+static void
+test_lsp_stub_handle(test_lsp_stub *s, json_value *msg, json_writer *w)
+{
+    json_value *method = json_get(msg, "method");
+    json_value *id = json_get(msg, "id");
+    json_value *params = json_get(msg, "params");
+    json_value *doc = json_get(params, "textDocument");
+
+    if (json_is_string(method, "initialize"))
+    {
+        json_write_cstr(w, "{\"jsonrpc\":\"2.0\",\"id\":");
+        json_write(w, (const char *)id->text.s, id->text.len);
+        json_write_cstr(w, ",\"result\":{\"capabilities\":{\"positionEncoding\":\"utf-16\","
+                           "\"textDocumentSync\":2,\"hoverProvider\":true}}}");
+        test_lsp_stub_send(s, w);
+
+        /* a request of the server's own, which the client must answer */
+        json_write_cstr(w, "{\"jsonrpc\":\"2.0\",\"id\":\"c1\",\"method\":\"workspace/configuration\","
+                           "\"params\":{\"items\":[{},{}]}}");
+        test_lsp_stub_send(s, w);
+    }
+    else if (json_is_string(method, "textDocument/didOpen") || json_is_string(method, "textDocument/didChange"))
+    {
+        json_value *changes = json_get(params, "contentChanges");
+        json_value *change;
+
+        if (json_is_string(method, "textDocument/didOpen"))
+        {
+            s->len = 0;
+            test_lsp_stub_replace(s, 0, 0, json_get(doc, "text"));
+        }
+
+        for (change = changes != NULL ? changes->child : NULL; change != NULL; change = change->next)
+        {
+            json_value *range = json_get(change, "range");
+            u64 start = test_lsp_stub_offset(s, json_get(range, "start"));
+            u64 end = test_lsp_stub_offset(s, json_get(range, "end"));
+
+            test_lsp_stub_replace(s, start, end, json_get(change, "text"));
+        }
+
+        json_write_cstr(w, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+                           "\"params\":{\"uri\":");
+        json_write_string(w, json_get(doc, "uri")->text);
+        json_write_cstr(w, ",\"version\":");
+        json_write(w, (const char *)json_get(doc, "version")->text.s, json_get(doc, "version")->text.len);
+        json_write_cstr(w, ",\"diagnostics\":[{\"range\":{\"start\":{\"line\":1,\"character\":0},"
+                           "\"end\":{\"line\":1,\"character\":1}},\"message\":\"unused \\\"x\\\"\"}]}}");
+        test_lsp_stub_send(s, w);
+    }
+    else if (json_is_string(method, "textDocument/hover"))
+    {
+        json_write_cstr(w, "{\"jsonrpc\":\"2.0\",\"id\":");
+        json_write(w, (const char *)id->text.s, id->text.len);
+        json_write_cstr(w, ",\"result\":{\"contents\":{\"kind\":\"plaintext\",\"value\":");
+        json_write_string(w, (string){.s = s->text, .len = s->len});
+        json_write_cstr(w, "}}}");
+        test_lsp_stub_send(s, w);
+    }
+    else if (json_is_string(method, "shutdown"))
+    {
+        json_write_cstr(w, "{\"jsonrpc\":\"2.0\",\"id\":");
+        json_write(w, (const char *)id->text.s, id->text.len);
+        json_write_cstr(w, ",\"result\":null}");
+        test_lsp_stub_send(s, w);
+    }
+    else if (json_is_string(method, "exit"))
+    {
+        _exit(0);
+    }
+}
+
+static void
+test_lsp_stub_run(int in, int out)
+{
+    test_lsp_stub s = {0};
+    json_writer w = {0};
+
+    s.in = in;
+    s.out = out;
+    s.read = (u8 *)malloc(MB(1));
+    s.json = new_arena(MB(64));
+
+    for (;;)
+    {
+        u8 *end = (u8 *)memmem(s.read, (size_t)s.read_len, "\r\n\r\n", 4);
+        ssize_t n;
+
+        if (end != NULL)
+        {
+            u64 header = (u64)(end - s.read) + 4;
+            u64 body = (u64)strtoull((char *)s.read + 16, NULL, 10);
+
+            if (s.read_len >= header + body)
+            {
+                json_value *msg;
+
+                arena_reset(&s.json);
+
+                msg = json_parse(&s.json, (string){.s = s.read + header, .len = body});
+                if (msg == NULL)
+                {
+                    _exit(2);
+                }
+
+                test_lsp_stub_handle(&s, msg, &w);
+                memmove(s.read, s.read + header + body, (size_t)(s.read_len - header - body));
+                s.read_len -= header + body;
+                continue;
+            }
+        }
+
+        n = read(s.in, s.read + s.read_len, (size_t)(MB(1) - s.read_len));
+        if (n <= 0)
+        {
+            _exit(1);
+        }
+        s.read_len += (u64)n;
+    }
+}
+
+static pid_t
+test_lsp_spawn(int *to_server, int *from_server)
+{
+    int to[2];
+    int from[2];
+    pid_t pid;
+
+    ASSERT(pipe(to) == 0 && pipe(from) == 0);
+    fflush(stdout);
+
+    pid = fork();
+    ASSERT(pid >= 0);
+    if (pid == 0)
+    {
+        close(to[1]);
+        close(from[0]);
+        test_lsp_stub_run(to[0], from[1]);
+    }
+
+    close(to[0]);
+    close(from[1]);
+    *to_server = to[1];
+    *from_server = from[0];
+    return pid;
+}
+
+static void
+test_lsp_json()
+{
+    arena a = new_arena(json_arena_size(128));
+    arena_checkpoint empty = arena_save(&a);
+    const char *text = "{\"a\":[1,-20,{\"b\":\"x\\n\\u00e9\\ud83d\\ude00\"}],\"c\":true,\"d\":null}";
+    json_value *v = json_parse(&a, TEST_LSP_TEXT(text));
+    json_value *b;
+    u8 out[32];
+    s64 n;
+
+    ASSERT(v != NULL && v->type == JSON_OBJECT && v->count == 3);
+    ASSERT(json_get(v, "a")->count == 3);
+    ASSERT(json_to_s64(json_at(json_get(v, "a"), 1), &n) && n == -20);
+    ASSERT(json_get(v, "c")->type == JSON_TRUE && json_get(v, "d")->type == JSON_NULL);
+    ASSERT(json_get(v, "e") == NULL && json_at(json_get(v, "a"), 3) == NULL);
+
+    /* strings point into the text, decoded only when asked */
+    b = json_get(json_at(json_get(v, "a"), 2), "b");
+    ASSERT(b->text.s > (u8 *)text && b->text.s < (u8 *)text + strlen(text));
+    ASSERT(json_unescape(b, out) == 8 && memcmp(out, "x\n\xc3\xa9\xf0\x9f\x98\x80", 8) == 0);
+
+    arena_restore(&a, empty);
+    ASSERT(json_parse(&a, TEST_LSP_TEXT("{\"a\":[1,2}")) == NULL);
+    arena_restore(&a, empty);
+    ASSERT(json_parse(&a, TEST_LSP_TEXT("[1] 2")) == NULL);
+
+    arena_release(&a);
+    printf("%s... OK\n", "test_lsp_json");
+}
+
+static void
+test_lsp_sync()
+{
+    char path[] = "/tmp/test_lsp_XXXXXX";
+    int fd = mkstemp(path);
+    lsp_client c;
+    buffer b = {0};
+    buffer_edit edits[3];
+    string text;
+    int to_server;
+    int from_server;
+    pid_t pid;
+    u64 i;
+
+    ASSERT(fd >= 0);
+    close(fd);
+
+    test_buffer_init(&b, "int x;\nchar *s = \"\xc3\xa9t\xc3\xa9\";\n\xf0\x9f\x98\x80 y;\n");
+    b.file_path = TEST_LSP_TEXT(path);
+
+    pid = test_lsp_spawn(&to_server, &from_server);
+    lsp_attach(&c, to_server, from_server, pid, "/tmp");
+    ASSERT(lsp_open(&c, &b, "c"));
+    ASSERT(c.root_uri != NULL && strcmp(c.root_uri, "file:///tmp") == 0);
+
+    /* edits made before the server has initialized are in the text didOpen sends */
+    buffer_insert(&b, 0, TEST_LSP_TEXT("static "));
+    TEST_LSP_WAIT(&c, c.initialized && c.documents[0].diagnostic_count > 0);
+    ASSERT(c.incremental && !c.utf8);
+    ASSERT(strcmp(c.documents[0].diagnostic, "unused \"x\"") == 0 && c.documents[0].diagnostic_line == 1);
+
+    /* past the emoji and the accents the server counts UTF-16 units */
+    buffer_insert(&b, b.total_len - 3, TEST_LSP_TEXT("\xc3\xa9"));
+    buffer_delete(&b, 24, 3);
+    buffer_replace(&b, 5, 9, TEST_LSP_TEXT("a\nb"));
+
+    edits[0].offset = 2;
+    edits[0].delete_len = 1;
+    edits[0].text = TEST_LSP_TEXT("\xf0\x9f\x98\x80");
+    edits[1].offset = 10;
+    edits[1].delete_len = 0;
+    edits[1].text = TEST_LSP_TEXT("q");
+    edits[2].offset = b.total_len - 2;
+    edits[2].delete_len = 2;
+    edits[2].text = TEST_LSP_TEXT("z\n\"\\");
+    buffer_apply_edits(&b, edits, 3);
+
+    for (i = 0; i < 40; i++)
+    {
+        u64 at = (i * 7) % b.total_len;
+
+        /* the editor never splits a character, the server could not name such a position */
+        while ((buffer_byte_at(&b, at) & 0xc0) == 0x80)
+        {
+            at++;
+        }
+        buffer_insert(&b, at, TEST_LSP_TEXT(i % 2 ? "\xc3\xa9" : "\n"));
+    }
+
+    ASSERT(lsp_hover(&c, &b, 3));
+    TEST_LSP_WAIT(&c, c.hover_ready);
+    text = buffer_to_string(&b);
+    ASSERT(c.hover_len == text.len && memcmp(c.hover, text.s, (size_t)text.len) == 0);
+    free(text.s);
+    ASSERT(c.documents[0].version == 1 + 1 + 3 + 1 + 40);
+
+    /* the answer is about a version the buffer has moved past */
+    c.hover_ready = 0;
+    ASSERT(lsp_hover(&c, &b, 0));
+    buffer_insert(&b, 0, TEST_LSP_TEXT("x"));
+    TEST_LSP_WAIT(&c, c.stale > 0 && c.pending_count == 0);
+    ASSERT(!c.hover_ready);
+
+    lsp_stop(&c);
+    ASSERT(!c.running && b.listener_count == 0);
+    ASSERT(waitpid(pid, NULL, WNOHANG) == -1);
+
+    unlink(path);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_lsp_sync");
+}
+
+static void
+test_lsp_init()
+{
+    test_lsp_json();
+    test_lsp_sync();
+}
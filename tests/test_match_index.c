@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/match_index.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* The index kept up to date across edits must equal one built from scratch. */
+static void
+test_match_index_check(buffer *b, match_index *mi, const char *pattern, u8 word)
+{
+    match_index fresh;
+    string p = {.s = (u8 *)pattern, .len = strlen(pattern)};
+    u64 i;
+
+    while (match_index_scan(mi, 97));
+
+    match_index_init(&fresh, b);
+    ASSERT(match_index_set_pattern(&fresh, p, word));
+    while (match_index_scan(&fresh, MATCH_INDEX_SCAN_CHUNK));
+
+    ASSERT(match_index_complete(mi));
+    ASSERT(mi->count == fresh.count);
+    for (i = 0; i < mi->count && i < fresh.count; i++)
+    {
+        ASSERT(mi->items[i].start == fresh.items[i].start);
+        ASSERT(mi->items[i].len == fresh.items[i].len);
+    }
+
+    match_index_free(&fresh);
+}
+
+typedef struct
+{
+    match_index *mi;
+    const char *pattern;
+    u8 word;
+} test_match_index_edit;
+
+/* Leaves part of the index unscanned across some edits. */
+static void
+test_match_index_after_edit(buffer *b, u64 step, u64 at, void *ctx)
+{
+    test_match_index_edit *e = (test_match_index_edit *)ctx;
+
+    if (rand() % 2)
+    {
+        match_index_scan(e->mi, (u64)rand() % 40);
+        match_index_scan_range(e->mi, at / 3, at);
+    }
+    else
+    {
+        test_match_index_check(b, e->mi, e->pattern, e->word);
+    }
+}
+
+static void
+test_match_index_edits()
+{
+    /* the last one is "ab" as a whole word, as * searches it */
+    const char *patterns[] = {"ab", "a+b", "^b", "a$", "b\na", "ab"};
+    const char *words[] = {"a", "b", "ab", "\n", "aab\nb", "ba", " "};
+    u64 p;
+
+    srand(11);
+    for (p = 0; p < 6; p++)
+    {
+        buffer b = {0};
+        match_index mi;
+        string pattern = {.s = (u8 *)patterns[p], .len = strlen(patterns[p])};
+        test_match_index_edit e = {.mi = &mi, .pattern = patterns[p], .word = (u8)(p == 5)};
+
+        test_buffer_init(&b, "ab\naab\nbab\nabba\n");
+        match_index_init(&mi, &b);
+        ASSERT(match_index_set_pattern(&mi, pattern, e.word));
+
+        test_buffer_edit_randomly(&b, words, 7, 4, 300, test_match_index_after_edit, &e);
+
+        test_match_index_check(&b, &mi, patterns[p], e.word);
+        match_index_free(&mi);
+        test_buffer_free(&b);
+    }
+
+    printf("%s... OK\n", "test_match_index_edits");
+}
+
+static void
+test_match_index_init()
+{
+    test_match_index_edits();
+}
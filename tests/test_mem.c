@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/arena.h"
+#include "../src/base.h"
+#include "../src/buffer.h"
+#include "../src/mem.h"
+#include "../src/registers.h"
+#include "common.h"
+
+static u64
+test_mem_bytes(mem_counter *before, mem_tag tag)
+{
+    return mem_counters[tag].bytes - before[tag].bytes;
+}
+
+static void
+test_mem_counters()
+{
+    mem_counter before[MEM_TAG_COUNT];
+    buffer b;
+    registers r;
+    arena a;
+    string text = {.s = (u8 *)"inserted\nlines\n", .len = 15};
+    char line[128];
+    FILE *f;
+    u64 i;
+
+    memcpy(before, mem_counters, sizeof(before));
+
+    test_buffer_init(&b, "one\ntwo\nthree\n");
+    for (i = 0; i < 20; i++)
+    {
+        buffer_insert(&b, i * 7, text);
+    }
+    buffer_delete(&b, 3, 40);
+
+    ASSERT(test_mem_bytes(before, MEM_ADD) == b.add_capacity);
+    ASSERT(test_mem_bytes(before, MEM_LINES) == sizeof(line_info) * b.lines.capacity);
+    ASSERT(test_mem_bytes(before, MEM_PIECES) ==
+           sizeof(piece) * b.pieces.capacity + sizeof(u64) * b.piece_starts_capacity);
+    ASSERT(mem_counters[MEM_ADD].peak >= mem_counters[MEM_ADD].bytes);
+
+    registers_init(&r);
+    registers_yank(&r, 'a', &b, 0, 30, REGISTER_CHARWISE);
+    registers_set_text(&r, 'b', text, REGISTER_LINEWISE);
+    ASSERT(test_mem_bytes(before, MEM_REGISTERS) == sizeof(piece) * r.pieces.capacity + r.bytes_capacity);
+    ASSERT(test_mem_bytes(before, MEM_REGISTERS) > 0);
+
+    a = new_arena(MB(1));
+    MEM_TAG_ARENA(&a, MEM_SCRATCH);
+    arena_push(&a, ARENA_COMMIT_SIZE + 1);
+    ASSERT(test_mem_bytes(before, MEM_SCRATCH) == ARENA_COMMIT_SIZE * 2);
+
+    f = tmpfile();
+    ASSERT(f != NULL && mem_dump(f) == 0);
+    rewind(f);
+    ASSERT(fgets(line, sizeof(line), f) != NULL && strncmp(line, "pieces\t", 7) == 0);
+    fclose(f);
+
+    arena_release(&a);
+    registers_free(&r);
+    test_buffer_free(&b);
+    for (i = 0; i < MEM_TAG_COUNT; i++)
+    {
+        ASSERT(mem_counters[i].bytes == before[i].bytes);
+    }
+    ASSERT(mem_counters[MEM_PIECES].frees > before[MEM_PIECES].frees);
+
+    printf("%s... OK\n", "test_mem_counters");
+}
+
+static void
+test_mem_init()
+{
+    test_mem_counters();
+}
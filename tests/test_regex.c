@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+
+#include "common.h"
+#include "../src/regex.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* POSIX regexec as the reference for where the leftmost match is. */
+static int
+test_regex_reference(regex_t *ref, const char *text, u64 from, u64 *start, u64 *len)
+{
+    regmatch_t m;
+    int flags = (from > 0 && text[from - 1] != '\n') ? REG_NOTBOL : 0;
+
+    if (regexec(ref, text + from, 1, &m, flags) != 0)
+    {
+        return 0;
+    }
+
+    *start = from + (u64)m.rm_so;
+    *len = (u64)(m.rm_eo - m.rm_so);
+    return 1;
+}
+
+static void
+test_regex_against_posix()
+{
+    const char *patterns[] = {
+        "a", "ab*c", "(ab)+", "a.c", "^ab", "b$", "[bc]+a", "a?b?c",
+        "(a|b)c", "c(ab|ba)*c", "^$", "c\na", "x", "ca*$", "^b+",
+        "[^c]+", "b[^a ]*c", "\\W+", "a\\D", "\\S+c", "\\w\\s",
+    };
+    /* POSIX has no \W \D \S, NULL where it reads the pattern the same */
+    const char *references[] = {
+        NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, "[^[:alnum:]_]+", "a[^0-9]", "[^[:space:]]+c", "[[:alnum:]_][[:space:]]",
+    };
+    char text[1200];
+    buffer b = {0};
+    u64 i;
+    u64 k;
+
+    srand(5);
+    for (i = 0; i < sizeof(text) - 1; i++)
+    {
+        text[i] = "aabc \n"[rand() % 6];
+    }
+    text[sizeof(text) - 1] = '\0';
+
+    /* split the text over many pieces */
+    test_buffer_init(&b, "");
+    for (i = 0; i < sizeof(text) - 1; i += 7)
+    {
+        u64 n = sizeof(text) - 1 - i < 7 ? sizeof(text) - 1 - i : 7;
+        string chunk = {.s = (u8 *)text + i, .len = n};
+
+        buffer_insert(&b, i, chunk);
+    }
+
+    for (k = 0; k < sizeof(patterns) / sizeof(patterns[0]); k++)
+    {
+        string pattern = {.s = (u8 *)patterns[k], .len = strlen(patterns[k])};
+        regex re;
+        regex_t ref;
+        u64 from;
+
+        ASSERT(regex_compile(&re, pattern));
+        ASSERT(regcomp(&ref, references[k] ? references[k] : patterns[k], REG_EXTENDED | REG_NEWLINE) == 0);
+
+        for (from = 0; from < sizeof(text) - 1; from += 13)
+        {
+            u64 start = 0;
+            u64 len = 0;
+            u64 ref_start = 0;
+            u64 ref_len = 0;
+            int found = test_regex_reference(&ref, text, from, &ref_start, &ref_len);
+
+            ASSERT(regex_search_forward(&re, &b, from, &start, &len) == found);
+            ASSERT(!found || (start == ref_start && len == ref_len));
+        }
+
+        /* the last start before `before` is the one a forward walk ends on */
+        for (from = 1; from < sizeof(text); from += 37)
+        {
+            u64 start = 0;
+            u64 len;
+            u64 expected = 0;
+            u64 at = 0;
+            u64 hit;
+            int found = 0;
+
+            while (at < from && regex_search_forward(&re, &b, at, &hit, &len) && hit < from)
+            {
+                expected = hit;
+                found = 1;
+                at = hit + 1;
+            }
+
+            ASSERT(regex_search_backward(&re, &b, from, &start, &len) == found);
+            ASSERT(!found || start == expected);
+        }
+
+        regex_free(&re);
+        regfree(&ref);
+    }
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_regex_against_posix");
+}
+
+/* (a*)*b on a long run of a's is where backtracking engines blow up. */
+static void
+test_regex_pathological()
+{
+    buffer b = {0};
+    string pattern = {.s = (u8 *)"(a*)*b", .len = 6};
+    char *text = (char *)malloc(200001);
+    regex re;
+    u64 start;
+    u64 len;
+
+    memset(text, 'a', 200000);
+    text[200000] = '\0';
+    test_buffer_init(&b, text);
+
+    ASSERT(regex_compile(&re, pattern));
+    ASSERT(re.required_len == 1 && re.required[0] == 'b');
+    ASSERT(!regex_search_forward(&re, &b, 0, &start, &len));
+    ASSERT(!regex_search_backward(&re, &b, b.total_len, &start, &len));
+
+    regex_free(&re);
+    test_buffer_free(&b);
+    free(text);
+    printf("%s... OK\n", "test_regex_pathological");
+}
+
+/* The n-th letter from the end needs 2^n DFA states, more than the cache holds. */
+static void
+test_regex_cache_flush()
+{
+    const char *p = "a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)c";
+    string pattern = {.s = (u8 *)p, .len = strlen(p)};
+    char text[20001];
+    buffer b = {0};
+    regex re;
+    regex_t ref;
+    u64 start;
+    u64 len;
+    u64 ref_start;
+    u64 ref_len;
+    u64 i;
+
+    srand(9);
+    for (i = 0; i < sizeof(text) - 1; i++)
+    {
+        text[i] = (i % 5000 == 4999) ? 'c' : "ab"[rand() % 2];
+    }
+    text[sizeof(text) - 1] = '\0';
+    test_buffer_init(&b, text);
+
+    ASSERT(regex_compile(&re, pattern));
+    ASSERT(regcomp(&ref, p, REG_EXTENDED | REG_NEWLINE) == 0);
+
+    for (i = 0; i < sizeof(text) - 1; i += 2500)
+    {
+        int found = test_regex_reference(&ref, text, i, &ref_start, &ref_len);
+
+        ASSERT(regex_search_forward(&re, &b, i, &start, &len) == found);
+        ASSERT(!found || (start == ref_start && len == ref_len));
+    }
+    ASSERT(re.forward.dfa_count <= REGEX_DFA_MAX_STATES);
+
+    regex_free(&re);
+    regfree(&ref);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_regex_cache_flush");
+}
+
+static void
+test_regex_errors()
+{
+    const char *bad[] = {"(ab", "a)", "[ab", "*a", "a\\", "[z-a]"};
+    regex re;
+    u64 i;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        string pattern = {.s = (u8 *)bad[i], .len = strlen(bad[i])};
+
+        ASSERT(!regex_compile(&re, pattern));
+        ASSERT(re.error[0] != '\0');
+    }
+
+    printf("%s... OK\n", "test_regex_errors");
+}
+
+static void
+test_regex_init()
+{
+    test_regex_against_posix();
+    test_regex_pathological();
+    test_regex_cache_flush();
+    test_regex_errors();
+}
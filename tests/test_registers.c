@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/registers.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+static void
+test_registers_delete_ring()
+{
+    buffer b = {0};
+    registers r;
+    string out;
+    u64 i;
+
+    test_buffer_init(&b, "one\ntwo\nthree\n");
+    registers_init(&r);
+
+    for (i = 0; i < 3; i++)
+    {
+        registers_delete(&r, REGISTER_UNNAMED, &b, 0,
+                         buffer_line_start(&b, 1), REGISTER_LINEWISE);
+        buffer_delete(&b, 0, buffer_line_start(&b, 1));
+    }
+
+    ASSERT(b.total_len == 0);
+    ASSERT(registers_get(&r, '1')->len == 6);
+    ASSERT(registers_get(&r, '2')->len == 4);
+    ASSERT(registers_get(&r, '3')->len == 4);
+    ASSERT(registers_get(&r, REGISTER_UNNAMED) == registers_get(&r, '1'));
+
+    /* the ring holds piece references, not copies */
+    ASSERT(registers_get(&r, '1')->source == &b);
+    ASSERT(r.bytes.len == 0);
+
+    registers_materialize(&r, registers_get(&r, '2'), &out);
+    ASSERT(out.len == 4);
+    ASSERT(memcmp(out.s, "two\n", 4) == 0);
+    free(out.s);
+
+    registers_free(&r);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_registers_delete_ring");
+}
+
+static void
+test_registers_put_and_append()
+{
+    buffer b = {0};
+    registers r;
+    string out;
+    string text = {.s = (u8*)"!", .len = 1};
+    const char *expected = "foobarfoo baz";
+
+    test_buffer_init(&b, "foo baz");
+    registers_init(&r);
+
+    registers_yank(&r, 'a', &b, 0, 3, REGISTER_CHARWISE);
+    buffer_insert(&b, 3, (string){.s = (u8*)"bar", .len = 3});
+    registers_put(&r, 'a', &b, 6);
+
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(expected));
+    ASSERT(memcmp(out.s, expected, out.len) == 0);
+    free(out.s);
+
+    registers_yank(&r, 'A', &b, 3, 3, REGISTER_CHARWISE);
+    ASSERT(registers_get(&r, 'a')->len == 6);
+    ASSERT(registers_get(&r, REGISTER_UNNAMED) == registers_get(&r, 'a'));
+
+    registers_materialize(&r, registers_get(&r, 'a'), &out);
+    ASSERT(memcmp(out.s, "foobar", 6) == 0);
+    free(out.s);
+
+    registers_set_text(&r, 'b', text, REGISTER_CHARWISE);
+    ASSERT(registers_get(&r, 'b')->source == NULL);
+    ASSERT(registers_put(&r, 'b', &b, 0) == 1);
+    ASSERT(buffer_byte_at(&b, 0) == '!');
+
+    registers_free(&r);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_registers_put_and_append");
+}
+
+/* "ayy "byy "ap: the unnamed register follows b, the named put must still take a. */
+static void
+test_registers_put_named()
+{
+    buffer b = {0};
+    registers r;
+    string out;
+    const char *expected = "one\none\ntwo\n";
+
+    test_buffer_init(&b, "one\ntwo\n");
+    registers_init(&r);
+
+    registers_yank(&r, 'a', &b, 0, 4, REGISTER_LINEWISE);
+    registers_yank(&r, 'b', &b, 4, 4, REGISTER_LINEWISE);
+    ASSERT(registers_get(&r, REGISTER_UNNAMED) == registers_get(&r, 'b'));
+
+    ASSERT(registers_put(&r, 'a', &b, 4) == 4);
+    out = buffer_to_string(&b);
+    ASSERT(out.len == strlen(expected));
+    ASSERT(memcmp(out.s, expected, out.len) == 0);
+    free(out.s);
+
+    registers_free(&r);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_registers_put_named");
+}
+
+static void
+test_registers_init()
+{
+    test_registers_delete_ring();
+    test_registers_put_and_append();
+    test_registers_put_named();
+}
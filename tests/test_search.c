@@ -0,0 +1,121 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/search.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+static int
+test_search_naive(const char *text, u64 len, const char *needle, u64 from, int backward, u64 *out)
+{
+    u64 n = strlen(needle);
+    u64 i;
+
+    for (i = 0; i + n <= len; i++)
+    {
+        u64 at = backward ? len - n - i : i;
+
+        if ((backward ? at < from : at >= from) && memcmp(text + at, needle, n) == 0)
+        {
+            *out = at;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Builds a text out of many small pieces so matches straddle boundaries. */
+static void
+test_search_pieces()
+{
+    buffer b = {0};
+    char model[2048];
+    u64 model_len = 0;
+    u64 i;
+    const char *chunks[] = {"ab", "c", "abcab", "x", "\n", "bca", "aaaaaaaaaaaaaaaaaaab"};
+    const char *needles[] = {"abc", "a", "cab", "aab", "ab\nb", "bcaab", "aaaaaaaaaaaaaaaaaaaaab", "zz"};
+
+    srand(3);
+    test_buffer_init(&b, "");
+
+    while (model_len < 1500)
+    {
+        const char *w = chunks[rand() % 7];
+        u64 at = (u64)rand() % (model_len + 1);
+        string text = {.s = (u8 *)w, .len = strlen(w)};
+
+        buffer_insert(&b, at, text);
+        memmove(model + at + text.len, model + at, model_len - at);
+        memcpy(model + at, w, text.len);
+        model_len += text.len;
+    }
+
+    for (i = 0; i < 400; i++)
+    {
+        const char *w = needles[rand() % 8];
+        string needle = {.s = (u8 *)w, .len = strlen(w)};
+        u64 from = (u64)rand() % (model_len + 1);
+        u64 expected = 0;
+        u64 got = 0;
+        int found;
+
+        found = test_search_naive(model, model_len, w, from, 0, &expected);
+        ASSERT(search_forward(&b, needle, from, &got) == found);
+        ASSERT(!found || got == expected);
+
+        found = test_search_naive(model, model_len, w, from, 1, &expected);
+        ASSERT(search_backward(&b, needle, from, &got) == found);
+        ASSERT(!found || got == expected);
+    }
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_search_pieces");
+}
+
+/* * and # only stop on the keyword itself, not inside a longer one. */
+static void
+test_search_words()
+{
+    buffer b = {0};
+    string needle = {.s = (u8 *)"len", .len = 3};
+    u64 got = 0;
+    u64 i;
+
+    test_buffer_init(&b, "len_max strlen(len)\nlen2 len\n");
+
+    ASSERT(search_forward_word(&b, needle, 0, &got));
+    ASSERT(got == 15);
+    ASSERT(search_forward_word(&b, needle, 16, &got));
+    ASSERT(got == 25);
+    ASSERT(!search_forward_word(&b, needle, 26, &got));
+    ASSERT(search_backward_word(&b, needle, 25, &got));
+    ASSERT(got == 15);
+    ASSERT(!search_backward_word(&b, needle, 15, &got));
+    ASSERT(!search_forward_word_range(&b, needle, 0, 15, &got));
+
+    ASSERT(search_word_class['_'] == SEARCH_CLASS_KEYWORD);
+    ASSERT(search_word_class['\t'] == SEARCH_CLASS_BLANK);
+    ASSERT(search_word_class['('] == SEARCH_CLASS_OTHER);
+    ASSERT(search_word_class[0xe9] == SEARCH_CLASS_OTHER);
+    for (i = 0; i < 256; i++)
+    {
+        u8 want = (i < 128 && (isalnum((int)i) || i == '_')) ? SEARCH_CLASS_KEYWORD
+                  : (i == ' ' || i == '\t' || i == '\n' || i == '\r') ? SEARCH_CLASS_BLANK
+                  : SEARCH_CLASS_OTHER;
+
+        ASSERT(search_word_class[i] == want);
+    }
+
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_search_words");
+}
+
+static void
+test_search_init()
+{
+    test_search_pieces();
+    test_search_words();
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/subst.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+/* Runs "s<args>" over lines [first, last] of `text` and checks the result. */
+static void
+test_subst_case(const char *text, u64 first, u64 last, const char *args, const char *expected,
+                u64 expected_count)
+{
+    buffer b = {0};
+    string pattern;
+    string replacement;
+    string out;
+    subst_result result;
+    char error[128];
+    u64 flags;
+
+    test_buffer_init(&b, text);
+    ASSERT(subst_parse((string){.s = (u8 *)args, .len = strlen(args)}, &pattern, &replacement,
+                       &flags, error, sizeof(error)));
+    ASSERT(subst_apply(&b, first, last, pattern, replacement, flags, &result, error, sizeof(error)));
+    ASSERT(result.count == expected_count);
+
+    out = buffer_to_string(&b);
+    if (out.len != strlen(expected) || memcmp(out.s, expected, (size_t)out.len) != 0)
+    {
+        fprintf(stderr, "s%s on \"%s\" gave \"%.*s\"\n", args, text, (int)out.len, (char *)out.s);
+        ASSERT(0);
+    }
+
+    free(out.s);
+    free(pattern.s);
+    free(replacement.s);
+    test_buffer_free(&b);
+}
+
+static void
+test_subst_cases()
+{
+    const char *text = "foo bar foo\nbar\nfoo foo\n";
+
+    test_subst_case(text, 0, 2, "/foo/x/", "x bar foo\nbar\nx foo\n", 2);
+    /* a negated class stops at the end of the line */
+    test_subst_case("a\nb,c\n", 0, 1, "/[^,]*,//", "a\nc\n", 1);
+    test_subst_case("ab\nb d\n", 0, 1, "/b\\W/Z/", "ab\nZd\n", 1);
+    test_subst_case(text, 0, 2, "/foo/x/g", "x bar x\nbar\nx x\n", 4);
+    test_subst_case(text, 1, 2, "/foo/x/g", "foo bar foo\nbar\nx x\n", 2);
+    test_subst_case(text, 0, 2, "/foo/x/gn", text, 4);
+    test_subst_case(text, 0, 2, "/o+/[&]/g", "f[oo] bar f[oo]\nbar\nf[oo] f[oo]\n", 4);
+    test_subst_case(text, 0, 2, "#^#> #", "> foo bar foo\n> bar\n> foo foo\n", 3);
+    test_subst_case(text, 0, 2, "/ /\\n/g", "foo\nbar\nfoo\nbar\nfoo\nfoo\n", 3);
+    test_subst_case(text, 0, 2, "/bar\\n//", "foo bar foo\nfoo foo\n", 1);
+    test_subst_case("a/b\n", 0, 0, "/\\//\\&/", "a&b\n", 1);
+    test_subst_case("axc\n", 0, 0, "/x*/-/g", "-a-c-\n", 3);
+    test_subst_case(text, 0, 2, "/zzz/x/g", text, 0);
+    test_subst_case("last", 0, 0, "/t$/T/", "lasT", 1);
+
+    printf("%s... OK\n", "test_subst_cases");
+}
+
+/* Many matches go through one batch, the line index must match a fresh one. */
+static void
+test_subst_many()
+{
+    buffer b = {0};
+    buffer fresh = {0};
+    string text;
+    string pattern = {.s = (u8 *)"ab", .len = 2};
+    string replacement = {.s = (u8 *)"x\\ny", .len = 4};
+    subst_result result;
+    char error[128];
+    char *data = (char *)malloc(30000 + 1);
+    u64 i;
+
+    for (i = 0; i < 10000; i++)
+    {
+        memcpy(data + i * 3, i % 10 == 9 ? "ab\n" : "ab ", 3);
+    }
+    data[30000] = '\0';
+
+    test_buffer_init(&b, data);
+    ASSERT(subst_apply(&b, 0, b.lines.count - 1, pattern, replacement, SUBST_GLOBAL, &result,
+                       error, sizeof(error)));
+    ASSERT(result.count == 10000);
+    ASSERT(result.lines == 1000);
+
+    /* buffer_to_string does not terminate the text */
+    text = buffer_to_string(&b);
+    ASSERT(text.len == 40000);
+    data = (char *)realloc(data, (size_t)text.len + 1);
+    memcpy(data, text.s, (size_t)text.len);
+    data[text.len] = '\0';
+    test_buffer_init(&fresh, data);
+    ASSERT(b.lines.count == fresh.lines.count);
+    ASSERT(b.lines.count == 11001);
+    for (i = 0; i < b.lines.count; i++)
+    {
+        ASSERT(b.lines.items[i].start == fresh.lines.items[i].start);
+    }
+    ASSERT(result.last_line_start == buffer_line_start(&b, 10998));
+
+    free(text.s);
+    test_buffer_free(&b);
+    test_buffer_free(&fresh);
+    free(data);
+    printf("%s... OK\n", "test_subst_many");
+}
+
+static void
+test_subst_init()
+{
+    test_subst_cases();
+    test_subst_many();
+}
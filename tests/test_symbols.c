@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/symbols.h"
+#include "../src/base.h"
+
+static void
+test_symbols_scan()
+{
+    const char *text =
+        "#include <stdio.h>\n"
+        "#define MAX 4\n"
+        "typedef struct node { int a; struct node *next; } node_t;\n"
+        "enum color { RED, GREEN = 2, BLUE };\n"
+        "typedef void (*callback)(int x);\n"
+        "static const char *names[MAX] = {\"a\", \"{\"};\n"
+        "extern int hidden;\n"
+        "int prototype(void);\n"
+        "/* int commented(void) { } */\n"
+        "static u64\n"
+        "function(node_t *n, int (*cb)(int))\n"
+        "{\n"
+        "    int local = 0;\n"
+        "    return local;\n"
+        "}\n"
+        "int a, b = 1, c;\n"
+        "#define LONG(x) \\\n"
+        "    int skipped;\n"
+        "const char *s = \"/* no\";\n"
+        "int after;\n";
+    const char *expected[] = {
+        "d2MAX", "s3node", "t3node_t", "g4color", "e4RED", "e4GREEN", "e4BLUE",
+        "t5callback", "v6names", "f11function", "v16a", "v16b", "v16c", "d17LONG",
+        "v19s", "v20after",
+    };
+    symbol_doc doc;
+    u64 i;
+
+    memset(&doc, 0, sizeof(doc));
+    symbol_scan(&doc, syntax_language_for((string){.s = (u8 *)"a.c", .len = 3}), (const u8 *)text,
+                strlen(text));
+
+    ASSERT(doc.count == sizeof(expected) / sizeof(expected[0]));
+    for (i = 0; i < doc.count; i++)
+    {
+        char got[64];
+
+        snprintf(got, sizeof(got), "%c%u%s", doc.items[i].kind, doc.items[i].line,
+                 doc.names + doc.items[i].name);
+        if (strcmp(got, expected[i]) != 0)
+        {
+            fprintf(stderr, "symbol %llu: got %s, expected %s\n", (unsigned long long)i, got, expected[i]);
+            ASSERT(0);
+        }
+    }
+
+    symbol_doc_free(&doc);
+
+    /* nothing to lex, and a first line with nothing on it */
+    symbol_scan(&doc, syntax_language_for((string){.s = (u8 *)"a.c", .len = 3}), (const u8 *)"", 0);
+    ASSERT(doc.count == 0);
+    symbol_scan(&doc, syntax_language_for((string){.s = (u8 *)"a.c", .len = 3}), (const u8 *)"\nint x;\n", 8);
+    ASSERT(doc.count == 1 && doc.items[0].line == 2);
+    symbol_doc_free(&doc);
+    printf("%s... OK\n", "test_symbols_scan");
+}
+
+static void
+test_symbols_index()
+{
+    char dir[] = "/tmp/editor-symbols-XXXXXX";
+    char a[64];
+    char b[64];
+    char c[64];
+    char empty[64];
+    char notes[64];
+    char index[64];
+    char *paths[5];
+    symbol_index si;
+    symbol_match m[4];
+
+    ASSERT(mkdtemp(dir) != NULL);
+    snprintf(a, sizeof(a), "%s/a.c", dir);
+    snprintf(b, sizeof(b), "%s/b.h", dir);
+    snprintf(c, sizeof(c), "%s/c.c", dir);
+    snprintf(empty, sizeof(empty), "%s/empty.c", dir);
+    snprintf(notes, sizeof(notes), "%s/notes.txt", dir);
+    snprintf(index, sizeof(index), "%s/tags", dir);
+
+    test_write_file(dir, "a.c", "int shared;\n\nvoid\nalpha(void)\n{\n}\n");
+    test_write_file(dir, "b.h", "#define shared 1\nstruct beta { int x; };\n");
+    test_write_file(dir, "empty.c", "\n");
+    test_write_file(dir, "notes.txt", "int alpha(void) { }\n");
+    paths[0] = a;
+    paths[1] = b;
+    paths[2] = empty;
+    paths[3] = notes;
+
+    memset(&si, 0, sizeof(si));
+    ASSERT(symbol_index_build(&si, index, paths, 4));
+    ASSERT(si.header->symbol_count == 4);
+    /* a file without symbols is listed all the same */
+    ASSERT(si.header->file_count == 3);
+
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"alpha", .len = 5}, m, 4) == 1);
+    ASSERT(strcmp(m[0].path, a) == 0 && m[0].line == 4 && m[0].kind == SYMBOL_FUNCTION);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"shared", .len = 6}, m, 4) == 2);
+    ASSERT(strcmp(m[0].path, a) == 0 && strcmp(m[1].path, b) == 0);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"shar", .len = 4}, m, 4) == 0);
+
+    /* a saved file replaces only its own symbols */
+    test_write_file(dir, "a.c", "int gamma;\n");
+    symbol_index_update(&si, a);
+    ASSERT(si.doc_count == 1);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"alpha", .len = 5}, m, 4) == 0);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"gamma", .len = 5}, m, 4) == 1);
+    ASSERT(strcmp(m[0].path, a) == 0 && m[0].line == 1);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"beta", .len = 4}, m, 4) == 1);
+
+    /* and reaches the file on the next write */
+    ASSERT(symbol_index_write(&si));
+    ASSERT(si.doc_count == 0);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"gamma", .len = 5}, m, 4) == 1);
+    symbol_index_free(&si);
+
+    /* the written index maps again as it was */
+    ASSERT(symbol_index_open(&si, index));
+    ASSERT(!symbol_index_refresh(&si, paths, 4));
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"shared", .len = 6}, m, 4) == 1);
+    ASSERT(m[0].kind == SYMBOL_MACRO);
+
+    /* a file created since is read, one removed behind its back dropped */
+    test_write_file(dir, "c.c", "int delta;\n");
+    paths[4] = c;
+    ASSERT(symbol_index_refresh(&si, paths, 5));
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"delta", .len = 5}, m, 4) == 1);
+    ASSERT(strcmp(m[0].path, c) == 0);
+    unlink(b);
+    paths[1] = c;
+    ASSERT(symbol_index_refresh(&si, paths, 4));
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"beta", .len = 4}, m, 4) == 0);
+    ASSERT(si.header->file_count == 3);
+
+    /* a file saved while a scan runs is read again after it */
+    test_write_file(dir, "c.c", "int epsilon;\n");
+    symbol_index_start(&si, paths, 4);
+    symbol_index_update(&si, c);
+    ASSERT(si.pending_count == 1);
+    ASSERT(symbol_index_finish(&si));
+    ASSERT(!symbol_index_scanning(&si) && si.pending_count == 0 && si.doc_count == 0);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"epsilon", .len = 7}, m, 4) == 1);
+    ASSERT(symbol_index_find(&si, (string){.s = (u8 *)"delta", .len = 5}, m, 4) == 0);
+    symbol_index_free(&si);
+
+    unlink(a);
+    unlink(c);
+    unlink(empty);
+    unlink(notes);
+    unlink(index);
+    rmdir(dir);
+    printf("%s... OK\n", "test_symbols_index");
+}
+
+static void
+test_symbols_init()
+{
+    test_symbols_scan();
+    test_symbols_index();
+}
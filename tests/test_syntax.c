@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/syntax.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+static void
+test_syntax_buffer_init(buffer *b, const char *text)
+{
+    test_buffer_init(b, text);
+    b->file_path.s = (u8 *)"test.c";
+    b->file_path.len = 6;
+}
+
+/* The states kept up to date across edits must be those lexed from scratch. */
+static void
+test_syntax_check(buffer *b, syntax_index *si)
+{
+    syntax_index fresh;
+    u64 i;
+
+    syntax_index_init(&fresh, b);
+    for (i = 0; i < b->lines.count; i++)
+    {
+        ASSERT(syntax_state_at(si, i) == syntax_state_at(&fresh, i));
+    }
+
+    syntax_index_free(&fresh);
+}
+
+static void
+test_syntax_classes()
+{
+    const char *text = "#include <a.h>\nint x = 0x1f; /* c\n */ return \"s\\\nt\" // d\n";
+    u8 expected[][32] = {
+        "PPPPPPPP SSSSS",
+        "TTT     NNNN  CCCC",
+        "CCC KKKKKK SSS",
+        "SS CCCC",
+    };
+    const char *codes = " KTSNCP";
+    buffer b = {0};
+    syntax_index si;
+    u8 classes[32];
+    u64 line;
+
+    test_syntax_buffer_init(&b, text);
+    syntax_index_init(&si, &b);
+    ASSERT(si.lang != NULL);
+
+    for (line = 0; line < 4; line++)
+    {
+        u64 len = buffer_line_len(&b, line);
+        u64 i;
+
+        syntax_lex_line(&si, line, syntax_state_at(&si, line), classes, 0, len);
+        for (i = 0; i < len; i++)
+        {
+            u8 want = i < strlen((char *)expected[line]) ? expected[line][i] : ' ';
+
+            ASSERT(codes[classes[i]] == want);
+        }
+    }
+
+    syntax_index_free(&si);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_syntax_classes");
+}
+
+/* Looks at a line somewhere so some edits land behind what was lexed. */
+static void
+test_syntax_after_edit(buffer *b, u64 step, u64 at, void *ctx)
+{
+    syntax_index *si = (syntax_index *)ctx;
+
+    syntax_state_at(si, (u64)rand() % b->lines.count);
+    if (step % 50 == 0)
+    {
+        test_syntax_check(b, si);
+    }
+}
+
+static void
+test_syntax_edits()
+{
+    const char *words[] = {"/*", "*/", "\"", "\\", "\n", "x", "\n/*\n", "// "};
+    u64 lines = 20000;
+    char *text = (char *)malloc((size_t)lines * 19 + 1);
+    buffer b = {0};
+    syntax_index si;
+    u64 lexed;
+    u64 i;
+
+    for (i = 0; i < lines; i++)
+    {
+        memcpy(text + i * 19, "int a = 1; /* x */\n", 19);
+    }
+    text[lines * 19] = '\0';
+
+    test_syntax_buffer_init(&b, text);
+    syntax_index_init(&si, &b);
+    syntax_state_at(&si, lines);
+    ASSERT(si.lexed == lines);
+
+    /* a keystroke, or a comment opened and closed again, re-lexes a line or two */
+    lexed = si.lexed;
+    buffer_insert(&b, buffer_line_start(&b, 10000) + 3, (string){.s = (u8 *)"b", .len = 1});
+    ASSERT(syntax_state_at(&si, lines) == 0 && si.lexed - lexed <= 2);
+
+    lexed = si.lexed;
+    buffer_insert(&b, buffer_line_start(&b, 100) + 5, (string){.s = (u8 *)"/*\n\n", .len = 4});
+    ASSERT(syntax_state_at(&si, lines + 2) == 0 && si.lexed - lexed <= 4);
+    test_syntax_check(&b, &si);
+
+    srand(29);
+    test_buffer_edit_randomly(&b, words, 8, 50, 300, test_syntax_after_edit, &si);
+
+    test_syntax_check(&b, &si);
+    syntax_index_free(&si);
+    test_buffer_free(&b);
+    free(text);
+    printf("%s... OK\n", "test_syntax_edits");
+}
+
+static void
+test_syntax_init()
+{
+    test_syntax_classes();
+    test_syntax_edits();
+}
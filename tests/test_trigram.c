@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/trigram.h"
+#include "../src/regex.h"
+#include "../src/base.h"
+
+/* The candidates among `names` under `root` for `literal`, as a bitmask of positions. */
+static u64
+test_trigram_candidates(trigram_index *ti, const char *root, const char **names, u64 count,
+                        const char *literal)
+{
+    char **paths = (char **)malloc(sizeof(char *) * count);
+    char path[256];
+    u64 kept = count;
+    u64 mask = 0;
+    u64 i;
+    u64 j;
+
+    for (i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+        paths[i] = strdup(path);
+    }
+
+    paths = trigram_index_filter(ti, (string){.s = (u8 *)literal, .len = strlen(literal)}, paths, &kept);
+
+    for (i = 0; i < kept; i++)
+    {
+        for (j = 0; j < count; j++)
+        {
+            snprintf(path, sizeof(path), "%s/%s", root, names[j]);
+            if (strcmp(paths[i], path) == 0)
+            {
+                mask |= (u64)1 << j;
+            }
+        }
+        free(paths[i]);
+    }
+    free(paths);
+
+    return mask;
+}
+
+static void
+test_trigram_index()
+{
+    const char *names[] = {"a.c", "b.c", "c.txt", "d.bin"};
+    char root[] = "/tmp/editor_trigram_XXXXXX";
+    char index_path[256];
+    char path[256];
+    char **paths;
+    trigram_index ti;
+    regex re;
+    u64 i;
+
+    ASSERT(mkdtemp(root) != NULL);
+    test_write_file(root, "a.c", "int needle_count;\nvoid haystack(void);\n");
+    test_write_file(root, "b.c", "static int needle;\n");
+    test_write_file(root, "c.txt", "nothing to see\n");
+    snprintf(path, sizeof(path), "%s/d.bin", root);
+    test_write_bytes(path, "needle\0binary", 13);
+    snprintf(index_path, sizeof(index_path), "%s/%s", root, TRIGRAM_INDEX_FILE);
+
+    ASSERT(!trigram_index_open(&ti, index_path));
+    paths = (char **)malloc(sizeof(char *) * 4);
+    for (i = 0; i < 4; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+        paths[i] = strdup(path);
+    }
+    trigram_index_build(&ti, index_path, paths, 4);
+    for (i = 0; i < 4; i++)
+    {
+        free(paths[i]);
+    }
+    free(paths);
+    ASSERT(ti.loaded);
+    ASSERT(ti.header->file_count == 4);
+    ASSERT(ti.doc_count == 0);
+
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "needle") == 3);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "haystack") == 1);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "needle_count;") == 1);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "zzz") == 0);
+    /* too short to filter */
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "ne") == 15);
+
+    /* :grep narrows a regex by the literal all its matches contain */
+    ASSERT(regex_compile(&re, (string){.s = (u8 *)"void hay[a-z]+", .len = 14}));
+    memcpy(path, re.required, (size_t)re.required_len);
+    path[re.required_len] = '\0';
+    ASSERT(strcmp(path, "void hay") == 0);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, path) == 1);
+    regex_free(&re);
+
+    /* a saved file replaces its mapped copy until the next write */
+    test_write_file(root, "c.txt", "a needle at last\n");
+    snprintf(path, sizeof(path), "%s/c.txt", root);
+    trigram_index_update(&ti, path);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "needle") == 7);
+
+    /* the watcher only notes the change, the file is a candidate until refreshed */
+    test_write_file(root, "b.c", "static int pin;\n");
+    snprintf(path, sizeof(path), "%s/b.c", root);
+    trigram_index_on_path(&ti, path, 0);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "haystack") == 3);
+    trigram_index_refresh(&ti, NULL, 0);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "needle") == 5);
+
+    snprintf(path, sizeof(path), "%s/a.c", root);
+    trigram_index_on_path(&ti, path, 1);
+    ASSERT(trigram_index_write(&ti));
+    ASSERT(ti.header->file_count == 3);
+    /* a.c is unknown to the index now, so it is always searched */
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "needle") == 5);
+    ASSERT(test_trigram_candidates(&ti, root, names, 4, "pin;") == 3);
+    ASSERT(test_trigram_candidates(&ti, root, names + 1, 3, "pin;") == 1);
+    trigram_index_free(&ti);
+
+    /* reopened, files changed behind its back are found by mtime and size */
+    test_write_file(root, "c.txt", "haystack\n");
+    ASSERT(trigram_index_open(&ti, index_path));
+    paths = (char **)malloc(sizeof(char *) * 3);
+    for (i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", root, names[i + 1]);
+        paths[i] = strdup(path);
+    }
+    trigram_index_refresh(&ti, paths, 3);
+    ASSERT(test_trigram_candidates(&ti, root, names + 1, 3, "haystack") == 2);
+    ASSERT(test_trigram_candidates(&ti, root, names + 1, 3, "needle") == 0);
+    for (i = 0; i < 3; i++)
+    {
+        free(paths[i]);
+    }
+    free(paths);
+
+    /* a file saved while a build runs keeps what it was saved with, the walk frees the paths */
+    paths = (char **)malloc(sizeof(char *) * 3);
+    for (i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", root, names[i + 1]);
+        paths[i] = strdup(path);
+    }
+    trigram_index_start(&ti, index_path, paths, 3);
+    test_write_file(root, "b.c", "static int thread;\n");
+    snprintf(path, sizeof(path), "%s/b.c", root);
+    trigram_index_update(&ti, path);
+    ASSERT(trigram_index_finish(&ti));
+    ASSERT(!trigram_index_building(&ti));
+    ASSERT(ti.doc_count == 0 && ti.header->file_count == 3);
+    ASSERT(test_trigram_candidates(&ti, root, names + 1, 3, "thread") == 1);
+    ASSERT(test_trigram_candidates(&ti, root, names + 1, 3, "pin;") == 0);
+    trigram_index_free(&ti);
+
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    ASSERT(system(path) == 0);
+
+    printf("%s... OK\n", "test_trigram_index");
+}
+
+static void
+test_trigram_init()
+{
+    test_trigram_index();
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "../src/words.h"
+#include "../src/buffer.h"
+#include "../src/base.h"
+
+#define TEST_WORD(text) (string){.s = (u8 *)(text), .len = strlen(text)}
+
+/* The counts kept up to date across edits must be those counted from scratch. */
+static void
+test_words_check(buffer *b, word_index *wi)
+{
+    word_index fresh;
+    u64 i;
+
+    word_index_init(&fresh, b);
+    while (word_index_scan(&fresh, MB(1)))
+    {
+    }
+
+    while (word_index_scan(wi, 7))
+    {
+    }
+
+    for (i = 0; i < fresh.entry_count; i++)
+    {
+        word_entry *e = &fresh.entries[i];
+        string word = {.s = fresh.text + e->text, .len = e->len};
+
+        ASSERT(word_index_count(wi, word) == e->count);
+    }
+
+    for (i = 0; i < wi->entry_count; i++)
+    {
+        word_entry *e = &wi->entries[i];
+        string word = {.s = wi->text + e->text, .len = e->len};
+
+        ASSERT(word_index_count(&fresh, word) == e->count);
+    }
+
+    word_index_free(&fresh);
+}
+
+static void
+test_words_matches()
+{
+    buffer a = {0};
+    buffer b = {0};
+    word_index wa;
+    word_index wb;
+    word_list wl = {0};
+
+    test_buffer_init(&a, "buffer_insert(b, buf); buffer_delete(x);\nbuffer_insert x");
+    test_buffer_init(&b, "buffer_init buffer_insert bu");
+    word_index_init(&wa, &a);
+    word_index_init(&wb, &b);
+
+    /* keywords are counted by the chunk, a chunk never ends inside a word */
+    ASSERT(word_index_scan(&wa, 3) && !word_index_complete(&wa));
+    ASSERT(word_index_count(&wa, TEST_WORD("buffer_insert")) == 1);
+    while (word_index_scan(&wa, 3))
+    {
+    }
+    ASSERT(word_index_scan(&wb, MB(1)) && word_index_complete(&wb));
+
+    ASSERT(word_index_count(&wa, TEST_WORD("buffer_insert")) == 2);
+    ASSERT(word_index_count(&wa, TEST_WORD("x")) == 0);
+    ASSERT(word_index_count(&wa, TEST_WORD("buf")) == 1);
+
+    /* merged across buffers, sorted, once each and without the prefix itself */
+    word_index_matches(&wa, TEST_WORD("buf"), &wl, 16);
+    word_index_matches(&wb, TEST_WORD("buf"), &wl, 16);
+    word_list_finish(&wl, 16);
+    ASSERT(wl.count == 3);
+    ASSERT(memcmp(word_list_get(&wl, 0).s, "buffer_delete", 13) == 0);
+    ASSERT(memcmp(word_list_get(&wl, 1).s, "buffer_init", 11) == 0);
+    ASSERT(word_list_get(&wl, 2).len == 13);
+
+    /* a word deleted everywhere is no longer offered */
+    buffer_delete(&a, 23, 16);
+    word_list_clear(&wl);
+    word_index_matches(&wa, TEST_WORD("buffer_"), &wl, 16);
+    word_list_finish(&wl, 16);
+    ASSERT(wl.count == 1 && word_list_get(&wl, 0).len == 13);
+
+    word_list_clear(&wl);
+    word_index_matches(&wb, TEST_WORD("b"), &wl, 1);
+    word_list_finish(&wl, 1);
+    ASSERT(wl.count == 1 && word_list_get(&wl, 0).len == 2);
+
+    word_list_free(&wl);
+    word_index_free(&wa);
+    word_index_free(&wb);
+    test_buffer_free(&a);
+    test_buffer_free(&b);
+    printf("%s... OK\n", "test_words_matches");
+}
+
+static void
+test_words_after_edit(buffer *b, u64 step, u64 at, void *ctx)
+{
+    word_index *wi = (word_index *)ctx;
+
+    if (step % 50 == 0)
+    {
+        test_words_check(b, wi);
+    }
+
+    /* now and then start over, with the scan stopped part way */
+    if (step % 40 == 39)
+    {
+        word_index_free(wi);
+        word_index_init(wi, b);
+        word_index_scan(wi, (u64)rand() % (b->total_len + 1));
+    }
+}
+
+static void
+test_words_edits()
+{
+    const char *words[] = {"a", "bc", " ", "\n", "de_f", "(", "gh i", "jk"};
+    u64 lines = 20000;
+    char *text = (char *)malloc((size_t)lines * 20 + 1);
+    buffer b = {0};
+    word_index wi;
+    u64 i;
+
+    for (i = 0; i < lines; i++)
+    {
+        memcpy(text + i * 20, "int ab = cd(ef, 1);\n", 20);
+    }
+    text[lines * 20] = '\0';
+
+    test_buffer_init(&b, text);
+    word_index_init(&wi, &b);
+
+    /* edits behind, across and ahead of a scan still running */
+    word_index_scan(&wi, lines * 10);
+    buffer_insert(&b, 5, TEST_WORD("x"));
+    buffer_insert(&b, wi.scanned - 1, TEST_WORD("y z"));
+    buffer_delete(&b, lines * 15, 30);
+    test_words_check(&b, &wi);
+    ASSERT(word_index_count(&wi, TEST_WORD("axb")) == 1);
+
+    srand(31);
+    test_buffer_edit_randomly(&b, words, 8, 5, 400, test_words_after_edit, &wi);
+
+    test_words_check(&b, &wi);
+    word_index_free(&wi);
+    test_buffer_free(&b);
+    free(text);
+    printf("%s... OK\n", "test_words_edits");
+}
+
+static void
+test_words_init()
+{
+    test_words_matches();
+    test_words_edits();
+}